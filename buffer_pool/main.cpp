@@ -0,0 +1,96 @@
+#include <cl_utils.h>
+#include <cl_buffer_pool.h>
+#include <common_miscs.h>
+#include <benchmark.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * Allocation cost of clCreateBuffer(CL_MEM_COPY_HOST_PTR) per call, the way the samples allocate, against
+ * buffers recycled by CLBufferPool and uploaded with a write. Each iteration allocates `batch` buffers of `bytes`,
+ * uploads the host data and releases them again.
+ */
+
+static CLHRESULT TestCreateBuffer(cl_context context, cl_command_queue cmd_queue, const std::vector<uint8_t> &host_data,
+                                  BenchState &state) {
+  CLHRESULT hr;
+  size_t bytes = (size_t)state.GetInt("bytes");
+  size_t batch = (size_t)state.GetInt("batch");
+  std::vector<ycl_buffer> buffers(batch);
+
+  while (state.KeepRunning()) {
+    for (auto &buff : buffers) {
+      V_RETURN2(buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes,
+                                        (void *)host_data.data(), &hr),
+                hr);
+    }
+    // Some drivers defer the copy until first use, make it happen inside the iteration.
+    for (auto &buff : buffers)
+      V_RETURN(clEnqueueMigrateMemObjects(cmd_queue, 1, &buff, 0, 0, nullptr, nullptr));
+    V_RETURN(clFinish(cmd_queue));
+    for (auto &buff : buffers)
+      buff = nullptr;
+  }
+
+  state.SetBytesProcessed((double)bytes * batch);
+  return hr;
+}
+
+static CLHRESULT TestPooledBuffer(CLBufferPool &pool, cl_command_queue cmd_queue,
+                                  const std::vector<uint8_t> &host_data, BenchState &state) {
+  CLHRESULT hr;
+  size_t bytes = (size_t)state.GetInt("bytes");
+  size_t batch = (size_t)state.GetInt("batch");
+  std::vector<CLPooledBuffer> buffers(batch);
+
+  while (state.KeepRunning()) {
+    for (auto &buff : buffers)
+      V_RETURN(pool.AcquireAndUpload(cmd_queue, bytes, host_data.data(), CL_FALSE, &buff));
+    V_RETURN(clFinish(cmd_queue));
+    for (auto &buff : buffers)
+      buff.Reset();
+  }
+
+  state.SetBytesProcessed((double)bytes * batch);
+  return hr;
+}
+
+int main(int argc, char **argv) {
+
+  CLHRESULT hr;
+  ycl_platform_id platform;
+  ycl_device_id device;
+  ycl_context context;
+  ycl_command_queue cmd_queue;
+
+  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {"NVIDIA CUDA", "AMD"}, {}, &platform, &device));
+  V_RETURN(CreateDeviceContext(platform, device, &context));
+  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
+
+  const size_t max_bytes = 16 << 20;
+  std::vector<uint8_t> host_data(max_bytes);
+  for (size_t i = 0; i < max_bytes; ++i)
+    host_data[i] = (uint8_t)i;
+
+  CLBufferPool pool(context, device, CL_MEM_READ_WRITE);
+
+  BenchmarkSuite suite("buffer_pool");
+  suite.ParseArgs(argc, argv);
+
+  auto sweep = MakeParamSweep({{"bytes", {256, 4096, 65536, 1 << 20, (int)max_bytes}}, {"batch", {1, 8}}});
+  suite.Register("create_buffer", sweep,
+                 [&](BenchState &state) { return TestCreateBuffer(context, cmd_queue, host_data, state); });
+  suite.Register("pooled_buffer", sweep,
+                 [&](BenchState &state) { return TestPooledBuffer(pool, cmd_queue, host_data, state); });
+
+  hr = suite.Run();
+
+  CLBufferPoolStats stats;
+  pool.GetStats(&stats);
+  printf("Pool: %zu acquires, %zu reused (%.1f%%), %zu created, %zu slabs, %.2fMB reserved, %.2fMB peak in use\n",
+         stats.acquires, stats.reuses, stats.acquires ? 100.0 * stats.reuses / stats.acquires : 0.0, stats.creates,
+         stats.slabs, stats.bytes_reserved / 1048576.0, stats.peak_bytes_in_use / 1048576.0);
+
+  return hr;
+}
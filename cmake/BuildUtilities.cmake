@@ -18,6 +18,8 @@ endif()
 function(clang_oclxx_to_spirv oclxx_source_files aux_options dir_name linked_file compiled_spirvs)
 set(list_compiled_files "")
 set(output_dir ${CMAKE_CURRENT_BINARY_DIR}/${CMAKE_BUILD_TYPE}/${dir_name})
+# One command line argument per option, or several -D options would reach clang as a single one.
+separate_arguments(aux_option_list NATIVE_COMMAND "${aux_options}")
 foreach(shader ${${oclxx_source_files}})
   get_filename_component(file_ext ${shader} LAST_EXT)
 
@@ -34,7 +36,7 @@ foreach(shader ${${oclxx_source_files}})
       add_custom_command(
           OUTPUT ${output_file}
           COMMAND ${CLANG_CXX_EXECUTABLE} -cc1 -emit-llvm -finclude-default-header -triple=spir64-unknown-unknown
-                    -cl-std=CL2.0 ${aux_options} -x cl -o ${output_file} ${full_path}
+                    -cl-std=CL2.0 ${aux_option_list} -x cl -o ${output_file} ${full_path}
           DEPENDS ${full_path}
           WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR}
       )
@@ -43,7 +45,7 @@ foreach(shader ${${oclxx_source_files}})
         OUTPUT ${output_file}
         COMMAND mkdir --parents ${output_dir} &&
           ${CLANG_CXX_EXECUTABLE} -cc1 -emit-spirv -triple=spir64-unknown-unknown
-            -cl-std=CL2.0 ${aux_options} -x cl -o ${output_file} ${full_path}
+            -cl-std=CL2.0 ${aux_option_list} -x cl -o ${output_file} ${full_path}
         DEPENDS ${full_path}
         WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR}
       )
@@ -88,6 +90,60 @@ if(${list_compiled_files_length} GREATER 0)
 endif()
 endfunction(clang_oclxx_to_spirv)
 
+# Pre-specialised SPIR-V: one module per precision and tile size, plus a manifest the runtime loader
+# (common/cl_il_library.h) picks from. Precisions are fp32, fp64 (-D_USE_DOUBLE_FP=1), and the half-width
+# storage formats fp16 (-D_USE_HALF_STORAGE=1) and bf16 (-D_USE_BF16_STORAGE=1); every tile size in `tile_sizes`
+# is passed as -D<tile_define>=<size>. An empty `tile_sizes` builds one module per precision only.
+#
+#   ${dir_name}/${linked_name}.manifest
+#   ${dir_name}/<precision>_t<tile>/${linked_name}.spv
+function(clang_oclxx_to_spirv_variants oclxx_source_files aux_options dir_name linked_name precisions tile_sizes
+  tile_define compiled_spirvs)
+set(output_dir ${CMAKE_CURRENT_BINARY_DIR}/${CMAKE_BUILD_TYPE}/${dir_name})
+set(manifest_file ${output_dir}/${linked_name}.manifest)
+set(manifest_content "# <spirv module> <precision> <tile size, 0 when not specialised>\n")
+set(all_spirvs "")
+
+if("${tile_sizes}" STREQUAL "")
+  set(tile_sizes 0)
+endif()
+
+foreach(precision ${precisions})
+  if(${precision} STREQUAL "fp64")
+    set(precision_options "-D_USE_DOUBLE_FP=1")
+  elseif(${precision} STREQUAL "fp32")
+    set(precision_options "")
+  elseif(${precision} STREQUAL "fp16")
+    set(precision_options "-D_USE_HALF_STORAGE=1")
+  elseif(${precision} STREQUAL "bf16")
+    set(precision_options "-D_USE_BF16_STORAGE=1")
+  else()
+    message(FATAL_ERROR "Unknown SPIR-V variant precision: ${precision}")
+  endif()
+
+  foreach(tile ${tile_sizes})
+    if(${tile} EQUAL 0)
+      set(variant ${precision})
+      set(variant_options "${precision_options} ${aux_options}")
+    else()
+      set(variant ${precision}_t${tile})
+      set(variant_options "${precision_options} -D${tile_define}=${tile} ${aux_options}")
+    endif()
+
+    file(MAKE_DIRECTORY ${output_dir}/${variant})
+    set(variant_spirvs "")
+    clang_oclxx_to_spirv(${oclxx_source_files} "${variant_options}" "${dir_name}/${variant}" "${linked_name}.spv"
+      variant_spirvs)
+    list(APPEND all_spirvs ${variant_spirvs})
+    string(APPEND manifest_content "${variant}/${linked_name}.spv ${precision} ${tile}\n")
+  endforeach()
+endforeach()
+
+message("Write SPIR-V variant manifest: ${manifest_file}")
+file(WRITE ${manifest_file} ${manifest_content})
+set(${compiled_spirvs} ${${compiled_spirvs}} ${all_spirvs} PARENT_SCOPE)
+endfunction(clang_oclxx_to_spirv_variants)
+
 function(copy_assets asset_files dir_name copied_files)
 foreach(asset ${${asset_files}})
   #message("asset: ${asset}")
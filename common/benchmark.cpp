@@ -0,0 +1,254 @@
+#include "benchmark.h"
+#include "cl_json.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+#pragma warning(disable: 4996)
+
+static const int g_DefaultWarmup = 2;
+static const int g_DefaultReps = 10;
+static const uint32_t g_DefaultSeed = 0x5eed1234u;
+
+std::vector<BenchParams> MakeParamSweep(std::initializer_list<std::pair<const char *, std::vector<BenchValue>>> axes) {
+
+  std::vector<BenchParams> sweep(1);
+
+  for (auto &axis : axes) {
+    std::vector<BenchParams> next;
+    next.reserve(sweep.size() * axis.second.size());
+    for (auto &params : sweep) {
+      for (auto &v : axis.second) {
+        next.push_back(params);
+        next.back().push_back({axis.first, v.str});
+      }
+    }
+    sweep.swap(next);
+  }
+
+  return sweep;
+}
+
+std::string FormatBenchParams(const BenchParams &params) {
+  std::string str;
+  for (auto &p : params) {
+    if (!str.empty())
+      str += ' ';
+    str += p.key;
+    str += '=';
+    str += p.value;
+  }
+  return str;
+}
+
+CLHRESULT GetEventElapsedTime(cl_event ev, double *ms) {
+  CLHRESULT hr;
+  cl_ulong start, end;
+
+  V_RETURN(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr));
+  V_RETURN(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr));
+  *ms = (end - start) * 1.0E-6;
+  return hr;
+}
+
+BenchState::BenchState(const BenchParams &params, int warmup, int reps)
+    : params_(params), warmup_(warmup), reps_(reps), iter_(-1), manual_ms_(-1.0), bytes_(0.0), flops_(0.0),
+      verified_(-1) {
+  samples_.reserve(reps);
+}
+
+bool BenchState::HasParam(const char *key) const {
+  for (auto &p : params_) {
+    if (p.key == key)
+      return true;
+  }
+  return false;
+}
+
+const char *BenchState::GetString(const char *key) const {
+  for (auto &p : params_) {
+    if (p.key == key)
+      return p.value.c_str();
+  }
+  CL_TRACE(CL_INVALID_VALUE, "Benchmark parameter \"%s\" is not defined!\n", key);
+  RT_ASSERT(0);
+  return "";
+}
+
+int64_t BenchState::GetInt(const char *key) const { return strtoll(GetString(key), nullptr, 0); }
+
+bool BenchState::KeepRunning() {
+
+  hp_timer::time_point now = hp_timer::now();
+
+  if (iter_ >= 0) {
+    double ms = manual_ms_ >= 0.0 ? manual_ms_ : fmilliseconds_cast(now - start_).count();
+    if (iter_ >= warmup_)
+      samples_.push_back(ms);
+  }
+
+  manual_ms_ = -1.0;
+  if (++iter_ >= warmup_ + reps_)
+    return false;
+
+  start_ = hp_timer::now();
+  return true;
+}
+
+BenchmarkSuite::BenchmarkSuite(const char *name)
+    : name_(name), warmup_(g_DefaultWarmup), reps_(g_DefaultReps), seed_(g_DefaultSeed), tune_(false) {
+  json_file_ = name_ + ".bench.json";
+}
+
+void BenchmarkSuite::ParseArgs(int argc, char **argv) {
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *val = strchr(arg, '=');
+    std::string key = val ? std::string(arg, val - arg) : std::string(arg);
+    val = val ? val + 1 : "";
+
+    if (key == "--reps")
+      reps_ = std::max(atoi(val), 1);
+    else if (key == "--warmup")
+      warmup_ = std::max(atoi(val), 0);
+    else if (key == "--seed")
+      seed_ = (uint32_t)strtoul(val, nullptr, 0);
+    else if (key == "--filter")
+      filter_ = val;
+    else if (key == "--json")
+      json_file_ = val;
+    else if (key == "--tune")
+      tune_ = true;
+    else
+      printf("Unknown benchmark argument: %s\n", arg);
+  }
+}
+
+void BenchmarkSuite::Register(const char *name, const std::vector<BenchParams> &sweep, BenchFunc func) {
+  entries_.push_back({name, sweep, std::move(func)});
+}
+
+void BenchmarkSuite::Register(const char *name, BenchFunc func) {
+  entries_.push_back({name, std::vector<BenchParams>(1), std::move(func)});
+}
+
+CLHRESULT BenchmarkSuite::Run() {
+
+  CLHRESULT first_failure = CL_SUCCESS;
+
+  results_.clear();
+  printf("Benchmark suite %s: warm-up %d, repetitions %d, seed 0x%08x\n", name_.c_str(), warmup_, reps_, seed_);
+
+  for (auto &entry : entries_) {
+    for (auto &params : entry.sweep) {
+      std::string params_str = FormatBenchParams(params);
+      std::string full_name = params_str.empty() ? entry.name : entry.name + " " + params_str;
+
+      if (!filter_.empty() && full_name.find(filter_) == std::string::npos)
+        continue;
+
+      BenchState state(params, warmup_, reps_);
+      BenchResult res = {entry.name, params};
+
+      g_RandomEngine.seed(seed_);
+      res.status = entry.func(state);
+      res.verified = state.Verified();
+      res.reps = state.Samples().size();
+
+      if (CL_FAILED(res.status) || res.reps == 0) {
+        if (CL_SUCCEEDED(res.status))
+          res.status = CL_INVALID_OPERATION;
+        CL_TRACE(res.status, "Benchmark %s failed!\n", full_name.c_str());
+        if (CL_SUCCEEDED(first_failure))
+          first_failure = res.status;
+        res.min_ms = res.median_ms = res.p90_ms = res.p99_ms = res.mean_ms = res.stddev_ms = 0.0;
+        res.gbytes_per_sec = res.gflops = 0.0;
+        results_.push_back(res);
+        continue;
+      }
+
+      std::vector<double> sorted = state.Samples();
+      std::sort(sorted.begin(), sorted.end());
+
+      double sum = 0.0, sqsum = 0.0;
+      for (double v : sorted)
+        sum += v;
+      res.mean_ms = sum / sorted.size();
+      for (double v : sorted)
+        sqsum += (v - res.mean_ms) * (v - res.mean_ms);
+
+      res.stddev_ms = sorted.size() > 1 ? std::sqrt(sqsum / (sorted.size() - 1)) : 0.0;
+      res.min_ms = sorted.front();
+      res.median_ms = SortedPercentile(sorted, 0.5);
+      res.p90_ms = SortedPercentile(sorted, 0.9);
+      res.p99_ms = SortedPercentile(sorted, 0.99);
+      res.gbytes_per_sec = res.median_ms > 0.0 ? state.BytesProcessed() / (res.median_ms * 1.0E6) : 0.0;
+      res.gflops = res.median_ms > 0.0 ? state.FlopsProcessed() / (res.median_ms * 1.0E6) : 0.0;
+      results_.push_back(res);
+
+      printf("  %-56s median %10.4fms  p99 %10.4fms  %8.2fGB/s  %8.2fGFLOP/s%s\n", full_name.c_str(), res.median_ms,
+             res.p99_ms, res.gbytes_per_sec, res.gflops,
+             res.verified == 0 ? "  MISMATCH" : "");
+    }
+  }
+
+  PrintResults();
+  if (!json_file_.empty())
+    WriteJSON(json_file_.c_str());
+
+  return first_failure;
+}
+
+void BenchmarkSuite::PrintResults(FILE *fp) const {
+
+  fprintf(fp, "%-56s %6s %10s %10s %10s %10s %10s %10s %s\n", "benchmark", "reps", "min(ms)", "median(ms)",
+          "p90(ms)", "p99(ms)", "GB/s", "GFLOP/s", "check");
+  for (auto &res : results_) {
+    std::string params_str = FormatBenchParams(res.params);
+    std::string full_name = params_str.empty() ? res.name : res.name + " " + params_str;
+
+    if (CL_FAILED(res.status)) {
+      fprintf(fp, "%-56s failed (CL error %d)\n", full_name.c_str(), (int)res.status);
+      continue;
+    }
+    fprintf(fp, "%-56s %6zu %10.4f %10.4f %10.4f %10.4f %10.2f %10.2f %s\n", full_name.c_str(), res.reps, res.min_ms,
+            res.median_ms, res.p90_ms, res.p99_ms, res.gbytes_per_sec, res.gflops,
+            res.verified < 0 ? "-" : (res.verified ? "ok" : "MISMATCH"));
+  }
+}
+
+CLHRESULT BenchmarkSuite::WriteJSON(const char *fname) const {
+
+  FILE *fp = fopen(fname, "w");
+
+  if (!fp) {
+    CL_TRACE(CL_INVALID_VALUE, "Can not open \"%s\" for writing!\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  fprintf(fp, "{\n  \"suite\": \"%s\",\n  \"warmup\": %d,\n  \"reps\": %d,\n  \"seed\": %u,\n  \"results\": [",
+          __json_escape(name_).c_str(), warmup_, reps_, seed_);
+
+  for (size_t i = 0; i < results_.size(); ++i) {
+    auto &res = results_[i];
+
+    fprintf(fp, "%s\n    {\"name\": \"%s\", \"params\": {", i ? "," : "", __json_escape(res.name).c_str());
+    for (size_t j = 0; j < res.params.size(); ++j) {
+      fprintf(fp, "%s\"%s\": \"%s\"", j ? ", " : "", __json_escape(res.params[j].key).c_str(),
+              __json_escape(res.params[j].value).c_str());
+    }
+    fprintf(fp,
+            "}, \"status\": %d, \"verified\": %d, \"reps\": %zu, \"min_ms\": %.6f, \"median_ms\": %.6f, "
+            "\"p90_ms\": %.6f, \"p99_ms\": %.6f, \"mean_ms\": %.6f, \"stddev_ms\": %.6f, \"gbytes_per_sec\": %.4f, "
+            "\"gflops\": %.4f}",
+            (int)res.status, res.verified, res.reps, res.min_ms, res.median_ms, res.p90_ms, res.p99_ms, res.mean_ms,
+            res.stddev_ms, res.gbytes_per_sec, res.gflops);
+  }
+
+  fprintf(fp, "\n  ]\n}\n");
+  fclose(fp);
+
+  return CL_SUCCESS;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "cl_utils.h"
+#include "common_miscs.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+/**
+ * Shared benchmark harness for the samples.
+ *
+ * A variant (CPU or OpenCL) is registered with a parameter sweep. For every parameter set the variant function
+ * runs its own setup, then loops on KeepRunning() around the timed work:
+ *
+ *   suite.Register("vector_dot", MakeParamSweep({{"n", {1 << 16, 1 << 20}}, {"precision", {"fp32", "fp64"}}}),
+ *                  [&](BenchState &state) -> CLHRESULT {
+ *                    ... setup from state.GetInt("n") ...
+ *                    while (state.KeepRunning()) {
+ *                      ... enqueue and wait, optionally state.SetIterationTime(device_ms) ...
+ *                    }
+ *                    state.SetBytesProcessed(bytes_per_iteration);
+ *                    return CL_SUCCESS;
+ *                  });
+ *
+ * The first `warmup` iterations are discarded. g_RandomEngine is reseeded with a fixed seed before every
+ * parameter set, so inputs are identical between runs and commits. Results are printed as a table and written
+ * as JSON, one entry per (variant, parameter set), for a regression script to diff.
+ *
+ * Command line: --reps=N --warmup=N --seed=N --filter=substring --json=file --tune
+ *
+ * --tune asks the sample to run its kernel autotuners (see cl_autotuner.h) before the benchmarks.
+ */
+
+struct BenchValue {
+  std::string str;
+
+  BenchValue(const char *s) : str(s) {}
+  BenchValue(const std::string &s) : str(s) {}
+  BenchValue(int v) : str(std::to_string(v)) {}
+  BenchValue(unsigned int v) : str(std::to_string(v)) {}
+  BenchValue(long v) : str(std::to_string(v)) {}
+  BenchValue(unsigned long v) : str(std::to_string(v)) {}
+  BenchValue(long long v) : str(std::to_string(v)) {}
+  BenchValue(unsigned long long v) : str(std::to_string(v)) {}
+};
+
+struct BenchParam {
+  std::string key;
+  std::string value;
+};
+
+using BenchParams = std::vector<BenchParam>;
+
+/**
+ * Cartesian product of the given axes, the last axis varies fastest.
+ */
+extern std::vector<BenchParams> MakeParamSweep(
+    std::initializer_list<std::pair<const char *, std::vector<BenchValue>>> axes);
+
+class BenchState {
+public:
+  BenchState(const BenchParams &params, int warmup, int reps);
+
+  const BenchParams &Params() const { return params_; }
+  bool HasParam(const char *key) const;
+  const char *GetString(const char *key) const;
+  int64_t GetInt(const char *key) const;
+
+  /**
+   * @return true while there is an iteration left to run. Each call closes the previous iteration.
+   */
+  bool KeepRunning();
+
+  /**
+   * Replace the host wall time of the current iteration, e.g. with the kernel time read from its event.
+   */
+  void SetIterationTime(double ms) { manual_ms_ = ms; }
+
+  /** Work done by one iteration, turned into GB/s and GFLOP/s at the median time. */
+  void SetBytesProcessed(double bytes) { bytes_ = bytes; }
+  void SetFlopsProcessed(double flops) { flops_ = flops; }
+
+  /** Result check of the variant, reported next to the timings. */
+  void SetVerified(bool ok) { verified_ = ok ? 1 : 0; }
+
+  bool IsWarmup() const { return iter_ < warmup_; }
+  int Iteration() const { return iter_; }
+
+  const std::vector<double> &Samples() const { return samples_; }
+  double BytesProcessed() const { return bytes_; }
+  double FlopsProcessed() const { return flops_; }
+  int Verified() const { return verified_; }
+
+private:
+  const BenchParams &params_;
+  int warmup_;
+  int reps_;
+  int iter_;
+  double manual_ms_;
+  double bytes_;
+  double flops_;
+  int verified_;   // -1 unchecked
+  hp_timer::time_point start_;
+  std::vector<double> samples_;
+};
+
+using BenchFunc = std::function<CLHRESULT(BenchState &)>;
+
+struct BenchResult {
+  std::string name;
+  BenchParams params;
+  CLHRESULT status;
+  int verified;    // -1 unchecked, 0 mismatch, 1 coincident
+  size_t reps;
+  double min_ms;
+  double median_ms;
+  double p90_ms;
+  double p99_ms;
+  double mean_ms;
+  double stddev_ms;
+  double gbytes_per_sec;
+  double gflops;
+};
+
+class BenchmarkSuite {
+public:
+  explicit BenchmarkSuite(const char *name);
+
+  void ParseArgs(int argc, char **argv);
+
+  void SetWarmup(int warmup) { warmup_ = warmup; }
+  void SetRepetitions(int reps) { reps_ = reps; }
+  void SetSeed(uint32_t seed) { seed_ = seed; }
+  void SetOutputFile(const char *fname) { json_file_ = fname ? fname : ""; }
+
+  bool IsTuningRequested() const { return tune_; }
+
+  void Register(const char *name, const std::vector<BenchParams> &sweep, BenchFunc func);
+  void Register(const char *name, BenchFunc func);
+
+  /**
+   * Run every registered variant over its sweep, then print and write the results. A failing variant is
+   * reported and skipped, the others still run; the first failure is returned.
+   */
+  CLHRESULT Run();
+
+  const std::vector<BenchResult> &Results() const { return results_; }
+
+  void PrintResults(FILE *fp = stdout) const;
+  CLHRESULT WriteJSON(const char *fname) const;
+
+private:
+  struct Entry {
+    std::string name;
+    std::vector<BenchParams> sweep;
+    BenchFunc func;
+  };
+
+  std::string name_;
+  std::string json_file_;
+  std::string filter_;
+  int warmup_;
+  int reps_;
+  uint32_t seed_;
+  bool tune_;
+  std::vector<Entry> entries_;
+  std::vector<BenchResult> results_;
+};
+
+extern std::string FormatBenchParams(const BenchParams &params);
+
+/**
+ * Device execution time (END - START) of a completed command, for BenchState::SetIterationTime.
+ */
+extern CLHRESULT GetEventElapsedTime(cl_event ev, double *ms);
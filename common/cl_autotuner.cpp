@@ -0,0 +1,303 @@
+#include "cl_autotuner.h"
+#include "cl_json.h"
+#include "benchmark.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+CLTuningConfig MakeTuningConfig(std::initializer_list<CLTuningDefine> defines, cl_uint work_dim,
+                                std::initializer_list<size_t> global_size, std::initializer_list<size_t> local_size) {
+  CLTuningConfig config = {};
+  size_t i;
+
+  config.defines = defines;
+  config.work_dim = work_dim;
+  i = 0;
+  for (size_t sz : global_size)
+    config.global_size[i++] = sz;
+  i = 0;
+  for (size_t sz : local_size)
+    config.local_size[i++] = sz;
+  for (i = work_dim; i < 3; ++i) {
+    config.global_size[i] = std::max(config.global_size[i], (size_t)1);
+    config.local_size[i] = std::max(config.local_size[i], (size_t)1);
+  }
+  return config;
+}
+
+std::string FormatTuningDefines(const std::vector<CLTuningDefine> &defines) {
+  std::string str;
+  for (auto &def : defines) {
+    str += "#define ";
+    str += def.name;
+    str += ' ';
+    str += std::to_string(def.value);
+    str += '\n';
+  }
+  return str;
+}
+
+static CLHRESULT __get_device_string(cl_device_id device, cl_device_info param, std::string &str) {
+  CLHRESULT hr;
+  size_t len = 0;
+
+  V_RETURN(clGetDeviceInfo(device, param, 0, nullptr, &len));
+  str.resize(len);
+  V_RETURN(clGetDeviceInfo(device, param, len, &str[0], nullptr));
+  while (!str.empty() && str.back() == '\0')
+    str.pop_back();
+  return hr;
+}
+
+uint32_t CLTuningDB::SizeBucket(size_t problem_size) {
+  uint32_t bucket = 0;
+  while (problem_size > 1) {
+    problem_size >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+bool CLTuningDB::Lookup(cl_device_id device, const char *kernel_name, size_t problem_size,
+                        CLTuningConfig *config) const {
+  std::string dev_name, drv_version;
+  uint32_t bucket = SizeBucket(problem_size);
+
+  if (CL_FAILED(__get_device_string(device, CL_DEVICE_NAME, dev_name)) ||
+      CL_FAILED(__get_device_string(device, CL_DRIVER_VERSION, drv_version)))
+    return false;
+
+  std::lock_guard<std::mutex> lck(lock_);
+  for (auto &entry : entries_) {
+    if (entry.bucket == bucket && entry.kernel == kernel_name && entry.device == dev_name &&
+        entry.driver == drv_version) {
+      *config = entry.config;
+      return true;
+    }
+  }
+  return false;
+}
+
+void CLTuningDB::Store(cl_device_id device, const char *kernel_name, size_t problem_size,
+                       const CLTuningConfig &config) {
+  Entry entry;
+
+  if (CL_FAILED(__get_device_string(device, CL_DEVICE_NAME, entry.device)) ||
+      CL_FAILED(__get_device_string(device, CL_DRIVER_VERSION, entry.driver)))
+    return;
+  entry.kernel = kernel_name;
+  entry.bucket = SizeBucket(problem_size);
+  entry.config = config;
+
+  std::lock_guard<std::mutex> lck(lock_);
+  for (auto &e : entries_) {
+    if (e.bucket == entry.bucket && e.kernel == entry.kernel && e.device == entry.device &&
+        e.driver == entry.driver) {
+      e = entry;
+      return;
+    }
+  }
+  entries_.push_back(entry);
+}
+
+size_t CLTuningDB::size() const {
+  std::lock_guard<std::mutex> lck(lock_);
+  return entries_.size();
+}
+
+CLHRESULT CLTuningDB::Save(const char *fname) const {
+  std::lock_guard<std::mutex> lck(lock_);
+
+  FILE *fp = fopen(fname, "w");
+  if (!fp) {
+    CL_TRACE(CL_INVALID_VALUE, "Can not open tuning database \"%s\" for writing!\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  fprintf(fp, "{\"entries\": [\n");
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const Entry &e = entries_[i];
+    const CLTuningConfig &c = e.config;
+
+    fprintf(fp, "  {\"device\": \"%s\", \"driver\": \"%s\", \"kernel\": \"%s\", \"bucket\": %u,\n",
+            __json_escape(e.device).c_str(), __json_escape(e.driver).c_str(), __json_escape(e.kernel).c_str(),
+            e.bucket);
+    fprintf(fp, "   \"defines\": {");
+    for (size_t j = 0; j < c.defines.size(); ++j)
+      fprintf(fp, "%s\"%s\": %lld", j ? ", " : "", __json_escape(c.defines[j].name).c_str(),
+              (long long)c.defines[j].value);
+    fprintf(fp, "},\n   \"work_dim\": %u, \"global_size\": [%zu, %zu, %zu], \"local_size\": [%zu, %zu, %zu], "
+                "\"ms\": %.6f}%s\n",
+            c.work_dim, c.global_size[0], c.global_size[1], c.global_size[2], c.local_size[0], c.local_size[1],
+            c.local_size[2], c.ms, i + 1 < entries_.size() ? "," : "");
+  }
+  fprintf(fp, "]}\n");
+  fclose(fp);
+
+  return CL_SUCCESS;
+}
+
+static void __read_sizes(const __JsonValue *arr, size_t sizes[3]) {
+  sizes[0] = sizes[1] = sizes[2] = 1;
+  if (!arr || arr->type != __JsonValue::ARRAY)
+    return;
+  for (size_t i = 0; i < std::min(arr->items.size(), (size_t)3); ++i)
+    sizes[i] = (size_t)arr->items[i].number;
+}
+
+CLHRESULT CLTuningDB::Load(const char *fname) {
+  std::ifstream fin(fname, std::fstream::binary);
+  std::vector<Entry> entries;
+
+  if (!fin)
+    return CL_SUCCESS;
+
+  std::stringstream ss;
+  ss << fin.rdbuf();
+
+  __JsonValue root;
+  __JsonReader reader(ss.str());
+  const __JsonValue *items;
+
+  if (!reader.Parse(&root) || !(items = root.Find("entries")) || items->type != __JsonValue::ARRAY) {
+    CL_TRACE(CL_INVALID_VALUE, "Tuning database \"%s\" is malformed, ignored.\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  for (auto &item : items->items) {
+    const __JsonValue *device = item.Find("device"), *driver = item.Find("driver"), *kernel = item.Find("kernel"),
+                      *bucket = item.Find("bucket"), *defines = item.Find("defines"),
+                      *work_dim = item.Find("work_dim"), *ms = item.Find("ms");
+    if (!device || !driver || !kernel || !bucket || !work_dim)
+      continue;
+
+    Entry entry;
+    entry.device = device->str;
+    entry.driver = driver->str;
+    entry.kernel = kernel->str;
+    entry.bucket = (uint32_t)bucket->number;
+    entry.config.work_dim = (cl_uint)work_dim->number;
+    entry.config.ms = ms ? ms->number : 0.0;
+    __read_sizes(item.Find("global_size"), entry.config.global_size);
+    __read_sizes(item.Find("local_size"), entry.config.local_size);
+    if (defines) {
+      for (auto &m : defines->members)
+        entry.config.defines.push_back({m.first, (int64_t)m.second.number});
+    }
+    entries.push_back(entry);
+  }
+
+  std::lock_guard<std::mutex> lck(lock_);
+  entries_ = std::move(entries);
+  return CL_SUCCESS;
+}
+
+std::string GetTuningDBPath() {
+  const char *path = getenv("CLX_TUNING_DB");
+  return path && *path ? path : "cl_tuning_db.json";
+}
+
+CLTuningDB &GetTuningDB() {
+  static CLTuningDB db;
+  static std::once_flag loaded;
+  std::call_once(loaded, []() { db.Load(GetTuningDBPath().c_str()); });
+  return db;
+}
+
+/**
+ * @return false when the candidate can not run on the device, checked before launching so the skip does not
+ * go through the failing enqueue.
+ */
+static bool __fits_device(cl_kernel kernel, cl_device_id device, const CLTuningConfig &config) {
+  size_t max_wg_size = 0;
+  cl_ulong local_mem = 0, max_local_mem = 0;
+
+  if (CL_FAILED(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_wg_size),
+                                         &max_wg_size, nullptr)) ||
+      CL_FAILED(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(local_mem), &local_mem,
+                                         nullptr)) ||
+      CL_FAILED(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(max_local_mem), &max_local_mem, nullptr)))
+    return false;
+
+  size_t wg_size = 1;
+  for (cl_uint i = 0; i < config.work_dim; ++i) {
+    wg_size *= config.local_size[i];
+    if (config.global_size[i] % config.local_size[i])
+      return false;
+  }
+  return wg_size <= max_wg_size && local_mem <= max_local_mem;
+}
+
+CLHRESULT AutotuneKernel(cl_context context,
+                         cl_device_id device,
+                         cl_command_queue cmd_queue,
+                         const char *fname,
+                         const char *base_defines,
+                         const char *kernel_name,
+                         size_t problem_size,
+                         const std::vector<CLTuningConfig> &candidates,
+                         CLTuneArgsSetter set_args,
+                         CLTuningConfig *best,
+                         int reps,
+                         const char *db_key,
+                         CLTuneVerifier verify) {
+  CLHRESULT hr = CL_SUCCESS;
+  bool found = false;
+
+  for (const CLTuningConfig &cand : candidates) {
+    CLTuningConfig config = cand;
+    std::string defines = base_defines ? base_defines : "";
+    ycl_program program;
+    ycl_kernel kernel;
+    std::vector<double> samples;
+
+    defines += '\n';
+    defines += FormatTuningDefines(config.defines);
+
+    if (CL_FAILED(CreateProgramFromFile(context, device, defines.c_str(), fname, &program)))
+      continue;
+    kernel <<= clCreateKernel(program, kernel_name, &hr);
+    if (CL_FAILED(hr) || CL_FAILED(set_args(kernel, &config)) || !__fits_device(kernel, device, config))
+      continue;
+
+    // One untimed launch first, it pays for the first-use costs and is the one verified.
+    bool passed = true;
+    for (int r = -1; r < reps; ++r) {
+      ycl_event ev;
+      double ms;
+
+      hr = clEnqueueNDRangeKernel(cmd_queue, kernel, config.work_dim, nullptr, config.global_size,
+                                  config.local_size, 0, nullptr, &ev);
+      if (CL_FAILED(hr) || CL_FAILED(hr = clWaitForEvents(1, &ev)) || CL_FAILED(hr = GetEventElapsedTime(ev, &ms)))
+        break;
+      if (r < 0 && verify && (CL_FAILED(hr = verify(cmd_queue, &passed)) || !passed))
+        break;
+      if (r >= 0)
+        samples.push_back(ms);
+    }
+    if (!passed)
+      CL_TRACE(CL_INVALID_VALUE, "Tuning candidate of \"%s\" with local size %zu gave a wrong result, skipped.\n",
+               kernel_name, config.local_size[0]);
+    if (CL_FAILED(hr) || !passed || samples.empty())
+      continue;
+
+    std::sort(samples.begin(), samples.end());
+    config.ms = samples[samples.size() / 2];
+
+    if (!found || config.ms < best->ms) {
+      *best = config;
+      found = true;
+    }
+  }
+
+  if (!found) {
+    CL_TRACE(CL_INVALID_WORK_GROUP_SIZE, "No tuning candidate of \"%s\" could run!\n", kernel_name);
+    return CL_INVALID_WORK_GROUP_SIZE;
+  }
+
+  GetTuningDB().Store(device, db_key ? db_key : kernel_name, problem_size, *best);
+  return CL_SUCCESS;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+/**
+ * Work-group size autotuner and its persisted tuning database.
+ *
+ * A kernel whose local size is a macro (guarded with #ifndef in the .cl file, so a define can override it) is
+ * rebuilt once per candidate with the candidate macros prepended to the source, launched with the candidate
+ * global and local sizes and timed from profiling events. The fastest candidate is stored in the tuning
+ * database under (device, driver, kernel, problem size bucket); the samples look it up at startup and fall back
+ * to the built-in sizes on a miss.
+ *
+ * The database is a JSON file, CLX_TUNING_DB or "cl_tuning_db.json" under the working directory:
+ *
+ *   {"entries": [
+ *     {"device": "...", "driver": "...", "kernel": "histo_atomic", "bucket": 24,
+ *      "defines": {"LOCAL_SIZE_X": 128, "LOCAL_SIZE_X_BIT": 7},
+ *      "work_dim": 1, "global_size": [9216, 1, 1], "local_size": [128, 1, 1], "ms": 0.4123}
+ *   ]}
+ *
+ * Rebuilds go through CreateProgramFromFile, so the program binary cache makes a second tuning pass cheap.
+ */
+
+struct CLTuningDefine {
+  std::string name;
+  int64_t value;
+};
+
+struct CLTuningConfig {
+  std::vector<CLTuningDefine> defines;
+  cl_uint work_dim;
+  size_t global_size[3];  // 0 in the first dimension: derived from the problem size by the caller
+  size_t local_size[3];
+  double ms;              // median kernel time measured by the autotuner
+};
+
+extern CLTuningConfig MakeTuningConfig(std::initializer_list<CLTuningDefine> defines, cl_uint work_dim,
+                                       std::initializer_list<size_t> global_size,
+                                       std::initializer_list<size_t> local_size);
+
+/** Render the defines as "#define NAME VALUE\n" lines, for the `defines` argument of CreateProgramFromFile. */
+extern std::string FormatTuningDefines(const std::vector<CLTuningDefine> &defines);
+
+class CLTuningDB {
+public:
+  /** Problem sizes within a power of two share their tuning. */
+  static uint32_t SizeBucket(size_t problem_size);
+
+  /** A missing file is an empty database. */
+  CLHRESULT Load(const char *fname);
+  CLHRESULT Save(const char *fname) const;
+
+  bool Lookup(cl_device_id device, const char *kernel_name, size_t problem_size, CLTuningConfig *config) const;
+  void Store(cl_device_id device, const char *kernel_name, size_t problem_size, const CLTuningConfig &config);
+
+  size_t size() const;
+
+private:
+  struct Entry {
+    std::string device;
+    std::string driver;
+    std::string kernel;
+    uint32_t bucket;
+    CLTuningConfig config;
+  };
+
+  std::vector<Entry> entries_;
+  mutable std::mutex lock_;
+};
+
+extern std::string GetTuningDBPath();
+
+/** Process wide database, loaded from GetTuningDBPath() on first use. */
+extern CLTuningDB &GetTuningDB();
+
+/**
+ * Set the kernel arguments for one candidate, and fill the global size when the candidate left it 0. Runs right
+ * before the first, checked launch, so it is also where outputs a kernel accumulates into are reset.
+ */
+using CLTuneArgsSetter = std::function<CLHRESULT(cl_kernel kernel, CLTuningConfig *config)>;
+
+/**
+ * Check the output of the first launch of a candidate, @param passed false rejects the candidate.
+ */
+using CLTuneVerifier = std::function<CLHRESULT(cl_command_queue cmd_queue, bool *passed)>;
+
+/**
+ * Time every candidate of @param kernel_name from @param fname and store the fastest one in GetTuningDB().
+ * Candidates that do not build, exceed the device limits, fail to launch or, with @param verify, produce a wrong
+ * result are skipped.
+ * @param base_defines prepended before the candidate defines, e.g. the precision switch.
+ * @param db_key database key, the kernel name when nullptr; builds with different base defines need their own.
+ * @return CL_INVALID_WORK_GROUP_SIZE when no candidate could run.
+ */
+extern CLHRESULT AutotuneKernel(cl_context context,
+                                cl_device_id device,
+                                cl_command_queue cmd_queue,
+                                const char *fname,
+                                const char *base_defines,
+                                const char *kernel_name,
+                                size_t problem_size,
+                                const std::vector<CLTuningConfig> &candidates,
+                                CLTuneArgsSetter set_args,
+                                CLTuningConfig *best,
+                                int reps = 5,
+                                const char *db_key = nullptr,
+                                CLTuneVerifier verify = nullptr);
@@ -0,0 +1,302 @@
+#include "cl_backend.h"
+#include "cl_device_db.h"
+#include "common_miscs.h"
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// Peak flops per clock of one host hardware thread, single precision with FMA. Rough on purpose: only the ratio
+// between the backends matters to the model.
+static const double g_CpuFlopsPerClock = 16.0;
+static const double g_NativeClockGHz = 2.5;
+
+static const size_t g_CalibrationBytes = 32 << 20;
+static const int g_CalibrationReps = 3;
+
+const char *GetBackendKindName(CLBackendKind kind) {
+  return kind == CLBackendKind::OPENCL ? "opencl" : "native";
+}
+
+CLComputeBackend::CLComputeBackend()
+    : device_type_(0), host_unified_(false), native_threads_(1), policy_(Policy::AUTO), launch_ms_(0.0),
+      device_gbps_(0.0), device_gflops_(0.0), transfer_gbps_(0.0), native_gbps_(0.0), native_gflops_(0.0) {}
+
+CLHRESULT CLComputeBackend::Init(std::initializer_list<const char *> preferred_plats,
+                                 std::initializer_list<const char *> req_extensions) {
+  CLHRESULT hr;
+  const char *policy = getenv("CLX_BACKEND");
+
+  policy_ = Policy::AUTO;
+  if (policy && strcmp(policy, "opencl") == 0)
+    policy_ = Policy::OPENCL;
+  else if (policy && strcmp(policy, "native") == 0)
+    policy_ = Policy::NATIVE;
+
+  native_threads_ = std::max(std::thread::hardware_concurrency(), 1u);
+
+  if (policy_ != Policy::NATIVE)
+    V_RETURN(FindDevice(preferred_plats, req_extensions));
+  V_RETURN(Calibrate());
+
+  printf("Backend: %s\n", Describe().c_str());
+  return hr;
+}
+
+CLHRESULT CLComputeBackend::FindDevice(std::initializer_list<const char *> preferred_plats,
+                                       std::initializer_list<const char *> req_extensions) {
+  CLHRESULT hr = CL_SUCCESS;
+  cl_uint num_plats = 0;
+  std::vector<cl_platform_id> plat_ids;
+  std::vector<cl_device_id> devices;
+
+  // No ICD loader or no platform installed: native only.
+  if (CL_FAILED(clGetPlatformIDs(0, nullptr, &num_plats)) || num_plats == 0)
+    return hr;
+
+  const struct {
+    cl_device_type type;
+    bool preferred_only;
+  } search_order[] = {
+      {CL_DEVICE_TYPE_GPU, true},
+      {CL_DEVICE_TYPE_GPU, false},
+      {CL_DEVICE_TYPE_ACCELERATOR, false},
+      {CL_DEVICE_TYPE_CPU, false},
+  };
+
+  // CL_DEVICE_NOT_FOUND only rules out this step, the search goes on with the next one.
+  for (auto &search : search_order) {
+    hr = EnumOpenCLDevices(search.type, search.preferred_only ? preferred_plats
+                                                              : std::initializer_list<const char *>{},
+                           req_extensions, &plat_ids, &devices);
+    if (hr == CL_DEVICE_NOT_FOUND)
+      continue;
+    V_RETURN(hr);
+    if (!devices.empty()) {
+      platform_ = plat_ids[0];
+      device_ = devices[0];
+      device_type_ = search.type;
+      break;
+    }
+  }
+
+  // Every step used up: native only, as documented for Init().
+  if (device_ == nullptr)
+    return CL_SUCCESS;
+
+  cl_bool host_unified = CL_FALSE;
+  V_RETURN(clGetDeviceInfo(device_, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(host_unified), &host_unified, nullptr));
+  host_unified_ = host_unified || device_type_ == CL_DEVICE_TYPE_CPU;
+
+  V_RETURN(CreateDeviceContext(platform_, device_, &context_));
+  V_RETURN(CreateCommandQueue(context_, device_, &cmd_queue_));
+  return hr;
+}
+
+CLHRESULT CLComputeBackend::Calibrate() {
+  CLHRESULT hr = CL_SUCCESS;
+  size_t bytes = g_CalibrationBytes;
+  std::vector<uint8_t> src(bytes, 1), dst(bytes);
+  double best_ms;
+
+  // Host: a copy split over every hardware thread, read plus write traffic.
+  best_ms = 1.0E30;
+  for (int i = 0; i < g_CalibrationReps; ++i) {
+    hp_timer::time_point start = hp_timer::now();
+    ParallelFor(bytes, 1 << 20, [&](size_t begin, size_t end) { memcpy(&dst[begin], &src[begin], end - begin); });
+    best_ms = std::min(best_ms, (double)fmilliseconds_cast(hp_timer::now() - start).count());
+  }
+  native_gbps_ = 2.0 * bytes / std::max(best_ms, 1.0E-3) * 1.0E-6;
+  native_gflops_ = native_threads_ * g_NativeClockGHz * g_CpuFlopsPerClock;
+
+  if (!HasDevice())
+    return hr;
+
+  // Device side from the device database: measured once per device and driver, then read from disk.
+  CLDeviceProfile profile;
+  V_RETURN(GetDeviceProfile(context_, device_, &profile));
+
+  device_gbps_ = profile.metrics.global_gbps;
+  device_gflops_ = profile.metrics.fp32_gflops;
+  transfer_gbps_ = profile.metrics.upload_gbps;
+  launch_ms_ = profile.metrics.launch_us * 1.0E-3;
+
+  return hr;
+}
+
+double CLComputeBackend::EstimateMs(CLBackendKind kind, const CLWorkload &workload) const {
+  if (kind == CLBackendKind::NATIVE)
+    return std::max(workload.bytes / native_gbps_, workload.flops / native_gflops_) * 1.0E-6;
+
+  if (!HasDevice())
+    return 1.0E30;
+
+  double ms = launch_ms_ + std::max(workload.bytes / device_gbps_, workload.flops / device_gflops_) * 1.0E-6;
+  if (!host_unified_)
+    ms += workload.transfer_bytes / transfer_gbps_ * 1.0E-6;
+  return ms;
+}
+
+CLBackendKind CLComputeBackend::Select(const CLWorkload &workload) const {
+  if (!HasDevice() || policy_ == Policy::NATIVE)
+    return CLBackendKind::NATIVE;
+  if (policy_ == Policy::OPENCL)
+    return CLBackendKind::OPENCL;
+  return EstimateMs(CLBackendKind::OPENCL, workload) < EstimateMs(CLBackendKind::NATIVE, workload)
+             ? CLBackendKind::OPENCL
+             : CLBackendKind::NATIVE;
+}
+
+std::string CLComputeBackend::Describe() const {
+  char buff[512];
+  const char *policy = policy_ == Policy::AUTO ? "auto" : policy_ == Policy::OPENCL ? "opencl" : "native";
+  int len = snprintf(buff, sizeof(buff), "native %u threads %.1fGB/s %.0fGFLOP/s", native_threads_, native_gbps_,
+                     native_gflops_);
+
+  if (HasDevice()) {
+    char name[256] = {};
+    clGetDeviceInfo(device_, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+    len += snprintf(buff + len, sizeof(buff) - len,
+                    "; device %s %.1fGB/s %.0fGFLOP/s, transfer %.1fGB/s%s, launch %.3fms", name, device_gbps_,
+                    device_gflops_, transfer_gbps_, host_unified_ ? " (unified)" : "", launch_ms_);
+  } else {
+    len += snprintf(buff + len, sizeof(buff) - len, "; no OpenCL device");
+  }
+  snprintf(buff + len, sizeof(buff) - len, "; policy %s", policy);
+  return buff;
+}
+
+/**
+ * Threads ParallelFor keeps parked between calls. A call takes idle workers for its ranges and starts new ones
+ * only when every worker is busy, so all ranges of one call run at once (cpu_gemm's team barrier relies on it)
+ * and a nested or concurrent call never waits for the workers of another.
+ */
+class CLWorkerPool {
+public:
+  ~CLWorkerPool() {
+    for (auto &worker : workers_) {
+      {
+        std::lock_guard<std::mutex> lck(worker->lock);
+        worker->stop = true;
+      }
+      worker->cv.notify_one();
+      worker->thread.join();
+    }
+  }
+
+  void Run(size_t count, size_t ranges, size_t range_len,
+           const std::function<void(size_t begin, size_t end)> &func) {
+    Latch done;
+    std::vector<Worker *> team;
+
+    team.reserve(ranges - 1);
+    {
+      std::lock_guard<std::mutex> lck(lock_);
+      for (size_t i = 1; i < ranges; ++i) {
+        if (std::min(i * range_len, count) >= count)
+          break;
+        if (idle_.empty()) {
+          workers_.emplace_back(new Worker());
+          workers_.back()->thread = std::thread(&CLWorkerPool::WorkerMain, this, workers_.back().get());
+          idle_.push_back(workers_.back().get());
+        }
+        team.push_back(idle_.back());
+        idle_.pop_back();
+      }
+    }
+
+    done.remaining = team.size();
+    for (size_t i = 0; i < team.size(); ++i) {
+      Worker *worker = team[i];
+      size_t begin = (i + 1) * range_len;
+      {
+        std::lock_guard<std::mutex> lck(worker->lock);
+        worker->func = &func;
+        worker->begin = begin;
+        worker->end = std::min(begin + range_len, count);
+        worker->done = &done;
+      }
+      worker->cv.notify_one();
+    }
+
+    func(0, std::min(range_len, count));
+
+    std::unique_lock<std::mutex> lck(done.lock);
+    done.cv.wait(lck, [&]() { return done.remaining == 0; });
+  }
+
+private:
+  struct Latch {
+    std::mutex lock;
+    std::condition_variable cv;
+    size_t remaining;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable cv;
+    const std::function<void(size_t begin, size_t end)> *func = nullptr;
+    size_t begin = 0;
+    size_t end = 0;
+    Latch *done = nullptr;
+    bool stop = false;
+  };
+
+  void WorkerMain(Worker *worker) {
+    for (;;) {
+      const std::function<void(size_t begin, size_t end)> *func;
+      size_t begin, end;
+      Latch *done;
+      {
+        std::unique_lock<std::mutex> lck(worker->lock);
+        worker->cv.wait(lck, [&]() { return worker->func || worker->stop; });
+        if (worker->stop)
+          return;
+        func = worker->func;
+        begin = worker->begin;
+        end = worker->end;
+        done = worker->done;
+        worker->func = nullptr;
+      }
+
+      (*func)(begin, end);
+
+      // Idle again before the caller may return, so the next call finds this worker instead of starting one.
+      {
+        std::lock_guard<std::mutex> lck(lock_);
+        idle_.push_back(worker);
+      }
+      // Notified under the lock: the latch lives on the caller's stack and goes away once it sees zero.
+      std::lock_guard<std::mutex> lck(done->lock);
+      if (--done->remaining == 0)
+        done->cv.notify_one();
+    }
+  }
+
+  std::mutex lock_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<Worker *> idle_;
+};
+
+void ParallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)> &func,
+                 unsigned threads) {
+  static CLWorkerPool pool;
+
+  if (threads == 0)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  size_t ranges = std::min((size_t)threads, (count + std::max(grain, (size_t)1) - 1) / std::max(grain, (size_t)1));
+  if (ranges <= 1) {
+    if (count)
+      func(0, count);
+    return;
+  }
+
+  pool.Run(count, ranges, (count + ranges - 1) / ranges, func);
+}
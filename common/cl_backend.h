@@ -0,0 +1,132 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <functional>
+#include <string>
+
+/**
+ * Compute backend selection: an OpenCL device of any type, or native multithreaded CPU code when there is no
+ * device at all or when the device would lose on the operation at hand.
+ *
+ * CLComputeBackend::Init() looks for a GPU on the preferred platforms, then a GPU, an accelerator and a CPU device
+ * on any platform, and settles for native only when none is found; it does not fail for lack of a device. The
+ * environment variable CLX_BACKEND=opencl|native|auto (auto by default) pins the choice for every operation.
+ *
+ * Each operation describes one call as a CLWorkload. The cost model estimates both backends from it,
+ *
+ *   OpenCL: launch + transfer_bytes / transfer bandwidth (none on host unified memory)
+ *           + max(bytes / device bandwidth, flops / device peak)
+ *   native: max(bytes / host bandwidth, flops / host peak)
+ *
+ * with the host bandwidth measured by Init() (a memcpy over every hardware thread) and its peak from the thread
+ * count, and the device rates from the device database (cl_device_db.h), measured on the first run only. Small
+ * problems stay on the host, large resident ones go to the device.
+ *
+ * CLBackendOp bundles the two implementations of an operation with its workload estimate:
+ *
+ *   CLBackendOp<const Problem &> op("spmv", workload_func, opencl_func, native_func);
+ *   V_RETURN(op.Run(backend, problem));
+ */
+
+enum class CLBackendKind { OPENCL, NATIVE };
+
+extern const char *GetBackendKindName(CLBackendKind kind);
+
+struct CLWorkload {
+  double bytes;           // memory traffic of the operation itself
+  double flops;
+  double transfer_bytes;  // host <-> device copies the OpenCL path adds, 0 when the data is resident
+};
+
+class CLComputeBackend {
+public:
+  CLComputeBackend();
+
+  /**
+   * @param preferred_plats platforms searched first for a GPU, as for FindOpenCLPlatform.
+   * @return CL_SUCCESS with or without a device; failures only on errors of a device that was found.
+   */
+  CLHRESULT Init(std::initializer_list<const char *> preferred_plats,
+                 std::initializer_list<const char *> req_extensions = {});
+
+  bool HasDevice() const { return device_ != nullptr; }
+
+  cl_platform_id Platform() const { return platform_; }
+  cl_device_id Device() const { return device_; }
+  cl_context Context() const { return context_; }
+  cl_command_queue Queue() const { return cmd_queue_; }
+  cl_device_type DeviceType() const { return device_type_; }
+
+  unsigned NativeThreads() const { return native_threads_; }
+
+  double EstimateMs(CLBackendKind kind, const CLWorkload &workload) const;
+
+  /** NATIVE without a device, the forced kind when CLX_BACKEND pins one, otherwise the cheaper estimate. */
+  CLBackendKind Select(const CLWorkload &workload) const;
+
+  /** One line: device, measured bandwidths and peaks, and the policy. */
+  std::string Describe() const;
+
+private:
+  CLHRESULT FindDevice(std::initializer_list<const char *> preferred_plats,
+                       std::initializer_list<const char *> req_extensions);
+  CLHRESULT Calibrate();
+
+  enum class Policy { AUTO, OPENCL, NATIVE };
+
+  ycl_platform_id platform_;
+  ycl_device_id device_;
+  ycl_context context_;
+  ycl_command_queue cmd_queue_;
+  cl_device_type device_type_;
+  bool host_unified_;
+  unsigned native_threads_;
+  Policy policy_;
+
+  double launch_ms_;
+  double device_gbps_;
+  double device_gflops_;
+  double transfer_gbps_;
+  double native_gbps_;
+  double native_gflops_;
+};
+
+/**
+ * Run @param func over [0, count) split into contiguous ranges on up to @param threads threads (all hardware
+ * threads when 0), in the calling thread alone when count is below @param grain. The other ranges go to workers
+ * parked between calls; every range has a thread of its own for the call, so ranges may wait on each other.
+ */
+extern void ParallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)> &func,
+                        unsigned threads = 0);
+
+template <typename... TArgs> class CLBackendOp {
+public:
+  using ImplFunc = std::function<CLHRESULT(TArgs...)>;
+  using WorkloadFunc = std::function<CLWorkload(TArgs...)>;
+
+  /** @param opencl may be empty for an operation without a device implementation. */
+  CLBackendOp(const char *name, WorkloadFunc workload, ImplFunc opencl, ImplFunc native)
+      : name_(name), workload_(workload), opencl_(opencl), native_(native) {}
+
+  const char *Name() const { return name_.c_str(); }
+
+  CLBackendKind Select(const CLComputeBackend &backend, TArgs... args) const {
+    if (!opencl_)
+      return CLBackendKind::NATIVE;
+    return backend.Select(workload_(args...));
+  }
+
+  CLHRESULT Run(CLBackendKind kind, TArgs... args) const {
+    return kind == CLBackendKind::OPENCL ? opencl_(args...) : native_(args...);
+  }
+
+  CLHRESULT Run(const CLComputeBackend &backend, TArgs... args) const {
+    return Run(Select(backend, args...), args...);
+  }
+
+private:
+  std::string name_;
+  WorkloadFunc workload_;
+  ImplFunc opencl_;
+  ImplFunc native_;
+};
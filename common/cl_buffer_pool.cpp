@@ -0,0 +1,225 @@
+#include "cl_buffer_pool.h"
+#include <algorithm>
+#include <string.h>
+
+static const size_t g_MinClassSize = 256;
+static const size_t g_MaxClassSize = (size_t)1 << 40;
+
+CLPooledBuffer::CLPooledBuffer(CLPooledBuffer &&other) noexcept
+    : pool_(other.pool_), mem_(other.mem_), size_(other.size_), class_idx_(other.class_idx_),
+      last_use_(other.last_use_) {
+  other.pool_ = nullptr;
+  other.mem_ = nullptr;
+  other.size_ = 0;
+  other.last_use_ = nullptr;
+}
+
+CLPooledBuffer &CLPooledBuffer::operator=(CLPooledBuffer &&other) noexcept {
+  if (this != &other) {
+    Reset();
+    pool_ = other.pool_;
+    mem_ = other.mem_;
+    size_ = other.size_;
+    class_idx_ = other.class_idx_;
+    last_use_ = other.last_use_;
+    other.pool_ = nullptr;
+    other.mem_ = nullptr;
+    other.size_ = 0;
+    other.last_use_ = nullptr;
+  }
+  return *this;
+}
+
+void CLPooledBuffer::SetLastUse(cl_event event) {
+  if (event)
+    clRetainEvent(event);
+  if (last_use_)
+    clReleaseEvent(last_use_);
+  last_use_ = event;
+}
+
+void CLPooledBuffer::Reset() {
+  if (pool_ && mem_)
+    pool_->Recycle(mem_, class_idx_, last_use_);
+  else if (last_use_)
+    clReleaseEvent(last_use_);
+  pool_ = nullptr;
+  mem_ = nullptr;
+  size_ = 0;
+  last_use_ = nullptr;
+}
+
+CLBufferPool::CLBufferPool(cl_context context, cl_device_id device, cl_mem_flags flags, size_t slab_size)
+    : flags_(flags), slab_size_(slab_size), slab_offset_(0) {
+
+  cl_uint align_bits = 0;
+
+  RT_ASSERT(!(flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR)));
+
+  context_ = context;
+  clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, nullptr);
+  align_ = std::max((size_t)(align_bits >> 3), (size_t)1);
+
+  // Sub-buffer origins must be aligned, so every class is a multiple of the alignment.
+  size_t base = RoundC(std::max(g_MinClassSize, align_), align_);
+  classes_.push_back({base});
+  for (size_t p = base; p < g_MaxClassSize; p <<= 1) {
+    for (size_t q = 1; q <= 4; ++q) {
+      size_t sz = RoundC(p + q * (p >> 2), align_);
+      if (sz > classes_.back().size)
+        classes_.push_back({sz});
+    }
+  }
+
+  max_carved_size_ = slab_size_ >> 3;
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+CLBufferPool::~CLBufferPool() {
+
+  RT_ASSERT(stats_.bytes_in_use == 0);
+
+  // The driver keeps a memory object alive until the commands using it are done, only the events are ours.
+  for (auto &cls : classes_) {
+    for (auto &free : cls.free_list) {
+      if (free.last_use)
+        clReleaseEvent(free.last_use);
+      if (cls.size > max_carved_size_)
+        clReleaseMemObject(free.mem);
+    }
+  }
+  for (cl_mem mem : carved_)
+    clReleaseMemObject(mem);
+  for (cl_mem mem : slabs_)
+    clReleaseMemObject(mem);
+}
+
+size_t CLBufferPool::ClassIndex(size_t size) const {
+  auto it = std::lower_bound(classes_.begin(), classes_.end(), size,
+                             [](const SizeClass &cls, size_t sz) { return cls.size < sz; });
+  return it - classes_.begin();
+}
+
+size_t CLBufferPool::GetClassSize(size_t size) const {
+  size_t idx = ClassIndex(size);
+  return idx < classes_.size() ? classes_[idx].size : 0;
+}
+
+CLHRESULT CLBufferPool::CreateFromSlab(size_t class_idx, cl_mem *mem) {
+  CLHRESULT hr;
+  size_t cls_size = classes_[class_idx].size;
+
+  if (slabs_.empty() || slab_offset_ + cls_size > slab_size_) {
+    cl_mem slab;
+    V_RETURN2(slab = clCreateBuffer(context_, flags_, slab_size_, nullptr, &hr), hr);
+    slabs_.push_back(slab);
+    slab_offset_ = 0;
+    stats_.slabs += 1;
+    stats_.bytes_reserved += slab_size_;
+  }
+
+  // Flags 0 inherits them from the slab.
+  cl_buffer_region region = {slab_offset_, cls_size};
+  V_RETURN2(*mem = clCreateSubBuffer(slabs_.back(), 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &hr), hr);
+  carved_.push_back(*mem);
+  slab_offset_ += cls_size;
+
+  return hr;
+}
+
+CLHRESULT CLBufferPool::Acquire(size_t size, CLPooledBuffer *buffer) {
+  CLHRESULT hr = CL_SUCCESS;
+
+  // Outside the lock, the previous loan may come from this pool.
+  buffer->Reset();
+
+  std::unique_lock<std::mutex> lck(lock_);
+  size_t class_idx = ClassIndex(std::max(size, (size_t)1));
+  cl_mem mem;
+  cl_event last_use = nullptr;
+
+  if (class_idx >= classes_.size()) {
+    CL_TRACE(CL_INVALID_BUFFER_SIZE, "Buffer pool request of %zu bytes is too large!\n", size);
+    return CL_INVALID_BUFFER_SIZE;
+  }
+
+  SizeClass &cls = classes_[class_idx];
+
+  stats_.acquires += 1;
+  if (!cls.free_list.empty()) {
+    mem = cls.free_list.back().mem;
+    last_use = cls.free_list.back().last_use;
+    cls.free_list.pop_back();
+    stats_.reuses += 1;
+  } else if (cls.size <= max_carved_size_) {
+    V_RETURN(CreateFromSlab(class_idx, &mem));
+    stats_.creates += 1;
+  } else {
+    V_RETURN2(mem = clCreateBuffer(context_, flags_, cls.size, nullptr, &hr), hr);
+    stats_.creates += 1;
+    stats_.bytes_reserved += cls.size;
+  }
+
+  stats_.bytes_in_use += cls.size;
+  stats_.peak_bytes_in_use = std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
+
+  buffer->pool_ = this;
+  buffer->mem_ = mem;
+  buffer->size_ = size;
+  buffer->class_idx_ = class_idx;
+  lck.unlock();
+
+  // The previous user's commands may still be pending on another queue. A failed command still ended its use.
+  if (last_use) {
+    clWaitForEvents(1, &last_use);
+    clReleaseEvent(last_use);
+  }
+
+  return hr;
+}
+
+CLHRESULT CLBufferPool::AcquireAndUpload(cl_command_queue cmd_queue, size_t size, const void *host_ptr,
+                                         cl_bool blocking, CLPooledBuffer *buffer, cl_event *event) {
+  CLHRESULT hr;
+
+  V_RETURN(Acquire(size, buffer));
+  V_RETURN(clEnqueueWriteBuffer(cmd_queue, *buffer, blocking, 0, size, host_ptr, 0, nullptr, event));
+  return hr;
+}
+
+void CLBufferPool::Recycle(cl_mem mem, size_t class_idx, cl_event last_use) {
+  std::lock_guard<std::mutex> lck(lock_);
+  SizeClass &cls = classes_[class_idx];
+
+  cls.free_list.push_back({mem, last_use});
+  stats_.bytes_in_use -= cls.size;
+}
+
+void CLBufferPool::Trim() {
+  std::lock_guard<std::mutex> lck(lock_);
+
+  for (auto &cls : classes_) {
+    if (cls.size <= max_carved_size_)
+      continue;
+    for (auto &free : cls.free_list) {
+      if (free.last_use)
+        clReleaseEvent(free.last_use);
+      clReleaseMemObject(free.mem);
+      stats_.bytes_reserved -= cls.size;
+    }
+    cls.free_list.clear();
+  }
+}
+
+void CLBufferPool::GetStats(CLBufferPoolStats *stats) {
+  std::lock_guard<std::mutex> lck(lock_);
+  *stats = stats_;
+}
+
+void CLBufferPool::ResetStats() {
+  std::lock_guard<std::mutex> lck(lock_);
+  stats_.acquires = 0;
+  stats_.reuses = 0;
+  stats_.creates = 0;
+  stats_.peak_bytes_in_use = stats_.bytes_in_use;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <vector>
+#include <mutex>
+
+/**
+ * Size-class pool of device buffers for one context.
+ *
+ * Requests are rounded up to a size class (4 classes per power of two, so at most 25% is wasted). Small classes
+ * are carved out of large slabs with clCreateSubBuffer, every origin aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN;
+ * larger classes get a buffer of their own. Released buffers go back to the free list of their class and are
+ * handed out again without touching the driver, so a service loop stops paying clCreateBuffer and the
+ * implicit copy of CL_MEM_COPY_HOST_PTR on every call. Upload explicitly with clEnqueueWriteBuffer (or
+ * CLBufferPool::AcquireAndUpload) instead.
+ *
+ * Commands on the queue that will use the buffer next are ordered after the earlier ones already, nothing to do.
+ * A buffer last used on another queue carries the event of that last command (CLPooledBuffer::SetLastUse) back
+ * to the pool; the Acquire handing it out again waits for that event, so the next user never races the pending
+ * reads or writes of the previous one.
+ *
+ * Memory is only returned to the driver by Trim() or when the pool is destroyed. The pool must outlive every
+ * CLPooledBuffer it handed out.
+ */
+
+struct CLBufferPoolStats {
+  size_t acquires;          // total Acquire calls
+  size_t reuses;            // served from a free list
+  size_t creates;           // buffers or sub-buffers created from the driver
+  size_t slabs;             // slabs allocated for the small classes
+  size_t bytes_reserved;    // device memory owned by the pool, slabs included
+  size_t bytes_in_use;      // rounded size of the buffers handed out
+  size_t peak_bytes_in_use;
+};
+
+class CLBufferPool;
+
+/**
+ * A buffer on loan from a CLBufferPool, returned to it on destruction. Move only.
+ */
+class CLPooledBuffer {
+public:
+  CLPooledBuffer() : pool_(nullptr), mem_(nullptr), size_(0), class_idx_(0), last_use_(nullptr) {}
+  CLPooledBuffer(CLPooledBuffer &&other) noexcept;
+  CLPooledBuffer &operator=(CLPooledBuffer &&other) noexcept;
+  CLPooledBuffer(const CLPooledBuffer &) = delete;
+  CLPooledBuffer &operator=(const CLPooledBuffer &) = delete;
+  ~CLPooledBuffer() { Reset(); }
+
+  /**
+   * Event of the last command using the buffer, retained until the buffer is handed out again. Needed when that
+   * command may still be pending on a queue other than the next user's; replaces an earlier event.
+   */
+  void SetLastUse(cl_event event);
+
+  /** Give the buffer back to its pool now, with the event of SetLastUse. */
+  void Reset();
+
+  /** Requested size, the underlying buffer may be larger. */
+  size_t Size() const { return size_; }
+
+  operator cl_mem() const { return mem_; }
+  /** For SetKernelArguments, which takes the address of every argument. */
+  cl_mem const *GetAddressOf() const { return &mem_; }
+
+private:
+  friend class CLBufferPool;
+
+  CLBufferPool *pool_;
+  cl_mem mem_;
+  size_t size_;
+  size_t class_idx_;
+  cl_event last_use_;
+};
+
+class CLBufferPool {
+public:
+  /**
+   * @param flags memory flags of every buffer in the pool, host pointer flags are not allowed.
+   * @param slab_size size of the slabs small classes are carved from, classes above slab_size / 8 are not
+   * carved.
+   */
+  CLBufferPool(cl_context context, cl_device_id device, cl_mem_flags flags = CL_MEM_READ_WRITE,
+               size_t slab_size = 4 << 20);
+  ~CLBufferPool();
+
+  CLBufferPool(const CLBufferPool &) = delete;
+  CLBufferPool &operator=(const CLBufferPool &) = delete;
+
+  /** Waits for the last use event of a recycled buffer, if it carried one. */
+  CLHRESULT Acquire(size_t size, CLPooledBuffer *buffer);
+
+  /**
+   * Acquire then write @param host_ptr to the buffer. A non-blocking write needs @param host_ptr valid until
+   * @param event (or the queue) completes.
+   */
+  CLHRESULT AcquireAndUpload(cl_command_queue cmd_queue, size_t size, const void *host_ptr, cl_bool blocking,
+                             CLPooledBuffer *buffer, cl_event *event = nullptr);
+
+  /**
+   * Release every free buffer of the non-carved classes back to the driver. Slabs are kept.
+   */
+  void Trim();
+
+  void GetStats(CLBufferPoolStats *stats);
+  void ResetStats();
+
+  /** Rounded size a request of @param size would receive. */
+  size_t GetClassSize(size_t size) const;
+
+private:
+  friend class CLPooledBuffer;
+
+  struct FreeBuffer {
+    cl_mem mem;
+    cl_event last_use;  // owned, nullptr when the buffer is idle
+  };
+
+  struct SizeClass {
+    size_t size;
+    std::vector<FreeBuffer> free_list;
+  };
+
+  size_t ClassIndex(size_t size) const;
+  CLHRESULT CreateFromSlab(size_t class_idx, cl_mem *mem);
+  void Recycle(cl_mem mem, size_t class_idx, cl_event last_use);
+
+  std::mutex lock_;
+  ycl_context context_;
+  cl_mem_flags flags_;
+  size_t align_;
+  size_t slab_size_;
+  size_t max_carved_size_;
+  std::vector<SizeClass> classes_;
+  std::vector<cl_mem> slabs_;
+  std::vector<cl_mem> carved_;    // every sub-buffer, released with the pool
+  size_t slab_offset_;            // next free byte in slabs_.back()
+  CLBufferPoolStats stats_;
+};
@@ -0,0 +1,166 @@
+#include "cl_completion_queue.h"
+#include <algorithm>
+
+CLCompletionQueue::JobQueue::JobQueue() : head_(&stub_), tail_(&stub_) { stub_.next.store(nullptr); }
+
+CLCompletionQueue::JobQueue::~JobQueue() {
+  while (Job *job = Pop())
+    delete job;
+}
+
+void CLCompletionQueue::JobQueue::Push(Job *job) {
+  job->next.store(nullptr, std::memory_order_relaxed);
+  Job *prev = head_.exchange(job, std::memory_order_acq_rel);
+  // between the exchange and this store the consumer sees the queue end at prev
+  prev->next.store(job, std::memory_order_release);
+}
+
+CLCompletionQueue::Job *CLCompletionQueue::JobQueue::Pop() {
+  Job *tail = tail_;
+  Job *next = tail->next.load(std::memory_order_acquire);
+
+  if (tail == &stub_) {
+    if (!next)
+      return nullptr;
+    tail_ = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  // tail is the last job pushed, unless a push is in flight
+  if (tail != head_.load(std::memory_order_acquire))
+    return nullptr;
+  // put the stub back behind it so tail can be handed out
+  Push(&stub_);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+CLCompletionQueue::CLCompletionQueue(unsigned threads)
+    : next_worker_(0), pending_(0), stop_(false), posted_(0), completed_(0), wakeups_(0) {
+  if (threads == 0)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  for (unsigned i = 0; i < threads; ++i) {
+    workers_.emplace_back(new Worker());
+    workers_.back()->sleeping.store(false);
+  }
+  for (auto &worker : workers_) {
+    Worker *w = worker.get();
+    w->thread = std::thread([this, w]() { WorkerLoop(*w); });
+  }
+}
+
+CLCompletionQueue::~CLCompletionQueue() {
+  Drain();
+  stop_.store(true);
+  for (auto &worker : workers_) {
+    {
+      std::lock_guard<std::mutex> lck(worker->lock);
+    }
+    worker->cv.notify_one();
+    worker->thread.join();
+  }
+}
+
+CLHRESULT CLCompletionQueue::Post(cl_event event, CLCompletionHandler handler) {
+  CLHRESULT hr;
+  Job *job;
+
+  V_RETURN(clRetainEvent(event));
+
+  job = new Job();
+  job->owner = this;
+  job->event = event;
+  job->status = CL_COMPLETE;
+  job->handler = std::move(handler);
+
+  pending_.fetch_add(1, std::memory_order_acq_rel);
+  posted_.fetch_add(1, std::memory_order_relaxed);
+
+  hr = clSetEventCallback(event, CL_COMPLETE, &CLCompletionQueue::OnEventComplete, job);
+  if (CL_FAILED(hr)) {
+    clReleaseEvent(event);
+    delete job;
+    posted_.fetch_sub(1, std::memory_order_relaxed);
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lck(drain_lock_);
+      drain_cv_.notify_all();
+    }
+    V_RETURN(hr);
+  }
+  return hr;
+}
+
+void CL_CALLBACK CLCompletionQueue::OnEventComplete(cl_event, cl_int status, void *user_data) {
+  Job *job = static_cast<Job *>(user_data);
+
+  job->status = status;
+  job->owner->Enqueue(job);
+}
+
+void CLCompletionQueue::Enqueue(Job *job) {
+  Worker &worker = *workers_[next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+
+  worker.jobs.Push(job);
+  // seq_cst against the worker's store of sleeping before its last look at the queue: either it sees the job,
+  // or this sees it asleep
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (worker.sleeping.load(std::memory_order_seq_cst)) {
+    {
+      std::lock_guard<std::mutex> lck(worker.lock);
+    }
+    worker.cv.notify_one();
+    wakeups_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void CLCompletionQueue::WorkerLoop(Worker &worker) {
+  const int spins = 64;
+
+  for (;;) {
+    Job *job = nullptr;
+
+    for (int i = 0; i < spins && !(job = worker.jobs.Pop()); ++i)
+      std::this_thread::yield();
+
+    if (!job) {
+      std::unique_lock<std::mutex> lck(worker.lock);
+      worker.sleeping.store(true, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (!(job = worker.jobs.Pop()) && !stop_.load())
+        worker.cv.wait(lck);
+      worker.sleeping.store(false, std::memory_order_relaxed);
+    }
+    if (!job)
+      return;
+
+    job->handler(job->event, job->status);
+    clReleaseEvent(job->event);
+    delete job;
+
+    completed_.fetch_add(1, std::memory_order_relaxed);
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lck(drain_lock_);
+      drain_cv_.notify_all();
+    }
+  }
+}
+
+void CLCompletionQueue::Drain() {
+  std::unique_lock<std::mutex> lck(drain_lock_);
+  drain_cv_.wait(lck, [this]() { return pending_.load(std::memory_order_acquire) == 0; });
+}
+
+void CLCompletionQueue::GetStats(CLCompletionStats *stats) const {
+  stats->posted = posted_.load(std::memory_order_relaxed);
+  stats->completed = completed_.load(std::memory_order_relaxed);
+  stats->wakeups = wakeups_.load(std::memory_order_relaxed);
+}
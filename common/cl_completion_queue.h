@@ -0,0 +1,139 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Completion port for OpenCL events: host work runs on a pool of worker threads when an event completes, no host
+ * thread waits in clWaitForEvents per job.
+ *
+ *   CLCompletionQueue completions;               // one worker per hardware thread
+ *   for (auto &job : jobs) {
+ *     ... enqueue the job, ending in a non-blocking read with read_ev
+ *     completions.Post(read_ev, [&job](cl_event, cl_int status) { check the result of job });
+ *   }
+ *   clFlush(cmd_queue);                          // callbacks only fire for submitted commands
+ *   completions.Drain();
+ *
+ * Post registers a clSetEventCallback on the event; the callback, on a driver thread, only pushes the job into
+ * the lock-free MPSC queue of one worker (round robin) and wakes it if it sleeps. The worker runs the handler, so
+ * result checks and CPU references overlap the device work on the next jobs, and the driver thread is never held
+ * up by them.
+ *
+ * Handlers run concurrently on different workers; whatever they share needs its own synchronisation. A handler
+ * must not call Drain.
+ */
+
+/** @param status CL_COMPLETE, or the negative error status the command terminated with. */
+using CLCompletionHandler = std::function<void(cl_event event, cl_int status)>;
+
+struct CLCompletionStats {
+  size_t posted;     // Post calls that registered a callback
+  size_t completed;  // handlers returned
+  size_t wakeups;    // times a sleeping worker was woken by a completion
+};
+
+class CLCompletionQueue {
+public:
+  /** @param threads workers, std::thread::hardware_concurrency() when 0. */
+  explicit CLCompletionQueue(unsigned threads = 0);
+  /** Drains, then joins the workers. */
+  ~CLCompletionQueue();
+
+  CLCompletionQueue(const CLCompletionQueue &) = delete;
+  CLCompletionQueue &operator=(const CLCompletionQueue &) = delete;
+
+  /**
+   * Run @param handler on a worker once @param event terminates. The event is retained until the handler
+   * returned. The command must still be flushed to the device by the caller.
+   */
+  CLHRESULT Post(cl_event event, CLCompletionHandler handler);
+
+  /** Block until every posted handler returned. */
+  void Drain();
+
+  /** Posted handlers not yet returned. */
+  size_t Pending() const { return pending_.load(std::memory_order_acquire); }
+
+  unsigned ThreadCount() const { return (unsigned)workers_.size(); }
+
+  void GetStats(CLCompletionStats *stats) const;
+
+private:
+  struct Job {
+    std::atomic<Job *> next;
+    CLCompletionQueue *owner;
+    cl_event event;
+    cl_int status;
+    CLCompletionHandler handler;
+  };
+
+  /**
+   * Intrusive multi-producer single-consumer queue (D. Vyukov): producers exchange the head, the one consumer
+   * follows the next links from a stub. A push is one exchange and one store, wait free.
+   */
+  class JobQueue {
+  public:
+    JobQueue();
+    ~JobQueue();
+    void Push(Job *job);
+    /** nullptr when empty, or while a push is half way (it is seen on the next call). */
+    Job *Pop();
+
+  private:
+    std::atomic<Job *> head_;
+    Job *tail_;  // consumer only
+    Job stub_;
+  };
+
+  struct Worker {
+    JobQueue jobs;
+    std::atomic<bool> sleeping;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::thread thread;
+  };
+
+  static void CL_CALLBACK OnEventComplete(cl_event event, cl_int status, void *user_data);
+  void Enqueue(Job *job);
+  void WorkerLoop(Worker &worker);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_;
+  std::atomic<size_t> pending_;
+  std::atomic<bool> stop_;
+
+  std::atomic<size_t> posted_;
+  std::atomic<size_t> completed_;
+  std::atomic<size_t> wakeups_;
+
+  std::mutex drain_lock_;
+  std::condition_variable drain_cv_;
+};
+
+/**
+ * Flushes @param cmd_queue and drains @param completions on destruction, so handlers referring to the frame that
+ * posted them never outlive it, early returns included.
+ */
+class CLCompletionDrainGuard {
+public:
+  CLCompletionDrainGuard(cl_command_queue cmd_queue, CLCompletionQueue &completions)
+      : cmd_queue_(cmd_queue), completions_(completions) {}
+  ~CLCompletionDrainGuard() {
+    clFlush(cmd_queue_);
+    completions_.Drain();
+  }
+
+  CLCompletionDrainGuard(const CLCompletionDrainGuard &) = delete;
+  CLCompletionDrainGuard &operator=(const CLCompletionDrainGuard &) = delete;
+
+private:
+  cl_command_queue cmd_queue_;
+  CLCompletionQueue &completions_;
+};
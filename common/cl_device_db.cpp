@@ -0,0 +1,466 @@
+#include "cl_device_db.h"
+#include "cl_json.h"
+#include "benchmark.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int g_MeasureReps = 3;
+static const size_t g_MaxCopyBytes = 64 << 20;
+static const cl_uint g_ComputeIters = 1024;
+static const cl_uint g_LocalIters = 1024;
+static const cl_uint g_AtomicIters = 64;
+
+static const char g_MicroBenchSource[] = R"(
+__kernel void copy_f4(__global const float4 *src, __global float4 *dst) {
+  size_t i = get_global_id(0);
+  dst[i] = src[i];
+}
+
+__attribute__((reqd_work_group_size(LOCAL_SIZE, 1, 1)))
+__kernel void local_read(__global float *out, uint iters) {
+  __local float4 tile[LOCAL_SIZE];
+  uint lid = get_local_id(0);
+  float4 acc = (float4)(0.0f);
+
+  tile[lid] = (float4)((float)lid);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint i = 0; i < iters; ++i)
+    acc += tile[(lid + i) & (LOCAL_SIZE - 1)];
+  out[get_global_id(0)] = acc.x + acc.y + acc.z + acc.w;
+}
+
+__kernel void atomic_counters(__global uint *counters, uint iters) {
+  __global uint *counter = counters + (get_global_id(0) & 63);
+  for (uint i = 0; i < iters; ++i)
+    atomic_inc(counter);
+}
+
+__kernel void fma_chains(__global REAL *out, REAL a, REAL b, uint iters) {
+  REAL x0 = (REAL)get_global_id(0), x1 = x0 + 1, x2 = x0 + 2, x3 = x0 + 3;
+  REAL x4 = x0 + 4, x5 = x0 + 5, x6 = x0 + 6, x7 = x0 + 7;
+
+  for (uint i = 0; i < iters; ++i) {
+    x0 = fma(x0, a, b); x1 = fma(x1, a, b); x2 = fma(x2, a, b); x3 = fma(x3, a, b);
+    x4 = fma(x4, a, b); x5 = fma(x5, a, b); x6 = fma(x6, a, b); x7 = fma(x7, a, b);
+  }
+  out[get_global_id(0)] = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+}
+
+__kernel void nop(__global uint *out) {
+  if (get_global_id(0) == 0xffffffff)
+    out[0] = 0;
+}
+)";
+
+static CLHRESULT __get_device_string(cl_device_id device, cl_device_info param, std::string *str) {
+  CLHRESULT hr;
+  size_t len = 0;
+
+  str->clear();
+  V_RETURN(clGetDeviceInfo(device, param, 0, nullptr, &len));
+  if (len == 0)
+    return hr;
+  std::vector<char> buff(len + 1, 0);
+  V_RETURN(clGetDeviceInfo(device, param, len, buff.data(), nullptr));
+  *str = buff.data();
+  return hr;
+}
+
+template <typename T> static CLHRESULT __get_device_value(cl_device_id device, cl_device_info param, T *value) {
+  return clGetDeviceInfo(device, param, sizeof(T), value, nullptr);
+}
+
+CLHRESULT QueryDeviceCaps(cl_device_id device, CLDeviceCaps *caps) {
+  CLHRESULT hr;
+  cl_device_local_mem_type local_type;
+  cl_device_fp_config fp64_config = 0;
+  cl_bool unified, image_support;
+  cl_command_queue_properties queue_props;
+
+  V_RETURN(__get_device_string(device, CL_DEVICE_NAME, &caps->name));
+  V_RETURN(__get_device_string(device, CL_DEVICE_VENDOR, &caps->vendor));
+  V_RETURN(__get_device_string(device, CL_DRIVER_VERSION, &caps->driver));
+  V_RETURN(__get_device_string(device, CL_DEVICE_VERSION, &caps->version));
+  V_RETURN(__get_device_string(device, CL_DEVICE_OPENCL_C_VERSION, &caps->opencl_c_version));
+  // Unknown to OpenCL 1.2 and 2.0 devices.
+  if (CL_FAILED(__get_device_string(device, CL_DEVICE_IL_VERSION, &caps->il_version)))
+    caps->il_version.clear();
+
+  V_RETURN(__get_device_value(device, CL_DEVICE_TYPE, &caps->type));
+  V_RETURN(__get_device_value(device, CL_DEVICE_MAX_COMPUTE_UNITS, &caps->compute_units));
+  V_RETURN(__get_device_value(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, &caps->clock_mhz));
+  V_RETURN(__get_device_value(device, CL_DEVICE_GLOBAL_MEM_SIZE, &caps->global_mem_size));
+  V_RETURN(__get_device_value(device, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, &caps->global_mem_cache_size));
+  V_RETURN(__get_device_value(device, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, &caps->global_mem_cacheline_size));
+  V_RETURN(__get_device_value(device, CL_DEVICE_LOCAL_MEM_SIZE, &caps->local_mem_size));
+  V_RETURN(__get_device_value(device, CL_DEVICE_LOCAL_MEM_TYPE, &local_type));
+  V_RETURN(__get_device_value(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, &caps->max_alloc_size));
+  V_RETURN(__get_device_value(device, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE, &caps->max_constant_size));
+  V_RETURN(__get_device_value(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, &caps->mem_base_addr_align));
+  V_RETURN(__get_device_value(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, &caps->max_work_group_size));
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(caps->max_work_item_sizes),
+                           caps->max_work_item_sizes, nullptr));
+  V_RETURN(__get_device_value(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, &caps->preferred_vector_width_float));
+  V_RETURN(__get_device_value(device, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, &caps->native_vector_width_float));
+  V_RETURN(__get_device_value(device, CL_DEVICE_DOUBLE_FP_CONFIG, &fp64_config));
+  V_RETURN(__get_device_value(device, CL_DEVICE_HOST_UNIFIED_MEMORY, &unified));
+  V_RETURN(__get_device_value(device, CL_DEVICE_QUEUE_PROPERTIES, &queue_props));
+  V_RETURN(__get_device_value(device, CL_DEVICE_IMAGE_SUPPORT, &image_support));
+
+  caps->local_mem_sram = local_type == CL_LOCAL;
+  caps->fp64 = fp64_config != 0;
+  caps->host_unified_memory = unified != CL_FALSE;
+  caps->out_of_order_queue = (queue_props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+  caps->image_support = image_support != CL_FALSE;
+  return hr;
+}
+
+/**
+ * Best of g_MeasureReps runs of @param kernel, from its profiling events.
+ */
+static CLHRESULT __time_kernel(cl_command_queue cmd_queue, cl_kernel kernel, size_t global_size,
+                               const size_t *local_size, double *best_ms) {
+  CLHRESULT hr;
+  ycl_event ev;
+  double ms;
+
+  *best_ms = 1.0E30;
+  for (int i = 0; i < g_MeasureReps; ++i) {
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, &global_size, local_size, 0, nullptr,
+                                    ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clWaitForEvents(1, &ev));
+    V_RETURN(GetEventElapsedTime(ev, &ms));
+    *best_ms = std::min(*best_ms, std::max(ms, 1.0E-6));
+  }
+  return hr;
+}
+
+static CLHRESULT __measure_fma(cl_context context, cl_device_id device, cl_command_queue cmd_queue, bool fp64,
+                               size_t global_size, double *gflops) {
+  CLHRESULT hr;
+  ycl_program program;
+  ycl_kernel kernel;
+  ycl_buffer out_buff;
+  size_t real_size = fp64 ? sizeof(double) : sizeof(float);
+  double ms;
+
+  V_RETURN(CreateProgramFromSource(context, device, fp64 ? "#define _USE_DOUBLE_FP\n#define LOCAL_SIZE 1\n"
+                                                         : "#define LOCAL_SIZE 1\n",
+                                   g_MicroBenchSource, sizeof(g_MicroBenchSource) - 1, &program));
+  V_RETURN2(kernel <<= clCreateKernel(program, "fma_chains", &hr), hr);
+  V_RETURN2(out_buff <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, global_size * real_size, nullptr, &hr), hr);
+
+  // |a| < 1 keeps the chains bounded, nothing overflows into slow paths.
+  if (fp64) {
+    double a = 0.999, b = 0.001;
+    V_RETURN(SetKernelArguments(kernel, &out_buff, &a, &b, &g_ComputeIters));
+  } else {
+    float a = 0.999f, b = 0.001f;
+    V_RETURN(SetKernelArguments(kernel, &out_buff, &a, &b, &g_ComputeIters));
+  }
+  V_RETURN(__time_kernel(cmd_queue, kernel, global_size, nullptr, &ms));
+
+  *gflops = 2.0 * 8 * g_ComputeIters * global_size / ms * 1.0E-6;
+  return hr;
+}
+
+CLHRESULT MeasureDeviceMetrics(cl_context context, cl_device_id device, CLDeviceMetrics *metrics) {
+  CLHRESULT hr;
+  CLDeviceCaps caps;
+  ycl_command_queue cmd_queue;
+  ycl_program program;
+  ycl_kernel kernel;
+  ycl_buffer src_buff, dst_buff, out_buff;
+  ycl_event ev;
+  double ms, best_ms;
+  char defines[64];
+
+  *metrics = {};
+  V_RETURN(QueryDeviceCaps(device, &caps));
+  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
+
+  // Power of two no larger than the device allows, for the __local tile index mask.
+  size_t local_size = 1;
+  while (local_size * 2 <= std::min(caps.max_work_group_size, (size_t)256))
+    local_size *= 2;
+  size_t compute_global = RoundC((size_t)caps.compute_units * 4 * local_size, local_size);
+
+  snprintf(defines, sizeof(defines), "#define LOCAL_SIZE %zu\n", local_size);
+  V_RETURN(CreateProgramFromSource(context, device, defines, g_MicroBenchSource, sizeof(g_MicroBenchSource) - 1,
+                                   &program));
+
+  // Global memory, and the host copies over the same buffers.
+  size_t copy_bytes = RoundF(std::min((size_t)caps.max_alloc_size, g_MaxCopyBytes), sizeof(float) * 4);
+  std::vector<uint8_t> host(copy_bytes, 1);
+
+  V_RETURN2(src_buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE, copy_bytes, nullptr, &hr), hr);
+  V_RETURN2(dst_buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE, copy_bytes, nullptr, &hr), hr);
+
+  best_ms = 1.0E30;
+  for (int i = 0; i < g_MeasureReps; ++i) {
+    V_RETURN(clEnqueueWriteBuffer(cmd_queue, src_buff, CL_TRUE, 0, copy_bytes, host.data(), 0, nullptr,
+                                  ev.ReleaseAndGetAddressOf()));
+    V_RETURN(GetEventElapsedTime(ev, &ms));
+    best_ms = std::min(best_ms, std::max(ms, 1.0E-6));
+  }
+  metrics->upload_gbps = copy_bytes / best_ms * 1.0E-6;
+
+  best_ms = 1.0E30;
+  for (int i = 0; i < g_MeasureReps; ++i) {
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, src_buff, CL_TRUE, 0, copy_bytes, host.data(), 0, nullptr,
+                                 ev.ReleaseAndGetAddressOf()));
+    V_RETURN(GetEventElapsedTime(ev, &ms));
+    best_ms = std::min(best_ms, std::max(ms, 1.0E-6));
+  }
+  metrics->download_gbps = copy_bytes / best_ms * 1.0E-6;
+
+  V_RETURN2(kernel <<= clCreateKernel(program, "copy_f4", &hr), hr);
+  V_RETURN(SetKernelArguments(kernel, &src_buff, &dst_buff));
+  V_RETURN(__time_kernel(cmd_queue, kernel, copy_bytes / (sizeof(float) * 4), nullptr, &ms));
+  metrics->global_gbps = 2.0 * copy_bytes / ms * 1.0E-6;
+
+  // Local memory.
+  V_RETURN2(out_buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE, compute_global * sizeof(float), nullptr, &hr),
+            hr);
+  V_RETURN2(kernel <<= clCreateKernel(program, "local_read", &hr), hr);
+  V_RETURN(SetKernelArguments(kernel, &out_buff, &g_LocalIters));
+  V_RETURN(__time_kernel(cmd_queue, kernel, compute_global, &local_size, &ms));
+  metrics->local_gbps = (double)compute_global * g_LocalIters * sizeof(float) * 4 / ms * 1.0E-6;
+
+  // Atomics, on the first 64 words of the same buffer.
+  V_RETURN2(kernel <<= clCreateKernel(program, "atomic_counters", &hr), hr);
+  V_RETURN(SetKernelArguments(kernel, &out_buff, &g_AtomicIters));
+  V_RETURN(__time_kernel(cmd_queue, kernel, compute_global, nullptr, &ms));
+  metrics->atomics_gops = (double)compute_global * g_AtomicIters / ms * 1.0E-6;
+
+  // Arithmetic.
+  V_RETURN(__measure_fma(context, device, cmd_queue, false, compute_global, &metrics->fp32_gflops));
+  if (caps.fp64)
+    V_RETURN(__measure_fma(context, device, cmd_queue, true, compute_global, &metrics->fp64_gflops));
+
+  // Launch latency: host time of the smallest kernel, enqueue to completion.
+  V_RETURN2(kernel <<= clCreateKernel(program, "nop", &hr), hr);
+  V_RETURN(SetKernelArguments(kernel, &out_buff));
+  best_ms = 1.0E30;
+  for (int i = 0; i < g_MeasureReps * 4; ++i) {
+    size_t global_size = 1;
+    hp_timer::time_point start = hp_timer::now();
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, &global_size, nullptr, 0, nullptr, nullptr));
+    V_RETURN(clFinish(cmd_queue));
+    best_ms = std::min(best_ms, (double)fmilliseconds_cast(hp_timer::now() - start).count());
+  }
+  metrics->launch_us = best_ms * 1.0E3;
+
+  return hr;
+}
+
+bool CLDeviceDB::Lookup(const std::string &name, const std::string &driver, CLDeviceProfile *profile) const {
+  std::lock_guard<std::mutex> lck(lock_);
+
+  for (auto &e : entries_) {
+    if (e.caps.name == name && e.caps.driver == driver) {
+      *profile = e;
+      return true;
+    }
+  }
+  return false;
+}
+
+void CLDeviceDB::Store(const CLDeviceProfile &profile) {
+  std::lock_guard<std::mutex> lck(lock_);
+
+  for (auto &e : entries_) {
+    if (e.caps.name == profile.caps.name && e.caps.driver == profile.caps.driver) {
+      e = profile;
+      return;
+    }
+  }
+  entries_.push_back(profile);
+}
+
+size_t CLDeviceDB::size() const {
+  std::lock_guard<std::mutex> lck(lock_);
+  return entries_.size();
+}
+
+CLHRESULT CLDeviceDB::Save(const char *fname) const {
+  std::lock_guard<std::mutex> lck(lock_);
+
+  FILE *fp = fopen(fname, "w");
+  if (!fp) {
+    CL_TRACE(CL_INVALID_VALUE, "Can not open device database \"%s\" for writing!\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  fprintf(fp, "{\"devices\": [\n");
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const CLDeviceCaps &c = entries_[i].caps;
+    const CLDeviceMetrics &m = entries_[i].metrics;
+
+    fprintf(fp, "  {\"device\": \"%s\", \"driver\": \"%s\",\n", __json_escape(c.name).c_str(),
+            __json_escape(c.driver).c_str());
+    fprintf(fp, "   \"caps\": {\"vendor\": \"%s\", \"version\": \"%s\", \"opencl_c_version\": \"%s\", "
+                "\"il_version\": \"%s\",\n",
+            __json_escape(c.vendor).c_str(), __json_escape(c.version).c_str(),
+            __json_escape(c.opencl_c_version).c_str(), __json_escape(c.il_version).c_str());
+    fprintf(fp, "    \"type\": %llu, \"compute_units\": %u, \"clock_mhz\": %u, \"global_mem_size\": %llu, "
+                "\"global_mem_cache_size\": %llu, \"global_mem_cacheline_size\": %u,\n",
+            (unsigned long long)c.type, c.compute_units, c.clock_mhz, (unsigned long long)c.global_mem_size,
+            (unsigned long long)c.global_mem_cache_size, c.global_mem_cacheline_size);
+    fprintf(fp, "    \"local_mem_size\": %llu, \"local_mem_sram\": %d, \"max_alloc_size\": %llu, "
+                "\"max_constant_size\": %llu, \"mem_base_addr_align\": %u,\n",
+            (unsigned long long)c.local_mem_size, (int)c.local_mem_sram, (unsigned long long)c.max_alloc_size,
+            (unsigned long long)c.max_constant_size, c.mem_base_addr_align);
+    fprintf(fp, "    \"max_work_group_size\": %zu, \"max_work_item_sizes\": [%zu, %zu, %zu], "
+                "\"preferred_vector_width_float\": %u, \"native_vector_width_float\": %u,\n",
+            c.max_work_group_size, c.max_work_item_sizes[0], c.max_work_item_sizes[1], c.max_work_item_sizes[2],
+            c.preferred_vector_width_float, c.native_vector_width_float);
+    fprintf(fp, "    \"fp64\": %d, \"host_unified_memory\": %d, \"out_of_order_queue\": %d, \"image_support\": %d},\n",
+            (int)c.fp64, (int)c.host_unified_memory, (int)c.out_of_order_queue, (int)c.image_support);
+    fprintf(fp, "   \"metrics\": {\"global_gbps\": %.3f, \"local_gbps\": %.3f, \"atomics_gops\": %.4f, "
+                "\"fp32_gflops\": %.3f, \"fp64_gflops\": %.3f,\n",
+            m.global_gbps, m.local_gbps, m.atomics_gops, m.fp32_gflops, m.fp64_gflops);
+    fprintf(fp, "    \"launch_us\": %.3f, \"upload_gbps\": %.3f, \"download_gbps\": %.3f}}%s\n", m.launch_us,
+            m.upload_gbps, m.download_gbps, i + 1 < entries_.size() ? "," : "");
+  }
+  fprintf(fp, "]}\n");
+  fclose(fp);
+
+  return CL_SUCCESS;
+}
+
+static double __json_number(const __JsonValue *obj, const char *key) {
+  const __JsonValue *v = obj ? obj->Find(key) : nullptr;
+  return v ? v->number : 0.0;
+}
+
+static std::string __json_string(const __JsonValue *obj, const char *key) {
+  const __JsonValue *v = obj ? obj->Find(key) : nullptr;
+  return v ? v->str : std::string();
+}
+
+CLHRESULT CLDeviceDB::Load(const char *fname) {
+  std::ifstream fin(fname, std::fstream::binary);
+  std::vector<CLDeviceProfile> entries;
+
+  if (!fin)
+    return CL_SUCCESS;
+
+  std::stringstream ss;
+  ss << fin.rdbuf();
+
+  __JsonValue root;
+  __JsonReader reader(ss.str());
+  const __JsonValue *items;
+
+  if (!reader.Parse(&root) || !(items = root.Find("devices")) || items->type != __JsonValue::ARRAY) {
+    CL_TRACE(CL_INVALID_VALUE, "Device database \"%s\" is malformed, ignored.\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  for (auto &item : items->items) {
+    const __JsonValue *device = item.Find("device"), *driver = item.Find("driver"), *c = item.Find("caps"),
+                      *m = item.Find("metrics");
+    if (!device || !driver || !c || !m)
+      continue;
+
+    CLDeviceProfile e = {};
+    e.caps.name = device->str;
+    e.caps.driver = driver->str;
+    e.caps.vendor = __json_string(c, "vendor");
+    e.caps.version = __json_string(c, "version");
+    e.caps.opencl_c_version = __json_string(c, "opencl_c_version");
+    e.caps.il_version = __json_string(c, "il_version");
+    e.caps.type = (cl_device_type)__json_number(c, "type");
+    e.caps.compute_units = (cl_uint)__json_number(c, "compute_units");
+    e.caps.clock_mhz = (cl_uint)__json_number(c, "clock_mhz");
+    e.caps.global_mem_size = (cl_ulong)__json_number(c, "global_mem_size");
+    e.caps.global_mem_cache_size = (cl_ulong)__json_number(c, "global_mem_cache_size");
+    e.caps.global_mem_cacheline_size = (cl_uint)__json_number(c, "global_mem_cacheline_size");
+    e.caps.local_mem_size = (cl_ulong)__json_number(c, "local_mem_size");
+    e.caps.local_mem_sram = __json_number(c, "local_mem_sram") != 0.0;
+    e.caps.max_alloc_size = (cl_ulong)__json_number(c, "max_alloc_size");
+    e.caps.max_constant_size = (cl_ulong)__json_number(c, "max_constant_size");
+    e.caps.mem_base_addr_align = (cl_uint)__json_number(c, "mem_base_addr_align");
+    e.caps.max_work_group_size = (size_t)__json_number(c, "max_work_group_size");
+    const __JsonValue *sizes = c->Find("max_work_item_sizes");
+    for (size_t i = 0; sizes && i < std::min(sizes->items.size(), (size_t)3); ++i)
+      e.caps.max_work_item_sizes[i] = (size_t)sizes->items[i].number;
+    e.caps.preferred_vector_width_float = (cl_uint)__json_number(c, "preferred_vector_width_float");
+    e.caps.native_vector_width_float = (cl_uint)__json_number(c, "native_vector_width_float");
+    e.caps.fp64 = __json_number(c, "fp64") != 0.0;
+    e.caps.host_unified_memory = __json_number(c, "host_unified_memory") != 0.0;
+    e.caps.out_of_order_queue = __json_number(c, "out_of_order_queue") != 0.0;
+    e.caps.image_support = __json_number(c, "image_support") != 0.0;
+
+    e.metrics.global_gbps = __json_number(m, "global_gbps");
+    e.metrics.local_gbps = __json_number(m, "local_gbps");
+    e.metrics.atomics_gops = __json_number(m, "atomics_gops");
+    e.metrics.fp32_gflops = __json_number(m, "fp32_gflops");
+    e.metrics.fp64_gflops = __json_number(m, "fp64_gflops");
+    e.metrics.launch_us = __json_number(m, "launch_us");
+    e.metrics.upload_gbps = __json_number(m, "upload_gbps");
+    e.metrics.download_gbps = __json_number(m, "download_gbps");
+    entries.push_back(e);
+  }
+
+  std::lock_guard<std::mutex> lck(lock_);
+  entries_ = std::move(entries);
+  return CL_SUCCESS;
+}
+
+std::string GetDeviceDBPath() {
+  const char *path = getenv("CLX_DEVICE_DB");
+  return path && *path ? path : "cl_device_db.json";
+}
+
+CLDeviceDB &GetDeviceDB() {
+  static CLDeviceDB db;
+  static std::once_flag loaded;
+  std::call_once(loaded, []() { db.Load(GetDeviceDBPath().c_str()); });
+  return db;
+}
+
+CLHRESULT GetDeviceProfile(cl_context context, cl_device_id device, CLDeviceProfile *profile, bool remeasure) {
+  CLHRESULT hr;
+  CLDeviceDB &db = GetDeviceDB();
+  CLDeviceCaps caps;
+
+  V_RETURN(QueryDeviceCaps(device, &caps));
+  if (!remeasure && db.Lookup(caps.name, caps.driver, profile)) {
+    // Fresh capabilities, cached metrics.
+    profile->caps = caps;
+    return hr;
+  }
+
+  profile->caps = caps;
+  V_RETURN(MeasureDeviceMetrics(context, device, &profile->metrics));
+  db.Store(*profile);
+  // A failed save only costs the next run a measurement.
+  db.Save(GetDeviceDBPath().c_str());
+  return hr;
+}
+
+CLHRESULT GetAllDeviceProfiles(std::vector<CLDeviceProfile> *profiles, bool remeasure) {
+  CLHRESULT hr;
+  std::vector<cl_platform_id> plat_ids;
+  std::vector<cl_device_id> devices;
+
+  profiles->clear();
+  V_RETURN(EnumOpenCLDevices(CL_DEVICE_TYPE_ALL, {}, {}, &plat_ids, &devices));
+
+  for (size_t i = 0; i < devices.size(); ++i) {
+    ycl_context context;
+    CLDeviceProfile profile;
+
+    V_RETURN(CreateDeviceContext(plat_ids[i], devices[i], &context));
+    V_RETURN(GetDeviceProfile(context, devices[i], &profile, remeasure));
+    profiles->push_back(profile);
+  }
+
+  return hr;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Device capability database: the clGetDeviceInfo record of a device plus measured rates, cached on disk so the
+ * modules that size their work from them (CLComputeBackend, chunk sizes, work-group choices) do not measure again
+ * on every start.
+ *
+ * The micro-benchmarks build their kernels from an embedded source and time them from profiling events, best of
+ * a few runs:
+ *
+ *   global_gbps    float4 buffer copy, read plus write traffic
+ *   local_gbps     float4 reads from __local memory, a full work-group tile
+ *   atomics_gops   atomic_inc on 64 global counters
+ *   fp32_gflops    8 independent fma chains per work-item, fp64_gflops the same in double (0 without fp64)
+ *   launch_us      host round trip of an empty kernel, enqueue to clFinish
+ *   upload_gbps    host to device copy of up to 64MB, download_gbps the way back
+ *
+ * The database is a JSON file, CLX_DEVICE_DB or "cl_device_db.json" under the working directory, one entry per
+ * (device name, driver version):
+ *
+ *   {"devices": [
+ *     {"device": "...", "driver": "...", "caps": {"type": 4, "compute_units": 40, ...},
+ *      "metrics": {"global_gbps": 402.1, "fp32_gflops": 9120.4, ...}}
+ *   ]}
+ */
+
+struct CLDeviceCaps {
+  std::string name;
+  std::string vendor;
+  std::string driver;
+  std::string version;           // CL_DEVICE_VERSION
+  std::string opencl_c_version;
+  std::string il_version;        // empty before OpenCL 2.1
+  cl_device_type type;
+  cl_uint compute_units;
+  cl_uint clock_mhz;
+  cl_ulong global_mem_size;
+  cl_ulong global_mem_cache_size;
+  cl_uint global_mem_cacheline_size;
+  cl_ulong local_mem_size;
+  bool local_mem_sram;           // false when __local memory is emulated in global memory
+  cl_ulong max_alloc_size;
+  cl_ulong max_constant_size;
+  cl_uint mem_base_addr_align;   // bits
+  size_t max_work_group_size;
+  size_t max_work_item_sizes[3];
+  cl_uint preferred_vector_width_float;
+  cl_uint native_vector_width_float;
+  bool fp64;
+  bool host_unified_memory;
+  bool out_of_order_queue;
+  bool image_support;
+};
+
+struct CLDeviceMetrics {
+  double global_gbps;
+  double local_gbps;
+  double atomics_gops;
+  double fp32_gflops;
+  double fp64_gflops;
+  double launch_us;
+  double upload_gbps;
+  double download_gbps;
+};
+
+struct CLDeviceProfile {
+  CLDeviceCaps caps;
+  CLDeviceMetrics metrics;
+};
+
+extern CLHRESULT QueryDeviceCaps(cl_device_id device, CLDeviceCaps *caps);
+
+/**
+ * Run every micro-benchmark on @param device, on a queue of its own in @param context.
+ */
+extern CLHRESULT MeasureDeviceMetrics(cl_context context, cl_device_id device, CLDeviceMetrics *metrics);
+
+class CLDeviceDB {
+public:
+  /** A missing file is an empty database. */
+  CLHRESULT Load(const char *fname);
+  CLHRESULT Save(const char *fname) const;
+
+  bool Lookup(const std::string &name, const std::string &driver, CLDeviceProfile *profile) const;
+  /** Replaces the entry of the same device and driver. */
+  void Store(const CLDeviceProfile &profile);
+
+  size_t size() const;
+
+private:
+  mutable std::mutex lock_;
+  std::vector<CLDeviceProfile> entries_;
+};
+
+extern std::string GetDeviceDBPath();
+
+/** Process wide database, loaded from GetDeviceDBPath() on first use. */
+extern CLDeviceDB &GetDeviceDB();
+
+/**
+ * Profile of @param device from the database, measured and saved on a miss or when @param remeasure is set.
+ * Capabilities are always queried afresh; only the metrics come from the cache.
+ */
+extern CLHRESULT GetDeviceProfile(cl_context context, cl_device_id device, CLDeviceProfile *profile,
+                                  bool remeasure = false);
+
+/**
+ * Profiles of every device of every platform, CPU devices included, in platform order.
+ */
+extern CLHRESULT GetAllDeviceProfiles(std::vector<CLDeviceProfile> *profiles, bool remeasure = false);
@@ -0,0 +1,207 @@
+#include "cl_device_group.h"
+#include <algorithm>
+#include <numeric>
+
+static CLHRESULT __estimate_device_throughput(cl_device_id device, double *estimate) {
+  CLHRESULT hr;
+  cl_uint cu_count, clock_mhz;
+
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu_count), &cu_count, nullptr));
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clock_mhz), &clock_mhz, nullptr));
+
+  // Only a starting point until the first measurement comes in.
+  *estimate = std::max(1.0, (double)cu_count * (double)std::max(clock_mhz, 1u));
+  return hr;
+}
+
+static CLHRESULT __append_member(cl_platform_id plat_id, cl_context context, cl_device_id device,
+                                 CLDeviceGroup *group) {
+  CLHRESULT hr;
+  CLDeviceGroupMember member;
+
+  member.platform = plat_id;
+  member.context = context;
+  member.device = device;
+  V_RETURN(CreateCommandQueue(context, device, &member.cmd_queue));
+  V_RETURN(__estimate_device_throughput(device, &member.estimate));
+  member.throughput = 0.0;
+  member.samples = 0;
+
+  group->members.push_back(std::move(member));
+  return hr;
+}
+
+CLHRESULT CreateDeviceGroupFromDevices(cl_platform_id plat_id,
+                                       const cl_device_id *devices,
+                                       cl_uint num_devices,
+                                       CLDeviceGroup *group) {
+  CLHRESULT hr;
+  ycl_context context;
+
+  cl_context_properties ctx_props[] = {CL_CONTEXT_PLATFORM, (cl_context_properties)plat_id, 0};
+  V_RETURN2(context <<= clCreateContext(ctx_props, num_devices, devices, nullptr, nullptr, &hr), hr);
+
+  for (cl_uint i = 0; i < num_devices; ++i)
+    V_RETURN(__append_member(plat_id, context, devices[i], group));
+
+  return hr;
+}
+
+CLHRESULT CreateDeviceGroup(cl_device_type dev_type,
+                            std::initializer_list<const char *> preferred_plats,
+                            std::initializer_list<const char *> req_extensions,
+                            CLDeviceGroup *group) {
+  CLHRESULT hr;
+  std::vector<cl_platform_id> plat_ids;
+  std::vector<cl_device_id> devices;
+
+  group->members.clear();
+
+  // No matching device is not a failure of the enumeration, the caller falls back to another group quietly.
+  hr = EnumOpenCLDevices(dev_type, preferred_plats, req_extensions, &plat_ids, &devices);
+  if (hr == CL_DEVICE_NOT_FOUND)
+    return hr;
+  V_RETURN(hr);
+
+  // EnumOpenCLDevices yields devices grouped by platform, so each run shares one context.
+  for (size_t i = 0, j; i < devices.size(); i = j) {
+    for (j = i + 1; j < devices.size() && plat_ids[j] == plat_ids[i]; ++j);
+    V_RETURN(CreateDeviceGroupFromDevices(plat_ids[i], devices.data() + i, (cl_uint)(j - i), group));
+  }
+
+  return hr;
+}
+
+CLHRESULT CreateSubDeviceGroup(cl_platform_id plat_id,
+                               cl_device_id parent_device,
+                               cl_uint num_sub_devices,
+                               CLDeviceGroup *group) {
+  CLHRESULT hr;
+  cl_uint cu_count;
+  cl_uint max_sub_devices;
+  cl_uint num_created;
+
+  group->members.clear();
+
+  V_RETURN(clGetDeviceInfo(parent_device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu_count), &cu_count, nullptr));
+  V_RETURN(clGetDeviceInfo(parent_device, CL_DEVICE_PARTITION_MAX_SUB_DEVICES, sizeof(max_sub_devices),
+                           &max_sub_devices, nullptr));
+
+  num_sub_devices = std::min(num_sub_devices, max_sub_devices);
+  if (num_sub_devices < 1) {
+    hr = CL_DEVICE_PARTITION_FAILED;
+    CL_TRACE(hr, "Device can not be partitioned!\n");
+    return hr;
+  }
+
+  const cl_device_partition_property props[] = {
+    CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)std::max(cu_count / num_sub_devices, 1u), 0
+  };
+
+  V_RETURN(clCreateSubDevices(parent_device, props, 0, nullptr, &num_created));
+
+  std::vector<cl_device_id> sub_devices(num_created);
+  V_RETURN(clCreateSubDevices(parent_device, props, num_created, sub_devices.data(), nullptr));
+
+  // The group owns the sub-devices from here on, drop the ones we don't use.
+  num_sub_devices = std::min(num_sub_devices, num_created);
+  for (cl_uint i = num_sub_devices; i < num_created; ++i)
+    clReleaseDevice(sub_devices[i]);
+
+  hr = CreateDeviceGroupFromDevices(plat_id, sub_devices.data(), num_sub_devices, group);
+
+  for (cl_uint i = 0; i < num_sub_devices; ++i)
+    clReleaseDevice(sub_devices[i]);
+
+  return hr;
+}
+
+void PartitionNDRange(const CLDeviceGroup &group,
+                      cl_uint work_dim,
+                      const size_t *global_size,
+                      const size_t *granularity,
+                      std::vector<CLNDRangePartition> *partitions) {
+
+  RT_ASSERT(work_dim == 1 || work_dim == 2);
+
+  const size_t split_dim = work_dim - 1;
+  const size_t grain = granularity && granularity[split_dim] ? granularity[split_dim] : 1;
+  const size_t total_units = (global_size[split_dim] + grain - 1) / grain;
+  const size_t nmembers = group.members.size();
+
+  partitions->resize(nmembers);
+  if (nmembers == 0)
+    return;
+
+  // Estimates and measurements have different units, bring the estimates onto the measured scale.
+  double scale = 0.0;
+  size_t nmeasured = 0;
+  for (auto &m : group.members) {
+    if (m.samples) {
+      scale += m.throughput / m.estimate;
+      ++nmeasured;
+    }
+  }
+  scale = nmeasured ? scale / nmeasured : 1.0;
+
+  std::vector<double> weights(nmembers);
+  double total_throughput = 0.0;
+  for (size_t i = 0; i < nmembers; ++i) {
+    const CLDeviceGroupMember &m = group.members[i];
+    weights[i] = m.samples ? m.throughput : m.estimate * scale;
+    total_throughput += weights[i];
+  }
+
+  // Largest remainder method, so the shares always add up to total_units.
+  std::vector<size_t> units(nmembers);
+  std::vector<std::pair<double, size_t>> remainders(nmembers);
+  size_t assigned = 0;
+
+  for (size_t i = 0; i < nmembers; ++i) {
+    double share = total_units * (weights[i] / total_throughput);
+    units[i] = (size_t)share;
+    remainders[i] = {share - (double)units[i], i};
+    assigned += units[i];
+  }
+
+  std::sort(remainders.begin(), remainders.end(), [](auto &a, auto &b) { return a.first > b.first; });
+  for (size_t i = 0; assigned < total_units; ++i, ++assigned)
+    units[remainders[i % nmembers].second] += 1;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < nmembers; ++i) {
+    CLNDRangePartition &part = (*partitions)[i];
+
+    part.offset[0] = part.offset[1] = 0;
+    part.size[0] = global_size[0];
+    part.size[1] = work_dim > 1 ? global_size[1] : 1;
+
+    part.offset[split_dim] = std::min(offset * grain, global_size[split_dim]);
+    part.size[split_dim] = std::min((offset + units[i]) * grain, global_size[split_dim]) - part.offset[split_dim];
+    offset += units[i];
+  }
+}
+
+void UpdateDeviceThroughput(CLDeviceGroup *group, size_t member, size_t work_items, double elapsed_ms) {
+
+  const double smoothing = 0.5;
+
+  if (work_items == 0 || elapsed_ms <= 0.0)
+    return;
+
+  CLDeviceGroupMember &m = group->members[member];
+  double measured = (double)work_items / elapsed_ms;
+  m.throughput = m.samples ? m.throughput * (1.0 - smoothing) + measured * smoothing : measured;
+  m.samples += 1;
+}
+
+CLHRESULT UpdateDeviceThroughputFromEvent(CLDeviceGroup *group, size_t member, size_t work_items, cl_event ev) {
+  CLHRESULT hr;
+  cl_ulong start, end;
+
+  V_RETURN(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr));
+  V_RETURN(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr));
+
+  UpdateDeviceThroughput(group, member, work_items, (end - start) * 1.0E-6);
+  return hr;
+}
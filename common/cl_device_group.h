@@ -0,0 +1,87 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <vector>
+
+/**
+ * A set of devices driven together, one in-order profiling queue per device.
+ *
+ * An OpenCL context can not span platforms, so members on the same platform share one context and members
+ * on different platforms get their own. Memory objects are per context: allocate them per member (or per
+ * distinct member context) and split the work with PartitionNDRange.
+ */
+struct CLDeviceGroupMember {
+  cl_platform_id platform;
+  ycl_context context;
+  ycl_device_id device;
+  ycl_command_queue cmd_queue;
+  double estimate;    // compute units x clock, only used until the member has been measured
+  double throughput;  // measured work-items per ms
+  cl_uint samples;    // number of measurements folded into throughput
+};
+
+struct CLDeviceGroup {
+  std::vector<CLDeviceGroupMember> members;
+
+  size_t size() const { return members.size(); }
+  CLDeviceGroupMember &operator[](size_t i) { return members[i]; }
+  const CLDeviceGroupMember &operator[](size_t i) const { return members[i]; }
+};
+
+/**
+ * Sub range of an NDRange assigned to one group member, dimensions beyond work_dim are 0 offset, 1 size.
+ */
+struct CLNDRangePartition {
+  size_t offset[2];
+  size_t size[2];
+};
+
+/**
+ * Create a group of every device matching @param dev_type across all the (preferred) platforms.
+ * @return CL_DEVICE_NOT_FOUND, without tracing, when no device matches.
+ */
+extern CLHRESULT CreateDeviceGroup(cl_device_type dev_type,
+                                   std::initializer_list<const char *> preferred_plats,
+                                   std::initializer_list<const char *> req_extensions,
+                                   CLDeviceGroup *group);
+
+/**
+ * Create a group from explicit devices, all of them must belong to @param plat_id.
+ */
+extern CLHRESULT CreateDeviceGroupFromDevices(cl_platform_id plat_id,
+                                              const cl_device_id *devices,
+                                              cl_uint num_devices,
+                                              CLDeviceGroup *group);
+
+/**
+ * Partition @param parent_device equally into @param num_sub_devices sub-devices (CL_DEVICE_PARTITION_EQUALLY)
+ * and create a group of them. This lets a CPU-only host exercise the multi-device paths.
+ */
+extern CLHRESULT CreateSubDeviceGroup(cl_platform_id plat_id,
+                                      cl_device_id parent_device,
+                                      cl_uint num_sub_devices,
+                                      CLDeviceGroup *group);
+
+/**
+ * Split a 1D/2D NDRange across the group proportionally to each member's throughput. Members not measured yet
+ * are weighted by their estimate, scaled to the measured members when there are any. The split runs along
+ * the slowest varying dimension (dimension 0 for 1D, dimension 1 for 2D) in multiples of
+ * @param granularity (usually the local size of that dimension, 1 when nullptr). Members may receive an empty
+ * partition (size 0) when the range is too small, callers must skip them.
+ */
+extern void PartitionNDRange(const CLDeviceGroup &group,
+                             cl_uint work_dim,
+                             const size_t *global_size,
+                             const size_t *granularity,
+                             std::vector<CLNDRangePartition> *partitions);
+
+/**
+ * Fold a measured run of @param work_items in @param elapsed_ms into the member's throughput
+ * (exponential moving average, so one noisy run doesn't swing the next split).
+ */
+extern void UpdateDeviceThroughput(CLDeviceGroup *group, size_t member, size_t work_items, double elapsed_ms);
+
+/**
+ * Same as UpdateDeviceThroughput, the elapsed time is read from the START/END profiling info of @param ev.
+ */
+extern CLHRESULT UpdateDeviceThroughputFromEvent(CLDeviceGroup *group, size_t member, size_t work_items, cl_event ev);
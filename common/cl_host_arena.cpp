@@ -0,0 +1,224 @@
+#include "cl_host_arena.h"
+#include "cl_host_buffer.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+static bool __enable_lock_memory_privilege() {
+  static bool enabled = false;
+  static std::once_flag once;
+
+  std::call_once(once, []() {
+    HANDLE token;
+    TOKEN_PRIVILEGES tp;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+      return;
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    // AdjustTokenPrivileges succeeds without assigning a privilege the account does not hold, check the last error
+    enabled = LookupPrivilegeValueW(nullptr, L"SeLockMemoryPrivilege", &tp.Privileges[0].Luid) &&
+              AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, 0) && GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+  });
+  return enabled;
+}
+
+void *AllocLargePages(size_t size, size_t *page_size, CLPageKind kind, CLPageKind *obtained) {
+  size_t large_page = GetLargePageMinimum();
+  SYSTEM_INFO info;
+  void *ptr = nullptr;
+
+  if (kind == CLPageKind::HUGE_TLB && large_page && size >= large_page && __enable_lock_memory_privilege()) {
+    ptr = VirtualAlloc(nullptr, RoundC(size, large_page), MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES,
+                       PAGE_READWRITE);
+    if (ptr && page_size)
+      *page_size = large_page;
+    if (ptr && obtained)
+      *obtained = CLPageKind::HUGE_TLB;
+  }
+  if (!ptr) {
+    GetSystemInfo(&info);
+    ptr = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (page_size)
+      *page_size = info.dwPageSize;
+    if (obtained)
+      *obtained = CLPageKind::BASE;
+  }
+  return ptr;
+}
+
+void FreeLargePages(void *ptr, size_t) {
+  if (ptr)
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+#else
+
+/** Default huge page size from /proc/meminfo, 2MB when it cannot be read. */
+static size_t __huge_page_size() {
+  static size_t huge_page = 0;
+  static std::once_flag once;
+
+  std::call_once(once, []() {
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[128];
+    unsigned long kb;
+
+    huge_page = (size_t)2 << 20;
+    if (!fp)
+      return;
+    while (fgets(line, sizeof(line), fp)) {
+      if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+        huge_page = (size_t)kb << 10;
+        break;
+      }
+    }
+    fclose(fp);
+  });
+  return huge_page;
+}
+
+/**
+ * Both paths map a multiple of the huge page size at a huge page aligned address, so FreeLargePages unmaps the
+ * same length whichever one succeeded, and a THP backed region has no partial huge page at either end.
+ */
+void *AllocLargePages(size_t size, size_t *page_size, CLPageKind kind, CLPageKind *obtained) {
+  size_t huge_page = __huge_page_size();
+  size_t length = RoundC(std::max(size, (size_t)1), huge_page);
+  void *ptr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  if (kind == CLPageKind::HUGE_TLB) {
+    ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      if (page_size)
+        *page_size = huge_page;
+      if (obtained)
+        *obtained = CLPageKind::HUGE_TLB;
+      return ptr;
+    }
+  }
+#endif
+
+  // THP or 4K asked for, or the hugetlbfs pool empty or not configured: over-map by one huge page and trim both
+  // ends to align
+  char *base = (char *)mmap(nullptr, length + huge_page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return nullptr;
+
+  char *aligned = (char *)RoundC((uintptr_t)base, (uintptr_t)huge_page);
+  if (aligned > base)
+    munmap(base, aligned - base);
+  if (base + huge_page > aligned)
+    munmap(aligned + length, base + huge_page - aligned);
+
+  CLPageKind got = CLPageKind::BASE;
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+  // madvise fails when THP is compiled out; "never" in /sys/kernel/mm/transparent_hugepage/enabled is not seen
+  // from here
+  if (kind != CLPageKind::BASE && madvise(aligned, length, MADV_HUGEPAGE) == 0)
+    got = CLPageKind::TRANSPARENT_HUGE;
+  else
+    madvise(aligned, length, MADV_NOHUGEPAGE);
+#endif
+  if (page_size)
+    *page_size = (size_t)sysconf(_SC_PAGESIZE);
+  if (obtained)
+    *obtained = got;
+  return aligned;
+}
+
+void FreeLargePages(void *ptr, size_t size) {
+  if (ptr)
+    munmap(ptr, RoundC(std::max(size, (size_t)1), __huge_page_size()));
+}
+
+#endif /** _WIN32 */
+
+CLHostArena::CLHostArena(size_t block_size, bool large_pages)
+    : block_size_(block_size), large_pages_(large_pages), current_(0), offset_(0), peak_(0) {}
+
+CLHostArena::~CLHostArena() { Release(); }
+
+void *CLHostArena::Allocate(size_t size, size_t alignment) {
+  RT_ASSERT(alignment && (alignment & (alignment - 1)) == 0 && "alignment must be pow of 2");
+
+  // place in the current block, then in the first later block that fits, then in a new block
+  for (size_t i = current_; i < blocks_.size(); ++i) {
+    Block &block = blocks_[i];
+    size_t start = i == current_ ? offset_ : 0;
+    uintptr_t addr = RoundC((uintptr_t)block.base + start, (uintptr_t)alignment);
+    size_t end = (size_t)(addr - (uintptr_t)block.base) + size;
+
+    if (end <= block.size) {
+      current_ = i;
+      offset_ = end;
+      peak_ = std::max(peak_, BytesInUse());
+      return (void *)addr;
+    }
+  }
+
+  // blocks are page aligned, the padding only matters for alignments above a page
+  Block block;
+  block.size = std::max(block_size_, size + (alignment > 4096 ? alignment : 0));
+  block.large_pages = large_pages_;
+  block.base = (char *)(large_pages_ ? AllocLargePages(block.size) : AllocPageAligned(block.size));
+  if (!block.base)
+    return nullptr;
+
+  blocks_.push_back(block);
+  current_ = blocks_.size() - 1;
+  offset_ = 0;
+  return Allocate(size, alignment);
+}
+
+void CLHostArena::Rewind(const Mark &mark) {
+  RT_ASSERT((mark.block < current_ || (mark.block == current_ && mark.offset <= offset_)) &&
+            "rewind to a mark ahead of the arena");
+  current_ = mark.block;
+  offset_ = mark.offset;
+}
+
+void CLHostArena::Release() {
+  for (auto &block : blocks_) {
+    if (block.large_pages)
+      FreeLargePages(block.base, block.size);
+    else
+      FreePageAligned(block.base);
+  }
+  blocks_.clear();
+  current_ = 0;
+  offset_ = 0;
+}
+
+size_t CLHostArena::BytesInUse() const {
+  size_t bytes = offset_;
+
+  for (size_t i = 0; i < current_ && i < blocks_.size(); ++i)
+    bytes += blocks_[i].size;
+  return bytes;
+}
+
+size_t CLHostArena::BytesReserved() const {
+  size_t bytes = 0;
+
+  for (auto &block : blocks_)
+    bytes += block.size;
+  return bytes;
+}
+
+CLHostArena &GetThreadArena() {
+  thread_local CLHostArena arena(CLHostArena::DEFAULT_BLOCK_SIZE, true);
+  return arena;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Page backing of AllocLargePages:
+ *   BASE:              the system page, THP explicitly disabled on Linux
+ *   TRANSPARENT_HUGE:  ordinary mapping advised with MADV_HUGEPAGE, promoted by the kernel (Linux only)
+ *   HUGE_TLB:          MEM_LARGE_PAGES on Windows (needs SeLockMemoryPrivilege), MAP_HUGETLB on Linux
+ */
+enum class CLPageKind { BASE, TRANSPARENT_HUGE, HUGE_TLB };
+
+/**
+ * Host memory backed by large pages where the system grants them, falling back HUGE_TLB -> TRANSPARENT_HUGE ->
+ * BASE from @param kind when the system refuses (Windows has no THP and goes straight to BASE). Always returns
+ * page aligned memory unless the system is out of memory.
+ *
+ * @param page_size receives the page size actually obtained, the base page size on the fallbacks (a THP backed
+ *   region still reports the base page, whether khugepaged promotes it is up to the kernel).
+ * @param obtained receives the backing actually requested from the system.
+ */
+extern void *AllocLargePages(size_t size, size_t *page_size = nullptr, CLPageKind kind = CLPageKind::HUGE_TLB,
+                             CLPageKind *obtained = nullptr);
+extern void FreeLargePages(void *ptr, size_t size);
+
+/**
+ * Bump allocator for host scratch memory: solver temporaries, generator work arrays, result vectors of the
+ * CPU references. Allocate moves a pointer, nothing is freed one by one; Rewind (or a CLHostArenaScope) takes
+ * everything back to an earlier mark and the blocks stay around for the next call, so a hot loop stops going
+ * through the heap.
+ *
+ *   CLHostArena &arena = GetThreadArena();
+ *   CLHostArenaScope scope(arena);
+ *   double *tmp = arena.Allocate<double>(n * 2);
+ *   ...                                          // memory goes back to the arena with scope
+ *
+ * Blocks are block_size bytes, or as large as a request that does not fit; with large_pages they come from
+ * AllocLargePages. Not thread safe, one arena per thread (GetThreadArena) is the intended use on long-lived
+ * threads; ParallelFor ranges take slices carved out of the caller's arena instead, their worker changes per call.
+ */
+class CLHostArena {
+public:
+  struct Mark {
+    size_t block;
+    size_t offset;
+  };
+
+  static const size_t DEFAULT_BLOCK_SIZE = (size_t)4 << 20;
+  static const size_t DEFAULT_ALIGNMENT = 64;
+
+  explicit CLHostArena(size_t block_size = DEFAULT_BLOCK_SIZE, bool large_pages = false);
+  ~CLHostArena();
+
+  CLHostArena(const CLHostArena &) = delete;
+  CLHostArena &operator=(const CLHostArena &) = delete;
+
+  /** @param alignment must be a power of two. Never returns nullptr unless out of memory. */
+  void *Allocate(size_t size, size_t alignment = DEFAULT_ALIGNMENT);
+
+  /** Uninitialized storage of @param count T. */
+  template <typename T> T *Allocate(size_t count, size_t alignment = DEFAULT_ALIGNMENT) {
+    return static_cast<T *>(Allocate(count * sizeof(T), alignment < alignof(T) ? alignof(T) : alignment));
+  }
+
+  Mark GetMark() const { return {current_, offset_}; }
+  void Rewind(const Mark &mark);
+  /** Rewind to empty, the blocks are kept. */
+  void Reset() { Rewind({0, 0}); }
+  /** Give every block back to the system. */
+  void Release();
+
+  size_t BytesInUse() const;
+  size_t BytesReserved() const;
+  size_t PeakBytesInUse() const { return peak_; }
+
+private:
+  struct Block {
+    char *base;
+    size_t size;
+    bool large_pages;
+  };
+
+  size_t block_size_;
+  bool large_pages_;
+  std::vector<Block> blocks_;
+  size_t current_;  // block being bumped
+  size_t offset_;   // bytes used in blocks_[current_]
+  size_t peak_;
+};
+
+/**
+ * Rewinds @param arena to where it was at construction.
+ */
+class CLHostArenaScope {
+public:
+  explicit CLHostArenaScope(CLHostArena &arena) : arena_(arena), mark_(arena.GetMark()) {}
+  ~CLHostArenaScope() { arena_.Rewind(mark_); }
+
+  CLHostArenaScope(const CLHostArenaScope &) = delete;
+  CLHostArenaScope &operator=(const CLHostArenaScope &) = delete;
+
+private:
+  CLHostArena &arena_;
+  CLHostArena::Mark mark_;
+};
+
+/**
+ * Arena of the calling thread, created on first use with the default block size on large pages.
+ */
+extern CLHostArena &GetThreadArena();
@@ -0,0 +1,140 @@
+#include "cl_host_buffer.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static const size_t g_PageSize = 4096;
+
+const char *GetHostMemModeName(CLHostMemMode mode) {
+  switch (mode) {
+  case CLHostMemMode::COPY:
+    return "copy";
+  case CLHostMemMode::ALLOC_HOST_PTR:
+    return "alloc_host_ptr";
+  case CLHostMemMode::USE_HOST_PTR:
+    return "use_host_ptr";
+  }
+  return "unknown";
+}
+
+bool ParseHostMemMode(const char *name, CLHostMemMode *mode) {
+  for (CLHostMemMode m : {CLHostMemMode::COPY, CLHostMemMode::ALLOC_HOST_PTR, CLHostMemMode::USE_HOST_PTR}) {
+    if (strcmp(name, GetHostMemModeName(m)) == 0) {
+      *mode = m;
+      return true;
+    }
+  }
+  return false;
+}
+
+void *AllocPageAligned(size_t size) {
+  size = RoundC(std::max(size, (size_t)1), g_PageSize);
+#ifdef _WIN32
+  return _aligned_malloc(size, g_PageSize);
+#else
+  return aligned_alloc(g_PageSize, size);
+#endif
+}
+
+void FreePageAligned(void *ptr) {
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+CLHostBuffer::CLHostBuffer()
+    : handle_(nullptr), host_storage_(nullptr), mapped_(nullptr), map_flags_(0), size_(0),
+      mode_(CLHostMemMode::COPY) {}
+
+CLHostBuffer::~CLHostBuffer() { Release(); }
+
+void CLHostBuffer::Release() {
+  RT_ASSERT(!mapped_ || mode_ == CLHostMemMode::COPY);
+
+  mem_ = nullptr;
+  handle_ = nullptr;
+  if (host_storage_)
+    FreePageAligned(host_storage_);
+  host_storage_ = nullptr;
+  mapped_ = nullptr;
+  size_ = 0;
+}
+
+CLHRESULT CLHostBuffer::Create(cl_context context, cl_mem_flags flags, size_t size, CLHostMemMode mode) {
+  CLHRESULT hr;
+  void *host_ptr = nullptr;
+
+  Release();
+
+  switch (mode) {
+  case CLHostMemMode::COPY:
+    host_storage_ = AllocPageAligned(size);
+    break;
+  case CLHostMemMode::ALLOC_HOST_PTR:
+    flags |= CL_MEM_ALLOC_HOST_PTR;
+    break;
+  case CLHostMemMode::USE_HOST_PTR:
+    host_storage_ = AllocPageAligned(size);
+    host_ptr = host_storage_;
+    flags |= CL_MEM_USE_HOST_PTR;
+    break;
+  }
+
+  if (mode != CLHostMemMode::ALLOC_HOST_PTR && !host_storage_) {
+    CL_TRACE(CL_OUT_OF_HOST_MEMORY, "Can not allocate %zu bytes of page aligned host memory!\n", size);
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+
+  // USE_HOST_PTR: a size multiple of 64 keeps the zero copy path on the drivers that require it.
+  size_t buffer_size = mode == CLHostMemMode::USE_HOST_PTR ? RoundC(size, 64) : size;
+  V_RETURN2(mem_ <<= clCreateBuffer(context, flags, buffer_size, host_ptr, &hr), hr);
+
+  handle_ = mem_;
+  size_ = size;
+  mode_ = mode;
+  return hr;
+}
+
+CLHRESULT CLHostBuffer::Map(cl_command_queue cmd_queue, cl_map_flags map_flags, void **ptr) {
+  CLHRESULT hr = CL_SUCCESS;
+
+  RT_ASSERT(!mapped_ && "CLHostBuffer is already mapped");
+
+  if (mode_ == CLHostMemMode::COPY) {
+    if (map_flags & CL_MAP_READ)
+      V_RETURN(clEnqueueReadBuffer(cmd_queue, mem_, CL_TRUE, 0, size_, host_storage_, 0, nullptr, nullptr));
+    mapped_ = host_storage_;
+  } else {
+    V_RETURN2(mapped_ = clEnqueueMapBuffer(cmd_queue, mem_, CL_TRUE, map_flags, 0, size_, 0, nullptr, nullptr, &hr),
+              hr);
+  }
+
+  map_flags_ = map_flags;
+  *ptr = mapped_;
+  return hr;
+}
+
+CLHRESULT CLHostBuffer::Unmap(cl_command_queue cmd_queue, cl_event *event) {
+  CLHRESULT hr = CL_SUCCESS;
+
+  RT_ASSERT(mapped_ && "CLHostBuffer is not mapped");
+
+  if (mode_ == CLHostMemMode::COPY) {
+    if (map_flags_ & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION)) {
+      V_RETURN(clEnqueueWriteBuffer(cmd_queue, mem_, CL_FALSE, 0, size_, host_storage_, 0, nullptr, event));
+    } else if (event) {
+      V_RETURN(clEnqueueMarkerWithWaitList(cmd_queue, 0, nullptr, event));
+    }
+  } else {
+    V_RETURN(clEnqueueUnmapMemObject(cmd_queue, mem_, mapped_, 0, nullptr, event));
+  }
+
+  mapped_ = nullptr;
+  map_flags_ = 0;
+  return hr;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "cl_utils.h"
+
+/**
+ * How a CLHostBuffer backs its host view.
+ *
+ * COPY: device buffer plus a page aligned host staging copy, transferred with clEnqueueRead/WriteBuffer on
+ *   Map/Unmap. The classic path, one extra copy on devices sharing host memory.
+ * ALLOC_HOST_PTR: the driver allocates host visible (pinned) memory, Map/Unmap hand it out without a copy on
+ *   integrated and CPU devices and DMA from pinned memory on discrete ones.
+ * USE_HOST_PTR: page aligned host storage of our own wrapped by the buffer, zero copy where the driver accepts
+ *   the alignment (4096 bytes, size a multiple of 64).
+ */
+enum class CLHostMemMode { COPY, ALLOC_HOST_PTR, USE_HOST_PTR };
+
+extern const char *GetHostMemModeName(CLHostMemMode mode);
+
+/** "copy", "alloc_host_ptr" or "use_host_ptr". @return false on an unknown name. */
+extern bool ParseHostMemMode(const char *name, CLHostMemMode *mode);
+
+extern void *AllocPageAligned(size_t size);
+extern void FreePageAligned(void *ptr);
+
+/**
+ * Device buffer with a host view reached through Map/Unmap only, so the same sample code runs in copy or
+ * zero-copy mode.
+ *
+ *   buff.Map(cmd_queue, CL_MAP_WRITE_INVALIDATE_REGION, &ptr);  fill ptr;  buff.Unmap(cmd_queue);
+ *   ... kernels ...
+ *   buff.Map(cmd_queue, CL_MAP_READ, &ptr);  read ptr;  buff.Unmap(cmd_queue);
+ *
+ * Map is blocking. In copy mode a map without CL_MAP_READ returns the staging memory as the host last left it,
+ * and Unmap uploads it when the map had write access.
+ */
+class CLHostBuffer {
+public:
+  CLHostBuffer();
+  ~CLHostBuffer();
+
+  CLHostBuffer(const CLHostBuffer &) = delete;
+  CLHostBuffer &operator=(const CLHostBuffer &) = delete;
+
+  /**
+   * @param flags device access and host access flags, host pointer flags are added by @param mode.
+   */
+  CLHRESULT Create(cl_context context, cl_mem_flags flags, size_t size, CLHostMemMode mode);
+
+  CLHRESULT Map(cl_command_queue cmd_queue, cl_map_flags map_flags, void **ptr);
+
+  /** @param event completes once the device sees the host writes. */
+  CLHRESULT Unmap(cl_command_queue cmd_queue, cl_event *event = nullptr);
+
+  /** Host view while mapped, nullptr otherwise. */
+  void *Data() const { return mapped_; }
+
+  size_t Size() const { return size_; }
+  CLHostMemMode Mode() const { return mode_; }
+
+  operator cl_mem() const { return mem_; }
+  /** For SetKernelArguments, which takes the address of every argument. */
+  cl_mem const *GetAddressOf() const { return &handle_; }
+
+private:
+  void Release();
+
+  ycl_mem mem_;
+  cl_mem handle_;
+  void *host_storage_;
+  void *mapped_;
+  cl_map_flags map_flags_;
+  size_t size_;
+  CLHostMemMode mode_;
+};
@@ -0,0 +1,114 @@
+#include "cl_il_library.h"
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+const char *GetILPrecisionName(CLILPrecision precision) { return GetPrecisionName(precision); }
+
+CLHRESULT LoadILManifest(const char *fname, std::vector<CLILVariant> *variants) {
+  std::ifstream fin(fname);
+  std::string line;
+  fs::path base = fs::path(fname).parent_path();
+
+  variants->clear();
+  if (!fin) {
+    CL_TRACE(CL_INVALID_VALUE, "Can not open SPIR-V manifest \"%s\"!\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  for (int lineno = 1; std::getline(fin, line); ++lineno) {
+    std::istringstream sin(line);
+    std::string file, precision;
+    CLILVariant variant;
+
+    if (line.empty() || line[0] == '#' || line[0] == '\r')
+      continue;
+
+    if (!(sin >> file >> precision >> variant.tile) || !ParsePrecision(precision.c_str(), &variant.precision)) {
+      CL_TRACE(CL_INVALID_VALUE, "Malformed SPIR-V manifest \"%s\", line %d!\n", fname, lineno);
+      variants->clear();
+      return CL_INVALID_VALUE;
+    }
+
+    variant.file = (base / file).string();
+    variants->push_back(std::move(variant));
+  }
+
+  return CL_SUCCESS;
+}
+
+CLHRESULT SelectILVariant(cl_device_id device,
+                          const std::vector<CLILVariant> &variants,
+                          CLILPrecision precision,
+                          cl_uint tile,
+                          const CLILVariant **variant) {
+  CLHRESULT hr;
+  char il_version[256] = {};
+  cl_device_fp_config fp64_config = 0;
+  size_t max_group_size;
+  size_t max_item_sizes[3];
+
+  *variant = nullptr;
+
+  // Devices before OpenCL 2.1 do not know the query at all.
+  if (CL_FAILED(clGetDeviceInfo(device, CL_DEVICE_IL_VERSION, sizeof(il_version) - 1, il_version, nullptr)) ||
+      strstr(il_version, "SPIR-V") == nullptr) {
+    CL_TRACE(CL_INVALID_DEVICE, "The device does not take SPIR-V modules!\n");
+    return CL_INVALID_DEVICE;
+  }
+
+  if (precision == CLILPrecision::FP64)
+    V_RETURN(clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64_config), &fp64_config, nullptr));
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, nullptr));
+  V_RETURN(
+      clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_item_sizes), max_item_sizes, nullptr));
+
+  for (auto &v : variants) {
+    if (v.precision != precision || (precision == CLILPrecision::FP64 && fp64_config == 0))
+      continue;
+    if (tile && v.tile != tile)
+      continue;
+    if (v.tile && ((size_t)v.tile * v.tile > max_group_size || v.tile > max_item_sizes[0] ||
+                   v.tile > max_item_sizes[1]))
+      continue;
+    if (*variant == nullptr || v.tile > (*variant)->tile)
+      *variant = &v;
+  }
+
+  if (*variant == nullptr) {
+    CL_TRACE(CL_INVALID_DEVICE, "No %s SPIR-V variant (tile %u) runs on the device!\n", GetILPrecisionName(precision),
+             tile);
+    return CL_INVALID_DEVICE;
+  }
+
+  return hr;
+}
+
+CLHRESULT CreateProgramFromILManifest(cl_context context,
+                                      cl_device_id device,
+                                      const char *fname,
+                                      CLILPrecision precision,
+                                      cl_uint tile,
+                                      cl_program *program,
+                                      CLILVariant *variant) {
+  CLHRESULT hr;
+  std::vector<CLILVariant> variants;
+  const CLILVariant *selected;
+
+  hr = LoadILManifest(fname, &variants);
+  if (CL_FAILED(hr))
+    return hr;
+
+  // No V_RETURN: a device without a fitting variant is an expected outcome the caller falls back from.
+  hr = SelectILVariant(device, variants, precision, tile, &selected);
+  if (CL_FAILED(hr))
+    return hr;
+
+  V_RETURN(CreateProgramFromILFile(context, device, selected->file.c_str(), program));
+  if (variant)
+    *variant = *selected;
+  return hr;
+}
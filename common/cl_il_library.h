@@ -0,0 +1,59 @@
+#pragma once
+
+#include "cl_utils.h"
+#include "cl_precision.h"
+#include <string>
+#include <vector>
+
+/**
+ * Pre-specialised SPIR-V modules built by clang_oclxx_to_spirv_variants (cmake/BuildUtilities.cmake), one per
+ * precision and tile size, and the manifest listing them:
+ *
+ *   # <spirv module> <precision> <tile size, 0 when not specialised>
+ *   fp64_t16/matrix.spv fp64 16
+ *
+ * Module paths are relative to the manifest. CreateProgramFromILManifest() picks the variant the device can run
+ * and builds it with CreateProgramFromIL, whose device binary goes through the program binary cache, so a second
+ * run skips the SPIR-V translation altogether.
+ */
+
+/** fp32, fp64, and the half-width storage formats fp16 and bf16 (see cl_precision.h). */
+using CLILPrecision = CLPrecision;
+
+struct CLILVariant {
+  std::string file;  // resolved against the manifest directory
+  CLILPrecision precision;
+  cl_uint tile;      // work-group tile edge the module was compiled for, 0 when not specialised
+};
+
+extern const char *GetILPrecisionName(CLILPrecision precision);
+
+/**
+ * @return CL_INVALID_VALUE when the manifest is missing or malformed.
+ */
+extern CLHRESULT LoadILManifest(const char *fname, std::vector<CLILVariant> *variants);
+
+/**
+ * Pick the variant of @param precision for @param device: fp64 needs CL_DEVICE_DOUBLE_FP_CONFIG, and a tile
+ * must fit a work-group (tile * tile work items) and the work-item sizes. @param tile selects that tile size
+ * exactly; 0 takes the largest one that fits.
+ *
+ * @return CL_INVALID_DEVICE when the device does not take SPIR-V or runs none of the variants.
+ */
+extern CLHRESULT SelectILVariant(cl_device_id device,
+                                 const std::vector<CLILVariant> &variants,
+                                 CLILPrecision precision,
+                                 cl_uint tile,
+                                 const CLILVariant **variant);
+
+/**
+ * LoadILManifest, SelectILVariant and CreateProgramFromILFile in one go. @param variant (optional) receives the
+ * chosen module.
+ */
+extern CLHRESULT CreateProgramFromILManifest(cl_context context,
+                                             cl_device_id device,
+                                             const char *fname,
+                                             CLILPrecision precision,
+                                             cl_uint tile,
+                                             cl_program *program,
+                                             CLILVariant *variant = nullptr);
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal JSON support shared by the on-disk databases (tuning database, device database). Not a general
+ * purpose parser.
+ */
+
+inline std::string __json_escape(const std::string &str) {
+  std::string out;
+  out.reserve(str.size());
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buff[8];
+      snprintf(buff, sizeof(buff), "\\u%04x", (unsigned)(unsigned char)c);
+      out += buff;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+/**
+ * Just enough JSON for the files the databases write: objects, arrays, strings with the escapes __json_escape
+ * emits (\", \\ and \u00XX), and numbers.
+ */
+struct __JsonValue {
+  enum Type { NUL, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+  double number = 0.0;
+  std::string str;
+  std::vector<__JsonValue> items;
+  std::vector<std::pair<std::string, __JsonValue>> members;
+
+  const __JsonValue *Find(const char *key) const {
+    for (auto &m : members)
+      if (m.first == key)
+        return &m.second;
+    return nullptr;
+  }
+};
+
+class __JsonReader {
+public:
+  // The text is copied, callers pass temporaries like ss.str().
+  explicit __JsonReader(const std::string &text) : text_(text), p_(text_.c_str()) {}
+
+  bool Parse(__JsonValue *value) {
+    SkipSpace();
+    switch (*p_) {
+    case '{':
+      return ParseObject(value);
+    case '[':
+      return ParseArray(value);
+    case '"':
+      value->type = __JsonValue::STRING;
+      return ParseString(&value->str);
+    default:
+      return ParseNumber(value);
+    }
+  }
+
+private:
+  void SkipSpace() {
+    while (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n')
+      ++p_;
+  }
+
+  static bool __IsHex4(const char *p) {
+    for (int i = 0; i < 4; ++i)
+      if (!isxdigit((unsigned char)p[i]))
+        return false;
+    return true;
+  }
+
+  bool ParseString(std::string *str) {
+    if (*p_++ != '"')
+      return false;
+    while (*p_ && *p_ != '"') {
+      if (*p_ == '\\' && p_[1] == 'u' && __IsHex4(p_ + 2)) {
+        char hex[5] = {p_[2], p_[3], p_[4], p_[5], 0};
+        *str += (char)strtoul(hex, nullptr, 16);
+        p_ += 6;
+        continue;
+      }
+      if (*p_ == '\\' && p_[1])
+        ++p_;
+      *str += *p_++;
+    }
+    return *p_++ == '"';
+  }
+
+  bool ParseNumber(__JsonValue *value) {
+    char *end;
+    value->type = __JsonValue::NUMBER;
+    value->number = strtod(p_, &end);
+    if (end == p_)
+      return false;
+    p_ = end;
+    return true;
+  }
+
+  bool ParseArray(__JsonValue *value) {
+    value->type = __JsonValue::ARRAY;
+    ++p_;
+    SkipSpace();
+    if (*p_ == ']')
+      return ++p_, true;
+    for (;;) {
+      value->items.emplace_back();
+      if (!Parse(&value->items.back()))
+        return false;
+      SkipSpace();
+      if (*p_ == ',') {
+        ++p_;
+        continue;
+      }
+      return *p_++ == ']';
+    }
+  }
+
+  bool ParseObject(__JsonValue *value) {
+    value->type = __JsonValue::OBJECT;
+    ++p_;
+    SkipSpace();
+    if (*p_ == '}')
+      return ++p_, true;
+    for (;;) {
+      std::string key;
+      SkipSpace();
+      if (!ParseString(&key))
+        return false;
+      SkipSpace();
+      if (*p_++ != ':')
+        return false;
+      value->members.emplace_back(key, __JsonValue());
+      if (!Parse(&value->members.back().second))
+        return false;
+      SkipSpace();
+      if (*p_ == ',') {
+        ++p_;
+        continue;
+      }
+      return *p_++ == '}';
+    }
+  }
+
+  std::string text_;
+  const char *p_;
+};
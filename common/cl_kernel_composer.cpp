@@ -0,0 +1,152 @@
+#include "cl_kernel_composer.h"
+#include <stdio.h>
+#include <utility>
+
+/**
+ * Replace every "{KEY}" of @param tmpl.
+ */
+static std::string __expand(const char *tmpl, std::initializer_list<std::pair<const char *, std::string>> values) {
+  std::string out = tmpl;
+
+  for (auto &kv : values) {
+    std::string key = std::string("{") + kv.first + "}";
+    for (size_t pos = out.find(key); pos != std::string::npos; pos = out.find(key, pos + kv.second.size()))
+      out.replace(pos, key.size(), kv.second);
+  }
+  return out;
+}
+
+static const char g_LoadStage[] = R"(
+    v = {INPUT}[i];)";
+
+static const char g_RowDotStage[] = R"(
+    {
+      __global const REAL *row = {MATRIX} + (size_t)i * {NCOLS};
+      REAL dot = (REAL)0;
+      for (uint k = 0; k < {NCOLS}; ++k)
+        dot = fma(row[k], {VECTOR}[k], dot);
+      v = dot;
+    })";
+
+static const char g_MapStage[] = R"(
+    v = ({EXPR});)";
+
+static const char g_StoreKernel[] = R"(
+__attribute__((reqd_work_group_size(LOCAL_SIZE, 1, 1)))
+__kernel void {NAME}({ARGS}uint n, __global REAL *{OUTPUT}) {
+
+  for (uint i = get_global_id(0); i < n; i += get_global_size(0)) {
+    REAL v = (REAL)0;
+{STAGES}
+    {OUTPUT}[i] = v;
+  }
+}
+)";
+
+static const char g_ReduceSumKernel[] = R"(
+__attribute__((reqd_work_group_size(LOCAL_SIZE, 1, 1)))
+__kernel void {NAME}({ARGS}uint n, __global REAL *{OUTPUT}) {
+
+  __local REAL tile[LOCAL_SIZE];
+  const uint tid = get_local_id(0);
+  REAL acc = (REAL)0;
+
+  for (uint i = get_global_id(0); i < n; i += get_global_size(0)) {
+    REAL v = (REAL)0;
+{STAGES}
+    acc += v;
+  }
+
+  tile[tid] = acc;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint s = LOCAL_SIZE >> 1; s > 0; s >>= 1) {
+    if (tid < s)
+      tile[tid] += tile[tid + s];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (tid == 0)
+    {OUTPUT}[get_group_id(0)] = tile[0];
+}
+)";
+
+CLKernelComposer::CLKernelComposer(const char *kernel_name) : name_(kernel_name), terminal_(Terminal::NONE) {}
+
+CLKernelComposer &CLKernelComposer::Input(const char *name) {
+  args_.push_back({"__global const REAL *", name});
+  return *this;
+}
+
+CLKernelComposer &CLKernelComposer::Param(const char *name, const char *type) {
+  args_.push_back({std::string(type) + " ", name});
+  return *this;
+}
+
+CLKernelComposer &CLKernelComposer::Load(const char *input) {
+  stages_.push_back(__expand(g_LoadStage, {{"INPUT", input}}));
+  return *this;
+}
+
+CLKernelComposer &CLKernelComposer::RowDot(const char *matrix, const char *vector, const char *ncols) {
+  stages_.push_back(__expand(g_RowDotStage, {{"MATRIX", matrix}, {"VECTOR", vector}, {"NCOLS", ncols}}));
+  return *this;
+}
+
+CLKernelComposer &CLKernelComposer::Map(const char *expr) {
+  stages_.push_back(__expand(g_MapStage, {{"EXPR", expr}}));
+  return *this;
+}
+
+CLKernelComposer &CLKernelComposer::Store(const char *output) {
+  terminal_ = Terminal::STORE;
+  output_ = output;
+  return *this;
+}
+
+CLKernelComposer &CLKernelComposer::ReduceSum(const char *output) {
+  terminal_ = Terminal::REDUCE_SUM;
+  output_ = output;
+  return *this;
+}
+
+CLHRESULT CLKernelComposer::GetSource(std::string *source) const {
+  std::string args, stages;
+
+  if (stages_.empty() || terminal_ == Terminal::NONE) {
+    CL_TRACE(CL_INVALID_VALUE, "Composed kernel \"%s\" needs at least one stage and a terminal!\n", name_.c_str());
+    return CL_INVALID_VALUE;
+  }
+
+  for (auto &arg : args_)
+    args += arg.type + arg.name + ", ";
+  for (auto &stage : stages_)
+    stages += stage;
+
+  *source = __expand(terminal_ == Terminal::STORE ? g_StoreKernel : g_ReduceSumKernel,
+                     {{"NAME", name_}, {"ARGS", args}, {"OUTPUT", output_}, {"STAGES", stages}});
+  return CL_SUCCESS;
+}
+
+CLHRESULT BuildComposedProgram(cl_context context,
+                               cl_device_id device,
+                               std::initializer_list<const CLKernelComposer *> composers,
+                               size_t local_size,
+                               cl_program *program,
+                               bool fp64) {
+  CLHRESULT hr;
+  std::string source, kernel_source;
+  char defines[64];
+
+  RT_ASSERT(local_size && (local_size & (local_size - 1)) == 0 && "local size must be pow of 2");
+
+  for (auto composer : composers) {
+    V_RETURN(composer->GetSource(&kernel_source));
+    source += kernel_source;
+  }
+
+  snprintf(defines, sizeof(defines), "%s#define LOCAL_SIZE %zu\n", fp64 ? "#define _USE_DOUBLE_FP\n" : "",
+           local_size);
+  V_RETURN(CreateProgramFromSource(context, device, defines, source.c_str(), source.size(), program));
+  return hr;
+}
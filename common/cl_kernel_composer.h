@@ -0,0 +1,78 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <string>
+#include <vector>
+
+/**
+ * Kernel source composer: a chain of per-element stages and one terminal, generated as a single kernel so the
+ * intermediate values stay in registers instead of going through global memory between kernels.
+ *
+ *   // sum over i of (A[i,:] . x - b[i])^2, one partial sum per work-group
+ *   CLKernelComposer fused("residual_sqr_sum");
+ *   fused.Input("A").Input("x").Input("b").Param("ncols")
+ *        .RowDot("A", "x", "ncols").Map("v - b[i]").Map("v * v").ReduceSum("partials");
+ *   V_RETURN(BuildComposedProgram(context, device, {&fused}, 256, &program));
+ *
+ * Stages work on the running value `v` of element `i`; Map expressions may use `v`, `i`, and every input and
+ * parameter by name, in REAL arithmetic. The kernel walks i over [0, n) with a grid-stride loop, so any global
+ * size works. Kernel arguments are the inputs and parameters in declaration order, then `uint n`, then the
+ * output of the terminal:
+ *
+ *   Store(out):        out[i] = v
+ *   ReduceSum(out):    out[get_group_id(0)] = sum of v over the elements of the work-group, summed on the host
+ *                      or by a second pass
+ *
+ * Work-groups are LOCAL_SIZE work-items (a power of two), set by BuildComposedProgram.
+ */
+class CLKernelComposer {
+public:
+  explicit CLKernelComposer(const char *kernel_name);
+
+  /** __global const REAL * argument. */
+  CLKernelComposer &Input(const char *name);
+  /** Scalar argument, uint by default; "REAL" for a value in the arithmetic type. */
+  CLKernelComposer &Param(const char *name, const char *type = "uint");
+
+  /** v = input[i] */
+  CLKernelComposer &Load(const char *input);
+  /** v = sum over k < ncols of matrix[i * ncols + k] * vector[k], matrix row-major. */
+  CLKernelComposer &RowDot(const char *matrix, const char *vector, const char *ncols);
+  /** v = expr */
+  CLKernelComposer &Map(const char *expr);
+
+  CLKernelComposer &Store(const char *output);
+  CLKernelComposer &ReduceSum(const char *output);
+
+  const std::string &Name() const { return name_; }
+
+  /**
+   * @return CL_INVALID_VALUE without stages or terminal.
+   */
+  CLHRESULT GetSource(std::string *source) const;
+
+private:
+  enum class Terminal { NONE, STORE, REDUCE_SUM };
+
+  struct Arg {
+    std::string type;
+    std::string name;
+  };
+
+  std::string name_;
+  std::vector<Arg> args_;
+  std::vector<std::string> stages_;  // generated statements, one block per stage
+  Terminal terminal_;
+  std::string output_;
+};
+
+/**
+ * One program holding the kernels of every composer, built with CreateProgramFromSource (and so through the
+ * program binary cache). @param local_size must be a power of two; REAL is double when @param fp64 is set.
+ */
+extern CLHRESULT BuildComposedProgram(cl_context context,
+                                      cl_device_id device,
+                                      std::initializer_list<const CLKernelComposer *> composers,
+                                      size_t local_size,
+                                      cl_program *program,
+                                      bool fp64 = false);
@@ -0,0 +1,54 @@
+#include "cl_kernel_launcher.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+static std::mutex g_KernelCacheLock;
+static std::map<std::pair<cl_program, std::string>, std::unique_ptr<CLCachedKernel>> g_KernelCache;
+static CLKernelCacheStats g_KernelCacheStats;
+
+static CLHRESULT __create_cached_kernel(cl_program program, const char *kernel_name, CLCachedKernel *entry) {
+  CLHRESULT hr;
+
+  entry->binder = nullptr;
+  entry->num_args = 0;
+  V_RETURN2(entry->kernel <<= clCreateKernel(program, kernel_name, &hr), hr);
+  V_RETURN(clGetKernelInfo(entry->kernel, CL_KERNEL_NUM_ARGS, sizeof(entry->num_args), &entry->num_args, nullptr));
+  return hr;
+}
+
+CLHRESULT GetCachedKernel(cl_program program, const char *kernel_name, CLCachedKernel **entry) {
+  CLHRESULT hr = CL_SUCCESS;
+  std::lock_guard<std::mutex> lck(g_KernelCacheLock);
+
+  // A cached kernel retains its program, so a program handle can not be recycled while it is a key.
+  auto &cached = g_KernelCache[std::make_pair(program, std::string(kernel_name))];
+  if (cached) {
+    ++g_KernelCacheStats.hits;
+    *entry = cached.get();
+    return hr;
+  }
+
+  std::unique_ptr<CLCachedKernel> created(new CLCachedKernel());
+  hr = __create_cached_kernel(program, kernel_name, created.get());
+  if (CL_FAILED(hr)) {
+    g_KernelCache.erase(std::make_pair(program, std::string(kernel_name)));
+    return hr;
+  }
+
+  ++g_KernelCacheStats.misses;
+  cached = std::move(created);
+  *entry = cached.get();
+  return hr;
+}
+
+void ClearKernelCache() {
+  std::lock_guard<std::mutex> lck(g_KernelCacheLock);
+  g_KernelCache.clear();
+}
+
+void GetKernelCacheStats(CLKernelCacheStats *stats) {
+  std::lock_guard<std::mutex> lck(g_KernelCacheLock);
+  *stats = g_KernelCacheStats;
+}
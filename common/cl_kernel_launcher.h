@@ -0,0 +1,178 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <array>
+#include <string.h>
+#include <utility>
+
+/**
+ * Typed kernel launcher.
+ *
+ *   KernelLauncher<ycl_buffer, ycl_buffer, cl_uint, LocalMem> launcher;
+ *   V_RETURN(launcher.Create(program, "cr_small_system"));
+ *   V_RETURN(launcher.SetArgs(a_d, x_d, dimx32, LocalMem{buffer_len * 5}));
+ *   V_RETURN(launcher.Enqueue(cmd_queue, 1, &global_size, &local_size));
+ *
+ * Arguments are bound by value: scalars and vector types (any trivially copyable non-pointer type), memory
+ * objects (ycl_mem, ycl_buffer, ycl_image or a raw cl_mem), samplers, and LocalMem{bytes} for a __local pointer.
+ * The argument list is checked at compile time against the launcher type, and once at Create() against
+ * CL_KERNEL_NUM_ARGS.
+ *
+ * Kernels come from a process wide cache keyed by (program, kernel name), so a test run many times creates its
+ * kernel once. SetArgs() remembers what it bound last and skips clSetKernelArg for the arguments that did not
+ * change, unless another launcher bound the same cached kernel in between. Like clSetKernelArg itself, a cached
+ * kernel is meant to be driven from one thread at a time.
+ */
+
+/** Size of a __local kernel argument, allocated by the runtime. */
+struct LocalMem {
+  size_t bytes;
+};
+
+struct CLCachedKernel {
+  ycl_kernel kernel;
+  cl_uint num_args;
+  const void *binder;  // launcher whose arguments the kernel currently holds
+};
+
+struct CLKernelCacheStats {
+  size_t hits;
+  size_t misses;
+};
+
+/**
+ * Kernel @param kernel_name of @param program, created on the first request. The entry lives until
+ * ClearKernelCache(), and keeps the program alive with it.
+ */
+extern CLHRESULT GetCachedKernel(cl_program program, const char *kernel_name, CLCachedKernel **entry);
+
+extern void ClearKernelCache();
+extern void GetKernelCacheStats(CLKernelCacheStats *stats);
+
+template <typename T, typename = void> struct CLKernelArgTraits {
+  static_assert(std::is_trivially_copyable_v<T> && !std::is_pointer_v<T>,
+                "kernel arguments are scalars, vector types, memory objects, samplers or LocalMem");
+
+  static constexpr size_t KeySize = sizeof(T);
+  static void Key(const T &arg, uint8_t *key) { memcpy(key, &arg, sizeof(T)); }
+  static CLHRESULT Set(cl_kernel kernel, cl_uint i, const T &arg) { return clSetKernelArg(kernel, i, sizeof(T), &arg); }
+};
+
+template <> struct CLKernelArgTraits<LocalMem> {
+  static constexpr size_t KeySize = sizeof(size_t);
+  static void Key(const LocalMem &arg, uint8_t *key) { memcpy(key, &arg.bytes, sizeof(size_t)); }
+  static CLHRESULT Set(cl_kernel kernel, cl_uint i, const LocalMem &arg) {
+    return clSetKernelArg(kernel, i, arg.bytes, nullptr);
+  }
+};
+
+/** Raw handles: cl_mem and cl_sampler, bound as the handle value. */
+template <typename T>
+struct CLKernelArgTraits<T, std::enable_if_t<std::is_same_v<T, cl_mem> || std::is_same_v<T, cl_sampler>>> {
+  static constexpr size_t KeySize = sizeof(T);
+  static void Key(const T &arg, uint8_t *key) { memcpy(key, &arg, sizeof(T)); }
+  static CLHRESULT Set(cl_kernel kernel, cl_uint i, const T &arg) { return clSetKernelArg(kernel, i, sizeof(T), &arg); }
+};
+
+template <typename ObjType, CLX_OBJECT_TYPE TypeIndex>
+struct CLKernelArgTraits<CLxObjectSPtr<ObjType, TypeIndex>,
+                         std::enable_if_t<std::is_same_v<ObjType, cl_mem> || std::is_same_v<ObjType, cl_sampler>>> {
+  static constexpr size_t KeySize = sizeof(ObjType);
+  static void Key(const CLxObjectSPtr<ObjType, TypeIndex> &arg, uint8_t *key) {
+    memcpy(key, arg.GetAddressOf(), sizeof(ObjType));
+  }
+  static CLHRESULT Set(cl_kernel kernel, cl_uint i, const CLxObjectSPtr<ObjType, TypeIndex> &arg) {
+    return clSetKernelArg(kernel, i, sizeof(ObjType), arg.GetAddressOf());
+  }
+};
+
+/** Offset of every argument in the launcher's copy of the last bound values, the total size last. */
+template <typename... TArgs> constexpr std::array<size_t, sizeof...(TArgs) + 1> __MakeKernelArgKeyOffsets() {
+  size_t sizes[] = {CLKernelArgTraits<TArgs>::KeySize..., 0};
+  std::array<size_t, sizeof...(TArgs) + 1> offsets = {};
+  for (size_t i = 0; i < sizeof...(TArgs); ++i)
+    offsets[i + 1] = offsets[i] + sizes[i];
+  return offsets;
+}
+
+template <typename... TArgs> class KernelLauncher {
+public:
+  static constexpr size_t NumArgs = sizeof...(TArgs);
+
+  KernelLauncher() : entry_(nullptr), bound_(false), key_() {}
+  ~KernelLauncher() { Detach(); }
+
+  KernelLauncher(const KernelLauncher &) = delete;
+  KernelLauncher &operator=(const KernelLauncher &) = delete;
+
+  /**
+   * @return CL_INVALID_KERNEL_ARGS when the kernel does not take exactly NumArgs arguments.
+   */
+  CLHRESULT Create(cl_program program, const char *kernel_name) {
+    CLHRESULT hr;
+    CLCachedKernel *entry;
+
+    Detach();
+    V_RETURN(GetCachedKernel(program, kernel_name, &entry));
+    if (entry->num_args != NumArgs) {
+      CL_TRACE(CL_INVALID_KERNEL_ARGS, "Kernel \"%s\" takes %u arguments, the launcher binds %zu!\n", kernel_name,
+               entry->num_args, NumArgs);
+      return CL_INVALID_KERNEL_ARGS;
+    }
+    entry_ = entry;
+    return hr;
+  }
+
+  CLHRESULT SetArgs(const TArgs &...args) {
+    RT_ASSERT(entry_ && "KernelLauncher::Create() first");
+
+    // Anything may have been bound in between by another launcher of the same cached kernel.
+    bool rebind = !bound_ || entry_->binder != this;
+    entry_->binder = this;
+    bound_ = false;
+
+    CLHRESULT hr = BindArgs(rebind, std::index_sequence_for<TArgs...>{}, args...);
+    bound_ = CL_SUCCEEDED(hr);
+    return hr;
+  }
+
+  CLHRESULT Enqueue(cl_command_queue cmd_queue, cl_uint work_dim, const size_t *global_size,
+                    const size_t *local_size = nullptr, cl_uint num_waits = 0, const cl_event *waits = nullptr,
+                    cl_event *event = nullptr) const {
+    RT_ASSERT(bound_ && "KernelLauncher::SetArgs() first");
+    return clEnqueueNDRangeKernel(cmd_queue, entry_->kernel, work_dim, nullptr, global_size, local_size,
+                                  num_waits, waits, event);
+  }
+
+  operator cl_kernel() const { return entry_ ? (cl_kernel)entry_->kernel : nullptr; }
+
+private:
+  static constexpr std::array<size_t, NumArgs + 1> KeyOffsets = __MakeKernelArgKeyOffsets<TArgs...>();
+
+  template <size_t I, typename T> CLHRESULT BindArg(bool rebind, const T &arg) {
+    uint8_t key[CLKernelArgTraits<T>::KeySize];
+
+    CLKernelArgTraits<T>::Key(arg, key);
+    if (!rebind && memcmp(key, key_.data() + KeyOffsets[I], sizeof(key)) == 0)
+      return CL_SUCCESS;
+    memcpy(key_.data() + KeyOffsets[I], key, sizeof(key));
+    return CLKernelArgTraits<T>::Set(entry_->kernel, (cl_uint)I, arg);
+  }
+
+  template <size_t... I> CLHRESULT BindArgs(bool rebind, std::index_sequence<I...>, const TArgs &...args) {
+    CLHRESULT hr = CL_SUCCESS;
+    ((hr = CL_SUCCEEDED(hr) ? BindArg<I>(rebind, args) : hr), ...);
+    return hr;
+  }
+
+  void Detach() {
+    if (entry_ && entry_->binder == this)
+      entry_->binder = nullptr;
+    entry_ = nullptr;
+    bound_ = false;
+  }
+
+  CLCachedKernel *entry_;
+  bool bound_;
+  std::array<uint8_t, KeyOffsets[NumArgs] ? KeyOffsets[NumArgs] : 1> key_;
+};
@@ -0,0 +1,387 @@
+#include "cl_kernel_variants.h"
+#include "cl_autotuner.h"
+#include "cl_json.h"
+#include <sys/stat.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+static CLHRESULT __get_device_string(cl_device_id device, cl_device_info param, std::string *str) {
+  CLHRESULT hr;
+  size_t len = 0;
+
+  str->clear();
+  V_RETURN(clGetDeviceInfo(device, param, 0, nullptr, &len));
+  if (len == 0)
+    return hr;
+  std::vector<char> buff(len + 1, 0);
+  V_RETURN(clGetDeviceInfo(device, param, len, buff.data(), nullptr));
+  *str = buff.data();
+  return hr;
+}
+
+CLVariantPrecondition RequireAlignment(size_t bytes) {
+  return {"input " + std::to_string(bytes) + "-byte aligned",
+          [bytes](cl_device_id, const CLVariantInput &input) { return input.alignment % bytes == 0; }};
+}
+
+CLVariantPrecondition RequireMinSize(size_t count, const char *what) {
+  return {std::string(what) + " >= " + std::to_string(count),
+          [count](cl_device_id, const CLVariantInput &input) { return input.size >= count; }};
+}
+
+CLVariantPrecondition RequireMaxSize(size_t count, const char *what) {
+  return {std::string(what) + " <= " + std::to_string(count),
+          [count](cl_device_id, const CLVariantInput &input) { return input.size <= count; }};
+}
+
+CLVariantPrecondition RequireMinAuxPerSize(double ratio, const char *what) {
+  char desc[128];
+
+  snprintf(desc, sizeof(desc), "%s >= %g", what, ratio);
+  return {desc, [ratio](cl_device_id, const CLVariantInput &input) {
+            return input.size && (double)input.aux / input.size >= ratio;
+          }};
+}
+
+CLKernelVariantRegistry::CLKernelVariantRegistry(cl_context context, cl_device_id device)
+    : context_(context), device_(device), generation_(0), watching_(false) {
+  __get_device_string(device, CL_DEVICE_NAME, &device_name_);
+  __get_device_string(device, CL_DRIVER_VERSION, &driver_version_);
+}
+
+CLKernelVariantRegistry::~CLKernelVariantRegistry() { StopWatching(); }
+
+bool CLKernelVariantRegistry::StatFile(const std::string &fname, SourceFile *stamp) {
+  struct stat st;
+
+  if (stat(fname.c_str(), &st) != 0)
+    return false;
+  stamp->mtime = (int64_t)st.st_mtime;
+  stamp->size = (int64_t)st.st_size;
+  return true;
+}
+
+void CLKernelVariantRegistry::Register(const char *contract, const CLKernelVariant &variant) {
+  std::lock_guard<std::mutex> lck(lock_);
+  contracts_[contract].push_back(variant);
+}
+
+std::vector<CLKernelVariant> CLKernelVariantRegistry::GetVariants(const char *contract) const {
+  std::lock_guard<std::mutex> lck(lock_);
+  auto it = contracts_.find(contract);
+  return it != contracts_.end() ? it->second : std::vector<CLKernelVariant>();
+}
+
+std::vector<CLKernelVariant> CLKernelVariantRegistry::GetEligible(const char *contract, const CLVariantInput &input,
+                                                                  std::vector<std::string> *rejected) const {
+  std::vector<CLKernelVariant> eligible;
+
+  for (auto &variant : GetVariants(contract)) {
+    bool ok = true;
+    for (auto &pre : variant.preconditions) {
+      if (!pre.check(device_, input)) {
+        ok = false;
+        if (rejected)
+          rejected->push_back(variant.name + ": " + pre.description);
+      }
+    }
+    if (ok)
+      eligible.push_back(variant);
+  }
+  return eligible;
+}
+
+CLHRESULT CLKernelVariantRegistry::CreateKernel(const CLKernelVariant &variant, cl_kernel *kernel) {
+  CLHRESULT hr = CL_SUCCESS;
+  std::lock_guard<std::mutex> lck(lock_);
+  Program &prog = programs_[{variant.fname, variant.defines}];
+
+  if (prog.program == nullptr) {
+    if (!StatFile(variant.fname, &prog.stamp))
+      prog.stamp = {0, 0};
+    hr = CreateProgramFromFile(context_, device_, variant.defines.empty() ? nullptr : variant.defines.c_str(),
+                               variant.fname.c_str(), &prog.program);
+    if (CL_FAILED(hr))
+      return hr;
+  }
+
+  *kernel = clCreateKernel(prog.program, variant.name.c_str(), &hr);
+  return hr;
+}
+
+uint32_t CLKernelVariantRegistry::Generation() const {
+  std::lock_guard<std::mutex> lck(lock_);
+  return generation_;
+}
+
+size_t CLKernelVariantRegistry::Refresh() {
+  struct Stale {
+    std::pair<std::string, std::string> key;  // (file, defines)
+    SourceFile stamp;
+    ycl_program rebuilt;
+  };
+  std::lock_guard<std::mutex> refresh_lck(refresh_lock_);
+  std::vector<Stale> stale;
+  size_t replaced = 0;
+  SourceFile stamp;
+
+  {
+    std::lock_guard<std::mutex> lck(lock_);
+    for (auto &entry : programs_) {
+      // a file missing for a moment is an editor saving it, look again next time
+      if (!StatFile(entry.first.first, &stamp))
+        continue;
+      if (entry.second.program != nullptr &&
+          (stamp.mtime != entry.second.stamp.mtime || stamp.size != entry.second.stamp.size))
+        stale.push_back({entry.first, stamp, {}});
+    }
+  }
+
+  // compile without the registry lock, a slow build must not stall the launches
+  for (auto &item : stale) {
+    const std::string &fname = item.key.first;
+    const std::string &defines = item.key.second;
+
+    if (CL_FAILED(CreateProgramFromFile(context_, device_, defines.empty() ? nullptr : defines.c_str(),
+                                        fname.c_str(), &item.rebuilt))) {
+      printf("Reload of %s failed, keeping the previous build\n", fname.c_str());
+      item.rebuilt = nullptr;
+    }
+  }
+
+  std::lock_guard<std::mutex> lck(lock_);
+  for (auto &item : stale) {
+    Program &prog = programs_[item.key];
+
+    // the stamp moves on a failed build too, the same broken source is not compiled again
+    prog.stamp = item.stamp;
+    if (item.rebuilt == nullptr)
+      continue;
+    prog.program <<= item.rebuilt;
+    DropStats(item.key.first);
+    ++replaced;
+    printf("Reloaded %s\n", item.key.first.c_str());
+  }
+
+  if (replaced)
+    ++generation_;
+  return replaced;
+}
+
+void CLKernelVariantRegistry::StartWatching(uint32_t interval_ms) {
+  std::lock_guard<std::mutex> lck(watch_lock_);
+
+  if (watching_)
+    return;
+  watching_ = true;
+  watcher_ = std::thread([this, interval_ms]() {
+    std::unique_lock<std::mutex> lck(watch_lock_);
+    while (!watch_cv_.wait_for(lck, std::chrono::milliseconds(interval_ms), [this]() { return !watching_; })) {
+      lck.unlock();
+      Refresh();
+      lck.lock();
+    }
+  });
+}
+
+void CLKernelVariantRegistry::StopWatching() {
+  {
+    std::lock_guard<std::mutex> lck(watch_lock_);
+    if (!watching_)
+      return;
+    watching_ = false;
+  }
+  watch_cv_.notify_all();
+  watcher_.join();
+}
+
+void CLKernelVariantRegistry::DropStats(const std::string &fname) {
+  for (auto &contract : contracts_) {
+    for (auto &variant : contract.second) {
+      if (variant.fname != fname)
+        continue;
+      for (auto &shape : shapes_)
+        if (shape.contract == contract.first)
+          shape.variants.erase(variant.name);
+    }
+  }
+}
+
+CLKernelVariantRegistry::ShapeEntry *CLKernelVariantRegistry::FindShape(const char *contract,
+                                                                        const CLVariantInput &input) {
+  uint32_t size_bucket = CLTuningDB::SizeBucket(input.size), aux_bucket = CLTuningDB::SizeBucket(input.aux);
+
+  for (auto &shape : shapes_) {
+    if (shape.size_bucket == size_bucket && shape.aux_bucket == aux_bucket && shape.contract == contract &&
+        shape.device == device_name_ && shape.driver == driver_version_)
+      return &shape;
+  }
+  return nullptr;
+}
+
+const CLKernelVariantRegistry::ShapeEntry *CLKernelVariantRegistry::FindShape(const char *contract,
+                                                                              const CLVariantInput &input) const {
+  return const_cast<CLKernelVariantRegistry *>(this)->FindShape(contract, input);
+}
+
+CLHRESULT CLKernelVariantRegistry::RunAB(const char *contract, const CLVariantInput &input, CLVariantRunner run,
+                                         CLKernelVariant *winner) {
+  std::vector<CLKernelVariant> eligible = GetEligible(contract, input);
+  std::vector<std::pair<std::string, double>> times;
+  uint32_t round;
+
+  if (eligible.empty())
+    return CL_INVALID_KERNEL_NAME;
+
+  {
+    std::lock_guard<std::mutex> lck(lock_);
+    round = ab_rounds_[contract]++;
+  }
+
+  for (size_t i = 0; i < eligible.size(); ++i) {
+    const CLKernelVariant &variant = eligible[(round + i) % eligible.size()];
+    ycl_kernel kernel;
+    double ms;
+
+    if (CL_FAILED(CreateKernel(variant, &kernel)) || CL_FAILED(run(variant, kernel, &ms)))
+      continue;
+    times.emplace_back(variant.name, ms);
+  }
+
+  std::lock_guard<std::mutex> lck(lock_);
+  ShapeEntry *shape = FindShape(contract, input);
+  if (!shape) {
+    shapes_.push_back({device_name_, driver_version_, contract, CLTuningDB::SizeBucket(input.size),
+                       CLTuningDB::SizeBucket(input.aux), {}});
+    shape = &shapes_.back();
+  }
+  for (auto &t : times) {
+    CLVariantStats &stats = shape->variants.emplace(t.first, CLVariantStats{0, 0.0}).first->second;
+    stats.mean_ms += (t.second - stats.mean_ms) / ++stats.runs;
+  }
+
+  if (winner) {
+    double best_ms = INFINITY;
+    for (auto &variant : eligible) {
+      auto it = shape->variants.find(variant.name);
+      if (it != shape->variants.end() && it->second.mean_ms < best_ms) {
+        best_ms = it->second.mean_ms;
+        *winner = variant;
+      }
+    }
+  }
+  return times.empty() ? CL_INVALID_KERNEL : CL_SUCCESS;
+}
+
+bool CLKernelVariantRegistry::Select(const char *contract, const CLVariantInput &input,
+                                     CLKernelVariant *variant) const {
+  std::vector<CLKernelVariant> eligible = GetEligible(contract, input);
+  double best_ms = INFINITY;
+
+  if (eligible.empty())
+    return false;
+  *variant = eligible.front();
+
+  std::lock_guard<std::mutex> lck(lock_);
+  const ShapeEntry *shape = FindShape(contract, input);
+  if (!shape)
+    return true;
+  for (auto &v : eligible) {
+    auto it = shape->variants.find(v.name);
+    if (it != shape->variants.end() && it->second.mean_ms < best_ms) {
+      best_ms = it->second.mean_ms;
+      *variant = v;
+    }
+  }
+  return true;
+}
+
+std::map<std::string, CLVariantStats> CLKernelVariantRegistry::GetStats(const char *contract,
+                                                                        const CLVariantInput &input) const {
+  std::lock_guard<std::mutex> lck(lock_);
+  const ShapeEntry *shape = FindShape(contract, input);
+  return shape ? shape->variants : std::map<std::string, CLVariantStats>();
+}
+
+CLHRESULT CLKernelVariantRegistry::Save(const char *fname) const {
+  std::lock_guard<std::mutex> lck(lock_);
+
+  FILE *fp = fopen(fname, "w");
+  if (!fp) {
+    CL_TRACE(CL_INVALID_VALUE, "Can not open variant database \"%s\" for writing!\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  fprintf(fp, "{\"entries\": [\n");
+  for (size_t i = 0; i < shapes_.size(); ++i) {
+    const ShapeEntry &e = shapes_[i];
+    size_t j = 0;
+
+    fprintf(fp, "  {\"device\": \"%s\", \"driver\": \"%s\", \"contract\": \"%s\", \"size_bucket\": %u, "
+                "\"aux_bucket\": %u,\n   \"variants\": {",
+            __json_escape(e.device).c_str(), __json_escape(e.driver).c_str(), __json_escape(e.contract).c_str(),
+            e.size_bucket, e.aux_bucket);
+    for (auto &v : e.variants)
+      fprintf(fp, "%s\"%s\": [%u, %.6f]", j++ ? ", " : "", __json_escape(v.first).c_str(), v.second.runs,
+              v.second.mean_ms);
+    fprintf(fp, "}}%s\n", i + 1 < shapes_.size() ? "," : "");
+  }
+  fprintf(fp, "]}\n");
+  fclose(fp);
+
+  return CL_SUCCESS;
+}
+
+CLHRESULT CLKernelVariantRegistry::Load(const char *fname) {
+  std::ifstream fin(fname, std::fstream::binary);
+  std::vector<ShapeEntry> shapes;
+
+  if (!fin)
+    return CL_SUCCESS;
+
+  std::stringstream ss;
+  ss << fin.rdbuf();
+
+  __JsonValue root;
+  __JsonReader reader(ss.str());
+  const __JsonValue *items;
+
+  if (!reader.Parse(&root) || !(items = root.Find("entries")) || items->type != __JsonValue::ARRAY) {
+    CL_TRACE(CL_INVALID_VALUE, "Variant database \"%s\" is malformed, ignored.\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  for (auto &item : items->items) {
+    const __JsonValue *device = item.Find("device"), *driver = item.Find("driver"),
+                      *contract = item.Find("contract"), *size_bucket = item.Find("size_bucket"),
+                      *aux_bucket = item.Find("aux_bucket"), *variants = item.Find("variants");
+    if (!device || !driver || !contract || !size_bucket || !aux_bucket || !variants)
+      continue;
+
+    ShapeEntry entry;
+    entry.device = device->str;
+    entry.driver = driver->str;
+    entry.contract = contract->str;
+    entry.size_bucket = (uint32_t)size_bucket->number;
+    entry.aux_bucket = (uint32_t)aux_bucket->number;
+    for (auto &m : variants->members) {
+      if (m.second.type == __JsonValue::ARRAY && m.second.items.size() == 2)
+        entry.variants[m.first] = {(uint32_t)m.second.items[0].number, m.second.items[1].number};
+    }
+    shapes.push_back(entry);
+  }
+
+  std::lock_guard<std::mutex> lck(lock_);
+  shapes_ = std::move(shapes);
+  return CL_SUCCESS;
+}
+
+std::string GetVariantDBPath() {
+  const char *path = getenv("CLX_VARIANT_DB");
+  return path && *path ? path : "cl_variant_db.json";
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * Registry of interchangeable kernels with source hot-reload and A/B selection.
+ *
+ * A contract ("histogram", "spmv") names what a kernel computes and how it is launched; every kernel registered
+ * under it computes the same result from the same arguments, under its own preconditions on the input
+ * ("pixels 64-byte aligned", "at most 65535 pixels per work item"). The samples ask the registry for the
+ * variants eligible for an input instead of picking a kernel by a hard-coded name.
+ *
+ *   CLKernelVariantRegistry registry(context, device);
+ *   registry.Register("histogram", {"histo_atomic", "histo.cl", "", {}});
+ *   registry.StartWatching(500);                    // rebuild histo.cl whenever it changes on disk
+ *   ...
+ *   registry.RunAB("histogram", input, run, &winner); // live input through every candidate, fastest recorded
+ *   registry.Select("histogram", input, &variant);    // recorded winner for the shape of input
+ *
+ * Programs are built once per (file, defines) through CreateProgramFromFile, so the program binary cache still
+ * applies. A file whose modification time or size changed is rebuilt by Refresh, or by the watcher thread; a
+ * build that fails keeps the previous program. Kernels created before a rebuild keep running the old code,
+ * Generation tells the caller to create them again. Only the .cl files themselves are watched: an edited header
+ * is picked up (the cache key hashes the headers) by the next build, not by the watcher.
+ *
+ * A/B results are kept per input shape (the power of two buckets of both sizes, see CLTuningDB::SizeBucket) and
+ * persisted in a JSON file, CLX_VARIANT_DB or "cl_variant_db.json" under the working directory:
+ *
+ *   {"entries": [
+ *     {"device": "...", "driver": "...", "contract": "histogram", "size_bucket": 24, "aux_bucket": 0,
+ *      "variants": {"histo_atomic": [12, 0.8312], "histo_optimized_ultimate": [12, 0.2141]}}
+ *   ]}
+ *
+ * where each variant holds its run count and mean kernel time in ms. The stats of a variant are dropped when its
+ * file is rebuilt, the old times say nothing about the new code.
+ */
+
+/** The input of one launch, what the preconditions are checked against and the A/B results are keyed by. */
+struct CLVariantInput {
+  size_t size;       // primary size: pixels, rows
+  size_t aux;        // secondary size: non zeros, 0 when the contract has none
+  size_t alignment;  // byte alignment of the primary input in device memory
+};
+
+struct CLVariantPrecondition {
+  std::string description;
+  std::function<bool(cl_device_id device, const CLVariantInput &input)> check;
+};
+
+/** input.alignment is a multiple of @param bytes. */
+extern CLVariantPrecondition RequireAlignment(size_t bytes);
+/** input.size >= @param count. */
+extern CLVariantPrecondition RequireMinSize(size_t count, const char *what = "size");
+/** input.size <= @param count. */
+extern CLVariantPrecondition RequireMaxSize(size_t count, const char *what = "size");
+/** input.aux / input.size >= @param ratio, e.g. the average non zeros per row. */
+extern CLVariantPrecondition RequireMinAuxPerSize(double ratio, const char *what = "aux per size");
+
+struct CLKernelVariant {
+  std::string name;     // kernel function
+  std::string fname;    // .cl file
+  std::string defines;  // prepended to the source, see CreateProgramFromFile
+  std::vector<CLVariantPrecondition> preconditions;
+};
+
+/**
+ * Time one launch of @param kernel on the live input and return the kernel time in @param ms. The runner sets
+ * the arguments, so variants of a contract may differ in launch sizes (read the compile work group size).
+ */
+using CLVariantRunner = std::function<CLHRESULT(const CLKernelVariant &variant, cl_kernel kernel, double *ms)>;
+
+struct CLVariantStats {
+  uint32_t runs;
+  double mean_ms;
+};
+
+class CLKernelVariantRegistry {
+public:
+  CLKernelVariantRegistry(cl_context context, cl_device_id device);
+  ~CLKernelVariantRegistry();
+
+  CLKernelVariantRegistry(const CLKernelVariantRegistry &) = delete;
+  CLKernelVariantRegistry &operator=(const CLKernelVariantRegistry &) = delete;
+
+  /** Variant names are unique within a contract, the A/B stats are kept by name. */
+  void Register(const char *contract, const CLKernelVariant &variant);
+
+  /** Every variant of @param contract in registration order, empty for an unknown contract. */
+  std::vector<CLKernelVariant> GetVariants(const char *contract) const;
+
+  /**
+   * Variants of @param contract whose preconditions all hold for @param input, in registration order.
+   * @param rejected (optional) receives "variant: precondition" for every failed check.
+   */
+  std::vector<CLKernelVariant> GetEligible(const char *contract, const CLVariantInput &input,
+                                           std::vector<std::string> *rejected = nullptr) const;
+
+  /** A new kernel from the current build of the variant's file, built on first use. */
+  CLHRESULT CreateKernel(const CLKernelVariant &variant, cl_kernel *kernel);
+
+  /** Bumped by every rebuild that replaced a program; kernels created under an older generation are stale. */
+  uint32_t Generation() const;
+
+  /**
+   * Check the source files now, rebuild the programs of changed ones. The builds run without holding the
+   * registry, CreateKernel and RunAB keep going on the previous programs meanwhile.
+   * @return number of programs replaced.
+   */
+  size_t Refresh();
+
+  /** Refresh every @param interval_ms on a background thread until StopWatching or destruction. */
+  void StartWatching(uint32_t interval_ms);
+  void StopWatching();
+
+  /**
+   * Run every variant eligible for @param input once through @param run, starting with a different one each
+   * call so no candidate always runs on a cold cache, and fold the times into the stats of the input shape.
+   * @param winner (optional) receives the variant with the lowest mean for the shape so far.
+   * @return CL_INVALID_KERNEL_NAME when no variant is eligible; a variant failing to build or run is skipped.
+   */
+  CLHRESULT RunAB(const char *contract, const CLVariantInput &input, CLVariantRunner run,
+                  CLKernelVariant *winner = nullptr);
+
+  /**
+   * Recorded winner for the shape of @param input when it is still eligible, the first eligible variant
+   * otherwise. @return false when no variant is eligible.
+   */
+  bool Select(const char *contract, const CLVariantInput &input, CLKernelVariant *variant) const;
+
+  /** Stats of every variant measured for the shape of @param input, by variant name. */
+  std::map<std::string, CLVariantStats> GetStats(const char *contract, const CLVariantInput &input) const;
+
+  /** A missing file is an empty record; entries of other devices are kept for Save. */
+  CLHRESULT Load(const char *fname);
+  CLHRESULT Save(const char *fname) const;
+
+private:
+  struct SourceFile {
+    int64_t mtime;
+    int64_t size;
+  };
+
+  struct Program {
+    ycl_program program;
+    SourceFile stamp;
+  };
+
+  struct ShapeEntry {
+    std::string device;
+    std::string driver;
+    std::string contract;
+    uint32_t size_bucket;
+    uint32_t aux_bucket;
+    std::map<std::string, CLVariantStats> variants;
+  };
+
+  static bool StatFile(const std::string &fname, SourceFile *stamp);
+  ShapeEntry *FindShape(const char *contract, const CLVariantInput &input);
+  const ShapeEntry *FindShape(const char *contract, const CLVariantInput &input) const;
+  void DropStats(const std::string &fname);
+
+  cl_context context_;
+  cl_device_id device_;
+  std::string device_name_;
+  std::string driver_version_;
+
+  std::map<std::string, std::vector<CLKernelVariant>> contracts_;
+  std::map<std::pair<std::string, std::string>, Program> programs_;  // by (file, defines)
+  std::vector<ShapeEntry> shapes_;
+  std::map<std::string, uint32_t> ab_rounds_;  // per contract, rotates the first candidate of RunAB
+  uint32_t generation_;
+  mutable std::mutex lock_;
+  std::mutex refresh_lock_;  // one Refresh at a time, taken before lock_
+
+  std::thread watcher_;
+  std::mutex watch_lock_;
+  std::condition_variable watch_cv_;
+  bool watching_;
+};
+
+extern std::string GetVariantDBPath();
@@ -0,0 +1,198 @@
+#include "cl_precision.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+const char *GetPrecisionName(CLPrecision precision) {
+  switch (precision) {
+  case CLPrecision::FP32:
+    return "fp32";
+  case CLPrecision::FP64:
+    return "fp64";
+  case CLPrecision::FP16:
+    return "fp16";
+  case CLPrecision::BF16:
+    return "bf16";
+  }
+  return "unknown";
+}
+
+bool ParsePrecision(const char *name, CLPrecision *precision) {
+  for (CLPrecision p : {CLPrecision::FP32, CLPrecision::FP64, CLPrecision::FP16, CLPrecision::BF16}) {
+    if (strcmp(name, GetPrecisionName(p)) == 0) {
+      *precision = p;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *GetPrecisionBuildDefines(CLPrecision precision) {
+  switch (precision) {
+  case CLPrecision::FP64:
+    return "#define _USE_DOUBLE_FP\n";
+  case CLPrecision::FP16:
+    return "#define _USE_HALF_STORAGE\n";
+  case CLPrecision::BF16:
+    return "#define _USE_BF16_STORAGE\n";
+  default:
+    return "";
+  }
+}
+
+size_t GetStorageSize(CLPrecision precision) {
+  switch (precision) {
+  case CLPrecision::FP64:
+    return sizeof(double);
+  case CLPrecision::FP16:
+  case CLPrecision::BF16:
+    return sizeof(uint16_t);
+  default:
+    return sizeof(float);
+  }
+}
+
+size_t GetAccumSize(CLPrecision precision) { return precision == CLPrecision::FP64 ? sizeof(double) : sizeof(float); }
+
+bool IsPrecisionSupported(cl_device_id device, CLPrecision precision) {
+  cl_device_fp_config fp64_config = 0;
+
+  if (precision != CLPrecision::FP64)
+    return true;
+  return CL_SUCCEEDED(clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64_config), &fp64_config,
+                                      nullptr)) &&
+         fp64_config != 0;
+}
+
+cl_image_format GetStorageImageFormat(CLPrecision precision) {
+  cl_image_format format = {CL_R, CL_FLOAT};
+
+  switch (precision) {
+  case CLPrecision::FP64:
+    format.image_channel_order = CL_RG;
+    break;
+  case CLPrecision::FP16:
+    format.image_channel_data_type = CL_HALF_FLOAT;
+    break;
+  case CLPrecision::BF16:
+    format.image_channel_data_type = CL_UNSIGNED_INT16;
+    break;
+  default:
+    break;
+  }
+  return format;
+}
+
+static uint32_t __float_bits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static float __bits_float(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+uint16_t FloatToHalf(float value) {
+  uint32_t x = __float_bits(value);
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t mant = x & 0x7fffff;
+  int32_t exp = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+  uint32_t half, rem, halfway;
+
+  if (((x >> 23) & 0xff) == 0xff)
+    return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));  // inf, quiet NaN
+  if (exp >= 31)
+    return (uint16_t)(sign | 0x7c00);
+
+  if (exp <= 0) {
+    // subnormal half, or zero below half the smallest subnormal
+    if (exp < -10)
+      return (uint16_t)sign;
+    mant |= 0x800000;
+    uint32_t shift = (uint32_t)(14 - exp);
+    half = mant >> shift;
+    rem = mant & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (half & 1)))
+      ++half;
+    return (uint16_t)(sign | half);
+  }
+
+  // a carry out of the mantissa rounds into the exponent, up to inf
+  half = ((uint32_t)exp << 10) | (mant >> 13);
+  rem = mant & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+    ++half;
+  return (uint16_t)(sign | half);
+}
+
+float HalfToFloat(uint16_t value) {
+  uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+  uint32_t exp = (value >> 10) & 0x1f;
+  uint32_t mant = value & 0x3ff;
+
+  if (exp == 0) {
+    float f = (float)mant * (1.0f / 16777216.0f);  // mant * 2^-24, exact
+    return sign ? -f : f;
+  }
+  if (exp == 31)
+    return __bits_float(sign | 0x7f800000 | (mant << 13));
+  return __bits_float(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+uint16_t FloatToBF16(float value) {
+  uint32_t x = __float_bits(value);
+
+  if ((x & 0x7fffffff) > 0x7f800000)
+    return (uint16_t)((x >> 16) | 0x40);  // keep NaN a NaN
+  return (uint16_t)((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+}
+
+float BF16ToFloat(uint16_t value) { return __bits_float((uint32_t)value << 16); }
+
+void ConvertToStorage(CLPrecision precision, const double *src, size_t count, void *dst) {
+  switch (precision) {
+  case CLPrecision::FP64:
+    memcpy(dst, src, count * sizeof(double));
+    break;
+  case CLPrecision::FP32:
+    std::transform(src, src + count, (float *)dst, [](double v) { return (float)v; });
+    break;
+  case CLPrecision::FP16:
+    std::transform(src, src + count, (uint16_t *)dst, [](double v) { return FloatToHalf((float)v); });
+    break;
+  case CLPrecision::BF16:
+    std::transform(src, src + count, (uint16_t *)dst, [](double v) { return FloatToBF16((float)v); });
+    break;
+  }
+}
+
+void ConvertFromAccum(CLPrecision precision, const void *src, size_t count, double *dst) {
+  if (precision == CLPrecision::FP64)
+    memcpy(dst, src, count * sizeof(double));
+  else
+    std::copy((const float *)src, (const float *)src + count, dst);
+}
+
+CLPrecisionError ComputePrecisionError(const double *reference, const double *values, size_t count) {
+  CLPrecisionError error = {0.0, 0.0, 0.0};
+  double sum_sqr = 0.0;
+
+  for (size_t i = 0; i < count; ++i) {
+    double abs_err = fabs(values[i] - reference[i]);
+    double rel_err = abs_err / std::max(fabs(reference[i]), 1.0);
+
+    if (isnan(abs_err))
+      abs_err = rel_err = INFINITY;
+
+    error.max_abs = std::max(error.max_abs, abs_err);
+    error.max_rel = std::max(error.max_rel, rel_err);
+    sum_sqr += rel_err * rel_err;
+  }
+  if (count)
+    error.rms_rel = sqrt(sum_sqr / count);
+  return error;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <stdint.h>
+
+/**
+ * Element precision of a kernel build, the host side of the REAL / REAL_STORAGE / REAL_ACCUM macros:
+ *
+ *   FP32  float storage, float arithmetic
+ *   FP64  double storage, double arithmetic (_USE_DOUBLE_FP)
+ *   FP16  half storage, float arithmetic (_USE_HALF_STORAGE)
+ *   BF16  bfloat16 storage, float arithmetic (_USE_BF16_STORAGE)
+ *
+ * Half-width storage halves the traffic of the memory-bound kernels; the host converts its double data with
+ * ConvertToStorage before the upload, reads the REAL_ACCUM results back with ConvertFromAccum and reports the
+ * error against the double reference with ComputePrecisionError.
+ */
+enum class CLPrecision { FP32, FP64, FP16, BF16 };
+
+/** "fp32", "fp64", "fp16" or "bf16". */
+extern const char *GetPrecisionName(CLPrecision precision);
+/** @return false on an unknown name. */
+extern bool ParsePrecision(const char *name, CLPrecision *precision);
+
+/** Defines to pass to CreateProgramFromSource/File, "" for FP32. */
+extern const char *GetPrecisionBuildDefines(CLPrecision precision);
+
+/** Bytes of a REAL_STORAGE element. */
+extern size_t GetStorageSize(CLPrecision precision);
+/** Bytes of a REAL_ACCUM element, the type the kernels write their results in. */
+extern size_t GetAccumSize(CLPrecision precision);
+
+/**
+ * FP64 needs a double precision config, the half-width formats only use core loads (vload_half) and bit casts.
+ */
+extern bool IsPrecisionSupported(cl_device_id device, CLPrecision precision);
+
+/**
+ * Single channel format of an image1d_buffer over REAL_STORAGE elements, as read by LOAD_REAL_IMAGE: CL_RG
+ * CL_FLOAT for FP64, CL_HALF_FLOAT for FP16, CL_UNSIGNED_INT16 for BF16.
+ */
+extern cl_image_format GetStorageImageFormat(CLPrecision precision);
+
+/** IEEE 754 binary16, round to nearest even. */
+extern uint16_t FloatToHalf(float value);
+extern float HalfToFloat(uint16_t value);
+/** bfloat16, the upper half of a float rounded to nearest even. */
+extern uint16_t FloatToBF16(float value);
+extern float BF16ToFloat(uint16_t value);
+
+/** @param dst holds @param count REAL_STORAGE elements. */
+extern void ConvertToStorage(CLPrecision precision, const double *src, size_t count, void *dst);
+/** @param src holds @param count REAL_ACCUM elements. */
+extern void ConvertFromAccum(CLPrecision precision, const void *src, size_t count, double *dst);
+
+struct CLPrecisionError {
+  double max_abs;
+  double max_rel;   // relative to max(|reference|, 1)
+  double rms_rel;   // root mean square of the relative errors
+};
+
+extern CLPrecisionError ComputePrecisionError(const double *reference, const double *values, size_t count);
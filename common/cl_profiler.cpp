@@ -0,0 +1,269 @@
+#include "cl_profiler.h"
+#include "cl_json.h"
+#include "common_miscs.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#pragma warning(disable: 4996)
+
+static CLProfileCategory __command_category(cl_command_type type) {
+  switch (type) {
+  case CL_COMMAND_NDRANGE_KERNEL:
+  case CL_COMMAND_TASK:
+  case CL_COMMAND_NATIVE_KERNEL:
+    return CLProfileCategory::KERNEL;
+  case CL_COMMAND_READ_BUFFER:
+  case CL_COMMAND_WRITE_BUFFER:
+  case CL_COMMAND_COPY_BUFFER:
+  case CL_COMMAND_READ_IMAGE:
+  case CL_COMMAND_WRITE_IMAGE:
+  case CL_COMMAND_COPY_IMAGE:
+  case CL_COMMAND_COPY_IMAGE_TO_BUFFER:
+  case CL_COMMAND_COPY_BUFFER_TO_IMAGE:
+  case CL_COMMAND_MAP_BUFFER:
+  case CL_COMMAND_MAP_IMAGE:
+  case CL_COMMAND_UNMAP_MEM_OBJECT:
+  case CL_COMMAND_READ_BUFFER_RECT:
+  case CL_COMMAND_WRITE_BUFFER_RECT:
+  case CL_COMMAND_COPY_BUFFER_RECT:
+  case CL_COMMAND_FILL_BUFFER:
+  case CL_COMMAND_FILL_IMAGE:
+  case CL_COMMAND_MIGRATE_MEM_OBJECTS:
+    return CLProfileCategory::TRANSFER;
+  default:
+    return CLProfileCategory::OTHER;
+  }
+}
+
+static std::string __csv_escape(const std::string &s) {
+  if (s.find_first_of(",\"\n") == std::string::npos)
+    return s;
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"')
+      out += '"';
+    out += c;
+  }
+  out += '"';
+  return out;
+}
+
+const char *GetProfileCategoryName(CLProfileCategory category) {
+  switch (category) {
+  case CLProfileCategory::KERNEL:   return "kernel";
+  case CLProfileCategory::TRANSFER: return "transfer";
+  default:                          return "other";
+  }
+}
+
+cl_event *CLProfiler::Mark(const char *name) {
+  std::lock_guard<std::mutex> lck(lock_);
+  pending_.push_back({name, ycl_event()});
+  return pending_.back().ev.GetAddressOf();
+}
+
+CLHRESULT CLProfiler::Record(const char *name, cl_event ev) {
+  std::lock_guard<std::mutex> lck(lock_);
+  pending_.push_back({name, ycl_event()});
+  pending_.back().ev = ev;
+  return CL_SUCCESS;
+}
+
+CLHRESULT CLProfiler::Collect() {
+  CLHRESULT hr = CL_SUCCESS;
+  std::lock_guard<std::mutex> lck(lock_);
+
+  for (auto &pe : pending_) {
+    CLProfileRecord rec;
+    cl_command_type type;
+
+    // The enqueue failed or was never issued.
+    if (pe.ev == nullptr)
+      continue;
+
+    V_RETURN(clWaitForEvents(1, &pe.ev));
+    V_RETURN(clGetEventInfo(pe.ev, CL_EVENT_COMMAND_TYPE, sizeof(type), &type, nullptr));
+    V_RETURN(clGetEventInfo(pe.ev, CL_EVENT_COMMAND_QUEUE, sizeof(rec.queue), &rec.queue, nullptr));
+    V_RETURN(clGetEventProfilingInfo(pe.ev, CL_PROFILING_COMMAND_START, sizeof(rec.start), &rec.start, nullptr));
+    V_RETURN(clGetEventProfilingInfo(pe.ev, CL_PROFILING_COMMAND_END, sizeof(rec.end), &rec.end, nullptr));
+
+    // Some drivers leave QUEUED/SUBMIT unimplemented, those collapse onto START.
+    if (clGetEventProfilingInfo(pe.ev, CL_PROFILING_COMMAND_QUEUED, sizeof(rec.queued), &rec.queued, nullptr) !=
+            CL_SUCCESS || rec.queued > rec.start)
+      rec.queued = rec.start;
+    if (clGetEventProfilingInfo(pe.ev, CL_PROFILING_COMMAND_SUBMIT, sizeof(rec.submit), &rec.submit, nullptr) !=
+            CL_SUCCESS || rec.submit > rec.start || rec.submit < rec.queued)
+      rec.submit = rec.start;
+
+    rec.name = std::move(pe.name);
+    rec.category = __command_category(type);
+    records_.push_back(std::move(rec));
+  }
+
+  pending_.clear();
+  return hr;
+}
+
+void CLProfiler::Reset() {
+  std::lock_guard<std::mutex> lck(lock_);
+  pending_.clear();
+  records_.clear();
+}
+
+std::vector<CLProfileRecord> CLProfiler::GetRecords() {
+  std::lock_guard<std::mutex> lck(lock_);
+  return records_;
+}
+
+void CLProfiler::GetStats(std::vector<CLProfileStats> *stats) {
+  std::lock_guard<std::mutex> lck(lock_);
+  GetStatsLocked(stats);
+}
+
+void CLProfiler::GetStatsLocked(std::vector<CLProfileStats> *stats) {
+  std::unordered_map<std::string, size_t> index;
+  std::vector<std::vector<double>> exec_ms, delay_ms;
+
+  stats->clear();
+  for (auto &rec : records_) {
+    auto it = index.find(rec.name);
+    if (it == index.end()) {
+      it = index.emplace(rec.name, stats->size()).first;
+      stats->push_back({rec.name, rec.category});
+      exec_ms.emplace_back();
+      delay_ms.emplace_back();
+    }
+    exec_ms[it->second].push_back((rec.end - rec.start) * 1.0E-6);
+    delay_ms[it->second].push_back((rec.start - rec.queued) * 1.0E-6);
+  }
+
+  for (size_t i = 0; i < stats->size(); ++i) {
+    CLProfileStats &st = (*stats)[i];
+    auto &ex = exec_ms[i];
+    auto &dl = delay_ms[i];
+
+    std::sort(ex.begin(), ex.end());
+    std::sort(dl.begin(), dl.end());
+
+    st.count = ex.size();
+    st.min_ms = ex.front();
+    st.median_ms = SortedPercentile(ex, 0.5);
+    st.p99_ms = SortedPercentile(ex, 0.99);
+    st.total_ms = 0.0;
+    for (double v : ex)
+      st.total_ms += v;
+    st.mean_ms = st.total_ms / st.count;
+    st.queue_delay_ms = SortedPercentile(dl, 0.5);
+  }
+}
+
+void CLProfiler::PrintSummary(FILE *fp) {
+  std::vector<CLProfileStats> stats;
+  GetStats(&stats);
+
+  fprintf(fp, "%-32s %-8s %6s %10s %10s %10s %10s %10s\n", "name", "category", "count", "min(ms)", "median(ms)",
+          "p99(ms)", "total(ms)", "delay(ms)");
+  for (auto &st : stats) {
+    fprintf(fp, "%-32s %-8s %6zu %10.4f %10.4f %10.4f %10.3f %10.4f\n", st.name.c_str(),
+            GetProfileCategoryName(st.category), st.count, st.min_ms, st.median_ms, st.p99_ms, st.total_ms,
+            st.queue_delay_ms);
+  }
+}
+
+CLHRESULT CLProfiler::WriteJSON(const char *fname) {
+  std::vector<CLProfileStats> stats;
+  FILE *fp = fopen(fname, "w");
+
+  if (!fp) {
+    CL_TRACE(CL_INVALID_VALUE, "Can not open \"%s\" for writing!\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  GetStats(&stats);
+  fprintf(fp, "{\n  \"stats\": [");
+  for (size_t i = 0; i < stats.size(); ++i) {
+    auto &st = stats[i];
+    fprintf(fp,
+            "%s\n    {\"name\": \"%s\", \"category\": \"%s\", \"count\": %zu, \"min_ms\": %.6f, \"median_ms\": %.6f, "
+            "\"p99_ms\": %.6f, \"mean_ms\": %.6f, \"total_ms\": %.6f, \"queue_delay_ms\": %.6f}",
+            i ? "," : "", __json_escape(st.name).c_str(), GetProfileCategoryName(st.category), st.count, st.min_ms,
+            st.median_ms, st.p99_ms, st.mean_ms, st.total_ms, st.queue_delay_ms);
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  fclose(fp);
+
+  return CL_SUCCESS;
+}
+
+CLHRESULT CLProfiler::WriteCSV(const char *fname) {
+  std::vector<CLProfileStats> stats;
+  FILE *fp = fopen(fname, "w");
+
+  if (!fp) {
+    CL_TRACE(CL_INVALID_VALUE, "Can not open \"%s\" for writing!\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  GetStats(&stats);
+  fprintf(fp, "name,category,count,min_ms,median_ms,p99_ms,mean_ms,total_ms,queue_delay_ms\n");
+  for (auto &st : stats) {
+    fprintf(fp, "%s,%s,%zu,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n", __csv_escape(st.name).c_str(),
+            GetProfileCategoryName(st.category), st.count, st.min_ms, st.median_ms, st.p99_ms, st.mean_ms,
+            st.total_ms, st.queue_delay_ms);
+  }
+  fclose(fp);
+
+  return CL_SUCCESS;
+}
+
+CLHRESULT CLProfiler::WriteChromeTrace(const char *fname) {
+  std::lock_guard<std::mutex> lck(lock_);
+  FILE *fp = fopen(fname, "w");
+
+  if (!fp) {
+    CL_TRACE(CL_INVALID_VALUE, "Can not open \"%s\" for writing!\n", fname);
+    return CL_INVALID_VALUE;
+  }
+
+  cl_ulong origin = ~0ull;
+  std::vector<cl_command_queue> queues;
+  for (auto &rec : records_) {
+    origin = std::min(origin, rec.queued);
+    if (std::find(queues.begin(), queues.end(), rec.queue) == queues.end())
+      queues.push_back(rec.queue);
+  }
+
+  // Timestamps are in microseconds relative to the first enqueue.
+  const char *sep = "";
+  fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for (size_t q = 0; q < queues.size(); ++q, sep = ",") {
+    fprintf(fp, "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %zu, "
+                "\"args\": {\"name\": \"command queue %zu\"}}",
+            sep, q, q);
+  }
+  for (auto &rec : records_) {
+    size_t tid = std::find(queues.begin(), queues.end(), rec.queue) - queues.begin();
+    fprintf(fp,
+            "%s\n  {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %zu, \"ts\": %.3f, "
+            "\"dur\": %.3f, \"args\": {\"queued_us\": %.3f, \"submit_us\": %.3f}}",
+            sep, __json_escape(rec.name).c_str(), GetProfileCategoryName(rec.category), tid, (rec.start - origin) * 1.0E-3,
+            (rec.end - rec.start) * 1.0E-3, (rec.queued - origin) * 1.0E-3, (rec.submit - origin) * 1.0E-3);
+    sep = ",";
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+
+  return CL_SUCCESS;
+}
+
+CLHRESULT CLProfiler::WriteReports(const char *basename) {
+  CLHRESULT hr;
+  std::string base = basename;
+
+  V_RETURN(Collect());
+  V_RETURN(WriteJSON((base + ".json").c_str()));
+  V_RETURN(WriteCSV((base + ".csv").c_str()));
+  V_RETURN(WriteChromeTrace((base + ".trace.json").c_str()));
+  return hr;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+/**
+ * Device side timing from CL_QUEUE_PROFILING_ENABLE events.
+ *
+ * Every enqueue to measure hands its event slot to the profiler under a name:
+ *
+ *   clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, gsize, nullptr, 0, nullptr, prof.Mark("mxv_block"));
+ *
+ * Collect() waits for the marked commands and reads their QUEUED/SUBMIT/START/END timestamps, so the
+ * kernel time is separated from the transfers around it and from the host side overhead. Records with the
+ * same name are aggregated over repetitions into min/median/p99 of the execution time (END - START).
+ */
+
+enum class CLProfileCategory { KERNEL, TRANSFER, OTHER };
+
+struct CLProfileRecord {
+  std::string name;
+  CLProfileCategory category;
+  cl_command_queue queue;  // identity only, not retained
+  cl_ulong queued;         // ns, device timer
+  cl_ulong submit;
+  cl_ulong start;
+  cl_ulong end;
+};
+
+struct CLProfileStats {
+  std::string name;
+  CLProfileCategory category;
+  size_t count;
+  double min_ms;
+  double median_ms;
+  double p99_ms;
+  double mean_ms;
+  double total_ms;
+  double queue_delay_ms;   // median of START - QUEUED, time spent waiting before execution
+};
+
+class CLProfiler {
+public:
+  CLProfiler() = default;
+  CLProfiler(const CLProfiler &) = delete;
+  CLProfiler &operator=(const CLProfiler &) = delete;
+
+  /**
+   * @return an event slot to pass as the `event` argument of a clEnqueue* call. The slot stays valid until
+   * the next Collect() or Reset().
+   */
+  cl_event *Mark(const char *name);
+
+  /**
+   * Track an event the caller already owns, the profiler takes its own reference.
+   */
+  CLHRESULT Record(const char *name, cl_event ev);
+
+  /**
+   * Wait for every marked command and move its timestamps into the records.
+   */
+  CLHRESULT Collect();
+
+  void Reset();
+
+  std::vector<CLProfileRecord> GetRecords();
+
+  /**
+   * Aggregate records by name, in the order the names were first marked.
+   */
+  void GetStats(std::vector<CLProfileStats> *stats);
+
+  void PrintSummary(FILE *fp = stdout);
+
+  CLHRESULT WriteJSON(const char *fname);
+  CLHRESULT WriteCSV(const char *fname);
+
+  /**
+   * Chrome trace event format, open with chrome://tracing or ui.perfetto.dev. One track per command queue.
+   */
+  CLHRESULT WriteChromeTrace(const char *fname);
+
+  /**
+   * Collect, then write <basename>.json, <basename>.csv and <basename>.trace.json.
+   */
+  CLHRESULT WriteReports(const char *basename);
+
+private:
+  struct PendingEvent {
+    std::string name;
+    ycl_event ev;
+  };
+
+  void GetStatsLocked(std::vector<CLProfileStats> *stats);
+
+  std::mutex lock_;
+  std::deque<PendingEvent> pending_;  // deque, so slots handed out by Mark never move
+  std::vector<CLProfileRecord> records_;
+};
+
+extern const char *GetProfileCategoryName(CLProfileCategory category);
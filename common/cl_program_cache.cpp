@@ -0,0 +1,351 @@
+#include "cl_program_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <set>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <chrono>
+
+#pragma warning(disable: 4996)
+
+namespace fs = std::filesystem;
+
+static const char g_CacheFileMagic[8] = {'C', 'L', 'X', 'P', 'B', 'I', 'N', '1'};
+
+static std::atomic<size_t> g_CacheHits{0};
+static std::atomic<size_t> g_CacheMisses{0};
+static std::atomic<size_t> g_CacheStores{0};
+static std::atomic<size_t> g_CacheRejects{0};
+
+static std::mutex g_CacheDirLock;
+static std::string g_CacheDir = []() -> std::string {
+  const char *dir = getenv("CLX_PROGRAM_CACHE_DIR");
+  return dir && *dir ? dir : "cl_program_cache";
+}();
+static std::atomic<bool> g_CacheEnabled{getenv("CLX_PROGRAM_CACHE_DISABLE") == nullptr};
+
+/** FNV-1a, good enough to name files; the full key id is compared on load. */
+static uint64_t __fnv1a_64(const void *data, size_t len, uint64_t h = 0xcbf29ce484222325ull) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static CLHRESULT __get_device_string(cl_device_id device, cl_device_info param, std::string &str) {
+  CLHRESULT hr;
+  size_t nlength;
+
+  V_RETURN(clGetDeviceInfo(device, param, 0, nullptr, &nlength));
+  str.resize(nlength);
+  V_RETURN(clGetDeviceInfo(device, param, nlength, &str[0], nullptr));
+  while (!str.empty() && str.back() == '\0')
+    str.pop_back();
+  return hr;
+}
+
+/** Search directories of the OpenCL C compiler: the working directory, then every -I in the build options. */
+static std::vector<fs::path> __include_dirs(const char *options) {
+  std::vector<fs::path> dirs{fs::path(".")};
+  std::istringstream iss(options ? options : "");
+  std::string tok;
+
+  while (iss >> tok) {
+    if (tok == "-I") {
+      if (iss >> tok)
+        dirs.emplace_back(tok);
+    } else if (tok.compare(0, 2, "-I") == 0) {
+      dirs.emplace_back(tok.substr(2));
+    }
+  }
+  return dirs;
+}
+
+/**
+ * Append the content hash of every header the source `#include`s, recursively, so editing a header invalidates
+ * the entry. Only plain `#include "x"`/`#include <x>` lines are followed; headers the compiler finds elsewhere
+ * (its own built-in paths) never change under the cache and are skipped.
+ */
+static void __hash_includes(const char *src,
+                            size_t len,
+                            const std::vector<fs::path> &dirs,
+                            std::set<fs::path> &visited,
+                            std::string &id) {
+  const char *p = src, *end = src + len;
+  char hbuff[24];
+
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+
+    const char *q = p;
+    while (q < eol && (*q == ' ' || *q == '\t')) ++q;
+    if (q < eol && *q == '#') {
+      ++q;
+      while (q < eol && (*q == ' ' || *q == '\t')) ++q;
+      if (eol - q > 7 && strncmp(q, "include", 7) == 0) {
+        q += 7;
+        while (q < eol && (*q == ' ' || *q == '\t')) ++q;
+        char close = q < eol ? (*q == '"' ? '"' : *q == '<' ? '>' : 0) : 0;
+        const char *name_end = close ? (const char *)memchr(q + 1, close, eol - q - 1) : nullptr;
+
+        if (name_end) {
+          std::string name(q + 1, name_end);
+          for (const auto &dir : dirs) {
+            std::error_code ec;
+            fs::path hpath = fs::weakly_canonical(dir / name, ec);
+            if (ec || !fs::is_regular_file(hpath, ec))
+              continue;
+            if (visited.insert(hpath).second) {
+              std::ifstream fin(hpath, std::fstream::binary);
+              std::string text((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+              snprintf(hbuff, sizeof(hbuff), "|%016llx", (unsigned long long)__fnv1a_64(text.data(), text.size()));
+              id += '|';
+              id += name;
+              id += hbuff;
+              __hash_includes(text.data(), text.size(), dirs, visited, id);
+            }
+            break;
+          }
+        }
+      }
+    }
+    p = eol + 1;
+  }
+}
+
+static fs::path __cache_file_path(const CLProgramCacheKey &key) {
+  char fname[32];
+  snprintf(fname, sizeof(fname), "%016llx.clbin", (unsigned long long)key.hash);
+  return fs::path(GetProgramCacheDirectory()) / fname;
+}
+
+void EnableProgramCache(bool enable) { g_CacheEnabled = enable; }
+
+bool IsProgramCacheEnabled() { return g_CacheEnabled; }
+
+void SetProgramCacheDirectory(const char *dir) {
+  std::lock_guard<std::mutex> lck(g_CacheDirLock);
+  g_CacheDir = dir ? dir : "";
+}
+
+std::string GetProgramCacheDirectory() {
+  std::lock_guard<std::mutex> lck(g_CacheDirLock);
+  return g_CacheDir;
+}
+
+void ClearProgramCache() {
+  std::error_code ec;
+  fs::path dir = GetProgramCacheDirectory();
+
+  for (auto it = fs::directory_iterator(dir, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+    if (it->path().extension() == ".clbin")
+      fs::remove(it->path(), ec);
+  }
+}
+
+void GetProgramCacheStats(CLProgramCacheStats *stats) {
+  stats->hits = g_CacheHits;
+  stats->misses = g_CacheMisses;
+  stats->stores = g_CacheStores;
+  stats->rejects = g_CacheRejects;
+}
+
+void ResetProgramCacheStats() {
+  g_CacheHits = 0;
+  g_CacheMisses = 0;
+  g_CacheStores = 0;
+  g_CacheRejects = 0;
+}
+
+CLHRESULT MakeProgramCacheKey(cl_device_id device,
+                              const char *options,
+                              cl_uint count,
+                              const char **strings,
+                              const size_t *lengths,
+                              bool include_headers,
+                              CLProgramCacheKey *key) {
+  CLHRESULT hr;
+  std::string dev_name, drv_version;
+  char hbuff[24];
+
+  V_RETURN(__get_device_string(device, CL_DEVICE_NAME, dev_name));
+  V_RETURN(__get_device_string(device, CL_DRIVER_VERSION, drv_version));
+
+  key->id = dev_name;
+  key->id += '|';
+  key->id += drv_version;
+  key->id += '|';
+  key->id += options ? options : "";
+
+  // Every source string is hashed on its own, so "#define X\n" + "src" never collides with "#define X\nsrc".
+  // Lengths follow clCreateProgramWithSource: strlen only when the array itself is null.
+  std::vector<size_t> lens(count);
+  for (cl_uint i = 0; i < count; ++i) {
+    lens[i] = lengths ? lengths[i] : strlen(strings[i]);
+    snprintf(hbuff, sizeof(hbuff), "|%016llx", (unsigned long long)__fnv1a_64(strings[i], lens[i]));
+    key->id += hbuff;
+  }
+
+  if (include_headers) {
+    std::vector<fs::path> dirs = __include_dirs(options);
+    std::set<fs::path> visited;
+    for (cl_uint i = 0; i < count; ++i)
+      __hash_includes(strings[i], lens[i], dirs, visited, key->id);
+  }
+
+  key->hash = __fnv1a_64(key->id.data(), key->id.size());
+  return hr;
+}
+
+CLHRESULT LoadProgramFromCache(cl_context context,
+                               cl_device_id device,
+                               const char *options,
+                               const CLProgramCacheKey &key,
+                               cl_program *program) {
+  CLHRESULT hr;
+  fs::path fpath = __cache_file_path(key);
+  std::ifstream fin(fpath, std::fstream::binary);
+
+  if (!fin) {
+    ++g_CacheMisses;
+    return CL_INVALID_BINARY;
+  }
+
+  char magic[sizeof(g_CacheFileMagic)];
+  uint32_t id_len = 0;
+  uint64_t bin_len = 0;
+  std::string id;
+  std::vector<unsigned char> binary;
+
+  fin.read(magic, sizeof(magic));
+  fin.read((char *)&id_len, sizeof(id_len));
+  if (fin && memcmp(magic, g_CacheFileMagic, sizeof(magic)) == 0 && id_len == key.id.size()) {
+    id.resize(id_len);
+    fin.read(&id[0], id_len);
+    fin.read((char *)&bin_len, sizeof(bin_len));
+  }
+
+  if (!fin || id != key.id || bin_len == 0) {
+    // Hash collision or stale file format, the entry will be overwritten by the next store.
+    ++g_CacheRejects;
+    ++g_CacheMisses;
+    return CL_INVALID_BINARY;
+  }
+
+  binary.resize((size_t)bin_len);
+  fin.read((char *)binary.data(), (std::streamsize)bin_len);
+  if (!fin) {
+    ++g_CacheRejects;
+    ++g_CacheMisses;
+    return CL_INVALID_BINARY;
+  }
+  fin.close();
+
+  const unsigned char *bin_ptr = binary.data();
+  size_t bin_size = binary.size();
+  cl_int bin_status = CL_SUCCESS;
+  cl_program prog;
+
+  prog = clCreateProgramWithBinary(context, 1, &device, &bin_size, &bin_ptr, &bin_status, &hr);
+  if (CL_SUCCEEDED(hr) && CL_SUCCEEDED(bin_status))
+    hr = clBuildProgram(prog, 1, &device, options, nullptr, nullptr);
+  else if (CL_SUCCEEDED(hr))
+    hr = bin_status;
+
+  if (CL_FAILED(hr)) {
+    // Driver refused the binary (e.g. updated in place without a version bump), fall back to the compiler.
+    if (prog)
+      clReleaseProgram(prog);
+    std::error_code ec;
+    fs::remove(fpath, ec);
+    ++g_CacheRejects;
+    ++g_CacheMisses;
+    return CL_INVALID_BINARY;
+  }
+
+  ++g_CacheHits;
+  *program = prog;
+  return CL_SUCCESS;
+}
+
+CLHRESULT StoreProgramToCache(cl_program program, cl_device_id device, const CLProgramCacheKey &key) {
+  CLHRESULT hr;
+  cl_uint num_devs;
+  std::vector<cl_device_id> devs;
+  std::vector<size_t> bin_sizes;
+  std::vector<std::vector<unsigned char>> binaries;
+  std::vector<unsigned char *> bin_ptrs;
+
+  V_RETURN(clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(num_devs), &num_devs, nullptr));
+  devs.resize(num_devs);
+  bin_sizes.resize(num_devs);
+  binaries.resize(num_devs);
+  bin_ptrs.resize(num_devs);
+  V_RETURN(clGetProgramInfo(program, CL_PROGRAM_DEVICES, num_devs * sizeof(cl_device_id), devs.data(), nullptr));
+  V_RETURN(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, num_devs * sizeof(size_t), bin_sizes.data(), nullptr));
+
+  for (cl_uint i = 0; i < num_devs; ++i) {
+    binaries[i].resize(bin_sizes[i]);
+    bin_ptrs[i] = bin_sizes[i] ? binaries[i].data() : nullptr;
+  }
+  V_RETURN(clGetProgramInfo(program, CL_PROGRAM_BINARIES, num_devs * sizeof(unsigned char *), bin_ptrs.data(),
+                            nullptr));
+
+  cl_uint idev = 0;
+  for (; idev < num_devs && devs[idev] != device; ++idev);
+  if (idev == num_devs || bin_sizes[idev] == 0)
+    return CL_INVALID_BINARY;
+
+  std::error_code ec;
+  fs::path fpath = __cache_file_path(key);
+  fs::create_directories(fpath.parent_path(), ec);
+
+  // Write aside then rename, so concurrent runners never observe a truncated entry.
+  fs::path tmp_path = fpath;
+  char tmp_ext[32];
+  snprintf(tmp_ext, sizeof(tmp_ext), ".%llx.tmp",
+           (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count() ^
+               (unsigned long long)(uintptr_t)&binaries);
+  tmp_path += tmp_ext;
+
+  std::ofstream fout(tmp_path, std::fstream::binary | std::fstream::trunc);
+  if (!fout)
+    return CL_INVALID_BINARY;
+
+  uint32_t id_len = (uint32_t)key.id.size();
+  uint64_t bin_len = bin_sizes[idev];
+  fout.write(g_CacheFileMagic, sizeof(g_CacheFileMagic));
+  fout.write((const char *)&id_len, sizeof(id_len));
+  fout.write(key.id.data(), id_len);
+  fout.write((const char *)&bin_len, sizeof(bin_len));
+  fout.write((const char *)binaries[idev].data(), (std::streamsize)bin_len);
+  fout.close();
+
+  if (!fout) {
+    fs::remove(tmp_path, ec);
+    return CL_INVALID_BINARY;
+  }
+
+  fs::rename(tmp_path, fpath, ec);
+  if (ec) {
+    fs::remove(fpath, ec);
+    fs::rename(tmp_path, fpath, ec);
+    if (ec) {
+      fs::remove(tmp_path, ec);
+      return CL_INVALID_BINARY;
+    }
+  }
+
+  ++g_CacheStores;
+  return CL_SUCCESS;
+}
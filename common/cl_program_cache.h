@@ -0,0 +1,66 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <string>
+
+/**
+ * Persistent on-disk cache of device program binaries.
+ *
+ * Programs built by CreateProgramFromSource are keyed by the hash of every source string (the `defines`
+ * string included) and of the headers they `#include`, the build options, the device name and the driver version; programs built by
+ * CreateProgramFromIL by the hash of the SPIR-V module instead. On a hit the cached CL_PROGRAM_BINARIES blob is
+ * reloaded with clCreateProgramWithBinary, skipping the OpenCL C compiler or the IL translation.
+ *
+ * The cache directory defaults to the environment variable CLX_PROGRAM_CACHE_DIR, or "cl_program_cache"
+ * under the working directory when it is not set. Defining CLX_PROGRAM_CACHE_DISABLE turns the cache off.
+ */
+
+struct CLProgramCacheStats {
+  size_t hits;     // programs created from a cached binary
+  size_t misses;   // programs compiled from source
+  size_t stores;   // binaries written to the cache directory
+  size_t rejects;  // cache entries that failed verification or did not build
+};
+
+struct CLProgramCacheKey {
+  uint64_t hash;
+  std::string id;  // device name, driver version, options and source hashes, verified on load
+};
+
+extern void EnableProgramCache(bool enable);
+extern bool IsProgramCacheEnabled();
+
+extern void SetProgramCacheDirectory(const char *dir);
+extern std::string GetProgramCacheDirectory();
+
+/**
+ * Remove every cached binary from the cache directory.
+ */
+extern void ClearProgramCache();
+
+extern void GetProgramCacheStats(CLProgramCacheStats *stats);
+extern void ResetProgramCacheStats();
+
+/**
+ * @param lengths may be null, every string is then null-terminated; a given length is always used as is.
+ * @param include_headers also hash the headers the sources `#include`, resolved against the working directory
+ *   and the -I paths in `options`. Off for binary inputs such as SPIR-V.
+ */
+extern CLHRESULT MakeProgramCacheKey(cl_device_id device,
+                                     const char *options,
+                                     cl_uint count,
+                                     const char **strings,
+                                     const size_t *lengths,
+                                     bool include_headers,
+                                     CLProgramCacheKey *key);
+
+/**
+ * @return CL_SUCCESS and a built program on hit, CL_INVALID_BINARY on miss.
+ */
+extern CLHRESULT LoadProgramFromCache(cl_context context,
+                                      cl_device_id device,
+                                      const char *options,
+                                      const CLProgramCacheKey &key,
+                                      cl_program *program);
+
+extern CLHRESULT StoreProgramToCache(cl_program program, cl_device_id device, const CLProgramCacheKey &key);
@@ -0,0 +1,112 @@
+#include "cl_queue_pool.h"
+
+CLQueuePool::CLQueuePool(cl_context context, cl_device_id device, bool out_of_order)
+    : out_of_order_(false) {
+  context_ = context;
+  device_ = device;
+
+  if (out_of_order) {
+    cl_command_queue_properties props = 0;
+    if (CL_SUCCEEDED(clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(props), &props, nullptr)))
+      out_of_order_ = (props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+  }
+}
+
+CLQueuePool::~CLQueuePool() {
+  // Outstanding commands still complete after the release, the driver keeps a queue alive until they did.
+  for (auto &entry : thread_queues_)
+    clReleaseCommandQueue(entry.second);
+  for (auto queue : stream_queues_)
+    if (queue)
+      clReleaseCommandQueue(queue);
+}
+
+CLHRESULT CLQueuePool::CreateQueue(cl_command_queue *cmd_queue) {
+  cl_command_queue_properties props = CL_QUEUE_PROFILING_ENABLE;
+
+  if (out_of_order_)
+    props |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+  return CreateCommandQueue2(context_, device_, props, cmd_queue);
+}
+
+CLHRESULT CLQueuePool::GetThreadQueue(cl_command_queue *cmd_queue) {
+  CLHRESULT hr = CL_SUCCESS;
+  std::lock_guard<std::mutex> lck(lock_);
+  std::thread::id tid = std::this_thread::get_id();
+
+  auto it = thread_queues_.find(tid);
+  if (it == thread_queues_.end()) {
+    cl_command_queue queue;
+    V_RETURN(CreateQueue(&queue));
+    it = thread_queues_.emplace(tid, queue).first;
+  }
+
+  *cmd_queue = it->second;
+  return hr;
+}
+
+CLHRESULT CLQueuePool::GetStreamQueue(size_t stream, cl_command_queue *cmd_queue) {
+  CLHRESULT hr = CL_SUCCESS;
+  std::lock_guard<std::mutex> lck(lock_);
+
+  if (stream >= stream_queues_.size())
+    stream_queues_.resize(stream + 1, nullptr);
+  if (stream_queues_[stream] == nullptr)
+    V_RETURN(CreateQueue(&stream_queues_[stream]));
+
+  *cmd_queue = stream_queues_[stream];
+  return hr;
+}
+
+CLHRESULT CLQueuePool::FinishAll() {
+  CLHRESULT hr = CL_SUCCESS;
+  std::vector<cl_command_queue> queues;
+
+  {
+    std::lock_guard<std::mutex> lck(lock_);
+    for (auto &entry : thread_queues_)
+      queues.push_back(entry.second);
+    for (auto queue : stream_queues_)
+      if (queue)
+        queues.push_back(queue);
+  }
+
+  // Without the lock: a clFinish may take long, and the queues live as long as the pool.
+  for (auto queue : queues)
+    V_RETURN(clFinish(queue));
+  return hr;
+}
+
+size_t CLQueuePool::QueueCount() {
+  std::lock_guard<std::mutex> lck(lock_);
+  size_t count = thread_queues_.size();
+
+  for (auto queue : stream_queues_)
+    count += queue != nullptr;
+  return count;
+}
+
+CLHRESULT EnqueueWaitForQueues(cl_command_queue cmd_queue, std::initializer_list<cl_command_queue> others) {
+  CLHRESULT hr = CL_SUCCESS;
+  std::vector<ycl_event> markers(others.size());
+  std::vector<cl_event> waits;
+  size_t i = 0;
+
+  for (auto other : others) {
+    if (other == cmd_queue)
+      continue;
+    // A marker without wait list waits for every command enqueued before it, in-order queue or not.
+    V_RETURN(clEnqueueMarkerWithWaitList(other, 0, nullptr, &markers[i]));
+    V_RETURN(clFlush(other));
+    waits.push_back(markers[i++]);
+  }
+
+  if (!waits.empty())
+    V_RETURN(EnqueueWaitForEvents(cmd_queue, (cl_uint)waits.size(), waits.data()));
+  return hr;
+}
+
+CLHRESULT EnqueueWaitForEvents(cl_command_queue cmd_queue, cl_uint num_events, const cl_event *events,
+                               cl_event *event) {
+  return clEnqueueBarrierWithWaitList(cmd_queue, num_events, events, event);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Command queues on one shared context, one per host thread or per logical stream.
+ *
+ * A single queue serialises every caller of a multithreaded host: enqueues contend on the queue lock of the
+ * driver, and a clFinish waits for the work of all the threads. The pool gives each calling thread
+ * (GetThreadQueue) or each stream index (GetStreamQueue) a queue of its own, created on first use and kept until
+ * the pool is destroyed. Look the queue up once per thread and hold on to it, the lookup takes the pool lock.
+ *
+ * Queues have profiling enabled, and are out-of-order when asked for and CL_DEVICE_QUEUE_PROPERTIES allows it;
+ * otherwise they silently stay in-order. Commands of an out-of-order queue are ordered by their wait lists only.
+ *
+ * Kernels are not shared between threads by the pool: clSetKernelArg on one cl_kernel from several threads
+ * races, create a kernel per thread.
+ */
+class CLQueuePool {
+public:
+  CLQueuePool(cl_context context, cl_device_id device, bool out_of_order = false);
+  ~CLQueuePool();
+
+  CLQueuePool(const CLQueuePool &) = delete;
+  CLQueuePool &operator=(const CLQueuePool &) = delete;
+
+  /** Queue of the calling thread. */
+  CLHRESULT GetThreadQueue(cl_command_queue *cmd_queue);
+
+  /** Queue of logical stream @param stream, shared by every thread using that index. */
+  CLHRESULT GetStreamQueue(size_t stream, cl_command_queue *cmd_queue);
+
+  /** clFinish on every queue of the pool. */
+  CLHRESULT FinishAll();
+
+  /** Whether the queues are out-of-order, false when asked for but not supported by the device. */
+  bool IsOutOfOrder() const { return out_of_order_; }
+
+  size_t QueueCount();
+
+private:
+  CLHRESULT CreateQueue(cl_command_queue *cmd_queue);
+
+  std::mutex lock_;
+  ycl_context context_;
+  ycl_device_id device_;
+  bool out_of_order_;
+  std::map<std::thread::id, cl_command_queue> thread_queues_;
+  std::vector<cl_command_queue> stream_queues_;
+};
+
+/**
+ * Make commands enqueued to @param cmd_queue after this call wait for every command enqueued so far to each of
+ * @param others: a marker on each of them, a barrier waiting on the markers on @param cmd_queue. Nothing blocks
+ * on the host.
+ */
+extern CLHRESULT EnqueueWaitForQueues(cl_command_queue cmd_queue, std::initializer_list<cl_command_queue> others);
+
+/**
+ * Barrier on @param cmd_queue waiting for @param events, typically from other queues of the same context.
+ * @param event (optional) signals once they completed and every earlier command of @param cmd_queue did.
+ */
+extern CLHRESULT EnqueueWaitForEvents(cl_command_queue cmd_queue, cl_uint num_events, const cl_event *events,
+                                      cl_event *event = nullptr);
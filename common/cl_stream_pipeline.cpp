@@ -0,0 +1,184 @@
+#include "cl_stream_pipeline.h"
+#include "common_miscs.h"
+#include <algorithm>
+#include <string.h>
+
+CLStreamPipeline::CLStreamPipeline(cl_context context, cl_device_id device, cl_uint num_queues, cl_uint depth)
+    : num_queues_(std::min(std::max(num_queues, 1u), 3u)), depth_(std::max(depth, 1u)), upload_queue_(nullptr),
+      compute_queue_(nullptr), download_queue_(nullptr), stream_output_(nullptr), output_elem_size_(0),
+      output_buffer_size_(0), result_size_(0), slot_elems_(0) {
+  context_ = context;
+  device_ = device;
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+int CLStreamPipeline::AddInput(const void *host_ptr, size_t elem_size) {
+  inputs_.push_back({(const uint8_t *)host_ptr, elem_size});
+  slot_elems_ = 0;
+  return (int)inputs_.size() - 1;
+}
+
+void CLStreamPipeline::SetChunkOutput(size_t buffer_size, size_t result_size) {
+  RT_ASSERT(result_size <= buffer_size);
+  stream_output_ = nullptr;
+  output_elem_size_ = 0;
+  output_buffer_size_ = buffer_size;
+  result_size_ = result_size;
+  slot_elems_ = 0;
+}
+
+void CLStreamPipeline::SetStreamOutput(void *host_ptr, size_t elem_size) {
+  stream_output_ = (uint8_t *)host_ptr;
+  output_elem_size_ = elem_size;
+  output_buffer_size_ = 0;
+  result_size_ = 0;
+  slot_elems_ = 0;
+}
+
+CLHRESULT CLStreamPipeline::CreateQueues() {
+  CLHRESULT hr = CL_SUCCESS;
+
+  if (!queues_.empty())
+    return hr;
+
+  queues_.resize(num_queues_);
+  for (auto &cmd_queue : queues_)
+    V_RETURN(CreateCommandQueue(context_, device_, &cmd_queue));
+
+  upload_queue_ = queues_[0];
+  compute_queue_ = queues_[num_queues_ > 1 ? 1 : 0];
+  download_queue_ = num_queues_ > 2 ? (cl_command_queue)queues_[2] : compute_queue_;
+  return hr;
+}
+
+CLHRESULT CLStreamPipeline::CreateSlots(size_t chunk_elems) {
+  CLHRESULT hr = CL_SUCCESS;
+
+  if (slot_elems_ >= chunk_elems && slots_.size() == depth_)
+    return hr;
+
+  size_t output_size = stream_output_ ? chunk_elems * output_elem_size_ : output_buffer_size_;
+
+  slots_.clear();
+  slots_.resize(depth_);
+  for (auto &slot : slots_) {
+    slot.inputs.resize(inputs_.size());
+    for (size_t k = 0; k < inputs_.size(); ++k) {
+      V_RETURN2(slot.inputs[k] <<= clCreateBuffer(context_, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                                                  chunk_elems * inputs_[k].elem_size, nullptr, &hr),
+                hr);
+      slot.input_handles.push_back(slot.inputs[k]);
+    }
+    if (output_size) {
+      V_RETURN2(slot.output <<= clCreateBuffer(context_, CL_MEM_READ_WRITE, output_size, nullptr, &hr), hr);
+    }
+  }
+
+  slot_elems_ = chunk_elems;
+  return hr;
+}
+
+CLHRESULT CLStreamPipeline::Run(size_t count, size_t chunk_elems, EnqueueKernelFunc enqueue_kernel) {
+  CLHRESULT hr = CL_SUCCESS;
+
+  RT_ASSERT(chunk_elems > 0);
+
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.chunks = (count + chunk_elems - 1) / chunk_elems;
+  chunk_elems = std::min(chunk_elems, std::max(count, (size_t)1));
+
+  V_RETURN(CreateQueues());
+  V_RETURN(CreateSlots(chunk_elems));
+
+  events_.clear();
+  events_.resize(stats_.chunks);
+  chunk_results_.resize(stats_.chunks * result_size_);
+
+  hp_timer::time_point start = hp_timer::now();
+
+  for (size_t i = 0; i < stats_.chunks; ++i) {
+    Slot &slot = slots_[i % depth_];
+    ChunkEvents &ev = events_[i];
+    ChunkEvents *prev = i >= depth_ ? &events_[i - depth_] : nullptr;
+    std::vector<cl_event> waits;
+
+    CLStreamChunk chunk;
+    chunk.index = i;
+    chunk.offset = i * chunk_elems;
+    chunk.count = std::min(chunk_elems, count - chunk.offset);
+    chunk.slot = (cl_uint)(i % depth_);
+    chunk.inputs = slot.input_handles.data();
+    chunk.output = slot.output;
+
+    // Slot inputs are free once the kernel that last read them completed.
+    ev.uploads.resize(inputs_.size());
+    for (size_t k = 0; k < inputs_.size(); ++k) {
+      const Input &input = inputs_[k];
+      size_t bytes = chunk.count * input.elem_size;
+      cl_event kernel_ev = prev ? (cl_event)prev->kernel : nullptr;
+
+      V_RETURN(clEnqueueWriteBuffer(upload_queue_, slot.inputs[k], CL_FALSE, 0, bytes,
+                                    input.host_ptr + chunk.offset * input.elem_size, kernel_ev ? 1 : 0,
+                                    kernel_ev ? &kernel_ev : nullptr, &ev.uploads[k]));
+      stats_.bytes_uploaded += bytes;
+    }
+
+    // In-order upload queue: the last upload covers the others. The slot output is free once read back.
+    if (!ev.uploads.empty())
+      waits.push_back(ev.uploads.back());
+    if (prev)
+      waits.push_back(prev->download);
+    V_RETURN(enqueue_kernel(compute_queue_, chunk, (cl_uint)waits.size(), waits.empty() ? nullptr : waits.data(),
+                            &ev.kernel));
+
+    cl_event kernel_ev = ev.kernel;
+    if (stream_output_) {
+      size_t bytes = chunk.count * output_elem_size_;
+      V_RETURN(clEnqueueReadBuffer(download_queue_, slot.output, CL_FALSE, 0, bytes,
+                                   stream_output_ + chunk.offset * output_elem_size_, 1, &kernel_ev, &ev.download));
+      stats_.bytes_downloaded += bytes;
+    } else if (result_size_) {
+      V_RETURN(clEnqueueReadBuffer(download_queue_, slot.output, CL_FALSE, 0, result_size_,
+                                   chunk_results_.data() + i * result_size_, 1, &kernel_ev, &ev.download));
+      stats_.bytes_downloaded += result_size_;
+    } else {
+      ev.download = ev.kernel;
+    }
+
+    for (auto &cmd_queue : queues_)
+      V_RETURN(clFlush(cmd_queue));
+  }
+
+  for (auto &cmd_queue : queues_)
+    V_RETURN(clFinish(cmd_queue));
+
+  stats_.wall_ms = fmilliseconds_cast(hp_timer::now() - start).count();
+
+  V_RETURN(CollectStats());
+  return hr;
+}
+
+static double GetCommandTime(cl_event ev) {
+  cl_ulong start = 0, end = 0;
+
+  if (CL_FAILED(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr)) ||
+      CL_FAILED(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr)))
+    return 0.0;
+  return (end - start) * 1.0E-6;
+}
+
+CLHRESULT CLStreamPipeline::CollectStats() {
+  CLHRESULT hr = CL_SUCCESS;
+
+  for (auto &ev : events_) {
+    for (auto &upload : ev.uploads)
+      stats_.upload_ms += GetCommandTime(upload);
+    stats_.kernel_ms += GetCommandTime(ev.kernel);
+    if (ev.download != ev.kernel)
+      stats_.download_ms += GetCommandTime(ev.download);
+  }
+
+  // Only kept for the timings above.
+  events_.clear();
+  return hr;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <vector>
+#include <functional>
+
+/**
+ * Chunked upload/compute/download pipeline for inputs that do not fit the device, or should not be copied in
+ * one piece before the first kernel starts.
+ *
+ * The inputs are cut into chunks of `chunk_elems` elements. Every chunk goes through `depth` rotating slots of
+ * device buffers (2 = ping-pong): chunk i uploads into slot i % depth as soon as the kernel of chunk i - depth
+ * released it, so the upload of one chunk overlaps the kernel of the previous one and the read back of the one
+ * before. Uploads, kernels and downloads go to separate in-order queues (3 queues), downloads share the compute
+ * queue with 2, everything is serialized with 1. Ordering across queues is expressed with events only, the host
+ * never blocks before the end of Run().
+ *
+ * Transfers from pageable host memory are staged by most drivers and overlap less than pinned memory.
+ *
+ *   CLStreamPipeline pipeline(context, device);
+ *   pipeline.AddInput(a.data(), sizeof(float));
+ *   pipeline.SetChunkOutput(partials_size, sizeof(float));
+ *   pipeline.Run(n, 1 << 20, [&](cl_command_queue q, const CLStreamChunk &chunk, cl_uint num_waits,
+ *                                const cl_event *waits, cl_event *event) -> CLHRESULT { ... });
+ *   then reduce GetChunkResult(0 .. ChunkCount() - 1) on the host.
+ */
+
+struct CLStreamChunk {
+  size_t index;          // chunk number
+  size_t offset;         // first element of the chunk in the inputs
+  size_t count;          // elements in the chunk, the last chunk may be short
+  cl_uint slot;
+  const cl_mem *inputs;  // device copy of the chunk, one per AddInput
+  cl_mem output;
+};
+
+struct CLStreamStats {
+  size_t chunks;
+  size_t bytes_uploaded;
+  size_t bytes_downloaded;
+  double wall_ms;        // host time of Run(), first upload to last download
+  double upload_ms;      // device busy time summed over the chunks
+  double kernel_ms;
+  double download_ms;
+};
+
+class CLStreamPipeline {
+public:
+  /**
+   * Enqueue the work of one chunk on @param cmd_queue. The first command must wait on @param waits, the event of
+   * the last command goes to @param event.
+   */
+  using EnqueueKernelFunc = std::function<CLHRESULT(cl_command_queue cmd_queue, const CLStreamChunk &chunk,
+                                                    cl_uint num_waits, const cl_event *waits, cl_event *event)>;
+
+  CLStreamPipeline(cl_context context, cl_device_id device, cl_uint num_queues = 3, cl_uint depth = 2);
+
+  CLStreamPipeline(const CLStreamPipeline &) = delete;
+  CLStreamPipeline &operator=(const CLStreamPipeline &) = delete;
+
+  /** Stream @param host_ptr to the device, @param elem_size bytes per element. @return input index. */
+  int AddInput(const void *host_ptr, size_t elem_size);
+
+  /**
+   * Reduction style output: every slot owns a @param buffer_size bytes buffer, the first @param result_size
+   * bytes of it are read back per chunk into GetChunkResult().
+   */
+  void SetChunkOutput(size_t buffer_size, size_t result_size);
+
+  /** Element-wise output, read back chunk by chunk into @param host_ptr. */
+  void SetStreamOutput(void *host_ptr, size_t elem_size);
+
+  /**
+   * Stream @param count elements through @param enqueue_kernel and wait for the last download. Device buffers
+   * are kept between runs and grown when @param chunk_elems grows.
+   */
+  CLHRESULT Run(size_t count, size_t chunk_elems, EnqueueKernelFunc enqueue_kernel);
+
+  size_t ChunkCount() const { return stats_.chunks; }
+  const void *GetChunkResult(size_t chunk) const { return chunk_results_.data() + chunk * result_size_; }
+
+  /** Statistics of the last Run(). */
+  void GetStats(CLStreamStats *stats) const { *stats = stats_; }
+
+private:
+  struct Input {
+    const uint8_t *host_ptr;
+    size_t elem_size;
+  };
+
+  struct Slot {
+    std::vector<ycl_mem> inputs;
+    std::vector<cl_mem> input_handles;
+    ycl_mem output;
+  };
+
+  struct ChunkEvents {
+    std::vector<ycl_event> uploads;
+    ycl_event kernel;
+    ycl_event download;
+  };
+
+  CLHRESULT CreateQueues();
+  CLHRESULT CreateSlots(size_t chunk_elems);
+  CLHRESULT CollectStats();
+
+  ycl_context context_;
+  ycl_device_id device_;
+  cl_uint num_queues_;
+  cl_uint depth_;
+  std::vector<ycl_command_queue> queues_;
+  cl_command_queue upload_queue_;
+  cl_command_queue compute_queue_;
+  cl_command_queue download_queue_;
+
+  std::vector<Input> inputs_;
+  uint8_t *stream_output_;
+  size_t output_elem_size_;
+  size_t output_buffer_size_;
+  size_t result_size_;
+
+  std::vector<Slot> slots_;
+  size_t slot_elems_;
+  std::vector<ChunkEvents> events_;
+  std::vector<uint8_t> chunk_results_;
+  CLStreamStats stats_;
+};
@@ -0,0 +1,265 @@
+#include "cl_task_graph.h"
+#include <string.h>
+
+CLTaskGraph::CLTaskGraph()
+    : next_queue_(0), launched_(false), done_(false), remaining_(0), first_error_(CL_SUCCESS) {}
+
+CLTaskGraph::~CLTaskGraph() {
+  if (launched_)
+    Wait();
+}
+
+int CLTaskGraph::AddQueue(cl_command_queue cmd_queue) {
+  queues_.emplace_back();
+  queues_.back() = cmd_queue;
+  return (int)queues_.size() - 1;
+}
+
+CLTaskGraph::Node *CLTaskGraph::NewNode(NodeType type, std::initializer_list<NodeId> deps, int queue) {
+
+  RT_ASSERT(!launched_ && "Reset the graph before adding nodes to it again");
+
+  nodes_.emplace_back(new Node());
+  Node *node = nodes_.back().get();
+
+  node->type = type;
+  node->queue = queue;
+  node->graph = this;
+  for (NodeId dep : deps) {
+    RT_ASSERT(dep < nodes_.size() - 1 && "A node can only depend on nodes added before it");
+    node->deps.push_back(dep);
+  }
+
+  return node;
+}
+
+CLTaskGraph::NodeId CLTaskGraph::AddUpload(cl_mem buffer, size_t offset, size_t size, const void *host_ptr,
+                                           std::initializer_list<NodeId> deps, int queue) {
+  Node *node = NewNode(NodeType::UPLOAD, deps, queue);
+  node->buffer = buffer;
+  node->offset = offset;
+  node->size = size;
+  node->src_ptr = host_ptr;
+  return nodes_.size() - 1;
+}
+
+CLTaskGraph::NodeId CLTaskGraph::AddFill(cl_mem buffer, const void *pattern, size_t pattern_size, size_t offset,
+                                         size_t size, std::initializer_list<NodeId> deps, int queue) {
+  Node *node = NewNode(NodeType::FILL, deps, queue);
+  node->buffer = buffer;
+  node->offset = offset;
+  node->size = size;
+  node->pattern.assign((const uint8_t *)pattern, (const uint8_t *)pattern + pattern_size);
+  return nodes_.size() - 1;
+}
+
+CLTaskGraph::NodeId CLTaskGraph::AddKernel(cl_kernel kernel, cl_uint work_dim, const size_t *global_size,
+                                           const size_t *local_size, std::initializer_list<NodeId> deps,
+                                           ArgsSetter set_args, int queue) {
+  Node *node = NewNode(NodeType::KERNEL, deps, queue);
+
+  RT_ASSERT(work_dim >= 1 && work_dim <= 3);
+
+  node->kernel = kernel;
+  node->work_dim = work_dim;
+  node->has_local_size = local_size != nullptr;
+  for (cl_uint i = 0; i < work_dim; ++i) {
+    node->global_size[i] = global_size[i];
+    node->local_size[i] = local_size ? local_size[i] : 0;
+  }
+  node->set_args = std::move(set_args);
+  return nodes_.size() - 1;
+}
+
+CLTaskGraph::NodeId CLTaskGraph::AddDownload(cl_mem buffer, size_t offset, size_t size, void *host_ptr,
+                                             std::initializer_list<NodeId> deps, int queue) {
+  Node *node = NewNode(NodeType::DOWNLOAD, deps, queue);
+  node->buffer = buffer;
+  node->offset = offset;
+  node->size = size;
+  node->dst_ptr = host_ptr;
+  return nodes_.size() - 1;
+}
+
+CLTaskGraph::NodeId CLTaskGraph::AddHostCallback(HostFunc func, std::initializer_list<NodeId> deps) {
+  Node *node = NewNode(NodeType::HOST, deps, -1);
+  node->host_func = std::move(func);
+  return nodes_.size() - 1;
+}
+
+int CLTaskGraph::SelectQueue(const Node &node) {
+
+  if (node.queue >= 0)
+    return node.queue;
+
+  // Following the producer keeps a chain on one in-order queue, where ordering costs nothing.
+  for (NodeId dep : node.deps) {
+    const Node &dep_node = *nodes_[dep];
+    if (dep_node.type != NodeType::HOST)
+      return dep_node.queue;
+  }
+
+  int queue = next_queue_;
+  next_queue_ = (next_queue_ + 1) % (int)queues_.size();
+  return queue;
+}
+
+CLHRESULT CLTaskGraph::EnqueueNode(Node &node) {
+  CLHRESULT hr = CL_SUCCESS;
+  std::vector<cl_event> wait_list;
+
+  if (node.type == NodeType::HOST)
+    return ScheduleHostNode(node);
+
+  node.queue = SelectQueue(node);
+  RT_ASSERT(node.queue < (int)queues_.size());
+
+  cl_command_queue cmd_queue = queues_[node.queue];
+  for (NodeId dep : node.deps)
+    wait_list.push_back(nodes_[dep]->event);
+
+  cl_uint num_waits = (cl_uint)wait_list.size();
+  const cl_event *waits = num_waits ? wait_list.data() : nullptr;
+  cl_event *event = node.event.ReleaseAndGetAddressOf();
+
+  switch (node.type) {
+  case NodeType::UPLOAD:
+    V_RETURN(clEnqueueWriteBuffer(cmd_queue, node.buffer, CL_FALSE, node.offset, node.size, node.src_ptr, num_waits,
+                                  waits, event));
+    break;
+  case NodeType::FILL:
+    V_RETURN(clEnqueueFillBuffer(cmd_queue, node.buffer, node.pattern.data(), node.pattern.size(), node.offset,
+                                 node.size, num_waits, waits, event));
+    break;
+  case NodeType::KERNEL:
+    if (node.set_args)
+      V_RETURN(node.set_args(node.kernel));
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, node.kernel, node.work_dim, nullptr, node.global_size,
+                                    node.has_local_size ? node.local_size : nullptr, num_waits, waits, event));
+    break;
+  case NodeType::DOWNLOAD:
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, node.buffer, CL_FALSE, node.offset, node.size, node.dst_ptr, num_waits,
+                                 waits, event));
+    break;
+  default:
+    break;
+  }
+
+  return hr;
+}
+
+CLHRESULT CLTaskGraph::ScheduleHostNode(Node &node) {
+  CLHRESULT hr;
+  cl_context context;
+
+  V_RETURN(clGetCommandQueueInfo(queues_[0], CL_QUEUE_CONTEXT, sizeof(context), &context, nullptr));
+  V_RETURN2(node.event <<= clCreateUserEvent(context, &hr), hr);
+
+  node.host_status = CL_SUCCESS;
+  node.host_remaining = (int)node.deps.size();
+
+  if (node.deps.empty()) {
+    node.host_func();
+    V_RETURN(clSetUserEventStatus(node.event, CL_COMPLETE));
+    return hr;
+  }
+
+  for (NodeId dep : node.deps)
+    V_RETURN(clSetEventCallback(nodes_[dep]->event, CL_COMPLETE, &CLTaskGraph::OnHostDependencyComplete, &node));
+
+  return hr;
+}
+
+void CL_CALLBACK CLTaskGraph::OnHostDependencyComplete(cl_event ev, cl_int status, void *user_data) {
+  Node *node = (Node *)user_data;
+
+  // Negative status: the dependency was terminated, propagate instead of running the callback.
+  if (status < 0) {
+    cl_int expected = CL_SUCCESS;
+    node->host_status.compare_exchange_strong(expected, status);
+  }
+
+  if (--node->host_remaining == 0) {
+    cl_int host_status = node->host_status;
+    if (host_status == CL_SUCCESS)
+      node->host_func();
+    clSetUserEventStatus(node->event, host_status == CL_SUCCESS ? CL_COMPLETE : host_status);
+  }
+}
+
+void CL_CALLBACK CLTaskGraph::OnNodeComplete(cl_event ev, cl_int status, void *user_data) {
+  Node *node = (Node *)user_data;
+  node->graph->NodeFinished(status);
+}
+
+void CLTaskGraph::NodeFinished(cl_int status) {
+
+  if (status < 0) {
+    cl_int expected = CL_SUCCESS;
+    first_error_.compare_exchange_strong(expected, status);
+  }
+
+  if (--remaining_ == 0) {
+    if (on_complete_)
+      on_complete_(first_error_);
+
+    std::lock_guard<std::mutex> lck(lock_);
+    done_ = true;
+    done_cv_.notify_all();
+  }
+}
+
+CLHRESULT CLTaskGraph::Launch(CompletionFunc on_complete) {
+  CLHRESULT hr = CL_SUCCESS;
+
+  RT_ASSERT(!launched_ && !queues_.empty());
+
+  on_complete_ = std::move(on_complete);
+  first_error_ = CL_SUCCESS;
+  done_ = false;
+  launched_ = true;
+
+  // One extra count held until every node is enqueued, so completion can not fire half way.
+  remaining_ = nodes_.size() + 1;
+
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    Node &node = *nodes_[i];
+
+    hr = EnqueueNode(node);
+    if (CL_SUCCEEDED(hr))
+      hr = clSetEventCallback(node.event, CL_COMPLETE, &CLTaskGraph::OnNodeComplete, &node);
+
+    if (CL_FAILED(hr)) {
+      cl_int expected = CL_SUCCESS;
+      first_error_.compare_exchange_strong(expected, hr);
+      // The nodes never enqueued will not report back.
+      remaining_ -= nodes_.size() - i;
+      break;
+    }
+  }
+
+  for (auto &cmd_queue : queues_)
+    clFlush(cmd_queue);
+
+  NodeFinished(CL_SUCCESS);
+  return hr;
+}
+
+CLHRESULT CLTaskGraph::Wait() {
+
+  if (!launched_)
+    return CL_SUCCESS;
+
+  std::unique_lock<std::mutex> lck(lock_);
+  done_cv_.wait(lck, [this]() { return done_; });
+  return first_error_;
+}
+
+cl_event CLTaskGraph::GetEvent(NodeId id) const { return nodes_[id]->event; }
+
+void CLTaskGraph::Reset() {
+  Wait();
+  nodes_.clear();
+  next_queue_ = 0;
+  launched_ = false;
+}
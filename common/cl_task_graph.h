@@ -0,0 +1,132 @@
+#pragma once
+
+#include "cl_utils.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * Dependency driven executor of uploads, kernels, downloads and host callbacks.
+ *
+ * Nodes are added with the ids of the nodes they depend on, so the graph is topologically ordered by
+ * construction. Launch() enqueues every node with the events of its dependencies as wait-list and returns
+ * without blocking; independent chains overlap when the graph is given an out-of-order queue or several in-order
+ * queues. A node without an explicit queue follows its first device dependency, or takes the next queue round
+ * robin when it has none.
+ *
+ * Host callbacks run from clSetEventCallback once all their dependencies completed, on a driver thread: they must
+ * not block on OpenCL calls. Device nodes depending on a host callback wait on its user event.
+ *
+ * Buffers, kernels and host pointers handed to the graph must stay valid until the graph completed; buffers and
+ * kernels are retained, host pointers are not.
+ */
+class CLTaskGraph {
+public:
+  using NodeId = size_t;
+  using ArgsSetter = std::function<CLHRESULT(cl_kernel)>;
+  using HostFunc = std::function<void()>;
+  using CompletionFunc = std::function<void(CLHRESULT)>;
+
+  CLTaskGraph();
+  ~CLTaskGraph();
+
+  CLTaskGraph(const CLTaskGraph &) = delete;
+  CLTaskGraph &operator=(const CLTaskGraph &) = delete;
+
+  /** All queues must belong to the same context. Returns the queue index for explicit placement. */
+  int AddQueue(cl_command_queue cmd_queue);
+
+  NodeId AddUpload(cl_mem buffer, size_t offset, size_t size, const void *host_ptr,
+                   std::initializer_list<NodeId> deps = {}, int queue = -1);
+
+  NodeId AddFill(cl_mem buffer, const void *pattern, size_t pattern_size, size_t offset, size_t size,
+                 std::initializer_list<NodeId> deps = {}, int queue = -1);
+
+  /**
+   * @param set_args runs right before the kernel is enqueued, so nodes may share one cl_kernel with different
+   * arguments. Kernels without it are enqueued with the arguments set at Launch time.
+   * @param local_size may be nullptr.
+   */
+  NodeId AddKernel(cl_kernel kernel, cl_uint work_dim, const size_t *global_size, const size_t *local_size,
+                   std::initializer_list<NodeId> deps = {}, ArgsSetter set_args = nullptr, int queue = -1);
+
+  NodeId AddDownload(cl_mem buffer, size_t offset, size_t size, void *host_ptr,
+                     std::initializer_list<NodeId> deps = {}, int queue = -1);
+
+  NodeId AddHostCallback(HostFunc func, std::initializer_list<NodeId> deps = {});
+
+  /**
+   * Enqueue every node and flush the queues. @param on_complete runs on a driver thread once every node finished,
+   * with the first error hit, if any.
+   */
+  CLHRESULT Launch(CompletionFunc on_complete = nullptr);
+
+  /**
+   * Block until the launched graph completed, @return its first error.
+   */
+  CLHRESULT Wait();
+
+  bool IsComplete() const { return remaining_ == 0; }
+
+  /** Event of a node, valid after Launch. */
+  cl_event GetEvent(NodeId id) const;
+
+  /** Wait for the launched graph, then drop every node. Queues are kept. */
+  void Reset();
+
+  size_t NodeCount() const { return nodes_.size(); }
+
+private:
+  enum class NodeType { UPLOAD, FILL, KERNEL, DOWNLOAD, HOST };
+
+  struct Node {
+    NodeType type;
+    std::vector<NodeId> deps;
+    int queue;
+    ycl_event event;
+
+    ycl_mem buffer;
+    size_t offset;
+    size_t size;
+    const void *src_ptr;
+    void *dst_ptr;
+    std::vector<uint8_t> pattern;
+
+    ycl_kernel kernel;
+    cl_uint work_dim;
+    size_t global_size[3];
+    size_t local_size[3];
+    bool has_local_size;
+    ArgsSetter set_args;
+
+    HostFunc host_func;
+    std::atomic<int> host_remaining;
+    std::atomic<cl_int> host_status;
+
+    CLTaskGraph *graph;
+  };
+
+  Node *NewNode(NodeType type, std::initializer_list<NodeId> deps, int queue);
+  int SelectQueue(const Node &node);
+  CLHRESULT EnqueueNode(Node &node);
+  CLHRESULT ScheduleHostNode(Node &node);
+  void NodeFinished(cl_int status);
+
+  static void CL_CALLBACK OnHostDependencyComplete(cl_event ev, cl_int status, void *user_data);
+  static void CL_CALLBACK OnNodeComplete(cl_event ev, cl_int status, void *user_data);
+
+  std::vector<ycl_command_queue> queues_;
+  std::vector<std::unique_ptr<Node>> nodes_;
+  int next_queue_;
+  bool launched_;
+
+  std::mutex lock_;
+  std::condition_variable done_cv_;
+  bool done_;                         // guarded by lock_
+  std::atomic<size_t> remaining_;
+  std::atomic<cl_int> first_error_;
+  CompletionFunc on_complete_;
+};
@@ -1,4 +1,5 @@
 #include "cl_utils.h"
+#include "cl_program_cache.h"
 #include <CL/cl_gl_ext.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -266,6 +267,78 @@ extern CLHRESULT FindOpenCLPlatform2(cl_device_type dev_type,
   return sel_platform ? CL_SUCCESS : -1;
 }
 
+CLHRESULT EnumOpenCLDevices(cl_device_type dev_type,
+                            std::initializer_list<const char *> preferred_plats,
+                            std::initializer_list<const char *> req_extensions,
+                            std::vector<cl_platform_id> *plat_ids,
+                            std::vector<cl_device_id> *devices) {
+  CLHRESULT hr;
+  cl_uint num_plats;
+
+  plat_ids->clear();
+  devices->clear();
+
+  V_RETURN(clGetPlatformIDs(0, nullptr, &num_plats));
+  if (num_plats == 0) {
+    hr = -1;
+    CL_TRACE(hr, "No Platform found!\n");
+    return hr;
+  }
+
+  std::vector<cl_platform_id> platforms{num_plats};
+  V_RETURN(clGetPlatformIDs(num_plats, &platforms[0], nullptr));
+
+  size_t nlength;
+  std::vector<char> name;
+  cl_uint num_devs;
+  std::vector<cl_device_id> devs;
+  bool preferred_name_matched;
+  cl_device_type dev_type2;
+
+  for (auto itPlat = platforms.begin(); itPlat != platforms.end(); ++itPlat) {
+
+    if (preferred_plats.size() != 0) {
+      V_RETURN(clGetPlatformInfo(*itPlat, CL_PLATFORM_NAME, 0, nullptr, &nlength));
+      name.resize(nlength + 1);
+      name[nlength] = 0;
+      V_RETURN(clGetPlatformInfo(*itPlat, CL_PLATFORM_NAME, nlength, &name[0], nullptr));
+
+      preferred_name_matched = false;
+      for (auto it_name = preferred_plats.begin(); it_name != preferred_plats.end(); ++it_name) {
+        if (_strnicmp(*it_name, name.data(), strlen(*it_name)) == 0) {
+          preferred_name_matched = true;
+          break;
+        }
+      }
+      if (!preferred_name_matched)
+        continue;
+    }
+
+    // A platform without devices of the requested type reports CL_DEVICE_NOT_FOUND, that is not an error here.
+    num_devs = 0;
+    hr = clGetDeviceIDs(*itPlat, dev_type, 0, nullptr, &num_devs);
+    if (hr == CL_DEVICE_NOT_FOUND || num_devs == 0)
+      continue;
+    V_RETURN(hr);
+
+    devs.resize(num_devs);
+    V_RETURN(clGetDeviceIDs(*itPlat, dev_type, num_devs, devs.data(), nullptr));
+
+    for (auto it_dev = devs.begin(); it_dev != devs.end(); ++it_dev) {
+      V_RETURN(clGetDeviceInfo(*it_dev, CL_DEVICE_TYPE, sizeof(dev_type2), &dev_type2, nullptr));
+      if ((dev_type2 & dev_type) == 0)
+        continue;
+
+      if (CheckCLExtensions(*it_dev, req_extensions) == CL_SUCCESS) {
+        plat_ids->push_back(*itPlat);
+        devices->push_back(*it_dev);
+      }
+    }
+  }
+
+  return devices->empty() ? CL_DEVICE_NOT_FOUND : CL_SUCCESS;
+}
+
 CLHRESULT CreateDeviceContext(cl_platform_id plat_id, cl_device_id dev, cl_context *dev_ctx) {
   CLHRESULT hr;
 
@@ -276,6 +349,11 @@ CLHRESULT CreateDeviceContext(cl_platform_id plat_id, cl_device_id dev, cl_conte
 }
 
 CLHRESULT CreateCommandQueue(cl_context dev_ctx, cl_device_id device, cl_command_queue *cmd_queue) {
+  return CreateCommandQueue2(dev_ctx, device, CL_QUEUE_PROFILING_ENABLE, cmd_queue);
+}
+
+CLHRESULT CreateCommandQueue2(cl_context dev_ctx, cl_device_id device, cl_command_queue_properties properties,
+                              cl_command_queue *cmd_queue) {
 
   CLHRESULT hr;
   size_t nlength;
@@ -301,13 +379,12 @@ CLHRESULT CreateCommandQueue(cl_context dev_ctx, cl_device_id device, cl_command
   }
 
   if (ver >= 2.0f) {
-    const cl_command_queue_properties cmd_queue_props[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+    const cl_command_queue_properties cmd_queue_props[] = {CL_QUEUE_PROPERTIES, properties, 0};
     *cmd_queue = clCreateCommandQueueWithProperties(dev_ctx, device, cmd_queue_props, &hr);
     V_RETURN(hr);
   } else if (ver >= 1.2f) {
 
-    const cl_command_queue_properties cmd_queue_props[] = {CL_QUEUE_PROFILING_ENABLE};
-    *cmd_queue = clCreateCommandQueue(dev_ctx, device, cmd_queue_props[0], &hr);
+    *cmd_queue = clCreateCommandQueue(dev_ctx, device, properties, &hr);
     V_RETURN(hr);
   } else {
     hr = -1;
@@ -318,45 +395,26 @@ CLHRESULT CreateCommandQueue(cl_context dev_ctx, cl_device_id device, cl_command
   return hr;
 }
 
+// The REAL and storage format macros, one copy shared with common.cl.h. The embedded text starts with the
+// "#endif" and ends with the "#ifdef" of its own marker lines, __prelude_open and __prelude_close balance them.
+static const char __prelude[] =
+#define __CL_PRELUDE_EMBED
+#include "common_prelude.cl.h"
+#undef __CL_PRELUDE_EMBED
+    ;
+static const char __prelude_open[] = "\n#if 1";
+static const char __prelude_close[] = "#endif\n";
+
 CLHRESULT CreateProgramFromSource(
     cl_context context, cl_device_id device, const char *defines, const char *source, size_t src_len, cl_program *program) {
 
   CLHRESULT hr;
-  char internal_defs[] =
-      R"(
-/** check fp arithmetic format */
-#ifdef _USE_DOUBLE_FP
-  #define REAL    double
-  #define REAL2   double2
-  #define REAL3   double3
-  #define REAL4   double4 
-  #define REAL16  double16
-  #define REAL2x2 double2x2
-  #define REAL3x3 double3x3
-  #define REAL4x4 double4x4
-
-  /** enable fp64 extension */
-  #if defined(cl_amd_fp64)
-      #pragma OPENCL EXTENSION cl_amd_fp64 : enable
-  #elif defined(cl_khr_fp64)
-      #pragma OPENCL EXTENSION cl_khr_fp64 : enable
-  #endif /** enable fp64 extension */
-#else /** _USE_DOUBLE_FP */
-  #define REAL    float
-  #define REAL2   float2
-  #define REAL3   float3
-  #define REAL4   float4 
-  #define REAL16  float16
-  #define REAL2x2 float2x2
-  #define REAL3x3 float3x3
-  #define REAL4x4 float4x4
-#endif /** _USE_DOUBLE_FP */
-)";
 
   if(!defines) defines = "";
 
-  const char *sources[] = {defines, internal_defs, source};
-  size_t src_lens[] = {strlen(defines), _countof(internal_defs) - 1, src_len};
+  const char *sources[] = {defines, __prelude_open, __prelude, __prelude_close, source};
+  size_t src_lens[] = {strlen(defines), _countof(__prelude_open) - 1, _countof(__prelude) - 1,
+                       _countof(__prelude_close) - 1, src_len};
 
   char tempbuff[256];
   V_RETURN(clGetDeviceInfo(device, CL_DEVICE_OPENCL_C_VERSION, sizeof(tempbuff), tempbuff, nullptr));
@@ -368,6 +426,13 @@ CLHRESULT CreateProgramFromSource(
   char cl_optbuff[128];
   sprintf_s(cl_optbuff, _countof(cl_optbuff), "-cl-std=CL%s", pver);
 
+  CLProgramCacheKey cache_key;
+  bool use_cache = IsProgramCacheEnabled() && CL_SUCCEEDED(MakeProgramCacheKey(device, cl_optbuff, _countof(sources),
+                                                                                sources, src_lens, true, &cache_key));
+
+  if (use_cache && CL_SUCCEEDED(LoadProgramFromCache(context, device, cl_optbuff, cache_key, program)))
+    return CL_SUCCESS;
+
   V_RETURN2(*program = clCreateProgramWithSource(context, _countof(sources), sources, src_lens, &hr), hr);
 
   hr = clBuildProgram(*program, 1, &device, cl_optbuff, nullptr, nullptr);
@@ -380,13 +445,24 @@ CLHRESULT CreateProgramFromSource(
     build_log.resize(log_size);
     clGetProgramBuildInfo(*program, device, CL_PROGRAM_BUILD_LOG, log_size, build_log.data(), nullptr);
     CL_TRACE(hr, "Build CL program erorr, log:\n%s\n", build_log.data());
+
+    // Not asserted: a source edited while the kernel registry reloads it may not build, the caller keeps its
+    // previous program.
+    clReleaseProgram(*program);
+    *program = nullptr;
+    return hr;
   }
 
   if (CL_FAILED(hr)) {
+    clReleaseProgram(*program);
     *program = nullptr;
     V_RETURN(hr);
   }
 
+  // A failed store only costs the next run a compile.
+  if (use_cache)
+    StoreProgramToCache(*program, device, cache_key);
+
   return hr;
 }
 
@@ -406,6 +482,15 @@ CLHRESULT CreateProgramFromIL(cl_context context, cl_device_id device,
   char cl_optbuff[128];
   sprintf_s(cl_optbuff, _countof(cl_optbuff), "-cl-std=CL%s", pver);
 
+  // The IL is the source here: a hit skips the runtime's SPIR-V translation and the device compile.
+  const char *il_strings[] = {(const char *)il};
+  CLProgramCacheKey cache_key;
+  bool use_cache = IsProgramCacheEnabled() &&
+                   CL_SUCCEEDED(MakeProgramCacheKey(device, cl_optbuff, 1, il_strings, &il_len, false, &cache_key));
+
+  if (use_cache && CL_SUCCEEDED(LoadProgramFromCache(context, device, cl_optbuff, cache_key, program)))
+    return CL_SUCCESS;
+
   V_RETURN2(*program = clCreateProgramWithIL(context, il, il_len, &hr), hr);
 
   hr = clBuildProgram(*program, 1, &device, cl_optbuff, nullptr, nullptr);
@@ -420,14 +505,22 @@ CLHRESULT CreateProgramFromIL(cl_context context, cl_device_id device,
     clGetProgramBuildInfo(*program, device, CL_PROGRAM_BUILD_LOG, log_size,
                           build_log.data(), nullptr);
     CL_TRACE(hr, "Build CL program erorr, log:\n%s\n", build_log.data());
+
+    // Not asserted, as for CreateProgramFromSource.
+    clReleaseProgram(*program);
+    *program = nullptr;
     return hr;
   }
 
   if (CL_FAILED(hr)) {
+    clReleaseProgram(*program);
     *program = nullptr;
     V_RETURN(hr);
   }
 
+  if (use_cache)
+    StoreProgramToCache(*program, device, cache_key);
+
   return hr;
 }
 
@@ -3,6 +3,7 @@
 #include <CL/cl.h>
 #include <assert.h>
 #include <type_traits>
+#include <vector>
 
 #pragma once
 
@@ -242,10 +243,24 @@ extern CLHRESULT FindOpenCLPlatform2(cl_device_type dev_type,
                                      cl_platform_id *plat_id,
                                      cl_device_id *device);
 
+/**
+ * Enumerate every device matching @param dev_type (a bit mask, CL_DEVICE_TYPE_ALL is allowed) across all the
+ * platforms, in platform order. @param plat_ids and @param devices receive one entry per matched device.
+ */
+extern CLHRESULT EnumOpenCLDevices(cl_device_type dev_type,
+                                   std::initializer_list<const char *> preferred_plats,
+                                   std::initializer_list<const char *> req_extensions,
+                                   std::vector<cl_platform_id> *plat_ids,
+                                   std::vector<cl_device_id> *devices);
+
 extern CLHRESULT CreateDeviceContext(
   cl_platform_id plat_id, cl_device_id dev, cl_context *dev_ctx);
 
+/** In-order queue with profiling enabled. */
 extern CLHRESULT CreateCommandQueue(cl_context dev_ctx, cl_device_id device, cl_command_queue *cmd_queue);
+/** Queue with explicit @param properties, e.g. CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE. */
+extern CLHRESULT CreateCommandQueue2(cl_context dev_ctx, cl_device_id device, cl_command_queue_properties properties,
+                                     cl_command_queue *cmd_queue);
 
 extern CLHRESULT CreateProgramFromSource(
   cl_context context, cl_device_id device, const char *defines, const char *source, size_t src_len, cl_program *program);
@@ -264,8 +279,8 @@ private:
     size_t arg_len = sizeof(*arg);
     return clSetKernelArg(kernel, i, arg_len, arg);
   }
-  template <>
-  CLHRESULT _SetKernelArg<size_t>(cl_kernel kernel, size_t i, const size_t &arg) const {
+  // An overload rather than an explicit specialization, which is not allowed at class scope.
+  CLHRESULT _SetKernelArg(cl_kernel kernel, size_t i, const size_t &arg) const {
     return clSetKernelArg(kernel, i, arg, nullptr);
   }
 public:
@@ -277,6 +292,10 @@ public:
   }
 };
 
+/**
+ * Every argument by address, a bare size_t meaning a __local argument of that many bytes.
+ * KernelLauncher (cl_kernel_launcher.h) binds typed values and LocalMem{bytes} instead.
+ */
 template<typename ...TArgs>
 CLHRESULT SetKernelArguments(cl_kernel kernel, const TArgs& ...args) {
 
@@ -1,4 +1,6 @@
 #include "common_miscs.h"
+#include <algorithm>
+#include <cmath>
 
 std::default_random_engine g_RandomEngine{[]() -> std::random_device::result_type {
   std::random_device rdev;
@@ -7,4 +9,9 @@ std::default_random_engine g_RandomEngine{[]() -> std::random_device::result_typ
 
 template <> fmilliseconds fmilliseconds_cast<hp_timer::duration>(const hp_timer::duration &dur) {
   return std::chrono::duration_cast<fmilliseconds>(dur);
-}
\ No newline at end of file
+}
+
+double SortedPercentile(const std::vector<double> &sorted, double p) {
+  size_t rank = (size_t)std::ceil(p * sorted.size());
+  return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
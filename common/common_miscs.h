@@ -1,6 +1,7 @@
 #pragma once
 #include <random>
 #include <chrono>
+#include <vector>
 
 using hp_timer = std::chrono::high_resolution_clock;
 using fmilliseconds = std::chrono::duration<float, std::milli>;
@@ -9,4 +10,7 @@ template<typename Duration> extern fmilliseconds fmilliseconds_cast(const Durati
 
 template<> fmilliseconds fmilliseconds_cast<hp_timer::duration>(const hp_timer::duration &dur);
 
-extern std::default_random_engine g_RandomEngine;
\ No newline at end of file
+extern std::default_random_engine g_RandomEngine;
+
+/** Nearest rank percentile of a sorted, non empty sample; p in [0, 1]. */
+extern double SortedPercentile(const std::vector<double> &sorted, double p);
@@ -0,0 +1,67 @@
+/**
+ * Arithmetic and storage format macros, shared by common.cl.h and the prelude CreateProgramFromSource puts in
+ * front of every source. The host embeds this file as a raw string (__CL_PRELUDE_EMBED, see cl_utils.cpp); OpenCL
+ * C has no raw string literals and skips the marker lines as an excluded group.
+ */
+#ifdef __CL_PRELUDE_EMBED
+R"__cl_prelude__(
+#endif
+/** check fp arithmetic format */
+#ifdef _USE_DOUBLE_FP
+  #define REAL    double
+  #define REAL2   double2
+  #define REAL3   double3
+  #define REAL4   double4 
+  #define REAL16  double16
+  #define REAL2x2 double2x2
+  #define REAL3x3 double3x3
+  #define REAL4x4 double4x4
+
+  /** enable fp64 extension */
+  #if defined(cl_amd_fp64)
+      #pragma OPENCL EXTENSION cl_amd_fp64 : enable
+  #elif defined(cl_khr_fp64)
+      #pragma OPENCL EXTENSION cl_khr_fp64 : enable
+  #endif /** enable fp64 extension */
+#else /** _USE_DOUBLE_FP */
+  #define REAL    float
+  #define REAL2   float2
+  #define REAL3   float3
+  #define REAL4   float4 
+  #define REAL16  float16
+  #define REAL2x2 float2x2
+  #define REAL3x3 float3x3
+  #define REAL4x4 float4x4
+#endif /** _USE_DOUBLE_FP */
+
+/**
+ * Storage format of the memory-bound kernels: REAL_STORAGE is the element type in global memory, REAL_ACCUM the
+ * arithmetic type. _USE_HALF_STORAGE (fp16 through vload_half/vstore_half, no cl_khr_fp16 needed) and
+ * _USE_BF16_STORAGE (bfloat16 as ushort) accumulate in float and are not combined with _USE_DOUBLE_FP.
+ */
+#if defined(_USE_HALF_STORAGE)
+  #define REAL_STORAGE  half
+  #define REAL_ACCUM    float
+  #define LOAD_REAL(p, i)         vload_half((i), (p))
+  #define STORE_REAL(p, i, v)     vstore_half_rte((v), (i), (p))
+  #define LOAD_REAL_IMAGE(img, i) read_imagef((img), (i)).x
+#elif defined(_USE_BF16_STORAGE)
+  #define REAL_STORAGE  ushort
+  #define REAL_ACCUM    float
+  #define LOAD_REAL(p, i)         as_float((uint)(p)[(i)] << 16)
+  #define STORE_REAL(p, i, v)     ((p)[(i)] = (ushort)((as_uint(v) + 0x7fffu + ((as_uint(v) >> 16) & 1u)) >> 16))
+  #define LOAD_REAL_IMAGE(img, i) as_float(read_imageui((img), (i)).x << 16)
+#else
+  #define REAL_STORAGE  REAL
+  #define REAL_ACCUM    REAL
+  #define LOAD_REAL(p, i)         (p)[(i)]
+  #define STORE_REAL(p, i, v)     ((p)[(i)] = (v))
+  #ifdef _USE_DOUBLE_FP
+    #define LOAD_REAL_IMAGE(img, i) as_double(read_imagef((img), (i)).xy)
+  #else
+    #define LOAD_REAL_IMAGE(img, i) read_imagef((img), (i)).x
+  #endif
+#endif /** storage format */
+#ifdef __CL_PRELUDE_EMBED
+)__cl_prelude__"
+#endif
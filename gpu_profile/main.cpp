@@ -1,55 +1,85 @@
 #include <cl_utils.h>
+#include <cl_device_db.h>
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 
-int main() {
+/**
+ * Capability record and measured rates of every OpenCL device, CPU devices included. Rates come from the device
+ * database (cl_device_db.json, or CLX_DEVICE_DB) when the device and driver are already in it; --remeasure runs
+ * the micro-benchmarks again and updates the database.
+ */
 
-  CLHRESULT hr;
-  cl_platform_id platfrom;
-  ycl_context context;
-  ycl_device_id device;
-  char nbuff[256];
-  cl_ulong mem_size;
-  cl_uint mem_cacheline_size;
-
-  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {}, {}, &platfrom, &device));
-
-  V_RETURN(CreateDeviceContext(platfrom, device, &context));
-
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(nbuff), nbuff, 0));
-  printf("GPU device name: %s\n", nbuff);
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_VENDOR, sizeof(nbuff), nbuff, 0));
-  printf("  device vendor: %s\n", nbuff);
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(nbuff), nbuff, 0));
-  printf("  device version: %s\n", nbuff);
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_OPENCL_C_VERSION, sizeof(nbuff), nbuff, 0));
-  printf("  device OpenCL C version: %s\n", nbuff);
+static const char *GetDeviceTypeName(cl_device_type type) {
+  if (type & CL_DEVICE_TYPE_GPU)
+    return "GPU";
+  if (type & CL_DEVICE_TYPE_CPU)
+    return "CPU";
+  if (type & CL_DEVICE_TYPE_ACCELERATOR)
+    return "Accelerator";
+  return "Other";
+}
+
+static void PrintDeviceProfile(size_t index, const CLDeviceProfile &profile) {
+  const CLDeviceCaps &caps = profile.caps;
+  const CLDeviceMetrics &metrics = profile.metrics;
+
+  printf("[%zu] %s device name: %s\n", index, GetDeviceTypeName(caps.type), caps.name.c_str());
+  printf("  device vendor: %s\n", caps.vendor.c_str());
+  printf("  driver version: %s\n", caps.driver.c_str());
+  printf("  device version: %s\n", caps.version.c_str());
+  printf("  device OpenCL C version: %s\n", caps.opencl_c_version.c_str());
+  printf("  device IL version: %s\n", caps.il_version.empty() ? "none" : caps.il_version.c_str());
+  printf("  compute units: %u, max clock: %uMHz\n", caps.compute_units, caps.clock_mhz);
 
   printf("  memory info:\n");
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, sizeof(mem_size), &mem_size, 0));
-  printf("    global memory cache size: %lluKB\n", mem_size >> 10);
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, sizeof(mem_cacheline_size), &mem_cacheline_size, 0));
-  printf("    global memory cache line size: %uB\n", mem_cacheline_size);
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(mem_size), &mem_size, 0));
-  printf("    global memory size: %lluMB\n", mem_size >> 20);
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(mem_size), &mem_size, 0));
-  printf("    local memory size: %lluKB\n", mem_size >> 10);
-
-  cl_device_local_mem_type type;
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_TYPE, sizeof(type), &type, nullptr));
-  printf("    local memory implementation type: %s\n", type == CL_GLOBAL ? "Global Mem" : "SRAM");
-
-  cl_command_queue_properties cq_props;
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(cq_props), &cq_props, nullptr));
+  printf("    global memory cache size: %lluKB\n", (unsigned long long)caps.global_mem_cache_size >> 10);
+  printf("    global memory cache line size: %uB\n", caps.global_mem_cacheline_size);
+  printf("    global memory size: %lluMB\n", (unsigned long long)caps.global_mem_size >> 20);
+  printf("    max allocation size: %lluMB\n", (unsigned long long)caps.max_alloc_size >> 20);
+  printf("    constant buffer size: %lluKB\n", (unsigned long long)caps.max_constant_size >> 10);
+  printf("    local memory size: %lluKB\n", (unsigned long long)caps.local_mem_size >> 10);
+  printf("    local memory implementation type: %s\n", caps.local_mem_sram ? "SRAM" : "Global Mem");
+  printf("    base address alignment: %uB\n", caps.mem_base_addr_align / 8);
+  printf("    host unified memory: %s\n", caps.host_unified_memory ? "yes" : "no");
+
   printf("  command-queue executation mode supported:\n");
-  if(cq_props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
-    printf("        out of order executation\n");
-  else
-    printf("        serialized executation\n");
+  printf("        %s\n", caps.out_of_order_queue ? "out of order executation" : "serialized executation");
+
+  printf("  maximum number of work-items in a work-group: %zu\n", caps.max_work_group_size);
+  printf("  maximum work-item sizes: (%zu, %zu, %zu)\n", caps.max_work_item_sizes[0], caps.max_work_item_sizes[1],
+         caps.max_work_item_sizes[2]);
+  printf("  float vector width: preferred %u, native %u\n", caps.preferred_vector_width_float,
+         caps.native_vector_width_float);
+  printf("  fp64: %s, images: %s\n", caps.fp64 ? "yes" : "no", caps.image_support ? "yes" : "no");
+
+  printf("  measured:\n");
+  printf("    global memory bandwidth: %.1fGB/s\n", metrics.global_gbps);
+  printf("    local memory bandwidth:  %.1fGB/s\n", metrics.local_gbps);
+  printf("    global atomics:          %.2fGop/s\n", metrics.atomics_gops);
+  printf("    fp32:                    %.1fGFLOP/s\n", metrics.fp32_gflops);
+  if (caps.fp64)
+    printf("    fp64:                    %.1fGFLOP/s\n", metrics.fp64_gflops);
+  printf("    kernel launch latency:   %.1fus\n", metrics.launch_us);
+  printf("    upload / download:       %.1f / %.1fGB/s\n", metrics.upload_gbps, metrics.download_gbps);
+}
+
+int main(int argc, char **argv) {
+
+  CLHRESULT hr;
+  std::vector<CLDeviceProfile> profiles;
+  bool remeasure = false;
+
+  for (int i = 1; i < argc; ++i)
+    remeasure = remeasure || strcmp(argv[i], "--remeasure") == 0;
+
+  V_RETURN(GetAllDeviceProfiles(&profiles, remeasure));
 
-  size_t max_work_group_size;
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, nullptr));
-  printf("  maximum number of work-items in a work-group: %llu\n", max_work_group_size);
+  printf("Device database: %s\n", GetDeviceDBPath().c_str());
+  for (size_t i = 0; i < profiles.size(); ++i) {
+    PrintDeviceProfile(i, profiles[i]);
+    printf("\n");
+  }
 
   return 0;
-}
\ No newline at end of file
+}
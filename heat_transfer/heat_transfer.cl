@@ -6,15 +6,21 @@
  *  and 1D function in time span.
  */
 
+#ifndef INIT_KERNEL_LOCAL_SIZE_X
 #define INIT_KERNEL_LOCAL_SIZE_X         64
+#endif
 
 typedef struct __attribute__((packed)) diff_params {
   int4 dims;
   float4 params;
 } diff_params;
 
+#ifndef LOCAL_SIZE_X
 #define LOCAL_SIZE_X    16
+#endif
+#ifndef LOCAL_SIZE_Y
 #define LOCAL_SIZE_Y    16
+#endif
 
 __attribute__((reqd_work_group_size(INIT_KERNEL_LOCAL_SIZE_X, 1, 1)))
 __kernel void heat_transfer_init(
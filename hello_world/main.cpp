@@ -1,4 +1,5 @@
 #include <cl_utils.h>
+#include <cl_task_graph.h>
 #include <vector>
 #include <random>
 #include <fstream>
@@ -104,7 +105,6 @@ CLHRESULT TestComputePi(cl_context context, cl_command_queue cmd_queue, cl_progr
   const size_t local_size = 128;
   const size_t global_work_size = local_size * 128;
   const uint32_t num_division = 1 << 26;
-  ycl_event done_ev;
   double pi_result;
 
   V_RETURN((ker1 <<= clCreateKernel(program, "PI1", &hr), hr));
@@ -116,21 +116,21 @@ CLHRESULT TestComputePi(cl_context context, cl_command_queue cmd_queue, cl_progr
   V_RETURN(clSetKernelArg(ker1, 1, sizeof(double) * local_size, nullptr));
   V_RETURN(clSetKernelArg(ker1, 2, sizeof(cl_mem), &temp_buffer));
 
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker1, 1, nullptr, &global_work_size, &local_size, 0, nullptr, nullptr));
-
-  clEnqueueBarrier(cmd_queue);
-
   uint32_t local_size32 = local_size;
-  clSetKernelArg(ker2, 0, sizeof(uint32_t), &local_size32);
-  clSetKernelArg(ker2, 1, sizeof(double) * local_size, nullptr);
-  clSetKernelArg(ker2, 2, sizeof(cl_mem), &temp_buffer);
-
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker2, 1, nullptr, &local_size, &local_size, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, temp_buffer, false, 0, sizeof(pi_result), &pi_result, 0, nullptr, done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &done_ev));
-
-  printf("Compute PI result: %.18f\n", pi_result);
+  V_RETURN(clSetKernelArg(ker2, 0, sizeof(uint32_t), &local_size32));
+  V_RETURN(clSetKernelArg(ker2, 1, sizeof(double) * local_size, nullptr));
+  V_RETURN(clSetKernelArg(ker2, 2, sizeof(cl_mem), &temp_buffer));
+
+  // PI2 reduces the partial sums of PI1: an event dependency instead of a queue wide barrier.
+  CLTaskGraph graph;
+  graph.AddQueue(cmd_queue);
+  auto pi1 = graph.AddKernel(ker1, 1, &global_work_size, &local_size);
+  auto pi2 = graph.AddKernel(ker2, 1, &local_size, &local_size, {pi1});
+  auto read = graph.AddDownload(temp_buffer, 0, sizeof(pi_result), &pi_result, {pi2});
+  graph.AddHostCallback([&pi_result]() { printf("Compute PI result: %.18f\n", pi_result); }, {read});
+
+  V_RETURN(graph.Launch());
+  V_RETURN(graph.Wait());
 
   return hr;
 }
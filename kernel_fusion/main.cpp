@@ -0,0 +1,176 @@
+#include <cl_utils.h>
+#include <cl_backend.h>
+#include <cl_kernel_composer.h>
+#include <common_miscs.h>
+#include <benchmark.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+/**
+ * sum over i of (A[i,:] . x - b[i])^2, A of rows x cols, in single precision.
+ *
+ * unfused: mxv -> subtract -> square -> reduce, four kernels passing rows-long intermediates through global
+ *   memory.
+ * fused: one kernel from the same stages, the intermediates never leave registers.
+ *
+ * Both are generated by CLKernelComposer; the reported time is the kernel time summed from the events, the bytes
+ * are the compulsory traffic (A, x and b read once) for both.
+ */
+
+static const size_t g_LocalSize = 256;
+static const size_t g_MaxGroups = 1024;
+
+struct ResidualPrograms {
+  ycl_program program;
+  ycl_kernel mxv, sub, sqr, sum;
+  ycl_kernel fused;
+};
+
+static CLHRESULT BuildResidualPrograms(cl_context context, cl_device_id device, ResidualPrograms *progs) {
+  CLHRESULT hr;
+  CLKernelComposer mxv("residual_mxv"), sub("residual_sub"), sqr("residual_sqr"), sum("residual_sum");
+  CLKernelComposer fused("residual_sqr_sum_fused");
+
+  mxv.Input("A").Input("x").Param("ncols").RowDot("A", "x", "ncols").Store("y");
+  sub.Input("y").Input("b").Load("y").Map("v - b[i]").Store("d");
+  sqr.Input("d").Load("d").Map("v * v").Store("s");
+  sum.Input("s").Load("s").ReduceSum("partials");
+  fused.Input("A").Input("x").Input("b").Param("ncols")
+      .RowDot("A", "x", "ncols").Map("v - b[i]").Map("v * v").ReduceSum("partials");
+
+  V_RETURN(BuildComposedProgram(context, device, {&mxv, &sub, &sqr, &sum, &fused}, g_LocalSize, &progs->program));
+  V_RETURN2(progs->mxv <<= clCreateKernel(progs->program, mxv.Name().c_str(), &hr), hr);
+  V_RETURN2(progs->sub <<= clCreateKernel(progs->program, sub.Name().c_str(), &hr), hr);
+  V_RETURN2(progs->sqr <<= clCreateKernel(progs->program, sqr.Name().c_str(), &hr), hr);
+  V_RETURN2(progs->sum <<= clCreateKernel(progs->program, sum.Name().c_str(), &hr), hr);
+  V_RETURN2(progs->fused <<= clCreateKernel(progs->program, fused.Name().c_str(), &hr), hr);
+  return hr;
+}
+
+static double ResidualSqrSumCPU(const std::vector<float> &A, const std::vector<float> &x, const std::vector<float> &b,
+                                size_t rows, size_t cols) {
+  double total = 0.0;
+
+  for (size_t i = 0; i < rows; ++i) {
+    double dot = 0.0;
+    for (size_t k = 0; k < cols; ++k)
+      dot += (double)A[i * cols + k] * x[k];
+    total += (dot - b[i]) * (dot - b[i]);
+  }
+  return total;
+}
+
+static CLHRESULT TestResidual(cl_context context, cl_command_queue cmd_queue, const ResidualPrograms &progs,
+                              bool fused, BenchState &state) {
+  CLHRESULT hr;
+  size_t rows = (size_t)state.GetInt("rows");
+  size_t cols = (size_t)state.GetInt("cols");
+  size_t ngroups = std::min(RoundC(rows, g_LocalSize) / g_LocalSize, g_MaxGroups);
+  size_t rows_global = RoundC(rows, g_LocalSize);
+  size_t reduce_global = ngroups * g_LocalSize;
+  cl_uint nrows = (cl_uint)rows, ncols = (cl_uint)cols;
+  std::uniform_real_distribution<float> rd(-1.0f, 1.0f);
+  std::vector<float> A(rows * cols), x(cols), b(rows), partials(ngroups);
+  ycl_buffer A_buff, x_buff, b_buff, y_buff, d_buff, s_buff, partials_buff;
+  ycl_event evs[4];
+  double result = 0.0;
+
+  for (auto &v : A)
+    v = rd(g_RandomEngine);
+  for (auto &v : x)
+    v = rd(g_RandomEngine);
+  for (auto &v : b)
+    v = rd(g_RandomEngine);
+
+  V_RETURN2(A_buff <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, A.size() * sizeof(float),
+                                      A.data(), &hr),
+            hr);
+  V_RETURN2(x_buff <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, x.size() * sizeof(float),
+                                      x.data(), &hr),
+            hr);
+  V_RETURN2(b_buff <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, b.size() * sizeof(float),
+                                      b.data(), &hr),
+            hr);
+  V_RETURN2(partials_buff <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, ngroups * sizeof(float), nullptr, &hr), hr);
+
+  if (fused) {
+    V_RETURN(SetKernelArguments(progs.fused, &A_buff, &x_buff, &b_buff, &ncols, &nrows, &partials_buff));
+  } else {
+    V_RETURN2(y_buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE, rows * sizeof(float), nullptr, &hr), hr);
+    V_RETURN2(d_buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE, rows * sizeof(float), nullptr, &hr), hr);
+    V_RETURN2(s_buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE, rows * sizeof(float), nullptr, &hr), hr);
+    V_RETURN(SetKernelArguments(progs.mxv, &A_buff, &x_buff, &ncols, &nrows, &y_buff));
+    V_RETURN(SetKernelArguments(progs.sub, &y_buff, &b_buff, &nrows, &d_buff));
+    V_RETURN(SetKernelArguments(progs.sqr, &d_buff, &nrows, &s_buff));
+    V_RETURN(SetKernelArguments(progs.sum, &s_buff, &nrows, &partials_buff));
+  }
+
+  while (state.KeepRunning()) {
+    double ms = 0.0, kernel_ms;
+    int nevs = 0;
+
+    if (fused) {
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, progs.fused, 1, nullptr, &reduce_global, &g_LocalSize, 0, nullptr,
+                                      &evs[nevs++]));
+    } else {
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, progs.mxv, 1, nullptr, &rows_global, &g_LocalSize, 0, nullptr,
+                                      &evs[nevs++]));
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, progs.sub, 1, nullptr, &rows_global, &g_LocalSize, 0, nullptr,
+                                      &evs[nevs++]));
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, progs.sqr, 1, nullptr, &rows_global, &g_LocalSize, 0, nullptr,
+                                      &evs[nevs++]));
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, progs.sum, 1, nullptr, &reduce_global, &g_LocalSize, 0, nullptr,
+                                      &evs[nevs++]));
+    }
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, partials_buff, CL_TRUE, 0, ngroups * sizeof(float), partials.data(), 0,
+                                 nullptr, nullptr));
+
+    for (int i = 0; i < nevs; ++i) {
+      V_RETURN(GetEventElapsedTime(evs[i], &kernel_ms));
+      ms += kernel_ms;
+      evs[i] = nullptr;
+    }
+    state.SetIterationTime(ms);
+
+    result = 0.0;
+    for (float p : partials)
+      result += p;
+  }
+
+  double expected = ResidualSqrSumCPU(A, x, b, rows, cols);
+  state.SetBytesProcessed((rows * cols + cols + rows) * sizeof(float));
+  state.SetFlopsProcessed(2.0 * rows * cols + 3.0 * rows);
+  state.SetVerified(fabs(result - expected) <= 1.0E-3 * std::max(1.0, fabs(expected)));
+  return hr;
+}
+
+int main(int argc, char **argv) {
+
+  CLHRESULT hr;
+  CLComputeBackend backend;
+  ResidualPrograms progs;
+
+  V_RETURN(backend.Init({"NVIDIA CUDA", "AMD"}));
+  if (!backend.HasDevice()) {
+    printf("No OpenCL device, nothing to measure\n");
+    return 0;
+  }
+
+  cl_context context = backend.Context();
+  cl_command_queue cmd_queue = backend.Queue();
+  V_RETURN(BuildResidualPrograms(context, backend.Device(), &progs));
+
+  BenchmarkSuite suite("kernel_fusion");
+  suite.ParseArgs(argc, argv);
+
+  auto sweep = MakeParamSweep({{"rows", {1024, 4096, 16384}}, {"cols", {64, 256, 1024}}});
+  suite.Register("residual_unfused", sweep,
+                 [&](BenchState &state) { return TestResidual(context, cmd_queue, progs, false, state); });
+  suite.Register("residual_fused", sweep,
+                 [&](BenchState &state) { return TestResidual(context, cmd_queue, progs, true, state); });
+
+  return suite.Run();
+}
@@ -0,0 +1,11 @@
+// Next to nothing to do: the launches measure host overhead, not the kernel.
+__kernel void scale_tail(__global float *y, __global const float *x, float a, uint n, __local float *scratch) {
+
+  uint gid = get_global_id(0);
+  uint lid = get_local_id(0);
+
+  scratch[lid] = gid < n ? a * x[gid] : 0.0f;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (gid < n)
+    y[gid] = scratch[lid];
+}
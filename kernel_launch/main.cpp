@@ -0,0 +1,150 @@
+#include <cl_utils.h>
+#include <cl_kernel_launcher.h>
+#include <common_miscs.h>
+#include <benchmark.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * Host cost of one kernel launch, the enqueue calls only; the queue is drained outside the timed section.
+ *
+ * create_set_enqueue: clCreateKernel, SetKernelArguments and clEnqueueNDRangeKernel per launch, what a test
+ *   that creates its kernel on every run pays.
+ * set_enqueue: one kernel, SetKernelArguments on every launch.
+ * launcher: cached KernelLauncher, unchanged arguments are not set again.
+ * launcher_scalar: cached KernelLauncher with one scalar changing every launch.
+ *
+ * Reported times are per launch.
+ */
+
+static const uint32_t g_ElemCount = 1024;
+static const size_t g_LocalSize = 64;
+
+// y, x, a, n, scratch
+using ScaleTailLauncher = KernelLauncher<ycl_buffer, ycl_buffer, float, cl_uint, LocalMem>;
+
+struct LaunchBuffers {
+  ycl_buffer y;
+  ycl_buffer x;
+};
+
+static CLHRESULT TestCreateSetEnqueue(cl_command_queue cmd_queue, cl_program program, const LaunchBuffers &buffs,
+                                      BenchState &state) {
+  CLHRESULT hr;
+  int batch = (int)state.GetInt("batch");
+  size_t global_size = g_ElemCount;
+  size_t local_size = g_LocalSize;
+  float a = 2.0f;
+  cl_uint n = g_ElemCount;
+  size_t scratch_len = g_LocalSize * sizeof(float);
+  ycl_kernel kernel;
+
+  while (state.KeepRunning()) {
+    hp_timer::time_point start = hp_timer::now();
+    for (int i = 0; i < batch; ++i) {
+      V_RETURN2(kernel <<= clCreateKernel(program, "scale_tail", &hr), hr);
+      V_RETURN(SetKernelArguments(kernel, &buffs.y, &buffs.x, &a, &n, scratch_len));
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, &global_size, &local_size, 0, nullptr, nullptr));
+    }
+    state.SetIterationTime(fmilliseconds_cast(hp_timer::now() - start).count() / batch);
+    V_RETURN(clFinish(cmd_queue));
+  }
+
+  return hr;
+}
+
+static CLHRESULT TestSetEnqueue(cl_command_queue cmd_queue, cl_program program, const LaunchBuffers &buffs,
+                                BenchState &state) {
+  CLHRESULT hr;
+  int batch = (int)state.GetInt("batch");
+  size_t global_size = g_ElemCount;
+  size_t local_size = g_LocalSize;
+  float a = 2.0f;
+  cl_uint n = g_ElemCount;
+  size_t scratch_len = g_LocalSize * sizeof(float);
+  ycl_kernel kernel;
+
+  V_RETURN2(kernel <<= clCreateKernel(program, "scale_tail", &hr), hr);
+
+  while (state.KeepRunning()) {
+    hp_timer::time_point start = hp_timer::now();
+    for (int i = 0; i < batch; ++i) {
+      V_RETURN(SetKernelArguments(kernel, &buffs.y, &buffs.x, &a, &n, scratch_len));
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, &global_size, &local_size, 0, nullptr, nullptr));
+    }
+    state.SetIterationTime(fmilliseconds_cast(hp_timer::now() - start).count() / batch);
+    V_RETURN(clFinish(cmd_queue));
+  }
+
+  return hr;
+}
+
+static CLHRESULT TestLauncher(cl_command_queue cmd_queue, cl_program program, const LaunchBuffers &buffs,
+                              bool vary_scalar, BenchState &state) {
+  CLHRESULT hr;
+  int batch = (int)state.GetInt("batch");
+  size_t global_size = g_ElemCount;
+  size_t local_size = g_LocalSize;
+  cl_uint n = g_ElemCount;
+  ScaleTailLauncher launcher;
+
+  V_RETURN(launcher.Create(program, "scale_tail"));
+
+  while (state.KeepRunning()) {
+    hp_timer::time_point start = hp_timer::now();
+    for (int i = 0; i < batch; ++i) {
+      float a = vary_scalar ? (float)i : 2.0f;
+      V_RETURN(launcher.SetArgs(buffs.y, buffs.x, a, n, LocalMem{g_LocalSize * sizeof(float)}));
+      V_RETURN(launcher.Enqueue(cmd_queue, 1, &global_size, &local_size));
+    }
+    state.SetIterationTime(fmilliseconds_cast(hp_timer::now() - start).count() / batch);
+    V_RETURN(clFinish(cmd_queue));
+  }
+
+  return hr;
+}
+
+int main(int argc, char **argv) {
+
+  CLHRESULT hr;
+  ycl_platform_id platform;
+  ycl_device_id device;
+  ycl_context context;
+  ycl_command_queue cmd_queue;
+  ycl_program program;
+  LaunchBuffers buffs;
+
+  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {"NVIDIA CUDA", "AMD"}, {}, &platform, &device));
+  V_RETURN(CreateDeviceContext(platform, device, &context));
+  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
+  V_RETURN(CreateProgramFromFile(context, device, nullptr, "kernel_launch.cl", &program));
+
+  std::vector<float> x_data(g_ElemCount, 1.0f);
+  V_RETURN2(buffs.x <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, g_ElemCount * sizeof(float),
+                                       x_data.data(), &hr),
+            hr);
+  V_RETURN2(buffs.y <<= clCreateBuffer(context, CL_MEM_READ_WRITE, g_ElemCount * sizeof(float), nullptr, &hr), hr);
+
+  BenchmarkSuite suite("kernel_launch");
+  suite.ParseArgs(argc, argv);
+
+  auto sweep = MakeParamSweep({{"batch", {1, 64, 1024}}});
+  suite.Register("create_set_enqueue", sweep,
+                 [&](BenchState &state) { return TestCreateSetEnqueue(cmd_queue, program, buffs, state); });
+  suite.Register("set_enqueue", sweep,
+                 [&](BenchState &state) { return TestSetEnqueue(cmd_queue, program, buffs, state); });
+  suite.Register("launcher", sweep,
+                 [&](BenchState &state) { return TestLauncher(cmd_queue, program, buffs, false, state); });
+  suite.Register("launcher_scalar", sweep,
+                 [&](BenchState &state) { return TestLauncher(cmd_queue, program, buffs, true, state); });
+
+  hr = suite.Run();
+
+  CLKernelCacheStats stats;
+  GetKernelCacheStats(&stats);
+  printf("Kernel cache: %zu hits, %zu misses\n", stats.hits, stats.misses);
+
+  ClearKernelCache();
+  return hr;
+}
@@ -0,0 +1,179 @@
+#include "batched_ops.h"
+#include <cl_backend.h>
+#include <cl_kernel_launcher.h>
+#include <immintrin.h>
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+
+namespace batched {
+
+// reqd_work_group_size of the kernels: BATCH_LOCAL_SIZE of matrix.cl, BATCH_MXV_LANES x BATCH_MXV_ROWS of
+// mat_mul_vec.cl
+static const size_t g_MatMulLocalSize = 256;
+static const size_t g_MxvLanes = 8;
+static const size_t g_MxvRows = 32;
+// the kernels loop over what a launch of this many work groups does not cover
+static const size_t g_MaxGroups = 65536;
+// problems per thread below which the host side stays on fewer threads
+static const size_t g_HostGrain = 16;
+
+using uint4_arg = std::array<uint32_t, 4>;
+
+template <typename TOffsets>
+static CLHRESULT __enqueue_mat_mul(cl_command_queue cmd_queue, cl_program program, const char *kernel_name,
+                                   cl_mem A, cl_mem B, cl_mem C, cl_uint M, cl_uint K, cl_uint N,
+                                   const TOffsets &problem_offsets, cl_uint batch, cl_event *event) {
+  CLHRESULT hr;
+  KernelLauncher<cl_mem, cl_mem, cl_mem, uint4_arg, TOffsets, cl_uint> launcher;
+  const uint4_arg MKN = {M, K, N, 0};
+  size_t global_size = std::min(RoundC((size_t)batch * M * N, g_MatMulLocalSize), g_MatMulLocalSize * g_MaxGroups);
+  size_t local_size = g_MatMulLocalSize;
+
+  if (batch == 0 || M == 0 || N == 0)
+    return CL_SUCCESS;
+
+  V_RETURN(launcher.Create(program, kernel_name));
+  V_RETURN(launcher.SetArgs(A, B, C, MKN, problem_offsets, batch));
+  V_RETURN(launcher.Enqueue(cmd_queue, 1, &global_size, &local_size, 0, nullptr, event));
+  return hr;
+}
+
+CLHRESULT enqueue_mat_mul(cl_command_queue cmd_queue, cl_program program, cl_mem A, cl_mem B, cl_mem C, cl_uint M,
+                          cl_uint K, cl_uint N, const strides &stride, cl_uint batch, cl_event *event) {
+  return __enqueue_mat_mul(cmd_queue, program, "mat_mul_batched", A, B, C, M, K, N,
+                           uint4_arg{stride.a, stride.b, stride.c, 0}, batch, event);
+}
+
+CLHRESULT enqueue_mat_mul(cl_command_queue cmd_queue, cl_program program, cl_mem A, cl_mem B, cl_mem C, cl_uint M,
+                          cl_uint K, cl_uint N, cl_mem problem_offsets, cl_uint batch, cl_event *event) {
+  return __enqueue_mat_mul(cmd_queue, program, "mat_mul_batched_indexed", A, B, C, M, K, N, problem_offsets, batch,
+                           event);
+}
+
+template <typename TOffsets>
+static CLHRESULT __enqueue_mxv(cl_command_queue cmd_queue, cl_program program, const char *kernel_name, cl_mem mat,
+                               cl_mem vec, cl_mem r, cl_uint rows, cl_uint cols, cl_uint pitch,
+                               const TOffsets &problem_offsets, cl_uint batch, cl_event *event) {
+  CLHRESULT hr;
+  KernelLauncher<cl_mem, cl_mem, cl_uint, cl_uint, cl_uint, TOffsets, cl_uint, cl_mem> launcher;
+  size_t groups = std::min(((size_t)batch * rows + g_MxvRows - 1) / g_MxvRows, g_MaxGroups);
+  size_t global_size[2] = {groups * g_MxvLanes, g_MxvRows};
+  size_t local_size[2] = {g_MxvLanes, g_MxvRows};
+
+  if (batch == 0 || rows == 0)
+    return CL_SUCCESS;
+
+  V_RETURN(launcher.Create(program, kernel_name));
+  V_RETURN(launcher.SetArgs(mat, vec, rows, cols, pitch, problem_offsets, batch, r));
+  V_RETURN(launcher.Enqueue(cmd_queue, 2, global_size, local_size, 0, nullptr, event));
+  return hr;
+}
+
+CLHRESULT enqueue_mxv(cl_command_queue cmd_queue, cl_program program, cl_mem mat, cl_mem vec, cl_mem r,
+                      cl_uint rows, cl_uint cols, cl_uint pitch, const strides &stride, cl_uint batch,
+                      cl_event *event) {
+  return __enqueue_mxv(cmd_queue, program, "mxv_batched", mat, vec, r, rows, cols, pitch,
+                       uint4_arg{stride.a, stride.b, stride.c, 0}, batch, event);
+}
+
+CLHRESULT enqueue_mxv(cl_command_queue cmd_queue, cl_program program, cl_mem mat, cl_mem vec, cl_mem r,
+                      cl_uint rows, cl_uint cols, cl_uint pitch, cl_mem problem_offsets, cl_uint batch,
+                      cl_event *event) {
+  return __enqueue_mxv(cmd_queue, program, "mxv_batched_indexed", mat, vec, r, rows, cols, pitch, problem_offsets,
+                       batch, event);
+}
+
+/** Lanes [0, count) of a ymm, count in [0, 4]. */
+static __m256i __tail_mask(size_t count) {
+  static const int64_t mask_bits[8] = {-1, -1, -1, -1, 0, 0, 0, 0};
+  return _mm256_loadu_si256((const __m256i *)(mask_bits + 4 - count));
+}
+
+/**
+ * One problem: each row of C from 16 columns at a time in 4 ymm accumulators, a row of A broadcast against the
+ * rows of B; the last partial vector of a row through a masked load and store.
+ */
+static void __mat_mul_avx2(const double *A, const double *B, double *C, size_t M, size_t K, size_t N) {
+  const __m256i tail = __tail_mask(N & 3);
+
+  for (size_t i = 0; i < M; ++i) {
+    for (size_t j0 = 0; j0 < N; j0 += 16) {
+      const size_t cols = std::min((size_t)16, N - j0);
+      const size_t full = cols >> 2;
+      __m256d acc[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd()};
+
+      for (size_t k = 0; k < K; ++k) {
+        const __m256d a = _mm256_broadcast_sd(A + i * K + k);
+        const double *b = B + k * N + j0;
+
+        for (size_t v = 0; v < full; ++v)
+          acc[v] = _mm256_fmadd_pd(a, _mm256_loadu_pd(b + v * 4), acc[v]);
+        if (cols & 3)
+          acc[full] = _mm256_fmadd_pd(a, _mm256_maskload_pd(b + full * 4, tail), acc[full]);
+      }
+
+      double *c = C + i * N + j0;
+      for (size_t v = 0; v < full; ++v)
+        _mm256_storeu_pd(c + v * 4, acc[v]);
+      if (cols & 3)
+        _mm256_maskstore_pd(c + full * 4, tail, acc[full]);
+    }
+  }
+}
+
+static void __mxv_avx2(const double *mat, const double *vec, double *r, size_t rows, size_t cols, size_t pitch) {
+  const __m256i tail = __tail_mask(cols & 3);
+  const size_t cols_f4 = cols & ~(size_t)3;
+
+  for (size_t i = 0; i < rows; ++i) {
+    const double *row = mat + i * pitch;
+    __m256d acc = _mm256_setzero_pd();
+    size_t j;
+
+    for (j = 0; j < cols_f4; j += 4)
+      acc = _mm256_fmadd_pd(_mm256_loadu_pd(row + j), _mm256_loadu_pd(vec + j), acc);
+    if (cols & 3)
+      acc = _mm256_fmadd_pd(_mm256_maskload_pd(row + j, tail), _mm256_maskload_pd(vec + j, tail), acc);
+
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    r[i] = _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+  }
+}
+
+void mat_mul(const double *A, const double *B, double *C, size_t M, size_t K, size_t N, const strides &stride,
+             size_t batch, unsigned threads) {
+  ParallelFor(batch, g_HostGrain, [&](size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p)
+      __mat_mul_avx2(A + p * stride.a, B + p * stride.b, C + p * stride.c, M, K, N);
+  }, threads);
+}
+
+void mat_mul(const double *A, const double *B, double *C, size_t M, size_t K, size_t N,
+             const offsets *problem_offsets, size_t batch, unsigned threads) {
+  ParallelFor(batch, g_HostGrain, [&](size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p) {
+      const offsets &off = problem_offsets[p];
+      __mat_mul_avx2(A + off.a, B + off.b, C + off.c, M, K, N);
+    }
+  }, threads);
+}
+
+void mxv(const double *mat, const double *vec, double *r, size_t rows, size_t cols, size_t pitch,
+         const strides &stride, size_t batch, unsigned threads) {
+  ParallelFor(batch, g_HostGrain, [&](size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p)
+      __mxv_avx2(mat + p * stride.a, vec + p * stride.b, r + p * stride.c, rows, cols, pitch);
+  }, threads);
+}
+
+void mxv(const double *mat, const double *vec, double *r, size_t rows, size_t cols, size_t pitch,
+         const offsets *problem_offsets, size_t batch, unsigned threads) {
+  ParallelFor(batch, g_HostGrain, [&](size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p) {
+      const offsets &off = problem_offsets[p];
+      __mxv_avx2(mat + off.a, vec + off.b, r + off.c, rows, cols, pitch);
+    }
+  }, threads);
+}
+}
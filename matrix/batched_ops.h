@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cl_utils.h>
+
+/**
+ * Batched small-matrix GEMM and GEMV: thousands of independent problems of one shape (8 to 64 rows and columns)
+ * per launch, where one launch per problem would be all launch overhead.
+ *
+ * Two ways to lay a batch out:
+ *   strided:  problem p at a fixed element distance from problem p - 1 in each operand, see strides
+ *   indexed:  problem p at its own element offsets in each operand, see offsets; the pointer-array interface,
+ *             with OpenCL 1.2 buffers in place of device pointers
+ *
+ * The device side enqueues mat_mul_batched(_indexed) of matrix.cl and mxv_batched(_indexed) of mat_mul_vec.cl from
+ * the program given, so any storage precision program of mat_mul_vec.cl works for mxv. The host side is AVX2+FMA,
+ * double only, the problems spread over the threads.
+ */
+namespace batched {
+
+  /** Element distance between consecutive problems: a and b the inputs (A, B or matrix, vector), c the result. */
+  struct strides {
+    cl_uint a, b, c;
+  };
+
+  /** Element offsets of one problem, uint4 on the device. */
+  struct offsets {
+    cl_uint a, b, c, pad;
+  };
+
+  /** C_p[M x N] = A_p[M x K] * B_p[K x N], all row major without padding. */
+  CLHRESULT enqueue_mat_mul(cl_command_queue cmd_queue, cl_program program, cl_mem A, cl_mem B, cl_mem C, cl_uint M,
+                            cl_uint K, cl_uint N, const strides &stride, cl_uint batch, cl_event *event = nullptr);
+  /** @param problem_offsets buffer of @param batch offsets. */
+  CLHRESULT enqueue_mat_mul(cl_command_queue cmd_queue, cl_program program, cl_mem A, cl_mem B, cl_mem C, cl_uint M,
+                            cl_uint K, cl_uint N, cl_mem problem_offsets, cl_uint batch, cl_event *event = nullptr);
+
+  /** r_p[rows] = mat_p[rows x cols] * vec_p[cols], the rows of mat_p @param pitch elements apart. */
+  CLHRESULT enqueue_mxv(cl_command_queue cmd_queue, cl_program program, cl_mem mat, cl_mem vec, cl_mem r,
+                        cl_uint rows, cl_uint cols, cl_uint pitch, const strides &stride, cl_uint batch,
+                        cl_event *event = nullptr);
+  CLHRESULT enqueue_mxv(cl_command_queue cmd_queue, cl_program program, cl_mem mat, cl_mem vec, cl_mem r,
+                        cl_uint rows, cl_uint cols, cl_uint pitch, cl_mem problem_offsets, cl_uint batch,
+                        cl_event *event = nullptr);
+
+  /** @param threads all hardware threads when 0. */
+  void mat_mul(const double *A, const double *B, double *C, size_t M, size_t K, size_t N, const strides &stride,
+               size_t batch, unsigned threads = 0);
+  void mat_mul(const double *A, const double *B, double *C, size_t M, size_t K, size_t N,
+               const offsets *problem_offsets, size_t batch, unsigned threads = 0);
+
+  void mxv(const double *mat, const double *vec, double *r, size_t rows, size_t cols, size_t pitch,
+           const strides &stride, size_t batch, unsigned threads = 0);
+  void mxv(const double *mat, const double *vec, double *r, size_t rows, size_t cols, size_t pitch,
+           const offsets *problem_offsets, size_t batch, unsigned threads = 0);
+}
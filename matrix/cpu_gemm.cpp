@@ -0,0 +1,367 @@
+#include "cpu_gemm.h"
+#include <cl_utils.h>
+#include <cl_backend.h>
+#include <immintrin.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <unistd.h>
+#endif
+
+// MSVC emits any intrinsic without an /arch switch; elsewhere the AVX-512 kernels need the compiler to target it.
+#if defined(_MSC_VER) || defined(__AVX512F__)
+#define __CPU_GEMM_AVX512
+#endif
+
+namespace cpu_gemm {
+
+const char *isa_name(isa kernel) { return kernel == isa::avx512 ? "avx512" : "avx2"; }
+
+isa detect_isa() {
+#if defined(__CPU_GEMM_AVX512)
+#if defined(_MSC_VER)
+  int regs[4];
+
+  __cpuid(regs, 1);
+  // OSXSAVE, then the OS saves the opmask, upper ymm/zmm and zmm16-31 state
+  if ((regs[2] & (1 << 27)) && (_xgetbv(0) & 0xe6) == 0xe6) {
+    __cpuidex(regs, 7, 0);
+    if (regs[1] & (1 << 16))
+      return isa::avx512;
+  }
+#else
+  if (__builtin_cpu_supports("avx512f"))
+    return isa::avx512;
+#endif
+#endif
+  return isa::avx2;
+}
+
+cache_sizes detect_cache_sizes() {
+  cache_sizes caches = {32 << 10, 256 << 10, 8 << 20};
+
+#if defined(_WIN32)
+  DWORD len = 0;
+
+  GetLogicalProcessorInformation(nullptr, &len);
+  std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+  if (!infos.empty() && GetLogicalProcessorInformation(infos.data(), &len)) {
+    for (const auto &info : infos) {
+      if (info.Relationship != RelationCache || info.Cache.Size == 0)
+        continue;
+      if (info.Cache.Level == 1 && info.Cache.Type != CacheInstruction)
+        caches.l1d = info.Cache.Size;
+      else if (info.Cache.Level == 2)
+        caches.l2 = info.Cache.Size;
+      else if (info.Cache.Level == 3)
+        caches.l3 = info.Cache.Size;
+    }
+  }
+#elif defined(_SC_LEVEL1_DCACHE_SIZE)
+  long l1d = sysconf(_SC_LEVEL1_DCACHE_SIZE), l2 = sysconf(_SC_LEVEL2_CACHE_SIZE), l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+
+  if (l1d > 0)
+    caches.l1d = (size_t)l1d;
+  if (l2 > 0)
+    caches.l2 = (size_t)l2;
+  if (l3 > 0)
+    caches.l3 = (size_t)l3;
+#endif
+  return caches;
+}
+
+blocking make_blocking(isa kernel, size_t elem_size, const cache_sizes &caches) {
+  blocking blk;
+  const size_t vec_elems = (kernel == isa::avx512 ? 64 : 32) / elem_size;
+
+  // two vectors of B per row of the micro tile; the rows use what is left of the 16 ymm / 32 zmm registers
+  blk.kernel = kernel;
+  blk.nr = 2 * vec_elems;
+  blk.mr = kernel == isa::avx512 ? 12 : 6;
+
+  blk.kc = std::min(std::max(caches.l1d / 2 / (blk.nr * elem_size), (size_t)64), (size_t)1024) & ~(size_t)7;
+  blk.mc = std::max(caches.l2 / 2 / (blk.kc * elem_size) / blk.mr, (size_t)1) * blk.mr;
+  blk.nc = std::max(caches.l3 / 2 / (blk.kc * elem_size) / blk.nr, (size_t)1) * blk.nr;
+  return blk;
+}
+
+namespace {
+
+  struct avx2_f32 {
+    using real = float;
+    using vec = __m256;
+    static const size_t width = 8, mr = 6;
+    static vec zero() { return _mm256_setzero_ps(); }
+    static vec load(const real *p) { return _mm256_load_ps(p); }
+    static vec loadu(const real *p) { return _mm256_loadu_ps(p); }
+    static void storeu(real *p, vec v) { _mm256_storeu_ps(p, v); }
+    static vec broadcast(const real *p) { return _mm256_broadcast_ss(p); }
+    static vec fmadd(vec a, vec b, vec c) { return _mm256_fmadd_ps(a, b, c); }
+  };
+
+  struct avx2_f64 {
+    using real = double;
+    using vec = __m256d;
+    static const size_t width = 4, mr = 6;
+    static vec zero() { return _mm256_setzero_pd(); }
+    static vec load(const real *p) { return _mm256_load_pd(p); }
+    static vec loadu(const real *p) { return _mm256_loadu_pd(p); }
+    static void storeu(real *p, vec v) { _mm256_storeu_pd(p, v); }
+    static vec broadcast(const real *p) { return _mm256_broadcast_sd(p); }
+    static vec fmadd(vec a, vec b, vec c) { return _mm256_fmadd_pd(a, b, c); }
+  };
+
+#if defined(__CPU_GEMM_AVX512)
+  struct avx512_f32 {
+    using real = float;
+    using vec = __m512;
+    static const size_t width = 16, mr = 12;
+    static vec zero() { return _mm512_setzero_ps(); }
+    static vec load(const real *p) { return _mm512_load_ps(p); }
+    static vec loadu(const real *p) { return _mm512_loadu_ps(p); }
+    static void storeu(real *p, vec v) { _mm512_storeu_ps(p, v); }
+    static vec broadcast(const real *p) { return _mm512_set1_ps(*p); }
+    static vec fmadd(vec a, vec b, vec c) { return _mm512_fmadd_ps(a, b, c); }
+  };
+
+  struct avx512_f64 {
+    using real = double;
+    using vec = __m512d;
+    static const size_t width = 8, mr = 12;
+    static vec zero() { return _mm512_setzero_pd(); }
+    static vec load(const real *p) { return _mm512_load_pd(p); }
+    static vec loadu(const real *p) { return _mm512_loadu_pd(p); }
+    static void storeu(real *p, vec v) { _mm512_storeu_pd(p, v); }
+    static vec broadcast(const real *p) { return _mm512_set1_pd(*p); }
+    static vec fmadd(vec a, vec b, vec c) { return _mm512_fmadd_pd(a, b, c); }
+  };
+#endif
+
+  /** Every thread of the team waits until all arrived; reusable. */
+  class team_barrier {
+  public:
+    explicit team_barrier(size_t count) : count_(count), waiting_(0), generation_(0) {}
+
+    void wait() {
+      std::unique_lock<std::mutex> lck(lock_);
+      size_t generation = generation_;
+
+      if (++waiting_ == count_) {
+        waiting_ = 0;
+        ++generation_;
+        cv_.notify_all();
+      } else {
+        cv_.wait(lck, [&]() { return generation != generation_; });
+      }
+    }
+
+  private:
+    std::mutex lock_;
+    std::condition_variable cv_;
+    size_t count_;
+    size_t waiting_;
+    size_t generation_;
+  };
+
+  static __m256 _add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+  static __m256d _add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+#if defined(__CPU_GEMM_AVX512)
+  static __m512 _add(__m512 a, __m512 b) { return _mm512_add_ps(a, b); }
+  static __m512d _add(__m512d a, __m512d b) { return _mm512_add_pd(a, b); }
+#endif
+
+  /**
+   * C[mr x nr] (+)= A[mr x kc] * B[kc x nr] from packed micro panels: @param a holds MR values per k, @param b
+   * NR = 2 * S::width values per k, 64-byte aligned. One row of the tile per index of I, the accumulators stay in
+   * registers; a partial tile at the edge of C goes through a buffer.
+   */
+  template <class S, size_t... I>
+  static void micro_kernel(size_t kc, const typename S::real *a, const typename S::real *b, typename S::real *c,
+                           size_t ldc, size_t mr, size_t nr, bool accumulate, std::index_sequence<I...>) {
+    using real = typename S::real;
+    constexpr size_t MR = sizeof...(I);
+    constexpr size_t NR = 2 * S::width;
+
+    typename S::vec c0[MR], c1[MR], b0, b1, av;
+
+    ((c0[I] = S::zero(), c1[I] = S::zero()), ...);
+    for (size_t k = 0; k < kc; ++k) {
+      b0 = S::load(b);
+      b1 = S::load(b + S::width);
+      ((av = S::broadcast(a + I), c0[I] = S::fmadd(av, b0, c0[I]), c1[I] = S::fmadd(av, b1, c1[I])), ...);
+      a += MR;
+      b += NR;
+    }
+
+    if (mr == MR && nr == NR) {
+      if (accumulate) {
+        ((c0[I] = _add(c0[I], S::loadu(c + I * ldc))), ...);
+        ((c1[I] = _add(c1[I], S::loadu(c + I * ldc + S::width))), ...);
+      }
+      ((S::storeu(c + I * ldc, c0[I]), S::storeu(c + I * ldc + S::width, c1[I])), ...);
+      return;
+    }
+
+    alignas(64) real tile[MR * NR];
+
+    ((S::storeu(tile + I * NR, c0[I]), S::storeu(tile + I * NR + S::width, c1[I])), ...);
+    for (size_t i = 0; i < mr; ++i) {
+      for (size_t j = 0; j < nr; ++j)
+        c[i * ldc + j] = accumulate ? c[i * ldc + j] + tile[i * NR + j] : tile[i * NR + j];
+    }
+  }
+
+  /** [mc x kc] of A into micro panels of @param mr rows, the last one zero padded. */
+  template <class real>
+  static void pack_a(const real *A, size_t lda, size_t mc, size_t kc, size_t mr, real *packed) {
+    for (size_t ir = 0; ir < mc; ir += mr) {
+      size_t rows = std::min(mr, mc - ir);
+
+      for (size_t k = 0; k < kc; ++k) {
+        for (size_t i = 0; i < rows; ++i)
+          packed[i] = A[(ir + i) * lda + k];
+        for (size_t i = rows; i < mr; ++i)
+          packed[i] = (real)0;
+        packed += mr;
+      }
+    }
+  }
+
+  /** Micro panels [first, last) of @param nr columns of B, zero padded at the right edge @param nc. */
+  template <class real>
+  static void pack_b(const real *B, size_t ldb, size_t kc, size_t nc, size_t nr, size_t first, size_t last,
+                     real *packed) {
+    for (size_t p = first; p < last; ++p) {
+      size_t jr = p * nr, cols = std::min(nr, nc - jr);
+      real *dst = packed + p * nr * kc;
+
+      for (size_t k = 0; k < kc; ++k) {
+        memcpy(dst, B + k * ldb + jr, cols * sizeof(real));
+        for (size_t j = cols; j < nr; ++j)
+          dst[j] = (real)0;
+        dst += nr;
+      }
+    }
+  }
+
+  template <class S>
+  static void gemm_impl(const typename S::real *A, const typename S::real *B, size_t M, size_t K, size_t N,
+                        typename S::real *C, unsigned threads, const blocking &blk) {
+    using real = typename S::real;
+    const size_t MR = S::mr, NR = 2 * S::width;
+    const size_t kc_max = blk.kc;
+    // whole micro panels; mr is not a power of two
+    const size_t mc_max = std::max((blk.mc + MR - 1) / MR, (size_t)1) * MR;
+    const size_t nc_max = RoundC(std::max(blk.nc, NR), NR);
+
+    if (M == 0 || N == 0)
+      return;
+    if (K == 0) {
+      for (size_t i = 0; i < M; ++i)
+        std::fill(C + i * N, C + i * N + N, (real)0);
+      return;
+    }
+    if (threads == 0)
+      threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // no more threads than micro tiles in a B panel
+    const size_t m_blocks = (M + mc_max - 1) / mc_max;
+    const size_t max_tasks = m_blocks * ((std::min(N, nc_max) + NR - 1) / NR);
+    const size_t team = std::max(std::min((size_t)threads, max_tasks), (size_t)1);
+
+    real *b_packed = (real *)_mm_malloc(kc_max * nc_max * sizeof(real), 64);
+    team_barrier barrier(team);
+
+    ParallelFor(team, 1, [&](size_t begin, size_t end) {
+      real *a_packed = (real *)_mm_malloc(mc_max * kc_max * sizeof(real), 64);
+
+      for (size_t tid = begin; tid < end; ++tid) {
+        for (size_t jc = 0; jc < N; jc += nc_max) {
+          const size_t nc = std::min(nc_max, N - jc);
+          const size_t panels = (nc + NR - 1) / NR;
+          // split the panels of B between as many tasks per A block as keeps the team busy
+          const size_t n_splits = std::min((team + m_blocks - 1) / m_blocks, panels);
+          const size_t tasks = m_blocks * n_splits;
+
+          for (size_t pc = 0; pc < K; pc += kc_max) {
+            const size_t kc = std::min(kc_max, K - pc);
+
+            pack_b(B + pc * N + jc, N, kc, nc, NR, panels * tid / team, panels * (tid + 1) / team, b_packed);
+            barrier.wait();
+
+            for (size_t task = tid; task < tasks; task += team) {
+              const size_t ic = (task / n_splits) * mc_max;
+              const size_t mc = std::min(mc_max, M - ic);
+              const size_t split = task % n_splits;
+              const size_t first = panels * split / n_splits, last = panels * (split + 1) / n_splits;
+
+              pack_a(A + ic * K + pc, K, mc, kc, MR, a_packed);
+              for (size_t p = first; p < last; ++p) {
+                const size_t jr = p * NR;
+
+                for (size_t ir = 0; ir < mc; ir += MR) {
+                  micro_kernel<S>(kc, a_packed + ir * kc, b_packed + jr * kc, C + (ic + ir) * N + jc + jr, N,
+                                  std::min(MR, mc - ir), std::min(NR, nc - jr), pc > 0,
+                                  std::make_index_sequence<S::mr>());
+                }
+              }
+            }
+            // the panel is packed over again for the next pc
+            barrier.wait();
+          }
+        }
+      }
+      _mm_free(a_packed);
+    }, (unsigned)team);
+
+    _mm_free(b_packed);
+  }
+
+  template <class real, class Avx2, class Avx512>
+  static void gemm_dispatch(const real *A, const real *B, size_t M, size_t K, size_t N, real *C, unsigned threads,
+                            const blocking *blk) {
+    blocking detected;
+
+    if (!blk) {
+      detected = make_blocking(detect_isa(), sizeof(real), detect_cache_sizes());
+      blk = &detected;
+    }
+#if defined(__CPU_GEMM_AVX512)
+    if (blk->kernel == isa::avx512)
+      return gemm_impl<Avx512>(A, B, M, K, N, C, threads, *blk);
+#endif
+    gemm_impl<Avx2>(A, B, M, K, N, C, threads, *blk);
+  }
+}
+
+#if defined(__CPU_GEMM_AVX512)
+void gemm(const float *A, const float *B, size_t M, size_t K, size_t N, float *C, unsigned threads,
+          const blocking *blk) {
+  gemm_dispatch<float, avx2_f32, avx512_f32>(A, B, M, K, N, C, threads, blk);
+}
+
+void gemm(const double *A, const double *B, size_t M, size_t K, size_t N, double *C, unsigned threads,
+          const blocking *blk) {
+  gemm_dispatch<double, avx2_f64, avx512_f64>(A, B, M, K, N, C, threads, blk);
+}
+#else
+void gemm(const float *A, const float *B, size_t M, size_t K, size_t N, float *C, unsigned threads,
+          const blocking *blk) {
+  gemm_dispatch<float, avx2_f32, avx2_f32>(A, B, M, K, N, C, threads, blk);
+}
+
+void gemm(const double *A, const double *B, size_t M, size_t K, size_t N, double *C, unsigned threads,
+          const blocking *blk) {
+  gemm_dispatch<double, avx2_f64, avx2_f64>(A, B, M, K, N, C, threads, blk);
+}
+#endif
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Cache-blocked multithreaded GEMM on the host, C[M][N] = A[M][K] * B[K][N], all row major and dense, in the
+ * GotoBLAS layout:
+ *
+ *   for jc in N step nc                      B panel [kc x nc], packed once, shared by the team     (L3)
+ *     for pc in K step kc
+ *       for ic in M step mc                  A block [mc x kc], packed per thread                   (L2)
+ *         for jr in nc step nr
+ *           for ir in mc step mr             micro kernel: C[mr x nr] += A[mr x kc] * B[kc x nr]    (L1, registers)
+ *
+ * Packing lays every mr rows of A and nr columns of B out contiguously along k, zero padded at the edges, so the
+ * micro kernel streams both with unit stride and aligned loads whatever M, K, N. The team of threads packs the B
+ * panel together, then works on (ic, jr range) tasks of it; two barriers per B panel.
+ */
+namespace cpu_gemm {
+
+  /** Micro kernel instruction set. */
+  enum class isa { avx2, avx512 };
+
+  const char *isa_name(isa kernel);
+
+  /** Best micro kernel the CPU and the OS run: avx512 needs AVX-512F with the zmm state enabled, avx2 otherwise. */
+  isa detect_isa();
+
+  struct cache_sizes {
+    size_t l1d;  // per core
+    size_t l2;   // per core
+    size_t l3;   // shared
+  };
+
+  /** From the system, a typical desktop part (32KB, 256KB, 8MB) for any level it does not report. */
+  cache_sizes detect_cache_sizes();
+
+  struct blocking {
+    isa kernel;
+    size_t mr, nr;  // micro tile, fixed by the kernel and the element type
+    size_t kc;      // a [kc x nr] micro panel of B takes half of L1, next to the streamed A micro panel
+    size_t mc;      // the packed [mc x kc] A block takes half of L2
+    size_t nc;      // the packed [kc x nc] B panel takes half of L3
+  };
+
+  /** Blocking of @param kernel for elements of @param elem_size bytes (4 or 8) from @param caches. */
+  blocking make_blocking(isa kernel, size_t elem_size, const cache_sizes &caches);
+
+  /**
+   * @param threads team size, all hardware threads when 0.
+   * @param blk (optional) blocking to use, make_blocking(detect_isa(), ...) of the detected caches otherwise.
+   */
+  void gemm(const float *A, const float *B, size_t M, size_t K, size_t N, float *C, unsigned threads = 0,
+            const blocking *blk = nullptr);
+  void gemm(const double *A, const double *B, size_t M, size_t K, size_t N, double *C, unsigned threads = 0,
+            const blocking *blk = nullptr);
+}
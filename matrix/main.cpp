@@ -1,5 +1,14 @@
 #include <cl_utils.h>
 #include <common_miscs.h>
+#include <cl_profiler.h>
+#include <cl_task_graph.h>
+#include <cl_backend.h>
+#include <cl_il_library.h>
+#include <cl_precision.h>
+#include <benchmark.h>
+#include "cpu_gemm.h"
+#include "batched_ops.h"
+#include "ooc_gemm.h"
 #include <vector>
 #include <stdio.h>
 #include <array>
@@ -7,6 +16,7 @@
 #include <immintrin.h>
 #include <type_traits>
 #include <fstream>
+#include <thread>
 
 #define __AVX2_ALIGNED   __declspec(align(32))
 
@@ -775,447 +785,1312 @@ void mxm_avx2_unroll(
   return __mxm_avx2_unroll_impl(mat1, mat2, M, K, N, mat_res, nullptr, std::make_index_sequence<UnrollRowSize>());
 }
 
-static ycl_program g_pMatrixProgram;
-static ycl_program g_pMatMuplVecProgram;
+/**
+ * Multithreaded variants for the native backend: contiguous row ranges on every thread, each range computed by the
+ * single threaded kernel above.
+ */
+template<size_t BX>
+void mxv_avx2_fma_unroll_mt(
+  const double *mat,
+  const double *vec,
+  size_t nrows,
+  size_t ncols,
+  size_t row_pitch,
+  double *res,
+  unsigned threads
+) {
+  ParallelFor(nrows, 64, [&](size_t begin, size_t end) {
+    mxv_avx2_fma_unroll<BX>(mat + begin * row_pitch, vec, end - begin, ncols, row_pitch, res + begin);
+  }, threads);
+}
 
-CLHRESULT TestMatrixTransposeProfile(
-    cl_context context, cl_device_id device, cl_command_queue cmd_queue, size_t ncols, size_t nrows) {
+template<size_t UnrollRowSize>
+void mxm_avx2_unroll_mt(
+  const double *mat1,
+  const double *mat2,
+  size_t M,
+  size_t K,
+  size_t N,
+  double *mat_res,
+  unsigned threads
+) {
+  ParallelFor(M, 2 * UnrollRowSize, [&](size_t begin, size_t end) {
+    mxm_avx2_unroll<UnrollRowSize>(mat1 + begin * K, mat2, end - begin, K, N, mat_res + begin * N);
+  }, threads);
+}
 
-  CLHRESULT hr;
+/**
+ * 32x32 tiles, bands of input rows (output columns) on every thread.
+ */
+void mat_transpose_tiled_mt(const double *mat, size_t nrows, size_t ncols, double *mat_res, unsigned threads) {
+  const size_t tile = 32;
+
+  ParallelFor((nrows + tile - 1) / tile, 1, [&](size_t begin, size_t end) {
+    for (size_t ib = begin * tile; ib < std::min(nrows, end * tile); ib += tile) {
+      for (size_t jb = 0; jb < ncols; jb += tile) {
+        for (size_t i = ib; i < std::min(nrows, ib + tile); ++i)
+          for (size_t j = jb; j < std::min(ncols, jb + tile); ++j)
+            mat_res[j * nrows + i] = mat[i * ncols + j];
+      }
+    }
+  }, threads);
+}
 
-  // nrows = nrows & ~3;
-  // ncols = ncols & ~7;
+/**
+ * Cache-oblivious transpose: the longer side of the block is halved until both sides are at most 32, the leaf then
+ * goes through the 4x4 register transpose of the kernels above with the pitches of the whole matrix. Every level of
+ * the cache sees blocks that fit it without knowing its size.
+ *
+ * The split points are multiples of 8 rows and 4 columns, so the leaves stay aligned to the micro tiles.
+ */
+struct __transpose_block {
+  size_t i0, i1, j0, j1;
+};
+
+static const size_t g_TransposeLeaf = 32;
+
+template <bool Streaming> static inline void __transpose_store4(double *p, __m256d v) {
+  if (Streaming)
+    _mm256_stream_pd(p, v);
+  else
+    _mm256_storeu_pd(p, v);
+}
 
-  const size_t mat_buff_size = ncols * nrows * sizeof(double);
+/**
+ * Leaf: 8x4 steps (two 4x4 register transposes stacked), so every column of the result gets 8 contiguous doubles,
+ * a whole cache line, per step; then 4x4 steps and scalar edges.
+ */
+template <bool Streaming>
+static void __mat_transpose_avx2_block(const double *mat, size_t nrows, size_t ncols, double *mat_res,
+                                       const __transpose_block &blk) {
+  __m256d ymm[4], ymmN[4];
+  __m256d ymm4;
+  size_t i = blk.i0, j;
 
-  auto test_mat = gen_random_matrix<double>(ncols, nrows);
-  printf("Input matrix dimensions: (rows: %lld, cols: %lld)\n", nrows, ncols);
+  for (; i + 8 <= blk.i1; i += 8) {
+    const double *src = mat + i * ncols;
+    double *dst = mat_res + i;
 
-  hp_timer::time_point start, fin;
-  fmilliseconds elapsed;
+    for (j = blk.j0; j + 4 <= blk.j1; j += 4) {
+      for (int k = 0; k < 4; ++k) {
+        ymm[k] = _mm256_loadu_pd(src + k * ncols + j);
+        ymmN[k] = _mm256_loadu_pd(src + (k + 4) * ncols + j);
+      }
+
+      __AVX2_MAT4X4_TRANSPOSE(ymm, ymm4)
+      __AVX2_MAT4X4_TRANSPOSE(ymmN, ymm4)
 
-  ycl_buffer input_mat_buff, output_mat_buff;
+      for (int k = 0; k < 4; ++k) {
+        __transpose_store4<Streaming>(dst + (j + k) * nrows, ymm[k]);
+        __transpose_store4<Streaming>(dst + (j + k) * nrows + 4, ymmN[k]);
+      }
+    }
+    for (; j < blk.j1; ++j) {
+      for (int k = 0; k < 8; ++k)
+        dst[j * nrows + k] = src[k * ncols + j];
+    }
+  }
 
-  V_RETURN((input_mat_buff <<=
-            clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mat_buff_size, test_mat.data(), &hr),
-            hr));
-  V_RETURN((output_mat_buff <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, mat_buff_size, nullptr, &hr), hr));
+  for (; i + 4 <= blk.i1; i += 4) {
+    const double *src = mat + i * ncols;
+    double *dst = mat_res + i;
 
-  std::vector<double> test_mat2(test_mat.size());
+    for (j = blk.j0; j + 4 <= blk.j1; j += 4) {
+      for (int k = 0; k < 4; ++k)
+        ymm[k] = _mm256_loadu_pd(src + k * ncols + j);
 
-  start = hp_timer::now();
-  for(ptrdiff_t i = 0; i < nrows; ++i) {
-    for(ptrdiff_t j = 0; j < ncols; ++j) {
-      ptrdiff_t ij = i * ncols + j;
-      ptrdiff_t ji = j * nrows + i;
+      __AVX2_MAT4X4_TRANSPOSE(ymm, ymm4)
 
-      test_mat2[ji] = test_mat[ij];
+      for (int k = 0; k < 4; ++k)
+        __transpose_store4<Streaming>(dst + (j + k) * nrows, ymm[k]);
+    }
+    for (; j < blk.j1; ++j) {
+      for (int k = 0; k < 4; ++k)
+        dst[j * nrows + k] = src[k * ncols + j];
     }
   }
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Transpose matrix(CPU seiralizing) elapsed:                         %.3fms\n", elapsed.count());
-
-  std::vector<double> test_mat3(test_mat.size());
-  start = hp_timer::now();
-  mat_transpose_avx2_4x8_unroll(test_mat.data(), nrows, ncols, (double *)test_mat3.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Transpose matrix(CPU AVX2 blocking 4x8) elapsed:                   %.3fms\n", elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(test_mat3, test_mat2, 1.0E-6, nrows, ncols) ? "true" : "false");
-
-  start = hp_timer::now();
-  mat_transpose_avx2_4x4_unroll(test_mat.data(), nrows, ncols, (double *)test_mat3.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Transpose matrix(CPU AVX2 blocking 4x4 implementation 1) elapsed:  %.3fms\n", elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(test_mat3, test_mat2, 1.0E-6, nrows, ncols) ? "true" : "false");
-
-  start = hp_timer::now();
-  mat_transpose_avx2_4x4_unroll2(test_mat.data(), nrows, ncols, (double *)test_mat3.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Transpose matrix(CPU AVX2 blocking 4x4 implementation 2) elapsed:  %.3fms\n", elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(test_mat3, test_mat2, 1.0E-6, nrows, ncols) ? "true" : "false");
-
-  ycl_kernel ker;
-  V_RETURN((ker <<= clCreateKernel(g_pMatrixProgram, "mat_transpose", &hr), hr));
-
-  int M = static_cast<int>(ncols), N = static_cast<int>(nrows);
-  V_RETURN(SetKernelArguments(ker, &input_mat_buff, &output_mat_buff, &M, &N));
-
-  size_t lworksize[3];
-  V_RETURN(
-      clGetKernelWorkGroupInfo(ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(lworksize), lworksize, nullptr));
 
-  size_t gworksize[] = {RoundC(ncols, lworksize[0]), RoundC(nrows, lworksize[1])};
-  ycl_event rd_done_ev;
+  for (; i < blk.i1; ++i) {
+    for (j = blk.j0; j < blk.j1; ++j)
+      mat_res[j * nrows + i] = mat[i * ncols + j];
+  }
+}
 
-  size_t max_work_size[3];
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_size), max_work_size, nullptr));
+static bool __split_transpose_block(const __transpose_block &blk, __transpose_block *lo, __transpose_block *hi) {
+  const size_t rows = blk.i1 - blk.i0, cols = blk.j1 - blk.j0;
 
-  gworksize[0] = std::min(gworksize[0], max_work_size[0]);
-  gworksize[1] = std::min(gworksize[0], max_work_size[1]);
-
-  start = hp_timer::now();
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker, 2, nullptr, gworksize, nullptr, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, output_mat_buff, false, 0, mat_buff_size, (void *)test_mat.data(), 0, nullptr,
-                               &rd_done_ev));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &rd_done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Transpose matrix(Use only global storage) elapsed:                 %.3fms\n", elapsed.count());
-  printf("results coincidence: %s\n",  check_matrix_equiv(test_mat, test_mat2, 1.0E-6, nrows, ncols) ? "true" : "false");
-
-  ycl_kernel ker_opt1;
-  V_RETURN((ker_opt1 <<= clCreateKernel(g_pMatrixProgram, "mat_transpose_opt1", &hr), hr));
-
-  V_RETURN(SetKernelArguments(ker_opt1, &input_mat_buff, &output_mat_buff, &M, &N));
-  double data_pattern = 0.0;
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, output_mat_buff, &data_pattern, sizeof(data_pattern), 0,
-                               mat_buff_size / sizeof(data_pattern), 0, nullptr, nullptr));
-  start = hp_timer::now();
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker_opt1, 2, nullptr, gworksize, nullptr, 0, nullptr, nullptr));
-  rd_done_ev = nullptr;
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, output_mat_buff, false, 0, mat_buff_size, (void *)test_mat.data(), 0, nullptr,
-                               &rd_done_ev));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &rd_done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Transpose matrix(Use shared local storage, 64bits bank) elapsed:   %.3fms\n", elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(test_mat, test_mat2, 1.0E-6, nrows, ncols) ? "true" : "false");
-
-  ycl_kernel ker_opt2;
-  V_RETURN((ker_opt2 <<= clCreateKernel(g_pMatrixProgram, "mat_transpose_opt2", &hr), hr));
-
-  V_RETURN(SetKernelArguments(ker_opt2, &input_mat_buff, &output_mat_buff, &M, &N));
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, output_mat_buff, &data_pattern, sizeof(data_pattern), 0,
-                               mat_buff_size / sizeof(data_pattern), 0, nullptr, nullptr));
-  start = hp_timer::now();
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker_opt2, 2, nullptr, gworksize, nullptr, 0, nullptr, nullptr));
-  rd_done_ev = nullptr;
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, output_mat_buff, false, 0, mat_buff_size, (void *)test_mat.data(), 0, nullptr,
-                               &rd_done_ev));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &rd_done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Transpose matrix(Eliminate bank conflict, 32bits bank) elapsed:    %.3fms\n", elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(test_mat, test_mat2, 1.0E-6, nrows, ncols) ? "true" : "false");
+  if (rows <= g_TransposeLeaf && cols <= g_TransposeLeaf)
+    return false;
 
-  return hr;
+  *lo = *hi = blk;
+  if (rows >= cols)
+    lo->i1 = hi->i0 = blk.i0 + ((rows / 2 + 7) & ~(size_t)7);
+  else
+    lo->j1 = hi->j0 = blk.j0 + ((cols / 2 + 3) & ~(size_t)3);
+  return true;
 }
 
-CLHRESULT TestMatrixMulitplicationProfile(
-  cl_context context, cl_device_id device, cl_command_queue cmd_queue, size_t M, size_t K, size_t N) {
+template <bool Streaming>
+static void __mat_transpose_recursive(const double *mat, size_t nrows, size_t ncols, double *mat_res,
+                                      const __transpose_block &blk) {
+  __transpose_block lo, hi;
 
+  if (!__split_transpose_block(blk, &lo, &hi)) {
+    __mat_transpose_avx2_block<Streaming>(mat, nrows, ncols, mat_res, blk);
+    return;
+  }
+  __mat_transpose_recursive<Streaming>(mat, nrows, ncols, mat_res, lo);
+  __mat_transpose_recursive<Streaming>(mat, nrows, ncols, mat_res, hi);
+}
+
+/**
+ * The top levels of the recursion are split breadth first into about 4 blocks per thread, each block then transposed
+ * recursively on one thread.
+ * @param streaming non-temporal stores for the result, worth it once the result no longer fits the last level
+ * cache. Only whole cache lines stream well, so they are used when mat_res is 64 byte aligned and nrows a multiple
+ * of 8 (every 8x4 step then fills a line per column), plain stores otherwise.
+ * @return whether the stores were non-temporal.
+ */
+bool mat_transpose_recursive_mt(const double *mat, size_t nrows, size_t ncols, double *mat_res, unsigned threads,
+                                bool streaming) {
+  std::vector<__transpose_block> blocks = {{0, nrows, 0, ncols}}, next;
+  const size_t target = 4 * (size_t)(threads ? threads : std::thread::hardware_concurrency());
+  __transpose_block lo, hi;
+
+  streaming = streaming && ((uintptr_t)mat_res & 63) == 0 && (nrows & 7) == 0;
+
+  while (blocks.size() < target) {
+    next.clear();
+    for (const __transpose_block &blk : blocks) {
+      if (__split_transpose_block(blk, &lo, &hi)) {
+        next.push_back(lo);
+        next.push_back(hi);
+      } else {
+        next.push_back(blk);
+      }
+    }
+    if (next.size() == blocks.size())
+      break;
+    blocks.swap(next);
+  }
+
+  ParallelFor(blocks.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; ++b) {
+      if (streaming)
+        __mat_transpose_recursive<true>(mat, nrows, ncols, mat_res, blocks[b]);
+      else
+        __mat_transpose_recursive<false>(mat, nrows, ncols, mat_res, blocks[b]);
+    }
+    // the streamed lines are globally visible before the thread reports the range done
+    if (streaming)
+      _mm_sfence();
+  }, threads);
+  return streaming;
+}
+
+static ycl_program g_pMatrixProgram;
+static ycl_program g_pMatMuplVecProgram;
+// mxv builds per storage precision, indexed by CLPrecision; a precision whose program did not load is left empty.
+static ycl_program g_pMatMulVecPrograms[4];
+static CLProfiler g_Profiler;
+static CLComputeBackend g_Backend;
+
+/** Where the cost model would run the operation; the profiles below time both sides regardless. */
+static void PrintBackendChoice(const char *op, double bytes, double flops, double transfer_bytes) {
+  CLWorkload workload = {bytes, flops, transfer_bytes};
+  printf("Backend for %s: %s (opencl %.3fms, native %.3fms estimated)\n", op,
+         GetBackendKindName(g_Backend.Select(workload)), g_Backend.EstimateMs(CLBackendKind::OPENCL, workload),
+         g_Backend.EstimateMs(CLBackendKind::NATIVE, workload));
+}
+
+/** Launch @param ker, wait for it and read its device time. */
+static CLHRESULT RunKernelTimed(cl_command_queue cmd_queue, cl_kernel ker, cl_uint work_dim, const size_t *global_size,
+                                const size_t *local_size, double *kernel_ms) {
   CLHRESULT hr;
-  ycl_kernel mul_ker;
-  ycl_buffer a_buffer, b_buffer, c_buffer;
+  ycl_event ker_ev;
 
-  printf("Input matrix A dimensions: (%llu, %llu)\n", M, K);
-  printf("Input matrix B dimensions: (%llu, %llu)\n", K, N);
+  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker, work_dim, nullptr, global_size, local_size, 0, nullptr, &ker_ev));
+  V_RETURN(clWaitForEvents(1, &ker_ev));
+  V_RETURN(GetEventElapsedTime(ker_ev, kernel_ms));
+  return hr;
+}
 
-  hp_timer::time_point start, fin;
-  fmilliseconds elapsed;
+enum class TransposeVariant {
+  SERIAL,
+  AVX2_4X8,
+  AVX2_4X4,
+  AVX2_4X4_2,
+  TILED_MT,
+  RECURSIVE_MT,
+  RECURSIVE_MT_STREAMING,
+  CL_GLOBAL,
+  CL_LOCAL,
+  CL_LOCAL_32BIT_BANK,
+};
+
+/**
+ * Out-of-place transpose of a "rows" x "cols" matrix, checked against the serial loop. The CPU variants are timed
+ * on the host, the device ones (mat_transpose, then shared local storage with 64 and 32 bit banks) by kernel time.
+ */
+CLHRESULT TestMatrixTranspose(TransposeVariant variant, cl_context context, cl_device_id device,
+                              cl_command_queue cmd_queue, BenchState &state) {
+
+  CLHRESULT hr = CL_SUCCESS;
+  const size_t nrows = (size_t)state.GetInt("rows");
+  const size_t ncols = (size_t)state.GetInt("cols");
+  const size_t mat_buff_size = ncols * nrows * sizeof(double);
+  const unsigned threads = g_Backend.NativeThreads();
+
+  auto test_mat = gen_random_matrix<double>(ncols, nrows);
+  std::vector<double> mat_ref(test_mat.size()), mat_res(test_mat.size());
+
+  for (size_t i = 0; i < nrows; ++i)
+    for (size_t j = 0; j < ncols; ++j)
+      mat_ref[j * nrows + i] = test_mat[i * ncols + j];
+
+  if (variant == TransposeVariant::SERIAL)
+    PrintBackendChoice("transpose", 2.0 * mat_buff_size, 0.0, 2.0 * mat_buff_size);
+
+  if (variant < TransposeVariant::CL_GLOBAL) {
+    // 64 byte aligned, so the streaming variant can use non-temporal stores.
+    double *transposed = (double *)_mm_malloc(mat_buff_size, 64);
+    bool streamed = true;
+
+    while (state.KeepRunning()) {
+      switch (variant) {
+      case TransposeVariant::SERIAL:
+        for (size_t i = 0; i < nrows; ++i)
+          for (size_t j = 0; j < ncols; ++j)
+            transposed[j * nrows + i] = test_mat[i * ncols + j];
+        break;
+      case TransposeVariant::AVX2_4X8:
+        mat_transpose_avx2_4x8_unroll(test_mat.data(), nrows, ncols, transposed);
+        break;
+      case TransposeVariant::AVX2_4X4:
+        mat_transpose_avx2_4x4_unroll(test_mat.data(), nrows, ncols, transposed);
+        break;
+      case TransposeVariant::AVX2_4X4_2:
+        mat_transpose_avx2_4x4_unroll2(test_mat.data(), nrows, ncols, transposed);
+        break;
+      case TransposeVariant::TILED_MT:
+        mat_transpose_tiled_mt(test_mat.data(), nrows, ncols, transposed, threads);
+        break;
+      case TransposeVariant::RECURSIVE_MT:
+        mat_transpose_recursive_mt(test_mat.data(), nrows, ncols, transposed, threads, false);
+        break;
+      default:
+        streamed = mat_transpose_recursive_mt(test_mat.data(), nrows, ncols, transposed, threads, true);
+        break;
+      }
+    }
+
+    if (!streamed)
+      printf("    rows=%zu: plain stores, rows not a multiple of 8\n", nrows);
+    std::copy(transposed, transposed + test_mat.size(), mat_res.begin());
+    _mm_free(transposed);
+  } else {
+    const char *kernel_names[] = {"mat_transpose", "mat_transpose_opt1", "mat_transpose_opt2"};
+    ycl_buffer input_mat_buff, output_mat_buff;
+    ycl_kernel ker;
+    int M = static_cast<int>(ncols), N = static_cast<int>(nrows);
+    size_t lworksize[3], max_work_size[3], gworksize[2];
+    double kernel_ms;
+
+    V_RETURN((input_mat_buff <<=
+              clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mat_buff_size, test_mat.data(), &hr),
+              hr));
+    V_RETURN((output_mat_buff <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, mat_buff_size, nullptr, &hr), hr));
+
+    V_RETURN((ker <<= clCreateKernel(g_pMatrixProgram,
+                                     kernel_names[(int)variant - (int)TransposeVariant::CL_GLOBAL], &hr),
+              hr));
+    V_RETURN(SetKernelArguments(ker, &input_mat_buff, &output_mat_buff, &M, &N));
+    V_RETURN(clGetKernelWorkGroupInfo(ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(lworksize), lworksize,
+                                      nullptr));
+    V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_size), max_work_size, nullptr));
+
+    gworksize[0] = std::min(RoundC(ncols, lworksize[0]), RoundF(max_work_size[0], lworksize[0]));
+    gworksize[1] = std::min(RoundC(nrows, lworksize[1]), RoundF(max_work_size[1], lworksize[1]));
+
+    while (state.KeepRunning()) {
+      V_RETURN(RunKernelTimed(cmd_queue, ker, 2, gworksize, nullptr, &kernel_ms));
+      state.SetIterationTime(kernel_ms);
+    }
+
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, output_mat_buff, CL_TRUE, 0, mat_buff_size, mat_res.data(), 0, nullptr,
+                                 nullptr));
+  }
+
+  state.SetVerified(check_matrix_equiv(mat_res, mat_ref, 1.0E-6, nrows, ncols));
+  state.SetBytesProcessed(2.0 * mat_buff_size);
+
+  return hr;
+}
 
-  const size_t a_data_size = M * K;
-  const size_t b_data_size = K * N;
+enum class MatMulVariant {
+  SERIAL,
+  AVX2_UNROLL16,
+  AVX2_UNROLL8,
+  AVX2_UNROLL4,
+  AVX2_UNROLL16_MT,
+  GEMM_FP64_1T,
+  GEMM_FP64,
+  GEMM_FP32,
+  CL_GLOBAL,
+  CL_LOCAL,
+  CL_REG_4X4,
+  CL_REG_8X4,
+  CL_REG_4X8,
+};
+
+/**
+ * C["M" x "N"] = A["M" x "K"] * B["K" x "N"] in double, checked against cpu_gemm on every thread. The CPU variants
+ * are timed on the host, the device ones by kernel time; the register blocked kernels compute a [tm x tn] micro
+ * tile per work item. The fp32 cpu_gemm reports its relative error and is left unchecked.
+ */
+CLHRESULT TestMatrixMultiplication(MatMulVariant variant, cl_context context, cl_device_id device,
+                                   cl_command_queue cmd_queue, BenchState &state) {
+
+  CLHRESULT hr = CL_SUCCESS;
+  const size_t M = (size_t)state.GetInt("M");
+  const size_t K = (size_t)state.GetInt("K");
+  const size_t N = (size_t)state.GetInt("N");
   const size_t c_data_size = M * N;
-  const size_t a_buffer_size = a_data_size * sizeof(double);
-  const size_t b_buffer_size = b_data_size * sizeof(double);
+  const size_t a_buffer_size = M * K * sizeof(double);
+  const size_t b_buffer_size = K * N * sizeof(double);
   const size_t c_buffer_size = c_data_size * sizeof(double);
-  std::vector<double> a_data, b_data, c_data, c_data2;
-  const double dbl_eq_tol = 1.0E-8;
-
-  a_data = gen_random_matrix<double>(K, M);
-  b_data = gen_random_matrix<double>(N, K);
-  c_data2.resize(c_data_size);
-
-  c_data.resize(c_data_size);
-  start = hp_timer::now();
-  for(ptrdiff_t i = 0; i < M; ++i) {
-    ptrdiff_t ii = i*K;
-    for(ptrdiff_t j = 0; j < N; ++j) {
-      double c = 0.0;
-      for(ptrdiff_t k = 0; k < K; ++k) {
-        c += a_data[ii+k]*b_data[k*N+j];
+  const unsigned threads = g_Backend.NativeThreads();
+  bool verify = true;
+
+  std::vector<double> a_data = gen_random_matrix<double>(K, M);
+  std::vector<double> b_data = gen_random_matrix<double>(N, K);
+  std::vector<double> c_ref(c_data_size), c_data(c_data_size);
+
+  cpu_gemm::gemm(a_data.data(), b_data.data(), M, K, N, c_ref.data(), threads);
+
+  if (variant == MatMulVariant::SERIAL)
+    PrintBackendChoice("mxm", (double)(a_buffer_size + b_buffer_size + c_buffer_size), 2.0 * M * K * N,
+                       (double)(a_buffer_size + b_buffer_size + c_buffer_size));
+
+  if (variant == MatMulVariant::GEMM_FP32) {
+    std::vector<float> a_data_f(a_data.begin(), a_data.end()), b_data_f(b_data.begin(), b_data.end());
+    std::vector<float> c_data_f(c_data_size);
+
+    while (state.KeepRunning())
+      cpu_gemm::gemm(a_data_f.data(), b_data_f.data(), M, K, N, c_data_f.data(), threads);
+
+    std::copy(c_data_f.begin(), c_data_f.end(), c_data.begin());
+    printf("    max relative error of fp32: %.3g\n",
+           ComputePrecisionError(c_ref.data(), c_data.data(), c_data_size).max_rel);
+    verify = false;
+  } else if (variant < MatMulVariant::CL_GLOBAL) {
+    while (state.KeepRunning()) {
+      switch (variant) {
+      case MatMulVariant::SERIAL:
+        for (size_t i = 0; i < M; ++i) {
+          for (size_t j = 0; j < N; ++j) {
+            double c = 0.0;
+            for (size_t k = 0; k < K; ++k)
+              c += a_data[i * K + k] * b_data[k * N + j];
+            c_data[i * N + j] = c;
+          }
+        }
+        break;
+      case MatMulVariant::AVX2_UNROLL16:
+        mxm_avx2_unroll<16>(a_data.data(), b_data.data(), M, K, N, c_data.data());
+        break;
+      case MatMulVariant::AVX2_UNROLL8:
+        mxm_avx2_unroll<8>(a_data.data(), b_data.data(), M, K, N, c_data.data());
+        break;
+      case MatMulVariant::AVX2_UNROLL4:
+        mxm_avx2_unroll<4>(a_data.data(), b_data.data(), M, K, N, c_data.data());
+        break;
+      case MatMulVariant::AVX2_UNROLL16_MT:
+        mxm_avx2_unroll_mt<16>(a_data.data(), b_data.data(), M, K, N, c_data.data(), threads);
+        break;
+      default:
+        cpu_gemm::gemm(a_data.data(), b_data.data(), M, K, N, c_data.data(),
+                       variant == MatMulVariant::GEMM_FP64_1T ? 1u : threads);
+        break;
       }
-      c_data[i*N+j] = c;
     }
+  } else {
+    const struct {
+      const char *name;
+      size_t tm, tn;  // 0 for the kernels without register blocking
+    } kernels[] = {{"mat_mul", 0, 0},
+                   {"mat_mul_opt1", 0, 0},
+                   {"mat_mul_reg_4x4", 4, 4},
+                   {"mat_mul_reg_8x4", 8, 4},
+                   {"mat_mul_reg_4x8", 4, 8}};
+    const auto &kernel = kernels[(int)variant - (int)MatMulVariant::CL_GLOBAL];
+    ycl_buffer a_buffer, b_buffer, c_buffer;
+    ycl_kernel mul_ker;
+    size_t group_size[3];
+    size_t global_size[2];
+    const double dbl_zero = 0.0;
+    std::array<uint32_t, 4> MKN{(uint32_t)M, (uint32_t)K, (uint32_t)N};
+    double kernel_ms;
+
+    V_RETURN((a_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                          a_buffer_size, a_data.data(), &hr),
+              hr));
+    V_RETURN((b_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                          b_buffer_size, b_data.data(), &hr),
+              hr));
+    V_RETURN((c_buffer <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, c_buffer_size, nullptr, &hr), hr));
+
+    V_RETURN((mul_ker <<= clCreateKernel(g_pMatrixProgram, kernel.name, &hr), hr));
+    V_RETURN(SetKernelArguments(mul_ker, &a_buffer, &b_buffer, &c_buffer, &MKN));
+    V_RETURN(clGetKernelWorkGroupInfo(mul_ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
+                                      group_size, nullptr));
+
+    if (kernel.tm) {
+      global_size[0] = RoundC(N, group_size[0] * kernel.tn) / kernel.tn;
+      global_size[1] = RoundC(M, group_size[1] * kernel.tm) / kernel.tm;
+    } else {
+      global_size[0] = RoundC(N, group_size[0]);
+      global_size[1] = RoundC(M, group_size[1]);
+    }
+
+    while (state.KeepRunning()) {
+      V_RETURN(clEnqueueFillBuffer(cmd_queue, c_buffer, &dbl_zero, sizeof(dbl_zero), 0, c_buffer_size, 0, nullptr,
+                                   nullptr));
+      V_RETURN(RunKernelTimed(cmd_queue, mul_ker, 2, global_size, kernel.tm ? group_size : nullptr, &kernel_ms));
+      state.SetIterationTime(kernel_ms);
+    }
+
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, c_buffer, CL_TRUE, 0, c_buffer_size, c_data.data(), 0, nullptr,
+                                 nullptr));
   }
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Matrix multiplication(CPU serializing) elapsed:                    %.3fms\n", elapsed.count());
-
-  start = hp_timer::now();
-  mxm_avx2_unroll<16>(a_data.data(), b_data.data(), M, K, N, (double *)c_data2.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Matrix multiplication(CPU AVX2+FMA Unroll 16 rows) elapsed:        %.3fms\n", elapsed.count());
-  printf("Results coincedence: %s\n", check_matrix_equiv(c_data2, c_data, 1.0E-6, N, M) ? "true" : "false");
-
-  start = hp_timer::now();
-  mxm_avx2_unroll<8>(a_data.data(), b_data.data(), M, K, N, (double *)c_data2.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Matrix multiplication(CPU AVX2+FMA Unroll 8 rows) elapsed:         %.3fms\n", elapsed.count());
-  printf("Results coincedence: %s\n", check_matrix_equiv(c_data2, c_data, 1.0E-6, N, M) ? "true" : "false");
-
-  start = hp_timer::now();
-  mxm_avx2_unroll<4>(a_data.data(), b_data.data(), M, K, N, (double *)c_data2.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Matrix multiplication(CPU AVX2+FMA Unroll 4 rows) elapsed:         %.3fms\n", elapsed.count());
-  printf("Results coincedence: %s\n", check_matrix_equiv(c_data2, c_data, 1.0E-6, N, M) ? "true" : "false");
-
-  V_RETURN((a_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                        a_buffer_size, a_data.data(), &hr),
-            hr));
-  V_RETURN((b_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                        b_buffer_size, b_data.data(), &hr),
-            hr));
-  V_RETURN(
-      (c_buffer <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, c_buffer_size, nullptr, &hr),
-       hr));
 
-  // Free some deprecated memory.
-  a_data = std::vector<double>();
-  b_data = a_data;
+  if (verify)
+    state.SetVerified(check_matrix_equiv(c_data, c_ref, 1.0E-6, N, M));
+  state.SetFlopsProcessed(2.0 * M * K * N);
 
-  V_RETURN((mul_ker <<= clCreateKernel(g_pMatrixProgram, "mat_mul", &hr), hr));
+  return hr;
+}
 
+/**
+ * Launch shape of the mxv kernels: one row per work group for a 1D work group (mxv_block), one row per warp for a
+ * 2D one (mxv_warp).
+ */
+static CLHRESULT GetMatMulVecLaunchShape(cl_kernel kernel, cl_device_id device, size_t mat_rows, size_t mat_cols,
+                                         cl_uint *work_dim, size_t *work_item_size) {
+  CLHRESULT hr;
   size_t group_size[3];
-  size_t global_size[2];
-  const double dbl_zero = 0.0;
+  size_t max_work_item_size[3];
 
-  V_RETURN(clGetKernelWorkGroupInfo(mul_ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size), group_size, nullptr));
-  global_size[0] = RoundC(N, group_size[0]);
-  global_size[1] = RoundC(M, group_size[1]);
+  V_RETURN(
+      clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_item_size), max_work_item_size, nullptr));
+  V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
+                                    group_size, nullptr));
+
+  if (group_size[1] == 1) {
+    *work_dim = 1;
+    work_item_size[0] = RoundC(mat_cols, group_size[0]);
+    work_item_size[0] = std::min(work_item_size[0], max_work_item_size[0]);
+    work_item_size[0] = RoundF(work_item_size[0], group_size[0]);
+  } else {
+    *work_dim = 2;
+    work_item_size[0] = RoundC(mat_rows / group_size[1], group_size[0]);
+    work_item_size[0] = std::min(work_item_size[0], max_work_item_size[0]);
+    work_item_size[1] = RoundC(1, group_size[1]);
+  }
+  return hr;
+}
+
+enum class MatMulVecVariant {
+  SERIAL,
+  AVX2_UNROLL3,
+  AVX2_UNROLL4,
+  AVX2_UNROLL5,
+  AVX2_UNROLL7,
+  AVX2_UNROLL4_MT,
+  CL_BLOCK,
+  CL_WARP,
+};
+
+/**
+ * res["rows"] = mat["rows" x "cols"] * vec["cols"], the matrix rows "cols" + "pitch_pad" elements apart, checked
+ * against the serial loop. The device kernels are timed by kernel time and also recorded in g_Profiler, with the
+ * fill before them and the read back after the last one.
+ */
+CLHRESULT TestMatMulVec(MatMulVecVariant variant, cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                        BenchState &state) {
+
+  CLHRESULT hr = CL_SUCCESS;
+  const size_t mat_rows = (size_t)state.GetInt("rows");
+  const size_t mat_cols = (size_t)state.GetInt("cols");
+  const size_t mat_pitch = mat_cols + (size_t)state.GetInt("pitch_pad");
+  const size_t mat_data_bsize = mat_pitch * mat_rows * sizeof(double);
+  const size_t vec_data_bsize = mat_cols * sizeof(double);
+  const size_t res_data_bsize = mat_rows * sizeof(double);
+  const unsigned threads = g_Backend.NativeThreads();
+
+  std::vector<double> mat_data = gen_random_matrix<double>(mat_pitch, mat_rows);
+  std::vector<double> vec_data = gen_random_matrix<double>(1, mat_cols);
+  std::vector<double> res_ref(mat_rows), res_data(mat_rows);
+
+  for (size_t i = 0; i < mat_rows; ++i) {
+    double temp = 0.0;
+    for (size_t j = 0; j < mat_cols; ++j)
+      temp += mat_data[i * mat_pitch + j] * vec_data[j];
+    res_ref[i] = temp;
+  }
+
+  if (variant == MatMulVecVariant::SERIAL)
+    PrintBackendChoice("mxv", (double)(mat_data_bsize + vec_data_bsize + res_data_bsize), 2.0 * mat_rows * mat_cols,
+                       (double)(mat_data_bsize + vec_data_bsize + res_data_bsize));
+
+  if (variant < MatMulVecVariant::CL_BLOCK) {
+    const double *mat = mat_data.data(), *vec = vec_data.data();
+    double *res = res_data.data();
+
+    while (state.KeepRunning()) {
+      switch (variant) {
+      case MatMulVecVariant::SERIAL:
+        for (size_t i = 0; i < mat_rows; ++i) {
+          double temp = 0.0;
+          for (size_t j = 0; j < mat_cols; ++j)
+            temp += mat[i * mat_pitch + j] * vec[j];
+          res[i] = temp;
+        }
+        break;
+      case MatMulVecVariant::AVX2_UNROLL3:
+        mxv_avx2_fma_unroll<3>(mat, vec, mat_rows, mat_cols, mat_pitch, res);
+        break;
+      case MatMulVecVariant::AVX2_UNROLL4:
+        mxv_avx2_fma_unroll<4>(mat, vec, mat_rows, mat_cols, mat_pitch, res);
+        break;
+      case MatMulVecVariant::AVX2_UNROLL5:
+        mxv_avx2_fma_unroll<5>(mat, vec, mat_rows, mat_cols, mat_pitch, res);
+        break;
+      case MatMulVecVariant::AVX2_UNROLL7:
+        mxv_avx2_fma_unroll<7>(mat, vec, mat_rows, mat_cols, mat_pitch, res);
+        break;
+      default:
+        mxv_avx2_fma_unroll_mt<4>(mat, vec, mat_rows, mat_cols, mat_pitch, res, threads);
+        break;
+      }
+    }
+  } else {
+    const bool block = variant == MatMulVecVariant::CL_BLOCK;
+    ycl_buffer mat_buffer, vec_buffer, res_buffer;
+    ycl_kernel kernel;
+    ycl_event ker_ev, done_ev;
+    cl_uint row_size = (cl_uint)mat_rows, col_size = (cl_uint)mat_cols, pitch_size = (cl_uint)mat_pitch;
+    cl_uint work_dim;
+    size_t work_item_size[2];
+    const double zero_pattern = 0.0;
+    double kernel_ms;
+
+    V_RETURN2(mat_buffer <<=
+              clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mat_data_bsize, mat_data.data(), &hr),
+              hr);
+    V_RETURN2(vec_buffer <<=
+              clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, vec_data_bsize, vec_data.data(), &hr),
+              hr);
+    V_RETURN2(res_buffer <<=
+              clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, res_data_bsize, nullptr, &hr),
+              hr);
+
+    V_RETURN2(kernel <<= clCreateKernel(block ? g_pMatrixProgram : g_pMatMuplVecProgram,
+                                        block ? "mxv_block" : "mxv_warp", &hr),
+              hr);
+    V_RETURN(SetKernelArguments(kernel, &mat_buffer, &vec_buffer, &row_size, &col_size, &pitch_size, &res_buffer));
+    V_RETURN(GetMatMulVecLaunchShape(kernel, device, mat_rows, mat_cols, &work_dim, work_item_size));
+
+    while (state.KeepRunning()) {
+      V_RETURN(clEnqueueFillBuffer(cmd_queue, res_buffer, &zero_pattern, sizeof(zero_pattern), 0, res_data_bsize, 0,
+                                   nullptr, g_Profiler.Mark(block ? "mxv_block.fill" : "mxv_warp.fill")));
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, work_dim, nullptr, work_item_size, nullptr, 0, nullptr,
+                                      ker_ev.ReleaseAndGetAddressOf()));
+      V_RETURN(clWaitForEvents(1, &ker_ev));
+      V_RETURN(g_Profiler.Record(block ? "mxv_block" : "mxv_warp", ker_ev));
+      V_RETURN(GetEventElapsedTime(ker_ev, &kernel_ms));
+      state.SetIterationTime(kernel_ms);
+    }
+
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, res_buffer, CL_TRUE, 0, res_data_bsize, res_data.data(), 0, nullptr,
+                                 &done_ev));
+    V_RETURN(g_Profiler.Record(block ? "mxv_block.read" : "mxv_warp.read", done_ev));
+  }
 
-  std::array<uint32_t, 4> MKN{ (uint32_t)M, (uint32_t)K, (uint32_t)N };
-  V_RETURN(SetKernelArguments(mul_ker, &a_buffer, &b_buffer, &c_buffer, &MKN));
+  state.SetVerified(check_matrix_equiv(res_data, res_ref, 1.0E-6, mat_rows, 1));
+  state.SetBytesProcessed((double)(mat_rows * mat_cols * sizeof(double) + vec_data_bsize + res_data_bsize));
+  state.SetFlopsProcessed(2.0 * mat_rows * mat_cols);
 
-  ycl_event rd_done_ev;
+  return hr;
+}
 
-  start = hp_timer::now();
+/**
+ * @param kernel_name mxv_block or mxv_warp over the storage "precision". The double data is converted on the host,
+ * so each precision multiplies the same matrix; kernel time only, bandwidth counts the REAL_STORAGE bytes of the
+ * matrix and vector. The error relative to the double CPU result is printed, not checked.
+ */
+CLHRESULT TestMatMulVecStorage(const char *kernel_name, cl_context context, cl_device_id device,
+                               cl_command_queue cmd_queue, BenchState &state) {
+
+  CLHRESULT hr = CL_SUCCESS;
+  CLPrecision precision;
+
+  if (!ParsePrecision(state.GetString("precision"), &precision))
+    return CL_INVALID_VALUE;
+
+  const size_t mat_rows = (size_t)state.GetInt("rows");
+  const size_t mat_cols = (size_t)state.GetInt("cols");
+  const size_t mat_pitch = mat_cols + (size_t)state.GetInt("pitch_pad");
+  cl_program program = g_pMatMulVecPrograms[(int)precision];
+  auto mat_data = gen_random_matrix<double>(mat_pitch, mat_rows);
+  auto vec_data = gen_random_matrix<double>(mat_cols, 1);
+  std::vector<double> ref_data(mat_rows), res_data(mat_rows);
+  cl_uint row_size = (cl_uint)mat_rows, col_size = (cl_uint)mat_cols, pitch_size = (cl_uint)mat_pitch;
+  const double zero_pattern = 0.0;
 
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, c_buffer, &dbl_zero, sizeof(dbl_zero), 0, c_data_size, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, mul_ker, 2, nullptr, global_size, nullptr, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, c_buffer, false, 0, c_buffer_size, (void *)c_data2.data(), 0, nullptr, &rd_done_ev));
-  V_RETURN(clFlush(cmd_queue));
+  mxv_avx2_fma_unroll<4>(mat_data.data(), vec_data.data(), mat_rows, mat_cols, mat_pitch, ref_data.data());
 
-  V_RETURN(clWaitForEvents(1, &rd_done_ev));
+  size_t mat_bsize = mat_rows * mat_pitch * GetStorageSize(precision);
+  size_t vec_bsize = mat_cols * GetStorageSize(precision);
+  size_t res_bsize = mat_rows * GetAccumSize(precision);
+  std::vector<uint8_t> mat_storage(mat_bsize), vec_storage(vec_bsize), res_accum(res_bsize);
+  ycl_buffer mat_buffer, vec_buffer, res_buffer;
+  ycl_kernel kernel;
+  cl_uint work_dim;
+  size_t work_item_size[2];
+  double kernel_ms;
 
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Matrix multiplication(Use global storage only) elapsed:            %.3fms\n",elapsed.count());
-  printf("Results coincedence: %s\n", check_matrix_equiv(c_data2, c_data, 1.0E-6, N, M) ? "true" : "false");
+  ConvertToStorage(precision, mat_data.data(), mat_rows * mat_pitch, mat_storage.data());
+  ConvertToStorage(precision, vec_data.data(), mat_cols, vec_storage.data());
 
-  V_RETURN((mul_ker <<= clCreateKernel(g_pMatrixProgram, "mat_mul_opt1", &hr), hr));
-  V_RETURN(SetKernelArguments(mul_ker, &a_buffer, &b_buffer, &c_buffer, &MKN));
+  V_RETURN2(mat_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mat_bsize,
+                                          mat_storage.data(), &hr),
+            hr);
+  V_RETURN2(vec_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, vec_bsize,
+                                          vec_storage.data(), &hr),
+            hr);
+  V_RETURN2(res_buffer <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, res_bsize, nullptr,
+                                          &hr),
+            hr);
 
-  start = hp_timer::now();
+  V_RETURN2(kernel <<= clCreateKernel(program, kernel_name, &hr), hr);
+  V_RETURN(SetKernelArguments(kernel, &mat_buffer, &vec_buffer, &row_size, &col_size, &pitch_size, &res_buffer));
+  V_RETURN(GetMatMulVecLaunchShape(kernel, device, mat_rows, mat_cols, &work_dim, work_item_size));
 
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, c_buffer, &dbl_zero, sizeof(dbl_zero), 0, c_data_size, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, mul_ker, 2, nullptr, global_size, nullptr, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, c_buffer, false, 0, c_buffer_size, (void *)c_data2.data(), 0, nullptr,
-                               rd_done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
+  while (state.KeepRunning()) {
+    V_RETURN(clEnqueueFillBuffer(cmd_queue, res_buffer, &zero_pattern, GetAccumSize(precision), 0, res_bsize, 0,
+                                 nullptr, nullptr));
+    V_RETURN(RunKernelTimed(cmd_queue, kernel, work_dim, work_item_size, nullptr, &kernel_ms));
+    state.SetIterationTime(kernel_ms);
+  }
 
-  V_RETURN(clWaitForEvents(1, &rd_done_ev));
+  V_RETURN(clEnqueueReadBuffer(cmd_queue, res_buffer, CL_TRUE, 0, res_bsize, res_accum.data(), 0, nullptr, nullptr));
+  ConvertFromAccum(precision, res_accum.data(), mat_rows, res_data.data());
+  CLPrecisionError error = ComputePrecisionError(ref_data.data(), res_data.data(), mat_rows);
 
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Matrix multiplication(Use shared local storage) elapsed:           %.3fms\n", elapsed.count());
-  printf("Results coincedence: %s\n", check_matrix_equiv(c_data2, c_data, 1.0E-6, N, M) ? "true" : "false");
+  printf("    %s %s: relative error max %.3e rms %.3e\n", kernel_name, GetPrecisionName(precision), error.max_rel,
+         error.rms_rel);
+  state.SetBytesProcessed((double)(mat_bsize + vec_bsize));
+  state.SetFlopsProcessed(2.0 * mat_rows * mat_cols);
 
   return hr;
 }
 
-CLHRESULT TestMatMulVecProfile(
-    cl_context context, cl_device_id device, cl_command_queue cmd_queue, size_t mat_rows, size_t mat_cols, size_t mat_pitch) {
+/**
+ * Both transpose kernels and both mat_mul kernels as one task graph over two queues: the four chains only share
+ * their uploads, so the device is free to overlap them. Results are checked from host callbacks as soon as each
+ * download lands; an iteration is the graph from its launch to its last node.
+ */
+CLHRESULT TestConcurrentTransposeAndMatMul(cl_context context, cl_device_id device, BenchState &state) {
 
   CLHRESULT hr;
+  const size_t nrows = (size_t)state.GetInt("rows");
+  const size_t ncols = (size_t)state.GetInt("cols");
+  const size_t M = (size_t)state.GetInt("M");
+  const size_t K = (size_t)state.GetInt("K");
+  const size_t N = (size_t)state.GetInt("N");
+  ycl_command_queue queues[2];
+  ycl_kernel trans_ker[2], mul_ker[2];
+  ycl_buffer trans_in_buff, trans_out_buff[2];
+  ycl_buffer a_buffer, b_buffer, c_buffer[2];
+  const char *trans_names[] = {"mat_transpose", "mat_transpose_opt1"};
+  const char *mul_names[] = {"mat_mul", "mat_mul_opt1"};
+  const double dbl_zero = 0.0;
 
-  std::vector<double> mat_data, vec_data;
-  size_t mat_data_bsize = mat_pitch * mat_rows * sizeof(double);
-  size_t vec_data_bsize = mat_cols * sizeof(double);
-  size_t res_data_bsize = mat_rows * sizeof(double);
+  auto trans_data = gen_random_matrix<double>(ncols, nrows);
+  auto a_data = gen_random_matrix<double>(K, M);
+  auto b_data = gen_random_matrix<double>(N, K);
+  std::vector<double> trans_ref(ncols * nrows), mul_ref(M * N);
+  std::vector<double> trans_res[2], mul_res[2];
+
+  for (size_t i = 0; i < nrows; ++i)
+    for (size_t j = 0; j < ncols; ++j)
+      trans_ref[j * nrows + i] = trans_data[i * ncols + j];
+
+  cpu_gemm::gemm(a_data.data(), b_data.data(), M, K, N, mul_ref.data(), g_Backend.NativeThreads());
+
+  const size_t trans_buff_size = ncols * nrows * sizeof(double);
+  const size_t a_buffer_size = M * K * sizeof(double);
+  const size_t b_buffer_size = K * N * sizeof(double);
+  const size_t c_buffer_size = M * N * sizeof(double);
+
+  V_RETURN(CreateCommandQueue(context, device, &queues[0]));
+  V_RETURN(CreateCommandQueue(context, device, &queues[1]));
+
+  V_RETURN((trans_in_buff <<= clCreateBuffer(context, CL_MEM_READ_ONLY, trans_buff_size, nullptr, &hr), hr));
+  V_RETURN((a_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY, a_buffer_size, nullptr, &hr), hr));
+  V_RETURN((b_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY, b_buffer_size, nullptr, &hr), hr));
+
+  int trans_M = static_cast<int>(ncols), trans_N = static_cast<int>(nrows);
+  std::array<uint32_t, 4> MKN{(uint32_t)M, (uint32_t)K, (uint32_t)N};
+  size_t trans_gsize[2], mul_gsize[2];
+  size_t group_size[3];
+  size_t max_work_size[3];
+
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_size), max_work_size, nullptr));
+
+  for (int v = 0; v < 2; ++v) {
+    V_RETURN((trans_out_buff[v] <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, trans_buff_size, nullptr, &hr), hr));
+    V_RETURN((c_buffer[v] <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, c_buffer_size, nullptr, &hr), hr));
+    V_RETURN((trans_ker[v] <<= clCreateKernel(g_pMatrixProgram, trans_names[v], &hr), hr));
+    V_RETURN((mul_ker[v] <<= clCreateKernel(g_pMatrixProgram, mul_names[v], &hr), hr));
+    V_RETURN(SetKernelArguments(trans_ker[v], &trans_in_buff, &trans_out_buff[v], &trans_M, &trans_N));
+    V_RETURN(SetKernelArguments(mul_ker[v], &a_buffer, &b_buffer, &c_buffer[v], &MKN));
+    trans_res[v].resize(ncols * nrows);
+    mul_res[v].resize(M * N);
+  }
+
+  V_RETURN(clGetKernelWorkGroupInfo(trans_ker[0], device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
+                                    group_size, nullptr));
+  trans_gsize[0] = std::min(RoundC(ncols, group_size[0]), RoundF(max_work_size[0], group_size[0]));
+  trans_gsize[1] = std::min(RoundC(nrows, group_size[1]), RoundF(max_work_size[1], group_size[1]));
+
+  V_RETURN(clGetKernelWorkGroupInfo(mul_ker[0], device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
+                                    group_size, nullptr));
+  mul_gsize[0] = RoundC(N, group_size[0]);
+  mul_gsize[1] = RoundC(M, group_size[1]);
+
+  bool coincident = true;
   hp_timer::time_point start, fin;
-  fmilliseconds elapsed;
 
-  mat_data = gen_random_matrix<double>(mat_pitch, mat_rows);
-  vec_data = gen_random_matrix<double>(1, mat_cols);
+  while (state.KeepRunning()) {
+    CLTaskGraph graph;
+    bool trans_ok[2] = {}, mul_ok[2] = {};
+
+    graph.AddQueue(queues[0]);
+    graph.AddQueue(queues[1]);
+
+    auto up_trans = graph.AddUpload(trans_in_buff, 0, trans_buff_size, trans_data.data(), {}, 0);
+    auto up_a = graph.AddUpload(a_buffer, 0, a_buffer_size, a_data.data(), {}, 1);
+    auto up_b = graph.AddUpload(b_buffer, 0, b_buffer_size, b_data.data(), {}, 1);
+
+    for (int v = 0; v < 2; ++v) {
+      // Variant v runs on queue v, each chain waits on the other queue's uploads through events only.
+      auto trans = graph.AddKernel(trans_ker[v], 2, trans_gsize, nullptr, {up_trans}, nullptr, v);
+      auto trans_rd = graph.AddDownload(trans_out_buff[v], 0, trans_buff_size, trans_res[v].data(), {trans}, v);
+      graph.AddHostCallback(
+          [&, v]() { trans_ok[v] = check_matrix_equiv(trans_res[v], trans_ref, 1.0E-6, nrows, ncols); }, {trans_rd});
+
+      auto fill = graph.AddFill(c_buffer[v], &dbl_zero, sizeof(dbl_zero), 0, c_buffer_size, {}, v);
+      auto mul = graph.AddKernel(mul_ker[v], 2, mul_gsize, nullptr, {up_a, up_b, fill}, nullptr, v);
+      auto mul_rd = graph.AddDownload(c_buffer[v], 0, c_buffer_size, mul_res[v].data(), {mul}, v);
+      graph.AddHostCallback([&, v]() { mul_ok[v] = check_matrix_equiv(mul_res[v], mul_ref, 1.0E-6, N, M); },
+                            {mul_rd});
+    }
+
+    start = hp_timer::now();
+    V_RETURN(graph.Launch());
+    V_RETURN(graph.Wait());
+    fin = hp_timer::now();
+    state.SetIterationTime(fmilliseconds_cast(fin - start).count());
+
+    for (int v = 0; v < 2; ++v) {
+      if (!trans_ok[v] || !mul_ok[v])
+        printf("    %s %s, %s %s\n", trans_names[v], trans_ok[v] ? "coincide" : "MISMATCH", mul_names[v],
+               mul_ok[v] ? "coincide" : "MISMATCH");
+      coincident = coincident && trans_ok[v] && mul_ok[v];
+    }
+  }
+
+  state.SetVerified(coincident);
+  state.SetFlopsProcessed(2.0 * 2.0 * M * K * N);
 
-  std::vector<double> res_data2;
-  res_data2.resize(mat_rows);
+  return hr;
+}
 
-  start = hp_timer::now();
-  for (ptrdiff_t i = 0; i < mat_rows; ++i) {
-    ptrdiff_t ii = i * mat_pitch;
-    double temp = 0.0;
-    for (ptrdiff_t j = 0; j < mat_cols; ++j) {
-      temp += mat_data[ii + j] * vec_data[j];
+enum class BatchedVariant {
+  CPU_LOOP_MXM,
+  CPU_STRIDED_MXM_1T,
+  CPU_STRIDED_MXM,
+  CPU_INDEXED_MXM,
+  CPU_LOOP_MXV,
+  CPU_STRIDED_MXV,
+  CL_LOOP_MXM,
+  CL_LOOP_MXV,
+  CL_STRIDED_MXM,
+  CL_INDEXED_MXM,
+  CL_STRIDED_MXV,
+  CL_INDEXED_MXV,
+};
+
+/**
+ * "batch" square problems of ["n" x "n"] through the batched API against a loop over the single-problem one:
+ * mxm_avx2_unroll / mxv_avx2_fma_unroll per problem on the host, a mat_mul / mxv_warp launch per problem on the
+ * device (the first 256 problems only, each in its own buffers). Every variant is timed on the host from the first
+ * enqueue to clFinish, so launch overheads count on both sides; the indexed variants write problem p to the slot of
+ * problem batch - 1 - p.
+ */
+CLHRESULT TestBatched(BatchedVariant variant, cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                      BenchState &state) {
+
+  CLHRESULT hr = CL_SUCCESS;
+  const size_t n = (size_t)state.GetInt("n");
+  const size_t batch = (size_t)state.GetInt("batch");
+  const size_t mat_len = n * n;
+  const unsigned threads = g_Backend.NativeThreads();
+  const batched::strides mm_stride = {(cl_uint)mat_len, (cl_uint)mat_len, (cl_uint)mat_len};
+  const batched::strides mv_stride = {(cl_uint)mat_len, (cl_uint)n, (cl_uint)n};
+  const bool is_mxv = variant == BatchedVariant::CPU_LOOP_MXV || variant == BatchedVariant::CPU_STRIDED_MXV ||
+                      variant == BatchedVariant::CL_LOOP_MXV || variant == BatchedVariant::CL_STRIDED_MXV ||
+                      variant == BatchedVariant::CL_INDEXED_MXV;
+  const bool is_indexed = variant == BatchedVariant::CPU_INDEXED_MXM || variant == BatchedVariant::CL_INDEXED_MXM ||
+                          variant == BatchedVariant::CL_INDEXED_MXV;
+  const size_t res_len = is_mxv ? n : mat_len;
+  std::vector<double> a_data = gen_random_matrix<double>(mat_len, batch);
+  std::vector<double> b_data = gen_random_matrix<double>(mat_len, batch);
+  std::vector<double> v_data = gen_random_matrix<double>(n, batch);
+  std::vector<double> res_ref(res_len * batch), res_data(res_len * batch);
+  std::vector<batched::offsets> problem_offsets(batch);
+  size_t problems = batch;
+
+  for (size_t p = 0; p < batch; ++p) {
+    if (is_mxv) {
+      mxv_avx2_fma_unroll<4>(&a_data[p * mat_len], &v_data[p * n], n, n, n, &res_ref[p * n]);
+      problem_offsets[p] = {(cl_uint)(p * mat_len), (cl_uint)(p * n), (cl_uint)((batch - 1 - p) * n), 0};
+    } else {
+      mxm_avx2_unroll<4>(&a_data[p * mat_len], &b_data[p * mat_len], n, n, n, &res_ref[p * mat_len]);
+      problem_offsets[p] = {(cl_uint)(p * mat_len), (cl_uint)(p * mat_len), (cl_uint)((batch - 1 - p) * mat_len), 0};
     }
-    res_data2[i] = temp;
   }
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("matrix [%lld x %lld] multipling vector [%lld x 1]  (CPU) elapsed:                            %.3fms\n",
-         mat_rows, mat_cols, mat_cols, elapsed.count());
-
-  std::vector<double> res_data(mat_rows);
-
-  start = hp_timer::now();
-  mxv_avx2_fma_unroll<3>(mat_data.data(), vec_data.data(), mat_rows, mat_cols, mat_pitch, (double *)res_data.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("matrix [%lld x %lld] multipling vector [%lld x 1]  (CPU, AVX2+FMA, unroll 3 rows) elapsed:   %.3fms\n",
-         mat_rows, mat_cols, mat_cols, elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(res_data, res_data2, 1.0E-6, mat_rows, 1) ? "true" : "false");
-  start = hp_timer::now();
-  mxv_avx2_fma_unroll<4>(mat_data.data(), vec_data.data(), mat_rows, mat_cols, mat_pitch, (double *)res_data2.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("matrix [%lld x %lld] multipling vector [%lld x 1]  (CPU, AVX2+FMA, unroll 4 rows) elapsed:   %.3fms\n",
-         mat_rows, mat_cols, mat_cols, elapsed.count());
-  start = hp_timer::now();
-  mxv_avx2_fma_unroll<5>(mat_data.data(), vec_data.data(), mat_rows, mat_cols, mat_pitch, (double *)res_data2.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("matrix [%lld x %lld] multipling vector [%lld x 1]  (CPU, AVX2+FMA, unroll 5 rows) elapsed:   %.3fms\n",
-         mat_rows, mat_cols, mat_cols, elapsed.count());
-  start = hp_timer::now();
-  mxv_avx2_fma_unroll<7>(mat_data.data(), vec_data.data(), mat_rows, mat_cols, mat_pitch, (double *)res_data2.data());
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("matrix [%lld x %lld] multipling vector [%lld x 1]  (CPU, AVX2+FMA, unroll 7 rows) elapsed:   %.3fms\n", mat_rows,
-         mat_cols, mat_cols, elapsed.count());
 
-  ycl_buffer mat_buffer, vec_buffer, res_buffer;
-  cl_uint row_size = (cl_uint)mat_rows,
-          col_size = (cl_uint)mat_cols,
-          pitch_size = (cl_uint)mat_pitch;
+  if (variant < BatchedVariant::CL_LOOP_MXM) {
+    while (state.KeepRunning()) {
+      switch (variant) {
+      case BatchedVariant::CPU_LOOP_MXM:
+        for (size_t p = 0; p < batch; ++p)
+          mxm_avx2_unroll<4>(&a_data[p * mat_len], &b_data[p * mat_len], n, n, n, &res_data[p * mat_len]);
+        break;
+      case BatchedVariant::CPU_STRIDED_MXM_1T:
+        batched::mat_mul(a_data.data(), b_data.data(), res_data.data(), n, n, n, mm_stride, batch, 1);
+        break;
+      case BatchedVariant::CPU_STRIDED_MXM:
+        batched::mat_mul(a_data.data(), b_data.data(), res_data.data(), n, n, n, mm_stride, batch, threads);
+        break;
+      case BatchedVariant::CPU_INDEXED_MXM:
+        batched::mat_mul(a_data.data(), b_data.data(), res_data.data(), n, n, n, problem_offsets.data(), batch,
+                         threads);
+        break;
+      case BatchedVariant::CPU_LOOP_MXV:
+        for (size_t p = 0; p < batch; ++p)
+          mxv_avx2_fma_unroll<4>(&a_data[p * mat_len], &v_data[p * n], n, n, n, &res_data[p * n]);
+        break;
+      default:
+        batched::mxv(a_data.data(), v_data.data(), res_data.data(), n, n, n, mv_stride, batch, threads);
+        break;
+      }
+    }
+  } else if (variant < BatchedVariant::CL_STRIDED_MXM) {
+    // Single-problem launches, each problem in buffers of its own as the single-problem API takes them.
+    const size_t mat_bsize = mat_len * sizeof(double), vec_bsize = n * sizeof(double);
+    const size_t res_bsize = res_len * sizeof(double);
+    std::vector<ycl_buffer> loop_buffers(std::min(batch, (size_t)256) * 3);
+    ycl_kernel ker;
+    size_t group_size[3], global_size[2];
+    cl_uint nu = (cl_uint)n;
+    std::array<uint32_t, 4> MKN{nu, nu, nu};
+
+    problems = loop_buffers.size() / 3;
+    for (size_t p = 0; p < problems; ++p) {
+      V_RETURN2(loop_buffers[p * 3] <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mat_bsize,
+                                                       &a_data[p * mat_len], &hr),
+                hr);
+      V_RETURN2(loop_buffers[p * 3 + 1] <<=
+                clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, is_mxv ? vec_bsize : mat_bsize,
+                               is_mxv ? &v_data[p * n] : &b_data[p * mat_len], &hr),
+                hr);
+      V_RETURN2(loop_buffers[p * 3 + 2] <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, res_bsize, nullptr, &hr), hr);
+    }
 
-  V_RETURN2(mat_buffer <<=
-            clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mat_data_bsize, mat_data.data(), &hr),
-            hr);
-  V_RETURN2(vec_buffer <<=
-            clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, vec_data_bsize, vec_data.data(), &hr),
-            hr);
-  V_RETURN2(res_buffer <<=
-            clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_HOST_READ_ONLY, res_data_bsize, nullptr, &hr),
-            hr);
+    V_RETURN2(ker <<= clCreateKernel(is_mxv ? g_pMatMuplVecProgram : g_pMatrixProgram, is_mxv ? "mxv_warp" : "mat_mul",
+                                     &hr),
+              hr);
+    V_RETURN(clGetKernelWorkGroupInfo(ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
+                                      group_size, nullptr));
+    if (is_mxv) {
+      global_size[0] = RoundC(std::max(n / group_size[1], (size_t)1), group_size[0]);
+      global_size[1] = group_size[1];
+    } else {
+      global_size[0] = RoundC(n, group_size[0]);
+      global_size[1] = RoundC(n, group_size[1]);
+    }
 
-  ycl_kernel kernel;
-  size_t group_size[3];
-  size_t max_work_item_size[3];
-  size_t work_item_size[2];
-  ycl_event done_ev;
-  const double zero_pattern = 0.0;
+    V_RETURN(clFinish(cmd_queue));
+    while (state.KeepRunning()) {
+      for (size_t p = 0; p < problems; ++p) {
+        if (is_mxv) {
+          V_RETURN(SetKernelArguments(ker, &loop_buffers[p * 3], &loop_buffers[p * 3 + 1], &nu, &nu, &nu,
+                                      &loop_buffers[p * 3 + 2]));
+        } else {
+          V_RETURN(SetKernelArguments(ker, &loop_buffers[p * 3], &loop_buffers[p * 3 + 1], &loop_buffers[p * 3 + 2],
+                                      &MKN));
+        }
+        V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker, 2, nullptr, global_size, nullptr, 0, nullptr, nullptr));
+      }
+      V_RETURN(clFinish(cmd_queue));
+    }
 
-  V_RETURN(
-      clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_item_size), max_work_item_size, nullptr));
+    for (size_t p = 0; p < problems; ++p)
+      V_RETURN(clEnqueueReadBuffer(cmd_queue, loop_buffers[p * 3 + 2], CL_FALSE, 0, res_bsize, &res_data[p * res_len],
+                                   0, nullptr, nullptr));
+    V_RETURN(clFinish(cmd_queue));
+  } else {
+    // One launch for the batch.
+    const size_t mat_bsize = mat_len * sizeof(double), vec_bsize = n * sizeof(double);
+    ycl_buffer a_buffer, b_buffer, res_buffer, offsets_buffer;
+    cl_uint nu = (cl_uint)n;
+
+    V_RETURN2(a_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mat_bsize * batch,
+                                          a_data.data(), &hr),
+              hr);
+    V_RETURN2(b_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                          (is_mxv ? vec_bsize : mat_bsize) * batch,
+                                          is_mxv ? v_data.data() : b_data.data(), &hr),
+              hr);
+    V_RETURN2(res_buffer <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, res_data.size() * sizeof(double), nullptr,
+                                            &hr),
+              hr);
+    V_RETURN2(offsets_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                                batch * sizeof(batched::offsets), problem_offsets.data(), &hr),
+              hr);
+
+    V_RETURN(clFinish(cmd_queue));
+    while (state.KeepRunning()) {
+      switch (variant) {
+      case BatchedVariant::CL_STRIDED_MXM:
+        V_RETURN(batched::enqueue_mat_mul(cmd_queue, g_pMatrixProgram, a_buffer, b_buffer, res_buffer, nu, nu, nu,
+                                          mm_stride, (cl_uint)batch));
+        break;
+      case BatchedVariant::CL_INDEXED_MXM:
+        V_RETURN(batched::enqueue_mat_mul(cmd_queue, g_pMatrixProgram, a_buffer, b_buffer, res_buffer, nu, nu, nu,
+                                          offsets_buffer, (cl_uint)batch));
+        break;
+      case BatchedVariant::CL_STRIDED_MXV:
+        V_RETURN(batched::enqueue_mxv(cmd_queue, g_pMatMuplVecProgram, a_buffer, b_buffer, res_buffer, nu, nu, nu,
+                                      mv_stride, (cl_uint)batch));
+        break;
+      default:
+        V_RETURN(batched::enqueue_mxv(cmd_queue, g_pMatMuplVecProgram, a_buffer, b_buffer, res_buffer, nu, nu, nu,
+                                      offsets_buffer, (cl_uint)batch));
+        break;
+      }
+      V_RETURN(clFinish(cmd_queue));
+    }
 
-  V_RETURN2(kernel <<= clCreateKernel(g_pMatrixProgram, "mxv_block", &hr), hr);
-  V_RETURN(SetKernelArguments(kernel, &mat_buffer, &vec_buffer, &row_size, &col_size, &pitch_size, &res_buffer));
-  V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size), group_size, nullptr));
-
-  work_item_size[0] = RoundC(mat_cols, group_size[0]);
-  work_item_size[0] = std::min(work_item_size[0], max_work_item_size[0]);
-  work_item_size[0] = RoundF(work_item_size[0], group_size[0]);
-
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, res_buffer, &zero_pattern, sizeof(zero_pattern), 0, res_data_bsize, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, work_item_size, nullptr, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, res_buffer, false, 0, res_data_bsize, (void *)res_data.data(), 0, nullptr,
-                               done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("matrix [%lld x %lld] multipling vector [%lld x 1]  (One Row Per Block) elaped:               %.3fms\n", mat_rows, mat_cols, mat_cols,
-    elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(res_data, res_data2, 1.0E-6, mat_rows, 1) ? "true" : "false");
-
-  V_RETURN2(kernel <<= clCreateKernel(g_pMatMuplVecProgram, "mxv_warp", &hr),
-            hr);
-  V_RETURN(SetKernelArguments(kernel, &mat_buffer, &vec_buffer, &row_size, &col_size, &pitch_size, &res_buffer));
-  V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size), group_size,
-                                    nullptr));
-
-  work_item_size[0] = RoundC(mat_rows / group_size[1], group_size[0]);
-  work_item_size[0] = std::min(work_item_size[0], max_work_item_size[0]);
-  work_item_size[1] = RoundC(1, group_size[1]);
-
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, res_buffer, &zero_pattern, sizeof(zero_pattern), 0, res_data_bsize, 0,
-                               nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 2, nullptr, work_item_size, nullptr, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, res_buffer, false, 0, res_data_bsize, (void *)res_data.data(), 0, nullptr,
-                               done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("matrix [%lld x %lld] multipling vector [%lld x 1]  (One Raw Per Warp) elapsed:               %.3fms\n", mat_rows, mat_cols,
-         mat_cols, elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(res_data, res_data2, 1.0E-6, mat_rows, 1) ? "true" : "false");
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, res_buffer, CL_TRUE, 0, res_data.size() * sizeof(double),
+                                 res_data.data(), 0, nullptr, nullptr));
+  }
+
+  if (is_indexed) {
+    for (size_t p = 0; p < batch / 2; ++p)
+      std::swap_ranges(res_data.begin() + p * res_len, res_data.begin() + (p + 1) * res_len,
+                       res_data.begin() + (batch - 1 - p) * res_len);
+  }
+
+  // The loop of launches covers the first problems only.
+  res_data.resize(problems * res_len);
+  res_ref.resize(problems * res_len);
+  state.SetVerified(check_matrix_equiv(res_data, res_ref, 1.0E-6, res_len, problems));
+  if (is_mxv) {
+    state.SetBytesProcessed((double)problems * (mat_len + 2 * n) * sizeof(double));
+    state.SetFlopsProcessed(2.0 * problems * mat_len);
+  } else {
+    state.SetBytesProcessed((double)problems * 3 * mat_len * sizeof(double));
+    state.SetFlopsProcessed(2.0 * problems * mat_len * n);
+  }
 
   return hr;
 }
 
-int main() {
+enum class OutOfCoreVariant { HOST_MEMORY, MAPPED_FILES };
+
+/**
+ * ooc_gemm of operands about 1.5x the device budget of "budget_mb" each, streamed through the device tile by tile,
+ * timed by its own wall clock and checked against cpu_gemm. MAPPED_FILES reads the inputs through file mappings, as
+ * they would be for inputs larger than host memory. HOST_MEMORY also checks the planner below a 64 and a 16 tile.
+ */
+CLHRESULT TestOutOfCoreGemm(OutOfCoreVariant variant, cl_context context, cl_device_id device, BenchState &state) {
+
+  CLHRESULT hr = CL_SUCCESS;
+  const size_t budget_bytes = (size_t)state.GetInt("budget_mb") << 20;
+  // A, B and C each about 1.5x the budget
+  const size_t n = RoundC((size_t)sqrt(budget_bytes * 1.5 / sizeof(double)), 64);
+  const size_t M = n, K = n - 64, N = n + 64;
+  std::vector<double> a_data = gen_random_matrix<double>(K, M);
+  std::vector<double> b_data = gen_random_matrix<double>(N, K);
+  std::vector<double> c_ref(M * N), c_data(M * N);
+  const ooc_gemm::config cfg = {budget_bytes, 0, 2};
+  ooc_gemm::stats st = {};
+  const double *a_ptr = a_data.data(), *b_ptr = b_data.data();
+  bool plan_ok = true;
+
+  cpu_gemm::gemm(a_data.data(), b_data.data(), M, K, N, c_ref.data(), g_Backend.NativeThreads());
+
+  if (variant == OutOfCoreVariant::HOST_MEMORY) {
+    // Budgets below a 64 tile: the planner steps down by 16, and fails cleanly below 16 instead of a tile of 0.
+    size_t small_tile = 0, no_tile = 0;
+    const ooc_gemm::config below_64 = {ooc_gemm::footprint(64, K, 2) - 1, 0, 2};
+    const ooc_gemm::config below_16 = {ooc_gemm::footprint(16, K, 2) - 1, 0, 2};
+
+    plan_ok = CL_SUCCEEDED(ooc_gemm::plan(device, M, K, N, below_64, &small_tile)) && small_tile == 48;
+    plan_ok = plan_ok && ooc_gemm::plan(device, M, K, N, below_16, &no_tile) == CL_OUT_OF_RESOURCES && no_tile == 0;
+    printf("    plan for budgets below a 64 and a 16 tile (tile %zu, then refused): %s\n", small_tile,
+           plan_ok ? "true" : "false");
+  }
+
+  const char *a_fname = "ooc_gemm_a.bin", *b_fname = "ooc_gemm_b.bin";
+  ooc_gemm::mapped_file a_file, b_file;
+
+  if (variant == OutOfCoreVariant::MAPPED_FILES) {
+    std::ofstream(a_fname, std::ios::binary).write((const char *)a_data.data(), a_data.size() * sizeof(double));
+    std::ofstream(b_fname, std::ios::binary).write((const char *)b_data.data(), b_data.size() * sizeof(double));
+    if (!a_file.open(a_fname) || !b_file.open(b_fname)) {
+      remove(a_fname);
+      remove(b_fname);
+      printf("    cannot map the input files\n");
+      return CL_INVALID_OPERATION;
+    }
+    a_ptr = (const double *)a_file.data();
+    b_ptr = (const double *)b_file.data();
+  }
+
+  while (state.KeepRunning()) {
+    hr = ooc_gemm::gemm(context, device, g_pMatrixProgram, a_ptr, b_ptr, M, K, N, c_data.data(), cfg, &st);
+    if (CL_FAILED(hr))
+      break;
+    state.SetIterationTime(st.wall_ms);
+  }
 
-  CLHRESULT hr;
-  cl_platform_id platform;
-  ycl_device_id device;
-  ycl_context context;
-  ycl_command_queue cmd_queue;
+  if (variant == OutOfCoreVariant::MAPPED_FILES) {
+    a_file.close();
+    b_file.close();
+    remove(a_fname);
+    remove(b_fname);
+  }
+  V_RETURN(hr);
+
+  printf("    tile %zu, %zu tiles, panels uploaded %zu / resident %zu, %.2fGB up %.2fGB down, %.1fMB on device\n",
+         st.tile, st.tiles, st.panel_uploads, st.panel_hits, st.bytes_uploaded / 1.0E9, st.bytes_downloaded / 1.0E9,
+         st.device_bytes / 1048576.0);
+  state.SetVerified(plan_ok && check_matrix_equiv(c_data, c_ref, 1.0E-6, N, M));
+  state.SetBytesProcessed((double)(st.bytes_uploaded + st.bytes_downloaded));
+  state.SetFlopsProcessed(2.0 * M * K * N);
 
-  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {"NVIDIA CUDA", "AMD"}, {}, &platform, &device));
-  V_RETURN(CreateDeviceContext(platform, device, &context));
-  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
+  return hr;
+}
 
-  V_RETURN(CreateProgramFromILFile(context, device, "OCL-SpirV/matrix.spv", &g_pMatrixProgram));
-  g_pMatMuplVecProgram = g_pMatrixProgram;
+int main(int argc, char **argv) {
 
-  std::uniform_int_distribution<size_t> transpose_ncols_nrows_distr(16, 5000);
+  CLHRESULT hr;
 
-  for(ptrdiff_t i = 0; i < 100; ++i) {
-    printf("Matrix Transpose Profile [%lld]:\n", i);
-    TestMatrixTransposeProfile(context, device, cmd_queue, transpose_ncols_nrows_distr(g_RandomEngine),
-                               transpose_ncols_nrows_distr(g_RandomEngine));
-    printf("\n");
+  // Without any OpenCL device only the CPU variants are registered (cmd_queue is nullptr).
+  V_RETURN(g_Backend.Init({"NVIDIA CUDA", "AMD"}));
+
+  cl_context context = g_Backend.Context();
+  cl_device_id device = g_Backend.Device();
+  cl_command_queue cmd_queue = g_Backend.Queue();
+  std::vector<BenchValue> storage_precisions;
+
+  BenchmarkSuite suite("matrix");
+  suite.ParseArgs(argc, argv);
+
+  if (g_Backend.HasDevice()) {
+    CLILVariant variant;
+
+    // The host side is double precision throughout; the tile size is the largest the device runs.
+    hr = CreateProgramFromILManifest(context, device, "OCL-SpirV/matrix.manifest", CLILPrecision::FP64, 0,
+                                     &g_pMatrixProgram, &variant);
+    if (CL_SUCCEEDED(hr)) {
+      printf("Matrix program: %s, %ux%u tiles\n", variant.file.c_str(), variant.tile, variant.tile);
+      g_pMatMuplVecProgram = g_pMatrixProgram;
+      g_pMatMulVecPrograms[(int)CLPrecision::FP64] = g_pMatrixProgram;
+      storage_precisions.push_back(GetPrecisionName(CLPrecision::FP64));
+
+      // Narrower storage for the memory-bound mxv kernels, optional.
+      for (CLPrecision precision : {CLPrecision::FP32, CLPrecision::FP16, CLPrecision::BF16}) {
+        if (CL_SUCCEEDED(CreateProgramFromILManifest(context, device, "OCL-SpirV/matrix.manifest", precision, 0,
+                                                     &g_pMatMulVecPrograms[(int)precision], &variant)))
+          storage_precisions.push_back(GetPrecisionName(precision));
+        else
+          printf("No %s matrix program, skipped in the mxv storage sweep\n", GetPrecisionName(precision));
+      }
+    } else {
+      printf("No usable matrix program on the device, CPU only\n");
+      cmd_queue = nullptr;
+    }
   }
 
-  std::uniform_int_distribution<size_t> mul_ncols_nrows_distr(510, 2000);
+  cpu_gemm::cache_sizes caches = cpu_gemm::detect_cache_sizes();
+  cpu_gemm::blocking gemm_blk = cpu_gemm::make_blocking(cpu_gemm::detect_isa(), sizeof(double), caches);
+  printf("CPU GEMM: %s micro kernel %zux%zu, L1d %zuKB L2 %zuKB L3 %zuKB -> kc %zu, mc %zu, nc %zu (fp64)\n",
+         cpu_gemm::isa_name(gemm_blk.kernel), gemm_blk.mr, gemm_blk.nr, caches.l1d >> 10, caches.l2 >> 10,
+         caches.l3 >> 10, gemm_blk.kc, gemm_blk.mc, gemm_blk.nc);
+
+  // Odd shapes on purpose, the edges of every blocked variant get exercised.
+  auto transpose_sweep = MakeParamSweep({{"rows", {500, 2048, 4999}}, {"cols", {333, 1024, 4096}}});
+  const struct {
+    const char *name;
+    TransposeVariant variant;
+  } transposes[] = {{"transpose_serial", TransposeVariant::SERIAL},
+                    {"transpose_avx2_4x8", TransposeVariant::AVX2_4X8},
+                    {"transpose_avx2_4x4", TransposeVariant::AVX2_4X4},
+                    {"transpose_avx2_4x4_2", TransposeVariant::AVX2_4X4_2},
+                    {"transpose_tiled_mt", TransposeVariant::TILED_MT},
+                    {"transpose_recursive_mt", TransposeVariant::RECURSIVE_MT},
+                    {"transpose_recursive_mt_streaming", TransposeVariant::RECURSIVE_MT_STREAMING},
+                    {"transpose_cl_global", TransposeVariant::CL_GLOBAL},
+                    {"transpose_cl_local", TransposeVariant::CL_LOCAL},
+                    {"transpose_cl_local_32bit_bank", TransposeVariant::CL_LOCAL_32BIT_BANK}};
+
+  for (auto &t : transposes) {
+    if (t.variant >= TransposeVariant::CL_GLOBAL && !cmd_queue)
+      continue;
+    suite.Register(t.name, transpose_sweep, [&, t](BenchState &state) {
+      return TestMatrixTranspose(t.variant, context, device, cmd_queue, state);
+    });
+  }
 
-  for(ptrdiff_t i = 0; i < 20; ++i) {
-    printf("Matrix Multiplication Profile [%lld]:\n", i);
-    TestMatrixMulitplicationProfile(context, device, cmd_queue, mul_ncols_nrows_distr(g_RandomEngine),
-                                    mul_ncols_nrows_distr(g_RandomEngine), mul_ncols_nrows_distr(g_RandomEngine));
-    printf("\n");
+  // The single threaded loops are cubic, keep them on the small shape.
+  auto mxm_small_sweep = MakeParamSweep({{"M", {512}}, {"K", {510}}, {"N", {768}}});
+  auto mxm_sweep = MakeParamSweep({{"M", {512, 1999}}, {"K", {1024}}, {"N", {768, 2000}}});
+  const struct {
+    const char *name;
+    MatMulVariant variant;
+    bool small_only;
+  } mat_muls[] = {{"mxm_serial", MatMulVariant::SERIAL, true},
+                  {"mxm_avx2_unroll16", MatMulVariant::AVX2_UNROLL16, false},
+                  {"mxm_avx2_unroll8", MatMulVariant::AVX2_UNROLL8, false},
+                  {"mxm_avx2_unroll4", MatMulVariant::AVX2_UNROLL4, false},
+                  {"mxm_avx2_unroll16_mt", MatMulVariant::AVX2_UNROLL16_MT, false},
+                  {"mxm_gemm_fp64_1t", MatMulVariant::GEMM_FP64_1T, false},
+                  {"mxm_gemm_fp64", MatMulVariant::GEMM_FP64, false},
+                  {"mxm_gemm_fp32", MatMulVariant::GEMM_FP32, false},
+                  {"mxm_cl_global", MatMulVariant::CL_GLOBAL, false},
+                  {"mxm_cl_local", MatMulVariant::CL_LOCAL, false},
+                  {"mxm_cl_reg_4x4", MatMulVariant::CL_REG_4X4, false},
+                  {"mxm_cl_reg_8x4", MatMulVariant::CL_REG_8X4, false},
+                  {"mxm_cl_reg_4x8", MatMulVariant::CL_REG_4X8, false}};
+
+  for (auto &m : mat_muls) {
+    if (m.variant >= MatMulVariant::CL_GLOBAL && !cmd_queue)
+      continue;
+    suite.Register(m.name, m.small_only ? mxm_small_sweep : mxm_sweep, [&, m](BenchState &state) {
+      return TestMatrixMultiplication(m.variant, context, device, cmd_queue, state);
+    });
   }
 
-  std::uniform_int_distribution<size_t> mxv_ncols_distr(510, 5000);
+  auto mxv_sweep = MakeParamSweep({{"rows", {510, 2048, 4999}}, {"cols", {510, 3001}}, {"pitch_pad", {0, 13}}});
+  const struct {
+    const char *name;
+    MatMulVecVariant variant;
+  } mat_vecs[] = {{"mxv_serial", MatMulVecVariant::SERIAL},
+                  {"mxv_avx2_unroll3", MatMulVecVariant::AVX2_UNROLL3},
+                  {"mxv_avx2_unroll4", MatMulVecVariant::AVX2_UNROLL4},
+                  {"mxv_avx2_unroll5", MatMulVecVariant::AVX2_UNROLL5},
+                  {"mxv_avx2_unroll7", MatMulVecVariant::AVX2_UNROLL7},
+                  {"mxv_avx2_unroll4_mt", MatMulVecVariant::AVX2_UNROLL4_MT},
+                  {"mxv_cl_block", MatMulVecVariant::CL_BLOCK},
+                  {"mxv_cl_warp", MatMulVecVariant::CL_WARP}};
+
+  for (auto &m : mat_vecs) {
+    if (m.variant >= MatMulVecVariant::CL_BLOCK && !cmd_queue)
+      continue;
+    suite.Register(m.name, mxv_sweep, [&, m](BenchState &state) {
+      return TestMatMulVec(m.variant, context, device, cmd_queue, state);
+    });
+  }
 
-  for(ptrdiff_t i = 0; i < 40; ++i) {
+  // Thousands of small problems per request: one launch for the batch against one per problem.
+  auto batched_sweep = MakeParamSweep({{"n", {8, 16, 32}}, {"batch", {4096}}});
+  auto batched_large = MakeParamSweep({{"n", {64}}, {"batch", {1024}}});
+  batched_sweep.insert(batched_sweep.end(), batched_large.begin(), batched_large.end());
+  const struct {
+    const char *name;
+    BatchedVariant variant;
+  } batched_ops[] = {{"batched_mxm_cpu_loop", BatchedVariant::CPU_LOOP_MXM},
+                     {"batched_mxm_cpu_strided_1t", BatchedVariant::CPU_STRIDED_MXM_1T},
+                     {"batched_mxm_cpu_strided", BatchedVariant::CPU_STRIDED_MXM},
+                     {"batched_mxm_cpu_indexed", BatchedVariant::CPU_INDEXED_MXM},
+                     {"batched_mxv_cpu_loop", BatchedVariant::CPU_LOOP_MXV},
+                     {"batched_mxv_cpu_strided", BatchedVariant::CPU_STRIDED_MXV},
+                     {"batched_mxm_cl_loop", BatchedVariant::CL_LOOP_MXM},
+                     {"batched_mxv_cl_loop", BatchedVariant::CL_LOOP_MXV},
+                     {"batched_mxm_cl_strided", BatchedVariant::CL_STRIDED_MXM},
+                     {"batched_mxm_cl_indexed", BatchedVariant::CL_INDEXED_MXM},
+                     {"batched_mxv_cl_strided", BatchedVariant::CL_STRIDED_MXV},
+                     {"batched_mxv_cl_indexed", BatchedVariant::CL_INDEXED_MXV}};
+
+  for (auto &b : batched_ops) {
+    if (b.variant >= BatchedVariant::CL_LOOP_MXM && !cmd_queue)
+      continue;
+    suite.Register(b.name, batched_sweep, [&, b](BenchState &state) {
+      return TestBatched(b.variant, context, device, cmd_queue, state);
+    });
+  }
 
-    size_t mat_rows = mxv_ncols_distr(g_RandomEngine);
-    size_t mat_cols = mxv_ncols_distr(g_RandomEngine);
-    size_t mat_pitch = mxv_ncols_distr(g_RandomEngine);
+  if (cmd_queue) {
+    suite.Register("mxv_cl_block_storage",
+                   MakeParamSweep({{"precision", storage_precisions},
+                                   {"rows", {2048, 4999}},
+                                   {"cols", {3001}},
+                                   {"pitch_pad", {13}}}),
+                   [&](BenchState &state) {
+                     return TestMatMulVecStorage("mxv_block", context, device, cmd_queue, state);
+                   });
+    suite.Register("mxv_cl_warp_storage",
+                   MakeParamSweep({{"precision", storage_precisions},
+                                   {"rows", {2048, 4999}},
+                                   {"cols", {3001}},
+                                   {"pitch_pad", {13}}}),
+                   [&](BenchState &state) {
+                     return TestMatMulVecStorage("mxv_warp", context, device, cmd_queue, state);
+                   });
+
+    suite.Register("concurrent_transpose_mxm",
+                   MakeParamSweep({{"rows", {2000}}, {"cols", {1500}}, {"M", {1024}}, {"K", {1000}}, {"N", {768}}}),
+                   [&](BenchState &state) { return TestConcurrentTransposeAndMatMul(context, device, state); });
+
+    // Operands several times the device budget, streamed through it tile by tile.
+    const char *budget_env = getenv("CLX_OOC_BUDGET_MB");
+    size_t budget_mb = budget_env ? strtoull(budget_env, nullptr, 10) : 0;
+    auto ooc_sweep = MakeParamSweep({{"budget_mb", {budget_mb ? budget_mb : 64}}});
+
+    suite.Register("ooc_gemm_host_memory", ooc_sweep, [&](BenchState &state) {
+      return TestOutOfCoreGemm(OutOfCoreVariant::HOST_MEMORY, context, device, state);
+    });
+    suite.Register("ooc_gemm_mapped_files", ooc_sweep, [&](BenchState &state) {
+      return TestOutOfCoreGemm(OutOfCoreVariant::MAPPED_FILES, context, device, state);
+    });
+  }
 
-    printf("Matrix-Vector Multiplication Profile [%lld]:\n", i);
-    if(mat_cols > mat_pitch)
-      std::swap(mat_cols, mat_pitch);
+  hr = suite.Run();
 
-    TestMatMulVecProfile(context, device, cmd_queue, mat_rows, mat_cols, mat_pitch);
-    printf("\n");
+  // Device side breakdown of the mxv_cl_* runs.
+  if (cmd_queue) {
+    CLHRESULT report_hr = g_Profiler.WriteReports("matrix_mxv_profile");
+    g_Profiler.PrintSummary();
+    if (CL_SUCCEEDED(hr))
+      hr = report_hr;
   }
 
   return hr;
-}
\ No newline at end of file
+}
@@ -0,0 +1,174 @@
+//
+// Register-blocked C = A * B, A[M][K], B[K][N], C[M][N], instantiated by matrix.cl for each micro tile:
+//
+//   #define GEMM_NAME  mat_mul_reg_4x4   kernel name
+//   #define GEMM_TM    4                 rows of C per work item
+//   #define GEMM_TN    4                 columns of C per work item, a multiple of 4
+//   #define GEMM_KT    16                depth of a local tile, a multiple of 4
+//   #include "mat_mul_reg.cl.h"
+//
+// A GEMM_WG x GEMM_WG work group computes a [GEMM_WG*GEMM_TM x GEMM_WG*GEMM_TN] block of C, each work item a
+// [GEMM_TM x GEMM_TN] micro tile held in registers: one REAL4 of B and GEMM_TM/4 REAL4 of A read from local memory
+// feed GEMM_TM*GEMM_TN FMAs. The tiles of A and B are fetched from global memory as REAL4 into registers one K
+// step ahead, and stored to the other half of the double-buffered local tiles while the current half is
+// consumed, so there is a single barrier per K step. Out of range elements load as zero and are not stored, any
+// M, K, N is valid.
+//
+// Launch: global size (ceil(N / BN) * GEMM_WG, ceil(M / BM) * GEMM_WG), local size (GEMM_WG, GEMM_WG).
+//
+
+#define GEMM_BM       (GEMM_WG * GEMM_TM)
+#define GEMM_BN       (GEMM_WG * GEMM_TN)
+#define GEMM_THREADS  (GEMM_WG * GEMM_WG)
+#define GEMM_A_QUADS  (GEMM_BM * GEMM_KT / 4)
+#define GEMM_B_QUADS  (GEMM_KT * GEMM_BN / 4)
+#define GEMM_A_LOADS  ((GEMM_A_QUADS + GEMM_THREADS - 1) / GEMM_THREADS)
+#define GEMM_B_LOADS  ((GEMM_B_QUADS + GEMM_THREADS - 1) / GEMM_THREADS)
+
+__attribute__((reqd_work_group_size(GEMM_WG, GEMM_WG, 1)))
+__kernel void GEMM_NAME(__global const REAL *A, __global const REAL *B, __global REAL *C, const uint4 MKN) {
+
+  // A is kept transposed, [k][m], so a work item reads its GEMM_TM rows as REAL4 along m.
+  __local REAL tile_a[2][GEMM_KT][GEMM_BM];
+  __local REAL tile_b[2][GEMM_KT][GEMM_BN];
+
+  const uint M = MKN.x, K = MKN.y, N = MKN.z;
+  const uint tx = get_local_id(0), ty = get_local_id(1);
+  const uint lid = ty * GEMM_WG + tx;
+  const uint row0 = get_group_id(1) * GEMM_BM;
+  const uint col0 = get_group_id(0) * GEMM_BN;
+  const uint ktiles = (K + GEMM_KT - 1) / GEMM_KT;
+
+  REAL c[GEMM_TM][GEMM_TN];
+  REAL4 pa[GEMM_A_LOADS], pb[GEMM_B_LOADS];
+
+  #pragma unroll
+  for(int i = 0; i < GEMM_TM; ++i) {
+    #pragma unroll
+    for(int j = 0; j < GEMM_TN; ++j)
+      c[i][j] = 0.0;
+  }
+
+  // Fetch the K step at k0 into pa/pb: A quad l is row l / (KT/4), k (l % (KT/4)) * 4; B quad l is k l / (BN/4),
+  // column (l % (BN/4)) * 4.
+  #define GEMM_FETCH(k0)                                                                                       \
+  {                                                                                                            \
+    _Pragma("unroll")                                                                                          \
+    for(int l = 0; l < GEMM_A_LOADS; ++l) {                                                                    \
+      uint q = lid + l * GEMM_THREADS;                                                                         \
+      uint r = row0 + q / (GEMM_KT / 4), k = (k0) + (q % (GEMM_KT / 4)) * 4;                                   \
+      __global const REAL *p = A + (size_t)r * K + k;                                                          \
+      if(q >= GEMM_A_QUADS || r >= M)                                                                          \
+        pa[l] = (REAL4)(0.0);                                                                                  \
+      else if(k + 3 < K)                                                                                       \
+        pa[l] = vload4(0, p);                                                                                  \
+      else                                                                                                     \
+        pa[l] = (REAL4)(k < K ? p[0] : 0, k + 1 < K ? p[1] : 0, k + 2 < K ? p[2] : 0, 0);                      \
+    }                                                                                                          \
+    _Pragma("unroll")                                                                                          \
+    for(int l = 0; l < GEMM_B_LOADS; ++l) {                                                                    \
+      uint q = lid + l * GEMM_THREADS;                                                                         \
+      uint k = (k0) + q / (GEMM_BN / 4), n = col0 + (q % (GEMM_BN / 4)) * 4;                                   \
+      __global const REAL *p = B + (size_t)k * N + n;                                                          \
+      if(q >= GEMM_B_QUADS || k >= K)                                                                          \
+        pb[l] = (REAL4)(0.0);                                                                                  \
+      else if(n + 3 < N)                                                                                       \
+        pb[l] = vload4(0, p);                                                                                  \
+      else                                                                                                     \
+        pb[l] = (REAL4)(n < N ? p[0] : 0, n + 1 < N ? p[1] : 0, n + 2 < N ? p[2] : 0, 0);                      \
+    }                                                                                                          \
+  }
+
+  #define GEMM_STORE(buf)                                                                                      \
+  {                                                                                                            \
+    _Pragma("unroll")                                                                                          \
+    for(int l = 0; l < GEMM_A_LOADS; ++l) {                                                                    \
+      uint q = lid + l * GEMM_THREADS;                                                                         \
+      uint r = q / (GEMM_KT / 4), k = (q % (GEMM_KT / 4)) * 4;                                                 \
+      if(q < GEMM_A_QUADS) {                                                                                   \
+        tile_a[buf][k][r] = pa[l].x;                                                                           \
+        tile_a[buf][k + 1][r] = pa[l].y;                                                                       \
+        tile_a[buf][k + 2][r] = pa[l].z;                                                                       \
+        tile_a[buf][k + 3][r] = pa[l].w;                                                                       \
+      }                                                                                                        \
+    }                                                                                                          \
+    _Pragma("unroll")                                                                                          \
+    for(int l = 0; l < GEMM_B_LOADS; ++l) {                                                                    \
+      uint q = lid + l * GEMM_THREADS;                                                                         \
+      if(q < GEMM_B_QUADS)                                                                                     \
+        vstore4(pb[l], 0, &tile_b[buf][q / (GEMM_BN / 4)][(q % (GEMM_BN / 4)) * 4]);                           \
+    }                                                                                                          \
+  }
+
+  GEMM_FETCH(0);
+  GEMM_STORE(0);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(uint t = 0; t < ktiles; ++t) {
+    const uint cur = t & 1;
+
+    // The next K step is in flight from global memory while this one is multiplied.
+    if(t + 1 < ktiles)
+      GEMM_FETCH((t + 1) * GEMM_KT);
+
+    #pragma unroll
+    for(int kk = 0; kk < GEMM_KT; ++kk) {
+      REAL a[GEMM_TM], b[GEMM_TN];
+
+      #pragma unroll
+      for(int i = 0; i < GEMM_TM; i += 4)
+        vstore4(vload4(0, &tile_a[cur][kk][ty * GEMM_TM + i]), 0, a + i);
+      #pragma unroll
+      for(int j = 0; j < GEMM_TN; j += 4)
+        vstore4(vload4(0, &tile_b[cur][kk][tx * GEMM_TN + j]), 0, b + j);
+
+      #pragma unroll
+      for(int i = 0; i < GEMM_TM; ++i) {
+        #pragma unroll
+        for(int j = 0; j < GEMM_TN; ++j)
+          c[i][j] = fma(a[i], b[j], c[i][j]);
+      }
+    }
+
+    // The other half was last read before the previous barrier.
+    if(t + 1 < ktiles)
+      GEMM_STORE(cur ^ 1);
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  #undef GEMM_FETCH
+  #undef GEMM_STORE
+
+  #pragma unroll
+  for(int i = 0; i < GEMM_TM; ++i) {
+    const uint r = row0 + ty * GEMM_TM + i;
+
+    if(r >= M)
+      break;
+    #pragma unroll
+    for(int j = 0; j < GEMM_TN; j += 4) {
+      const uint n = col0 + tx * GEMM_TN + j;
+      __global REAL *p = C + (size_t)r * N + n;
+
+      if(n + 3 < N) {
+        vstore4((REAL4)(c[i][j], c[i][j + 1], c[i][j + 2], c[i][j + 3]), 0, p);
+      } else {
+        if(n < N)     p[0] = c[i][j];
+        if(n + 1 < N) p[1] = c[i][j + 1];
+        if(n + 2 < N) p[2] = c[i][j + 2];
+      }
+    }
+  }
+}
+
+#undef GEMM_BM
+#undef GEMM_BN
+#undef GEMM_THREADS
+#undef GEMM_A_QUADS
+#undef GEMM_B_QUADS
+#undef GEMM_A_LOADS
+#undef GEMM_B_LOADS
+#undef GEMM_NAME
+#undef GEMM_TM
+#undef GEMM_TN
+#undef GEMM_KT
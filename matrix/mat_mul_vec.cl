@@ -7,15 +7,15 @@
 
 __attribute__((reqd_work_group_size(BLOCKED_LOCAL_SIZE_X, 1, 1)))
 __kernel void mxv_block(
-  __global const REAL *d_mat,
-  __global const REAL *d_vec,
+  __global const REAL_STORAGE *d_mat,
+  __global const REAL_STORAGE *d_vec,
   uint row_size,
   uint col_size,
   uint mat_pitch,
-  __global REAL * restrict d_r
+  __global REAL_ACCUM * restrict d_r
 ) {
 
-  __local REAL tile[BLOCKED_LOCAL_SIZE_X];
+  __local REAL_ACCUM tile[BLOCKED_LOCAL_SIZE_X];
 
   const uint bid = get_group_id(0);
   const uint tid = get_local_id(0);
@@ -24,9 +24,9 @@ __kernel void mxv_block(
   for(uint i = bid; i < row_size; i += bsize) {
 
     uint irow = i * mat_pitch;
-    REAL temp = (REAL)0.0;
+    REAL_ACCUM temp = (REAL_ACCUM)0.0;
     for(uint j = tid; j < col_size; j += BLOCKED_LOCAL_SIZE_X)
-      temp += d_mat[irow + j] * d_vec[j];
+      temp += LOAD_REAL(d_mat, irow + j) * LOAD_REAL(d_vec, j);
     tile[tid] = temp;
     barrier(CLK_LOCAL_MEM_FENCE);
 
@@ -57,22 +57,22 @@ __kernel void mxv_block(
  */
 __attribute__((reqd_work_group_size(WARP_LOCAL_SIZE_X, WARP_LOCAL_SIZE_Y, 1)))
 __kernel void mxv_warp(
-  __global const REAL *d_mat,
-  __global const REAL *d_vec,
+  __global const REAL_STORAGE *d_mat,
+  __global const REAL_STORAGE *d_vec,
   uint row_size,
   uint col_size,
   uint mat_pitch,
-  __global REAL * restrict d_r
+  __global REAL_ACCUM * restrict d_r
   ) {
 
-  __local REAL s_s[2*WARP_LOCAL_SIZE_Y][WARP_LOCAL_SIZE_X];
+  __local REAL_ACCUM s_s[2*WARP_LOCAL_SIZE_Y][WARP_LOCAL_SIZE_X];
 
   const uint2 tid = (uint2)(get_local_id(0), get_local_id(1));
   const uint2 bcount = (uint2)(get_num_groups(0), get_num_groups(1));
   const uint2 bid = (uint2)(get_group_id(0), get_group_id(1));
 
-  __local REAL * const s_v = (__local REAL *)s_s;
-  __local REAL * const row_s_r = (__local REAL *)(s_s + WARP_LOCAL_SIZE_Y + tid.y);
+  __local REAL_ACCUM * const s_v = (__local REAL_ACCUM *)s_s;
+  __local REAL_ACCUM * const row_s_r = (__local REAL_ACCUM *)(s_s + WARP_LOCAL_SIZE_Y + tid.y);
 
   const uint bsize = WARP_LOCAL_SIZE_Y * WARP_LOCAL_SIZE_X;
   const uint tid_spaned = tid.x + tid.y*WARP_LOCAL_SIZE_X;
@@ -89,15 +89,15 @@ __kernel void mxv_warp(
     for(uint j = 0; j < col_size; j += bsize) {
       uint j_tid = j + tid_spaned;
 
-      s_v[tid_spaned] = j_tid < col_size ? d_vec[j_tid] : 0.0; // Protect index out of range.
+      s_v[tid_spaned] = j_tid < col_size ? LOAD_REAL(d_vec, j_tid) : 0.0; // Protect index out of range.
       barrier(CLK_LOCAL_MEM_FENCE);
 
       uint bsize_spaned = min(bsize, col_size - j);
-      REAL temp = (REAL)0.0;
+      REAL_ACCUM temp = (REAL_ACCUM)0.0;
 
       #pragma unroll (WARP_LOCAL_SIZE_Y)
       for(uint k = tid.x; k < bsize_spaned; k += WARP_LOCAL_SIZE_X)
-        temp += d_mat[irow + j + k] * s_v[k];
+        temp += LOAD_REAL(d_mat, irow + j + k) * s_v[k];
       row_s_r[tid.x] += temp;
       // We will write to s_v laterly, so asychronize here.
       barrier(CLK_LOCAL_MEM_FENCE);
@@ -120,3 +120,74 @@ __kernel void mxv_warp(
 
 
 
+//
+// Batched r_i = M_i * v_i for many small matrices of one shape. The rows of all problems form one range,
+// BATCH_MXV_LANES work items per row as in mxv_warp but narrow enough for rows of 8 to 64 columns, and
+// BATCH_MXV_ROWS rows (of one or several problems) per work group.
+//
+#define BATCH_MXV_LANES  8
+#define BATCH_MXV_ROWS   32
+
+inline REAL_ACCUM __mxv_row_lane(__global const REAL_STORAGE *d_mat, __global const REAL_STORAGE *d_vec,
+                                 size_t mat_off, size_t vec_off, uint col_size, uint lane) {
+  REAL_ACCUM temp = (REAL_ACCUM)0.0;
+
+  for(uint j = lane; j < col_size; j += BATCH_MXV_LANES)
+    temp += LOAD_REAL(d_mat, mat_off + j) * LOAD_REAL(d_vec, vec_off + j);
+  return temp;
+}
+
+#define __MXV_BATCHED_BODY(problem_offsets)                                                                       \
+  __local REAL_ACCUM s_r[BATCH_MXV_ROWS][BATCH_MXV_LANES];                                                        \
+  const uint lane = get_local_id(0), ly = get_local_id(1);                                                        \
+  const size_t rows = (size_t)batch * row_size;                                                                   \
+  const size_t step = (size_t)get_num_groups(0) * BATCH_MXV_ROWS;                                                 \
+  const size_t rows_rc = ((rows + step - 1) / step) * step;                                                       \
+                                                                                                                  \
+  /* every work item runs the same trips, the barriers stay uniform */                                            \
+  for(size_t r = get_group_id(0) * BATCH_MXV_ROWS + ly; r < rows_rc; r += step) {                                 \
+    const uint p = r < rows ? r / row_size : 0, i = r < rows ? r % row_size : 0;                                  \
+    const uint4 off = problem_offsets;                                                                            \
+                                                                                                                  \
+    s_r[ly][lane] = r < rows ? __mxv_row_lane(d_mat, d_vec, off.x + (size_t)i * mat_pitch, off.y, col_size, lane) \
+                             : (REAL_ACCUM)0.0;                                                                   \
+    barrier(CLK_LOCAL_MEM_FENCE);                                                                                 \
+    if(lane == 0 && r < rows) {                                                                                   \
+      REAL_ACCUM sum = s_r[ly][0];                                                                                \
+      _Pragma("unroll")                                                                                           \
+      for(uint l = 1; l < BATCH_MXV_LANES; ++l)                                                                   \
+        sum += s_r[ly][l];                                                                                        \
+      d_r[off.z + i] = sum;                                                                                       \
+    }                                                                                                             \
+    barrier(CLK_LOCAL_MEM_FENCE);                                                                                 \
+  }
+
+// Problem p at d_mat + p * strides.x, d_vec + p * strides.y, d_r + p * strides.z (elements).
+__attribute__((reqd_work_group_size(BATCH_MXV_LANES, BATCH_MXV_ROWS, 1)))
+__kernel void mxv_batched(
+  __global const REAL_STORAGE *d_mat,
+  __global const REAL_STORAGE *d_vec,
+  uint row_size,
+  uint col_size,
+  uint mat_pitch,
+  const uint4 strides,
+  uint batch,
+  __global REAL_ACCUM * restrict d_r
+) {
+  __MXV_BATCHED_BODY(strides * p)
+}
+
+// Problem p at the element offsets (.x, .y, .z) of offsets[p].
+__attribute__((reqd_work_group_size(BATCH_MXV_LANES, BATCH_MXV_ROWS, 1)))
+__kernel void mxv_batched_indexed(
+  __global const REAL_STORAGE *d_mat,
+  __global const REAL_STORAGE *d_vec,
+  uint row_size,
+  uint col_size,
+  uint mat_pitch,
+  __global const uint4 *offsets,
+  uint batch,
+  __global REAL_ACCUM * restrict d_r
+) {
+  __MXV_BATCHED_BODY(offsets[p])
+}
@@ -1,7 +1,10 @@
 #include <common.cl.h>
 
+// Square tiles; the build pre-specialises LOCAL_SIZE_X per SPIR-V variant (see matrix.manifest).
+#ifndef LOCAL_SIZE_X
 #define LOCAL_SIZE_X    16
-#define LOCAL_SIZE_Y    16
+#endif
+#define LOCAL_SIZE_Y    LOCAL_SIZE_X
 
 #ifdef  _USE_DOUBLE_FP
 #define _REAL_BANK_WITH   8
@@ -142,3 +145,78 @@ __kernel void mat_mul_opt1(__global const REAL *A, __global const REAL *B, __glo
   if(mn_bsign.x & mn_bsign.y)
     C[gid.y*MKN.z+gid.x] = c;
 }
+
+//
+// Register-blocked multiplication, a micro tile of C per work item (see mat_mul_reg.cl.h). The work group is
+// at most 16x16 whatever the square tile of the kernels above, the block of C grows with the micro tile instead.
+//
+#if LOCAL_SIZE_X > 16
+#define GEMM_WG         16
+#else
+#define GEMM_WG         LOCAL_SIZE_X
+#endif
+
+#define GEMM_NAME       mat_mul_reg_4x4
+#define GEMM_TM         4
+#define GEMM_TN         4
+#define GEMM_KT         16
+#include "mat_mul_reg.cl.h"
+
+#define GEMM_NAME       mat_mul_reg_8x4
+#define GEMM_TM         8
+#define GEMM_TN         4
+#define GEMM_KT         8
+#include "mat_mul_reg.cl.h"
+
+#define GEMM_NAME       mat_mul_reg_4x8
+#define GEMM_TM         4
+#define GEMM_TN         8
+#define GEMM_KT         8
+#include "mat_mul_reg.cl.h"
+
+//
+// Batched C_i = A_i * B_i: many small problems of one [M x K] * [K x N] shape in a single launch. A work item
+// takes a (problem, element of C) pair from one flat index, so a work group covers several problems of 8x8 and a
+// 64x64 problem spans a few work groups; the operands of a small problem are read through the cache, there is
+// no reuse worth staging in local memory.
+//
+#define BATCH_LOCAL_SIZE  256
+
+inline void __mat_mul_element(__global const REAL *A, __global const REAL *B, __global REAL *C, uint K, uint N,
+                              uint e) {
+  const uint i = e / N, j = e % N;
+  REAL c = 0.0;
+
+  for(uint k = 0; k < K; ++k)
+    c = fma(A[i*K + k], B[k*N + j], c);
+  C[e] = c;
+}
+
+// Problem p at A + p * strides.x, B + p * strides.y, C + p * strides.z (elements).
+__attribute__((reqd_work_group_size(BATCH_LOCAL_SIZE, 1, 1)))
+__kernel void mat_mul_batched(__global const REAL *A, __global const REAL *B, __global REAL *C, const uint4 MKN,
+                              const uint4 strides, uint batch) {
+
+  const uint elems = MKN.x * MKN.z;
+  const size_t total = (size_t)batch * elems;
+
+  for(size_t g = get_global_id(0); g < total; g += get_global_size(0)) {
+    const uint p = g / elems;
+    __mat_mul_element(A + (size_t)p * strides.x, B + (size_t)p * strides.y, C + (size_t)p * strides.z, MKN.y,
+                      MKN.z, g % elems);
+  }
+}
+
+// Problem p at the element offsets (.x, .y, .z) of offsets[p], the pointer arrays of a batch in one set of buffers.
+__attribute__((reqd_work_group_size(BATCH_LOCAL_SIZE, 1, 1)))
+__kernel void mat_mul_batched_indexed(__global const REAL *A, __global const REAL *B, __global REAL *C,
+                                      const uint4 MKN, __global const uint4 *offsets, uint batch) {
+
+  const uint elems = MKN.x * MKN.z;
+  const size_t total = (size_t)batch * elems;
+
+  for(size_t g = get_global_id(0); g < total; g += get_global_size(0)) {
+    const uint4 off = offsets[g / elems];
+    __mat_mul_element(A + off.x, B + off.y, C + off.z, MKN.y, MKN.z, g % elems);
+  }
+}
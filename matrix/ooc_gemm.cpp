@@ -0,0 +1,265 @@
+#include "ooc_gemm.h"
+#include <cl_queue_pool.h>
+#include <cl_kernel_launcher.h>
+#include <common_miscs.h>
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <vector>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ooc_gemm {
+
+// micro tile of mat_mul_reg_4x4, the global size is one work item per 4x4 of C
+static const size_t g_MicroTile = 4;
+
+size_t footprint(size_t tile, size_t K, cl_uint slots) {
+  slots = std::max(slots, 2u);
+  return (2 * slots * tile * K + slots * tile * tile) * sizeof(double);
+}
+
+CLHRESULT plan(cl_device_id device, size_t M, size_t K, size_t N, const config &cfg, size_t *tile) {
+  CLHRESULT hr;
+  cl_ulong max_alloc;
+  const cl_uint slots = std::max(cfg.slots, 2u);
+
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, nullptr));
+
+  auto fits = [&](size_t t) {
+    return footprint(t, K, slots) <= cfg.budget_bytes && t * K * sizeof(double) <= max_alloc &&
+           t * t * sizeof(double) <= max_alloc;
+  };
+
+  if (cfg.tile) {
+    *tile = cfg.tile;
+    return fits(cfg.tile) ? CL_SUCCESS : CL_OUT_OF_RESOURCES;
+  }
+
+  // steps of 64 down to 64, then of 16 down to 16; a tile of 0 would divide by zero in gemm
+  size_t t = RoundC(std::max(M, N), 64);
+  while (t > 64 && !fits(t))
+    t -= 64;
+  while (t > 16 && !fits(t))
+    t -= 16;
+  if (t < 16 || !fits(t)) {
+    CL_TRACE(CL_OUT_OF_RESOURCES, "Out-of-core GEMM: a 16 row panel of K = %zu exceeds the budget of %zu bytes!\n",
+             K, cfg.budget_bytes);
+    return CL_OUT_OF_RESOURCES;
+  }
+  *tile = t;
+  return hr;
+}
+
+CLHRESULT gemm(cl_context context, cl_device_id device, cl_program program, const double *A, const double *B,
+               size_t M, size_t K, size_t N, double *C, const config &cfg, stats *st) {
+  CLHRESULT hr;
+  size_t tile;
+  const cl_uint slots = std::max(cfg.slots, 2u);
+  stats local_stats = {};
+  hp_timer::time_point start = hp_timer::now();
+
+  if (!st)
+    st = &local_stats;
+  *st = {};
+  if (M == 0 || N == 0 || K == 0)
+    return CL_INVALID_VALUE;
+  V_RETURN(plan(device, M, K, N, cfg, &tile));
+
+  CLQueuePool queues(context, device);
+  cl_command_queue upload_queue, compute_queue, download_queue;
+
+  V_RETURN(queues.GetStreamQueue(0, &upload_queue));
+  V_RETURN(queues.GetStreamQueue(1, &compute_queue));
+  V_RETURN(queues.GetStreamQueue(2, &download_queue));
+
+  struct panel_buffer {
+    ycl_buffer mem;
+    size_t panel;       // index of the panel held, SIZE_MAX for none
+    uint64_t used;      // LRU clock
+    ycl_event ready;    // upload of the panel
+    ycl_event last_use; // last kernel reading it, in order on the compute queue
+  };
+  struct tile_buffer {
+    ycl_buffer mem;
+    ycl_event downloaded;
+  };
+
+  std::vector<panel_buffer> a_panels(slots), b_panels(slots);
+  std::vector<tile_buffer> c_tiles(slots);
+  const size_t panel_bsize = tile * K * sizeof(double), tile_bsize = tile * tile * sizeof(double);
+  uint64_t clock = 0;
+
+  for (cl_uint s = 0; s < slots; ++s) {
+    V_RETURN2(a_panels[s].mem <<= clCreateBuffer(context, CL_MEM_READ_ONLY, panel_bsize, nullptr, &hr), hr);
+    V_RETURN2(b_panels[s].mem <<= clCreateBuffer(context, CL_MEM_READ_ONLY, panel_bsize, nullptr, &hr), hr);
+    V_RETURN2(c_tiles[s].mem <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, tile_bsize, nullptr, &hr), hr);
+    a_panels[s].panel = b_panels[s].panel = SIZE_MAX;
+    a_panels[s].used = b_panels[s].used = 0;
+  }
+  st->tile = tile;
+  st->device_bytes = footprint(tile, K, slots);
+
+  KernelLauncher<cl_mem, cl_mem, cl_mem, std::array<uint32_t, 4>> launcher;
+  size_t group_size[3];
+
+  V_RETURN(launcher.Create(program, "mat_mul_reg_4x4"));
+  V_RETURN(clGetKernelWorkGroupInfo(launcher, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
+                                    group_size, nullptr));
+
+  // Resident panel, or the least recently used buffer refilled once its last kernel is done.
+  using upload_func = std::function<CLHRESULT(panel_buffer &buf, cl_uint num_waits, const cl_event *waits)>;
+  auto acquire = [&](std::vector<panel_buffer> &bufs, size_t panel, const upload_func &upload,
+                     panel_buffer **acquired) -> CLHRESULT {
+    CLHRESULT hr;
+    panel_buffer *victim = &bufs[0];
+
+    for (auto &buf : bufs) {
+      if (buf.panel == panel) {
+        buf.used = ++clock;
+        ++st->panel_hits;
+        *acquired = &buf;
+        return CL_SUCCESS;
+      }
+      if (buf.used < victim->used)
+        victim = &buf;
+    }
+
+    V_RETURN(upload(*victim, victim->last_use ? 1 : 0, &victim->last_use));
+    V_RETURN(clFlush(upload_queue));
+    victim->panel = panel;
+    victim->used = ++clock;
+    ++st->panel_uploads;
+    *acquired = victim;
+    return hr;
+  };
+
+  const size_t row_panels = (M + tile - 1) / tile, col_panels = (N + tile - 1) / tile;
+
+  for (size_t i = 0; i < row_panels; ++i) {
+    const size_t r0 = i * tile, rows = std::min(tile, M - r0);
+
+    for (size_t jj = 0; jj < col_panels; ++jj) {
+      // serpentine: the B panel of the last tile of a row is reused by the first of the next
+      const size_t j = (i & 1) ? col_panels - 1 - jj : jj;
+      const size_t c0 = j * tile, cols = std::min(tile, N - c0);
+      tile_buffer &c_tile = c_tiles[st->tiles % slots];
+      panel_buffer *a_panel, *b_panel;
+
+      V_RETURN(acquire(a_panels, i, [&](panel_buffer &buf, cl_uint num_waits, const cl_event *waits) {
+        st->bytes_uploaded += rows * K * sizeof(double);
+        return clEnqueueWriteBuffer(upload_queue, buf.mem, CL_FALSE, 0, rows * K * sizeof(double), A + r0 * K,
+                                    num_waits, waits, buf.ready.ReleaseAndGetAddressOf());
+      }, &a_panel));
+
+      V_RETURN(acquire(b_panels, j, [&](panel_buffer &buf, cl_uint num_waits, const cl_event *waits) {
+        const size_t buffer_origin[3] = {0, 0, 0};
+        const size_t host_origin[3] = {c0 * sizeof(double), 0, 0};
+        const size_t region[3] = {cols * sizeof(double), K, 1};
+
+        st->bytes_uploaded += cols * K * sizeof(double);
+        return clEnqueueWriteBufferRect(upload_queue, buf.mem, CL_FALSE, buffer_origin, host_origin, region,
+                                        cols * sizeof(double), 0, N * sizeof(double), 0, B, num_waits, waits,
+                                        buf.ready.ReleaseAndGetAddressOf());
+      }, &b_panel));
+
+      // the panels are tile x K and K x cols, the kernel sees a small GEMM of its own
+      const std::array<uint32_t, 4> MKN = {(uint32_t)rows, (uint32_t)K, (uint32_t)cols, 0};
+      size_t global_size[2] = {RoundC(cols, group_size[0] * g_MicroTile) / g_MicroTile,
+                               RoundC(rows, group_size[1] * g_MicroTile) / g_MicroTile};
+      cl_event waits[3] = {a_panel->ready, b_panel->ready, c_tile.downloaded};
+      ycl_event kernel_ev;
+
+      V_RETURN(launcher.SetArgs(a_panel->mem, b_panel->mem, c_tile.mem, MKN));
+      V_RETURN(launcher.Enqueue(compute_queue, 2, global_size, group_size, c_tile.downloaded ? 3 : 2, waits,
+                                &kernel_ev));
+      V_RETURN(clFlush(compute_queue));
+      a_panel->last_use = kernel_ev;
+      b_panel->last_use = kernel_ev;
+
+      const size_t buffer_origin[3] = {0, 0, 0};
+      const size_t host_origin[3] = {c0 * sizeof(double), r0, 0};
+      const size_t region[3] = {cols * sizeof(double), rows, 1};
+
+      V_RETURN(clEnqueueReadBufferRect(download_queue, c_tile.mem, CL_FALSE, buffer_origin, host_origin, region,
+                                       cols * sizeof(double), 0, N * sizeof(double), 0, C, 1, &kernel_ev,
+                                       c_tile.downloaded.ReleaseAndGetAddressOf()));
+      V_RETURN(clFlush(download_queue));
+      st->bytes_downloaded += rows * cols * sizeof(double);
+      ++st->tiles;
+    }
+  }
+
+  V_RETURN(queues.FinishAll());
+  st->wall_ms = fmilliseconds_cast(hp_timer::now() - start).count();
+  return hr;
+}
+
+bool mapped_file::open(const char *fname) {
+  close();
+
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                            nullptr);
+  LARGE_INTEGER file_size;
+
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);  // the mapping keeps the file open
+  if (!mapping)
+    return false;
+  data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data_) {
+    CloseHandle(mapping);
+    return false;
+  }
+  handle_ = mapping;
+  size_ = (size_t)file_size.QuadPart;
+#else
+  int fd = ::open(fname, O_RDONLY);
+  struct stat file_stat;
+
+  if (fd < 0)
+    return false;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void *p = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);  // the mapping keeps the file open
+  if (p == MAP_FAILED)
+    return false;
+  madvise(p, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+  data_ = p;
+  size_ = (size_t)file_stat.st_size;
+#endif
+  return true;
+}
+
+void mapped_file::close() {
+  if (!data_)
+    return;
+#if defined(_WIN32)
+  UnmapViewOfFile(data_);
+  CloseHandle((HANDLE)handle_);
+#else
+  munmap(data_, size_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  handle_ = nullptr;
+}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cl_utils.h>
+
+/**
+ * Out-of-core C[M][N] = A[M][K] * B[K][N] (double, row major) for matrices larger than the device memory.
+ *
+ * C is cut into [tile x tile] tiles. Tile (i, j) needs row panel i of A ([tile x K]) and column panel j of B
+ * ([K x tile]); the panels live in a bounded set of device buffers, `slots` for A panels and as many for B
+ * panels, each holding the panel it last received. A panel still resident is not uploaded again, otherwise the
+ * least recently used buffer takes it once the kernels reading it are done. The tiles are walked row by row
+ * with the column order reversed on every other row, so the last B panel of a row is the first of the next.
+ *
+ * Uploads, kernels and downloads go to three queues of a CLQueuePool, ordered by events only: the upload of the
+ * next panels overlaps the kernel on the current ones and the read back of the previous tile, which goes
+ * straight into the rows of C with clEnqueueReadBufferRect. The host blocks once, at the end.
+ *
+ * The device footprint is 2 * slots * tile * K + slots * tile * tile doubles, sized to the budget by plan.
+ * A and B may point into memory-mapped files (see mapped_file): the panels are read from the mapping as they are
+ * uploaded, the inputs are never resident in host memory as a whole either.
+ */
+namespace ooc_gemm {
+
+  struct config {
+    size_t budget_bytes;  // device memory the driver may hold
+    size_t tile;          // edge of a C tile, 0 for the largest that fits the budget
+    cl_uint slots;        // buffers per operand, 2 or more to overlap
+  };
+
+  struct stats {
+    size_t tile;
+    size_t tiles;
+    size_t panel_uploads;  // A and B panels written to the device
+    size_t panel_hits;     // panels found resident
+    size_t bytes_uploaded;
+    size_t bytes_downloaded;
+    size_t device_bytes;   // held by the panel and tile buffers
+    double wall_ms;
+  };
+
+  /** Device bytes of the panel and tile buffers for a @param tile edge, @param slots per operand (2 at least). */
+  size_t footprint(size_t tile, size_t K, cl_uint slots);
+
+  /**
+   * Tile edge for @param cfg: cfg.tile when set, otherwise the largest multiple of 64 whose buffers fit
+   * cfg.budget_bytes and CL_DEVICE_MAX_MEM_ALLOC_SIZE, at most max(M, N); below 64, the largest multiple of 16.
+   * @return CL_OUT_OF_RESOURCES when not even a tile of 16 fits.
+   */
+  CLHRESULT plan(cl_device_id device, size_t M, size_t K, size_t N, const config &cfg, size_t *tile);
+
+  /**
+   * @param program a matrix.cl program, the tiles run mat_mul_reg_4x4.
+   * @param C host memory for the whole result; A and B must stay valid and unchanged until the call returns.
+   */
+  CLHRESULT gemm(cl_context context, cl_device_id device, cl_program program, const double *A, const double *B,
+                 size_t M, size_t K, size_t N, double *C, const config &cfg, stats *st = nullptr);
+
+  /** Read-only mapping of a whole file, advised for sequential reads. */
+  class mapped_file {
+  public:
+    mapped_file() : data_(nullptr), size_(0), handle_(nullptr) {}
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    /** @return false when the file cannot be opened or mapped, or is empty. */
+    bool open(const char *fname);
+    void close();
+
+    const void *data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    void *data_;
+    size_t size_;
+    void *handle_;  // file mapping object on Windows
+  };
+}
@@ -0,0 +1,192 @@
+#include <cl_utils.h>
+#include <cl_device_group.h>
+#include <common_miscs.h>
+#include <benchmark.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <random>
+
+/**
+ * Split one histogram across every member of a device group. On a CPU-only host the CPU device is partitioned
+ * into sub-devices, so the same code path is exercised without a second GPU. Each round re-balances the
+ * split from the throughput measured in the previous one.
+ */
+
+static std::vector<uint8_t> CreateGrayscaleImageData(uint32_t width, uint32_t height) {
+
+  std::vector<uint8_t> pixel_buffer(width * height);
+  std::uniform_int_distribution<uint16_t> cd(0, 0xff);
+
+  for (auto &p : pixel_buffer)
+    p = (uint8_t)cd(g_RandomEngine);
+
+  return pixel_buffer;
+}
+
+static CLHRESULT CreateGroup(CLDeviceGroup *group) {
+  CLHRESULT hr;
+  ycl_platform_id platform;
+  ycl_device_id device;
+
+  // Several GPUs when there are some, otherwise a partitioned CPU device.
+  hr = CreateDeviceGroup(CL_DEVICE_TYPE_GPU, {"NVIDIA CUDA", "AMD"}, {}, group);
+  if (CL_SUCCEEDED(hr) && group->size() > 1)
+    return hr;
+
+  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_CPU, {"Portable Computing Language", "Intel", "AMD"}, {}, &platform,
+                              &device));
+  hr = CreateSubDeviceGroup(platform, device, 4, group);
+  if (CL_FAILED(hr)) {
+    printf("CPU device can not be partitioned, fall back to a single member group\n");
+    group->members.clear();
+    V_RETURN(CreateDeviceGroupFromDevices(platform, &device, 1, group));
+  }
+
+  return hr;
+}
+
+/**
+ * One "dim" x "dim" histogram over @param group. Every iteration is a round: the split is re-balanced from the
+ * throughput measured in the previous one, so the warmup rounds are where it settles. Each round is checked
+ * against the host histogram.
+ */
+static CLHRESULT TestSplitHistogram(CLDeviceGroup &group, BenchState &state) {
+
+  CLHRESULT hr;
+  const uint32_t dim = (uint32_t)state.GetInt("dim");
+  const size_t nmembers = group.size();
+  const size_t histo_num = 256;
+  const size_t histo_buff_size = histo_num * sizeof(uint32_t);
+
+  auto pixels_data = CreateGrayscaleImageData(dim, dim);
+  size_t pixels_num = pixels_data.size();
+
+  uint32_t histo_ref[histo_num];
+  memset(histo_ref, 0, sizeof(histo_ref));
+  for (auto p : pixels_data)
+    histo_ref[p]++;
+
+  std::vector<ycl_program> programs(nmembers);
+  std::vector<ycl_kernel> kernels(nmembers);
+  std::vector<ycl_mem> pixel_buffs(nmembers), histo_buffs(nmembers);
+  std::vector<size_t> work_item_sizes(nmembers);
+
+  // Sub buffer origins must be aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN on every member.
+  size_t granularity = 4096;
+
+  for (size_t i = 0; i < nmembers; ++i) {
+    CLDeviceGroupMember &m = group[i];
+    cl_uint cu_cap, align_bits;
+    size_t group_size[3];
+
+    V_RETURN(clGetDeviceInfo(m.device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu_cap), &cu_cap, nullptr));
+    V_RETURN(clGetDeviceInfo(m.device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, nullptr));
+
+    granularity = std::max(granularity, (size_t)(align_bits >> 3));
+
+    V_RETURN(CreateProgramFromFile(m.context, m.device, nullptr, "histo.cl", &programs[i]));
+    V_RETURN2(kernels[i] <<= clCreateKernel(programs[i], "histo_atomic", &hr), hr);
+    V_RETURN(clGetKernelWorkGroupInfo(kernels[i], m.device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+                                      sizeof(group_size), group_size, nullptr));
+    work_item_sizes[i] = group_size[0] * cu_cap * 2;
+
+    // Members sharing a context share the pixel buffer.
+    size_t j = 0;
+    for (; j < i && group[j].context != m.context; ++j);
+    if (j < i) {
+      pixel_buffs[i] = pixel_buffs[j];
+    } else {
+      V_RETURN2(pixel_buffs[i] <<= clCreateBuffer(m.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, pixels_num,
+                                                  pixels_data.data(), &hr),
+                hr);
+    }
+    V_RETURN2(histo_buffs[i] <<= clCreateBuffer(m.context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                                                histo_buff_size, nullptr, &hr),
+              hr);
+  }
+
+  std::vector<CLNDRangePartition> partitions;
+  std::vector<ycl_mem> sub_buffs(nmembers);
+  std::vector<ycl_event> ker_evs(nmembers), rd_evs(nmembers);
+  std::vector<uint32_t> histo_parts(nmembers * histo_num);
+  uint32_t histo_data[histo_num];
+  uint32_t histo_init_data = 0;
+  bool coincident = true;
+
+  while (state.KeepRunning()) {
+
+    PartitionNDRange(group, 1, &pixels_num, &granularity, &partitions);
+
+    for (size_t i = 0; i < nmembers; ++i) {
+      CLDeviceGroupMember &m = group[i];
+      cl_buffer_region region = {partitions[i].offset[0], partitions[i].size[0]};
+      uint32_t part_num = (uint32_t)region.size;
+
+      if (region.size == 0)
+        continue;
+
+      V_RETURN2(sub_buffs[i] <<= clCreateSubBuffer(pixel_buffs[i], CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
+                                                   &region, &hr),
+                hr);
+      V_RETURN(SetKernelArguments(kernels[i], &sub_buffs[i], &part_num, &histo_buffs[i]));
+      V_RETURN(clEnqueueFillBuffer(m.cmd_queue, histo_buffs[i], &histo_init_data, sizeof(histo_init_data), 0,
+                                   histo_buff_size, 0, nullptr, nullptr));
+      V_RETURN(clEnqueueNDRangeKernel(m.cmd_queue, kernels[i], 1, nullptr, &work_item_sizes[i], nullptr, 0, nullptr,
+                                      ker_evs[i].ReleaseAndGetAddressOf()));
+      V_RETURN(clEnqueueReadBuffer(m.cmd_queue, histo_buffs[i], false, 0, histo_buff_size,
+                                   &histo_parts[i * histo_num], 0, nullptr, rd_evs[i].ReleaseAndGetAddressOf()));
+      V_RETURN(clFlush(m.cmd_queue));
+    }
+
+    memset(histo_data, 0, sizeof(histo_data));
+    for (size_t i = 0; i < nmembers; ++i) {
+      if (partitions[i].size[0] == 0)
+        continue;
+
+      V_RETURN(clWaitForEvents(1, &rd_evs[i]));
+      V_RETURN(UpdateDeviceThroughputFromEvent(&group, i, partitions[i].size[0], ker_evs[i]));
+      for (size_t k = 0; k < histo_num; ++k)
+        histo_data[k] += histo_parts[i * histo_num + k];
+    }
+
+    coincident = coincident && memcmp(histo_data, histo_ref, sizeof(histo_ref)) == 0;
+  }
+
+  // The split the last round settled on.
+  for (size_t i = 0; i < nmembers; ++i) {
+    printf("    member %zu: [%zu, %zu), %.1f pixels/ms\n", i, partitions[i].offset[0],
+           partitions[i].offset[0] + partitions[i].size[0], group[i].throughput);
+  }
+  state.SetVerified(coincident);
+  state.SetBytesProcessed((double)pixels_num);
+
+  return hr;
+}
+
+int main(int argc, char **argv) {
+
+  CLHRESULT hr;
+  CLDeviceGroup group;
+  char nbuff[256];
+
+  V_RETURN(CreateGroup(&group));
+
+  for (size_t i = 0; i < group.size(); ++i) {
+    cl_uint cu_cap;
+
+    V_RETURN(clGetDeviceInfo(group[i].device, CL_DEVICE_NAME, sizeof(nbuff), nbuff, nullptr));
+    V_RETURN(clGetDeviceInfo(group[i].device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu_cap), &cu_cap, nullptr));
+    printf("Member %zu: %s, %u compute units\n", i, nbuff, cu_cap);
+  }
+
+  BenchmarkSuite suite("multi_device");
+  suite.ParseArgs(argc, argv);
+
+  suite.Register("histogram_split", MakeParamSweep({{"dim", {1024, 4096}}}),
+                 [&](BenchState &state) { return TestSplitHistogram(group, state); });
+
+  hr = suite.Run();
+  return hr;
+}
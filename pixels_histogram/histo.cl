@@ -13,11 +13,19 @@
   atomic_fetch_add_explicit((atomic_uint *)(p), v, memory_order_relaxed, memory_scope_device)
 #endif
 
+#ifndef LOCAL_SIZE_X
 #define LOCAL_SIZE_X    64
+#endif
+#ifndef LOCAL_SIZE_X_BIT
 #define LOCAL_SIZE_X_BIT    6
+#endif
 /** @note OPTD_LOCAL_SIZE_X must be power of 2 */
+#ifndef OPTD_LOCAL_SIZE_X
 #define OPTD_LOCAL_SIZE_X 32
+#endif
+#ifndef OPTD_LOCAL_SIZE_X_BIT
 #define OPTD_LOCAL_SIZE_X_BIT 5
+#endif
 
 #define COALESCED_CACHE_LINE_SIZE       16
 #define COALESCED_CACHE_LINE_SIZE_BIT   6
@@ -1,15 +1,23 @@
 #include <cl_utils.h>
+#include <cl_profiler.h>
+#include <common_miscs.h>
+#include <benchmark.h>
+#include <cl_stream_pipeline.h>
+#include <cl_host_buffer.h>
+#include <cl_autotuner.h>
+#include <cl_backend.h>
+#include <cl_kernel_variants.h>
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <random>
-#include <chrono>
+#include <string>
+#include <map>
+#include <memory>
 
 static ycl_program g_pHistoProgram;
-
-std::default_random_engine g_RandomEngine{[]() -> std::random_device::result_type {
-  std::random_device rdev;
-  return rdev();
-}()};
+static std::map<std::string, ycl_program> g_TunedHistoPrograms;
+static CLProfiler g_Profiler;
 
 std::vector<uint8_t> CreateGrayscaleImageData(uint16_t width, uint16_t height) {
 
@@ -42,47 +50,232 @@ void PrintHistogram(const uint32_t *histo) {
   printf("-------------------------------------------------------------------------\n");
 }
 
-int main() {
+/**
+ * Kernel and launch sizes from the tuning database for @param pixels_num, the built-in sizes of histo.cl and two
+ * work groups per compute unit on a miss. @param local_size is 0 when the runtime may pick it.
+ */
+static CLHRESULT CreateHistoKernel(cl_context context, cl_device_id device, const char *kernel_name,
+                                   size_t pixels_num, cl_kernel *kernel, size_t *global_size, size_t *local_size) {
+
+  CLHRESULT hr;
+  CLTuningConfig config;
+
+  if (GetTuningDB().Lookup(device, kernel_name, pixels_num, &config)) {
+    std::string defines = FormatTuningDefines(config.defines);
+    ycl_program &program = g_TunedHistoPrograms[defines];
+
+    if (program == nullptr)
+      V_RETURN(CreateProgramFromFile(context, device, defines.c_str(), "histo.cl", &program));
+    V_RETURN2(*kernel = clCreateKernel(program, kernel_name, &hr), hr);
+    *global_size = config.global_size[0];
+    *local_size = config.local_size[0];
+    return hr;
+  }
+
+  cl_uint cu_cap;
+  size_t group_size[3];
+
+  V_RETURN2(*kernel = clCreateKernel(g_pHistoProgram, kernel_name, &hr), hr);
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu_cap), &cu_cap, nullptr));
+  V_RETURN(clGetKernelWorkGroupInfo(*kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
+                                    group_size, nullptr));
+  *global_size = group_size[0] * cu_cap * 2;
+  *local_size = 0;
+  return hr;
+}
+
+/**
+ * Time local sizes and work groups per compute unit of every kernel for every image size of the sweep, and
+ * save the winners to the tuning database.
+ */
+static CLHRESULT TuneHistogramKernels(cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                                      std::initializer_list<int> dims) {
 
   CLHRESULT hr;
-  ycl_platform_id platform;
-  ycl_device_id device;
-  ycl_context context;
-  ycl_command_queue cmd_queue;
+  cl_uint cu_cap;
 
-  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {"NVIDIA CUDA", "AMD"}, {}, &platform, &device));
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu_cap), &cu_cap, nullptr));
 
-  V_RETURN(CreateDeviceContext(platform, device, &context));
+  for (int dim : dims) {
+    auto pixels_data = CreateGrayscaleImageData(dim, dim);
+    uint32_t pixels_num = pixels_data.size();
+    ycl_mem pixel_buff, histo_buff;
+
+    V_RETURN2(pixel_buff <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, pixels_num,
+                                            pixels_data.data(), &hr),
+              hr);
+    V_RETURN2(histo_buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE, 256 * sizeof(uint32_t), nullptr, &hr), hr);
+
+    uint32_t histo_ref[256] = {};
+    for (uint8_t pixel : pixels_data)
+      histo_ref[pixel]++;
+
+    for (const char *kernel_name : {"histo_atomic", "hosto_atomic_coalesced", "histo_optimized_ultimate"}) {
+      bool optimized = strcmp(kernel_name, "histo_optimized_ultimate") == 0;
+      const char *size_macro = optimized ? "OPTD_LOCAL_SIZE_X" : "LOCAL_SIZE_X";
+      const char *bit_macro = optimized ? "OPTD_LOCAL_SIZE_X_BIT" : "LOCAL_SIZE_X_BIT";
+      std::vector<CLTuningConfig> candidates;
+      CLTuningConfig best;
+
+      // The bins are spread over the work group, so at most 256 work items (128 bin pairs for the optimized one).
+      for (int64_t bits = 4; bits <= (optimized ? 7 : 8); ++bits) {
+        size_t local = (size_t)1 << bits;
+        for (size_t groups_per_cu : {1, 2, 4, 8}) {
+          size_t global = local * cu_cap * groups_per_cu;
+          // The optimized kernel counts in 16-bit bins per work item: a work item may see every pixel of its
+          // 64-byte lines plus the tail in one bin, which must stay below 65536.
+          if (optimized && RoundC((pixels_num + global - 1) / global, 64) + 64 > 65535)
+            continue;
+          candidates.push_back(MakeTuningConfig({{size_macro, (int64_t)local}, {bit_macro, bits}}, 1, {global},
+                                                {local}));
+        }
+      }
+
+      V_RETURN(AutotuneKernel(context, device, cmd_queue, "histo.cl", nullptr, kernel_name, pixels_num, candidates,
+                              [&](cl_kernel kernel, CLTuningConfig *config) -> CLHRESULT {
+                                CLHRESULT hr;
+                                uint32_t zero = 0;
+                                V_RETURN(clEnqueueFillBuffer(cmd_queue, histo_buff, &zero, sizeof(zero), 0,
+                                                             sizeof(histo_ref), 0, nullptr, nullptr));
+                                return SetKernelArguments(kernel, &pixel_buff, &pixels_num, &histo_buff);
+                              },
+                              &best, 5, nullptr,
+                              [&](cl_command_queue queue, bool *passed) -> CLHRESULT {
+                                CLHRESULT hr;
+                                uint32_t histo[256];
+                                V_RETURN(clEnqueueReadBuffer(queue, histo_buff, true, 0, sizeof(histo), histo, 0,
+                                                             nullptr, nullptr));
+                                *passed = memcmp(histo, histo_ref, sizeof(histo)) == 0;
+                                return CL_SUCCESS;
+                              }));
+      printf("Tuned %s for %u pixels: local %zu, global %zu, %.4fms\n", kernel_name, pixels_num,
+             best.local_size[0], best.global_size[0], best.ms);
+    }
+  }
 
-  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
+  return GetTuningDB().Save(GetTuningDBPath().c_str());
+}
 
-  V_RETURN(CreateProgramFromFile(context, device, nullptr, "histo.cl", &g_pHistoProgram));
+/**
+ * Single-shot path. With @param end_to_end the image and the bins go through CLHostBuffer in the `host_mem` mode
+ * of the sweep, the image is handed to the device and the bins read back inside every iteration and the host
+ * time is reported; otherwise only the kernel time.
+ */
+CLHRESULT TestHistogram(cl_context context, cl_device_id device, cl_command_queue cmd_queue, const char *kernel_name,
+                        bool end_to_end, BenchState &state) {
 
-  std::uniform_int_distribution<uint16_t> dimid(1000, 10000);
+  CLHRESULT hr;
+  uint16_t dim = (uint16_t)state.GetInt("dim");
 
-  auto pixels_data = CreateGrayscaleImageData(dimid(g_RandomEngine), dimid(g_RandomEngine));
+  auto pixels_data = CreateGrayscaleImageData(dim, dim);
   uint32_t pixels_num = pixels_data.size();
   const size_t histo_num = 256;
   const size_t histo_buff_size = histo_num << 2;
 
   ycl_mem pixel_buff, histo_buff;
+  CLHostBuffer pixel_host, histo_host;
+  CLHostMemMode host_mem = CLHostMemMode::COPY;
+  void *host_ptr;
+
+  if (end_to_end) {
+    if (!ParseHostMemMode(state.GetString("host_mem"), &host_mem))
+      return CL_INVALID_VALUE;
+
+    V_RETURN(pixel_host.Create(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, pixels_num, host_mem));
+    V_RETURN(histo_host.Create(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, histo_buff_size, host_mem));
+
+    // The image lands in the host view once, as if decoded straight into it.
+    V_RETURN(pixel_host.Map(cmd_queue, CL_MAP_WRITE_INVALIDATE_REGION, &host_ptr));
+    memcpy(host_ptr, pixels_data.data(), pixels_num);
+    V_RETURN(pixel_host.Unmap(cmd_queue));
+    V_RETURN(clFinish(cmd_queue));
+
+    pixel_buff = (cl_mem)pixel_host;
+    histo_buff = (cl_mem)histo_host;
+  } else {
+    V_RETURN((pixel_buff <<=
+              clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, pixels_num, pixels_data.data(), &hr),
+              hr));
+    V_RETURN((histo_buff <<=
+              clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, histo_buff_size, nullptr, &hr),
+              hr));
+  }
+
+  ycl_kernel ker;
+  size_t work_item_size, local_size;
+  uint32_t histo_data[256];
+  uint32_t histo_init_data = 0;
+
+  uint32_t histo_data2[256];
+  memset(histo_data2, 0, sizeof(histo_data2));
+  for (int32_t i = 0; i < pixels_num; ++i) {
+    histo_data2[pixels_data[i]]++;
+  }
 
-  V_RETURN((pixel_buff <<=
-            clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, pixels_num, pixels_data.data(), &hr),
-            hr));
-  V_RETURN(
-      (histo_buff <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, histo_buff_size, nullptr, &hr),
-       hr));
+  V_RETURN(CreateHistoKernel(context, device, kernel_name, pixels_num, &ker, &work_item_size, &local_size));
+
+  V_RETURN(SetKernelArguments(ker, &pixel_buff, &pixels_num, &histo_buff));
+
+  std::string fill_name = std::string(kernel_name) + ".fill";
+  std::string read_name = std::string(kernel_name) + ".read";
+  ycl_event ker_ev, rd_done_ev;
+  double ker_ms;
+
+  while (state.KeepRunning()) {
+    if (end_to_end) {
+      // Hand the image to the device: an upload in copy mode, (nearly) free when zero copy.
+      V_RETURN(pixel_host.Map(cmd_queue, CL_MAP_WRITE, &host_ptr));
+      V_RETURN(pixel_host.Unmap(cmd_queue));
+    }
+    V_RETURN(clEnqueueFillBuffer(cmd_queue, histo_buff, &histo_init_data, sizeof(histo_init_data), 0, histo_buff_size,
+                                 0, nullptr, g_Profiler.Mark(fill_name.c_str())));
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker, 1, nullptr, &work_item_size,
+                                    local_size ? &local_size : nullptr, 0, nullptr, ker_ev.ReleaseAndGetAddressOf()));
+    if (end_to_end) {
+      V_RETURN(histo_host.Map(cmd_queue, CL_MAP_READ, &host_ptr));
+      memcpy(histo_data, host_ptr, histo_buff_size);
+      V_RETURN(histo_host.Unmap(cmd_queue));
+      V_RETURN(g_Profiler.Record(kernel_name, ker_ev));
+      continue;
+    }
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, histo_buff, false, 0, histo_buff_size, histo_data, 0, nullptr,
+                                 rd_done_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clFlush(cmd_queue));
+    V_RETURN(clWaitForEvents(1, &rd_done_ev));
+
+    V_RETURN(g_Profiler.Record(kernel_name, ker_ev));
+    V_RETURN(g_Profiler.Record(read_name.c_str(), rd_done_ev));
+    V_RETURN(GetEventElapsedTime(ker_ev, &ker_ms));
+    state.SetIterationTime(ker_ms);
+  }
 
-  ycl_kernel atomic_ker, atomic_coalesced_ker, optd_ker;
-  V_RETURN((atomic_ker <<= clCreateKernel(g_pHistoProgram, "histo_atomic", &hr), hr));
-  V_RETURN((atomic_coalesced_ker <<= clCreateKernel(g_pHistoProgram, "hosto_atomic_coalesced", &hr), hr));
-  V_RETURN((optd_ker <<= clCreateKernel(g_pHistoProgram, "histo_optimized_ultimate", &hr), hr));
+  if (end_to_end)
+    V_RETURN(clFinish(cmd_queue));
 
-  cl_uint cu_cap;
-  cl_ulong local_mem_cap;
+  state.SetVerified(memcmp(histo_data, histo_data2, histo_buff_size) == 0);
+  state.SetBytesProcessed((double)pixels_num);
 
-  size_t group_size[3];
+  return hr;
+}
+
+/**
+ * Streamed path: the image goes through CLStreamPipeline in chunks of `chunk` pixels, every chunk produces its own
+ * 256 bins which the host adds up. Host time end to end.
+ */
+CLHRESULT TestHistogramStreamed(cl_context context, cl_device_id device, const char *kernel_name, BenchState &state) {
+
+  CLHRESULT hr;
+  uint16_t dim = (uint16_t)state.GetInt("dim");
+  // Multiple of the 64 bytes the coalesced kernels load at once.
+  size_t chunk_elems = RoundC((size_t)state.GetInt("chunk"), 64);
+
+  auto pixels_data = CreateGrayscaleImageData(dim, dim);
+  uint32_t pixels_num = pixels_data.size();
+  const size_t histo_num = 256;
+  const size_t histo_buff_size = histo_num << 2;
+
+  ycl_kernel ker;
+  size_t work_item_size, local_size;
   uint32_t histo_data[256];
   uint32_t histo_init_data = 0;
 
@@ -92,71 +285,280 @@ int main() {
     histo_data2[pixels_data[i]]++;
   }
 
-  ycl_event rd_done_ev;
+  V_RETURN(CreateHistoKernel(context, device, kernel_name, chunk_elems, &ker, &work_item_size, &local_size));
+
+  CLStreamPipeline pipeline(context, device);
+  pipeline.AddInput(pixels_data.data(), 1);
+  pipeline.SetChunkOutput(histo_buff_size, histo_buff_size);
+
+  auto enqueue_chunk = [&](cl_command_queue cmd_queue, const CLStreamChunk &chunk, cl_uint num_waits,
+                           const cl_event *waits, cl_event *event) -> CLHRESULT {
+    CLHRESULT hr;
+    uint32_t chunk_num = (uint32_t)chunk.count;
+
+    V_RETURN(clEnqueueFillBuffer(cmd_queue, chunk.output, &histo_init_data, sizeof(histo_init_data), 0,
+                                 histo_buff_size, num_waits, waits, nullptr));
+    V_RETURN(SetKernelArguments(ker, &chunk.inputs[0], &chunk_num, &chunk.output));
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker, 1, nullptr, &work_item_size,
+                                    local_size ? &local_size : nullptr, 0, nullptr, event));
+    return hr;
+  };
+
+  CLStreamStats stats;
+
+  while (state.KeepRunning()) {
+    V_RETURN(pipeline.Run(pixels_num, chunk_elems, enqueue_chunk));
+
+    memset(histo_data, 0, sizeof(histo_data));
+    for (size_t i = 0; i < pipeline.ChunkCount(); ++i) {
+      const uint32_t *chunk_histo = (const uint32_t *)pipeline.GetChunkResult(i);
+      for (size_t j = 0; j < histo_num; ++j)
+        histo_data[j] += chunk_histo[j];
+    }
+  }
+
+  pipeline.GetStats(&stats);
+  printf("    %zu chunks: upload %.3fms, kernel %.3fms, download %.3fms busy, %.3fms wall\n", stats.chunks,
+         stats.upload_ms, stats.kernel_ms, stats.download_ms, stats.wall_ms);
+
+  state.SetVerified(memcmp(histo_data, histo_data2, histo_buff_size) == 0);
+  state.SetBytesProcessed((double)pixels_num);
 
-  using hp_timer = std::chrono::high_resolution_clock;
-  hp_timer::time_point start, fin;
-  std::chrono::microseconds elapsed;
+  return hr;
+}
+
+/**
+ * The three kernels computing the same 256 bins. The coalesced ones read 64 pixels per int16 load; the optimized
+ * one counts into 16-bit bins per work item, so no work item may see more than 65535 pixels at the built-in
+ * launch size (OPTD_LOCAL_SIZE_X work items, two groups per compute unit).
+ */
+static void RegisterHistogramVariants(cl_device_id device, CLKernelVariantRegistry &registry) {
+
+  cl_uint cu_cap = 1;
+
+  clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu_cap), &cu_cap, nullptr);
+
+  registry.Register("histogram", {"histo_atomic", "histo.cl", "", {}});
+  registry.Register("histogram", {"hosto_atomic_coalesced", "histo.cl", "", {RequireAlignment(64)}});
+  registry.Register("histogram", {"histo_optimized_ultimate", "histo.cl", "",
+                                  {RequireAlignment(64), RequireMaxSize((size_t)65535 * 32 * cu_cap * 2, "pixels")}});
+}
+
+/**
+ * A/B mode: every eligible histogram kernel runs on the same image each iteration, and the registry records
+ * the fastest per image size. A kernel producing wrong bins is left out of the record. Kernel time of the
+ * current winner.
+ */
+CLHRESULT TestHistogramAB(cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                          CLKernelVariantRegistry &registry, BenchState &state) {
+
+  CLHRESULT hr;
+  uint16_t dim = (uint16_t)state.GetInt("dim");
+
+  auto pixels_data = CreateGrayscaleImageData(dim, dim);
+  uint32_t pixels_num = pixels_data.size();
+  const size_t histo_buff_size = 256 * sizeof(uint32_t);
+  uint32_t histo_data2[256];
+  const uint32_t histo_init_data = 0;
+  cl_uint base_align_bits, cu_cap;
+  std::vector<std::string> rejected;
 
+  memset(histo_data2, 0, sizeof(histo_data2));
+  for (int32_t i = 0; i < pixels_num; ++i)
+    histo_data2[pixels_data[i]]++;
+
+  ycl_mem pixel_buff, histo_buff;
+  V_RETURN2(pixel_buff <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, pixels_num,
+                                          pixels_data.data(), &hr),
+            hr);
+  V_RETURN2(histo_buff <<= clCreateBuffer(context, CL_MEM_READ_WRITE, histo_buff_size, nullptr, &hr), hr);
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(base_align_bits), &base_align_bits,
+                           nullptr));
   V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cu_cap), &cu_cap, nullptr));
-  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem_cap), &local_mem_cap, nullptr));
-
-  // Atomic Histogram
-  V_RETURN(clGetKernelWorkGroupInfo(atomic_ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size), group_size, nullptr));
-  size_t work_item_size = group_size[0] * cu_cap * 2;
-
-  V_RETURN(SetKernelArguments(atomic_ker, &pixel_buff, &pixels_num, &histo_buff));
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, histo_buff, &histo_init_data, sizeof(histo_init_data), 0, histo_buff_size, 0,
-                               nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, atomic_ker, 1, nullptr, &work_item_size, nullptr, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, histo_buff, false, 0, histo_buff_size, histo_data, 0, nullptr,
-                               rd_done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &rd_done_ev));
-  fin =  hp_timer::now();
-  elapsed = std::chrono::duration_cast<std::chrono::microseconds>(fin - start);
-  printf("Atomics Histogram elapsed: %lldus, coincident: %s\n", elapsed.count(),
-         memcmp(histo_data, histo_data2, histo_buff_size) == 0 ? "true" : "false");
-
-  // Amotics Coalesced Histogram
-  V_RETURN(clGetKernelWorkGroupInfo(atomic_coalesced_ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
-                                    group_size, nullptr));
-  work_item_size = group_size[0] * cu_cap * 2;
-
-  V_RETURN(SetKernelArguments(atomic_coalesced_ker, &pixel_buff, &pixels_num, &histo_buff));
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, histo_buff, &histo_init_data, sizeof(histo_init_data), 0, histo_buff_size, 0,
-                               nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, atomic_coalesced_ker, 1, nullptr, &work_item_size, nullptr, 0, nullptr,
-                                  nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, histo_buff, false, 0, histo_buff_size, histo_data, 0, nullptr,
-                               rd_done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &rd_done_ev));
-  fin = hp_timer::now();
-  elapsed = std::chrono::duration_cast<std::chrono::microseconds>(fin - start);
-  printf("Atomics Coalesced Histogram elapsed: %lldus, coincident: %s\n", elapsed.count(),
-         memcmp(histo_data, histo_data2, histo_buff_size) == 0 ? "true" : "false");
-
-  // Optimize to Ultimate Histogram
-  V_RETURN(clGetKernelWorkGroupInfo(optd_ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
-                                    group_size, nullptr));
-  work_item_size = group_size[0] * cu_cap * 2;
-
-  V_RETURN(SetKernelArguments(optd_ker, &pixel_buff, &pixels_num, &histo_buff));
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, histo_buff, &histo_init_data, sizeof(histo_init_data), 0, histo_buff_size, 0,
-                               nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, optd_ker, 1, nullptr, &work_item_size, nullptr, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, histo_buff, false, 0, histo_buff_size, histo_data, 0, nullptr,
-                               rd_done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &rd_done_ev));
-  fin = hp_timer::now();
-  elapsed = std::chrono::duration_cast<std::chrono::microseconds>(fin - start);
-  printf("Optimizely Ultimate Histogram elapsed: %lldus, coincident: %s\n", elapsed.count(),
-         memcmp(histo_data, histo_data2, histo_buff_size) == 0 ? "true" : "false");
-
-  return 0;
-}
\ No newline at end of file
+
+  // a whole buffer starts at the device base alignment
+  CLVariantInput input = {pixels_num, 0, base_align_bits / 8};
+
+  registry.GetEligible("histogram", input, &rejected);
+  for (auto &reason : rejected)
+    printf("    dim=%u: %s\n", dim, reason.c_str());
+
+  auto run = [&](const CLKernelVariant &variant, cl_kernel kernel, double *ms) -> CLHRESULT {
+    CLHRESULT hr;
+    size_t group_size[3], work_item_size;
+    uint32_t histo_data[256];
+    ycl_event ker_ev;
+
+    V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(group_size),
+                                      group_size, nullptr));
+    work_item_size = group_size[0] * cu_cap * 2;
+    V_RETURN(SetKernelArguments(kernel, &pixel_buff, &pixels_num, &histo_buff));
+    V_RETURN(clEnqueueFillBuffer(cmd_queue, histo_buff, &histo_init_data, sizeof(histo_init_data), 0,
+                                 histo_buff_size, 0, nullptr, nullptr));
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, &work_item_size, nullptr, 0, nullptr,
+                                    ker_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, histo_buff, CL_TRUE, 0, histo_buff_size, histo_data, 0, nullptr,
+                                 nullptr));
+    V_RETURN(GetEventElapsedTime(ker_ev, ms));
+    if (memcmp(histo_data, histo_data2, histo_buff_size) != 0) {
+      printf("    %s: wrong bins, not recorded\n", variant.name.c_str());
+      return CL_INVALID_VALUE;
+    }
+    return hr;
+  };
+
+  CLKernelVariant winner;
+  bool verified = true;
+
+  while (state.KeepRunning()) {
+    if (CL_FAILED(registry.RunAB("histogram", input, run, &winner))) {
+      verified = false;
+      break;
+    }
+    state.SetIterationTime(registry.GetStats("histogram", input)[winner.name].mean_ms);
+  }
+
+  for (auto &stats : registry.GetStats("histogram", input))
+    printf("    %-26s %4u runs, %.4fms%s\n", stats.first.c_str(), stats.second.runs, stats.second.mean_ms,
+           stats.first == winner.name ? "  <- winner" : "");
+
+  state.SetVerified(verified);
+  state.SetBytesProcessed((double)pixels_num);
+
+  return CL_SUCCESS;
+}
+
+/**
+ * Native path: every range of the image counted into private bins on its own thread, the bins added up after.
+ */
+CLHRESULT TestHistogramNative(unsigned threads, BenchState &state) {
+
+  uint16_t dim = (uint16_t)state.GetInt("dim");
+  auto pixels_data = CreateGrayscaleImageData(dim, dim);
+  uint32_t pixels_num = pixels_data.size();
+  const size_t block_len = 1 << 20;
+  size_t block_num = (pixels_num + block_len - 1) / block_len;
+  std::vector<uint32_t> block_histo(block_num * 256);
+  uint32_t histo_data[256];
+
+  while (state.KeepRunning()) {
+    ParallelFor(block_num, 1, [&](size_t begin, size_t end) {
+      for (size_t blk = begin; blk < end; ++blk) {
+        uint32_t *histo = &block_histo[blk * 256];
+        memset(histo, 0, 256 * sizeof(uint32_t));
+        for (size_t i = blk * block_len; i < std::min((size_t)pixels_num, (blk + 1) * block_len); ++i)
+          histo[pixels_data[i]]++;
+      }
+    }, threads);
+
+    memset(histo_data, 0, sizeof(histo_data));
+    for (size_t blk = 0; blk < block_num; ++blk)
+      for (int32_t i = 0; i < 256; ++i)
+        histo_data[i] += block_histo[blk * 256 + i];
+  }
+
+  uint32_t histo_data2[256];
+  memset(histo_data2, 0, sizeof(histo_data2));
+  for (int32_t i = 0; i < pixels_num; ++i) {
+    histo_data2[pixels_data[i]]++;
+  }
+
+  state.SetVerified(memcmp(histo_data, histo_data2, sizeof(histo_data)) == 0);
+  state.SetBytesProcessed((double)pixels_num);
+
+  return CL_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+
+  CLHRESULT hr;
+  CLComputeBackend backend;
+
+  V_RETURN(backend.Init({"NVIDIA CUDA", "AMD"}));
+
+  cl_context context = backend.Context();
+  cl_device_id device = backend.Device();
+  cl_command_queue cmd_queue = backend.Queue();
+
+  BenchmarkSuite suite("pixels_histogram");
+  suite.ParseArgs(argc, argv);
+
+  // Square grayscale images, dim x dim pixels.
+  auto sweep = MakeParamSweep({{"dim", {1024, 4096, 10000}}});
+
+  // Histogram kernels by contract, rebuilt when histo.cl changes while the suite runs.
+  std::unique_ptr<CLKernelVariantRegistry> registry;
+
+  if (backend.HasDevice()) {
+    V_RETURN(CreateProgramFromFile(context, device, nullptr, "histo.cl", &g_pHistoProgram));
+
+    registry.reset(new CLKernelVariantRegistry(context, device));
+    RegisterHistogramVariants(device, *registry);
+    registry->Load(GetVariantDBPath().c_str());
+    registry->StartWatching(500);
+
+    if (suite.IsTuningRequested())
+      V_RETURN(TuneHistogramKernels(context, device, cmd_queue, {1024, 4096, 10000}));
+    printf("Tuning database %s: %zu entries\n", GetTuningDBPath().c_str(), GetTuningDB().size());
+
+    for (const char *kernel_name : {"histo_atomic", "hosto_atomic_coalesced", "histo_optimized_ultimate"}) {
+      suite.Register(kernel_name, sweep, [&, kernel_name](BenchState &state) -> CLHRESULT {
+        return TestHistogram(context, device, cmd_queue, kernel_name, false, state);
+      });
+    }
+
+    suite.Register("histogram_ab", sweep, [&](BenchState &state) -> CLHRESULT {
+      return TestHistogramAB(context, device, cmd_queue, *registry, state);
+    });
+
+    // End-to-end bandwidth, transfers included: whole image at once, copied or zero copy, against the chunked
+    // pipeline.
+    auto e2e_sweep =
+        MakeParamSweep({{"dim", {4096, 10000}}, {"host_mem", {"copy", "alloc_host_ptr", "use_host_ptr"}}});
+    auto stream_sweep = MakeParamSweep({{"dim", {4096, 10000}}, {"chunk", {1 << 20, 1 << 22}}});
+    for (const char *kernel_name : {"hosto_atomic_coalesced", "histo_optimized_ultimate"}) {
+      std::string single_name = std::string(kernel_name) + "/single_shot";
+      std::string stream_name = std::string(kernel_name) + "/streamed";
+      suite.Register(single_name.c_str(), e2e_sweep, [&, kernel_name](BenchState &state) -> CLHRESULT {
+        return TestHistogram(context, device, cmd_queue, kernel_name, true, state);
+      });
+      suite.Register(stream_name.c_str(), stream_sweep, [&, kernel_name](BenchState &state) -> CLHRESULT {
+        return TestHistogramStreamed(context, device, kernel_name, state);
+      });
+    }
+  }
+
+  // Image in host memory, bins back to the host: the OpenCL side pays the upload.
+  CLBackendOp<BenchState &> histogram_op(
+      "histogram",
+      [](BenchState &state) -> CLWorkload {
+        double pixels_num = (double)state.GetInt("dim") * state.GetInt("dim");
+        return {pixels_num, pixels_num, pixels_num + 256 * sizeof(uint32_t)};
+      },
+      [&](BenchState &state) -> CLHRESULT {
+        return TestHistogram(context, device, cmd_queue, "histo_optimized_ultimate", true, state);
+      },
+      [&](BenchState &state) -> CLHRESULT { return TestHistogramNative(backend.NativeThreads(), state); });
+
+  suite.Register("histogram_native", sweep,
+                 [&](BenchState &state) -> CLHRESULT { return histogram_op.Run(CLBackendKind::NATIVE, state); });
+  suite.Register("histogram_auto", MakeParamSweep({{"dim", {1024, 4096, 10000}}, {"host_mem", {"copy"}}}),
+                 [&](BenchState &state) -> CLHRESULT {
+                   CLBackendKind kind = histogram_op.Select(backend, state);
+                   printf("    %s dim=%lld: %s\n", histogram_op.Name(), (long long)state.GetInt("dim"),
+                          GetBackendKindName(kind));
+                   return histogram_op.Run(kind, state);
+                 });
+
+  hr = suite.Run();
+
+  if (registry) {
+    registry->StopWatching();
+    registry->Save(GetVariantDBPath().c_str());
+  }
+
+  V_RETURN(g_Profiler.WriteReports("pixels_histogram_profile"));
+  g_Profiler.PrintSummary();
+
+  return hr;
+}
@@ -0,0 +1,93 @@
+#include <cl_utils.h>
+#include <cl_program_cache.h>
+#include <common_miscs.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+/**
+ * Cold versus warm program creation through the on-disk binary cache.
+ * Run on a CPU platform (PoCL, Intel CPU runtime) with the driver's own kernel cache disabled,
+ * e.g. POCL_KERNEL_CACHE=0, otherwise the "cold" numbers are already served by the driver.
+ */
+
+struct ProgramSource {
+  const char *fname;
+  const char *defines;
+};
+
+static const ProgramSource g_ProgramSources[] = {
+  {"vector_dot.cl", nullptr},
+  {"vector_dot.cl", "#define _USE_DOUBLE_FP\n"},
+  {"histo.cl", nullptr},
+  {"sparse_matrix.cl", "#define _USE_DOUBLE_FP\n"},
+};
+
+static CLHRESULT TimeProgramCreation(cl_context context, cl_device_id device, const ProgramSource &src,
+                                     bool cold, fmilliseconds *elapsed) {
+  CLHRESULT hr;
+  ycl_program program;
+  hp_timer::time_point start, fin;
+
+  if (cold)
+    ClearProgramCache();
+
+  start = hp_timer::now();
+  V_RETURN(CreateProgramFromFile(context, device, src.defines, src.fname, &program));
+  fin = hp_timer::now();
+  *elapsed = fmilliseconds_cast(fin - start);
+
+  return hr;
+}
+
+int main() {
+
+  CLHRESULT hr;
+  ycl_platform_id platform;
+  ycl_device_id device;
+  ycl_context context;
+  const int reps = 5;
+  char nbuff[256];
+
+  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_CPU, {"Portable Computing Language", "Intel", "AMD"}, {}, &platform,
+                              &device));
+  V_RETURN(CreateDeviceContext(platform, device, &context));
+
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(nbuff), nbuff, nullptr));
+  printf("Device: %s\n", nbuff);
+
+  SetProgramCacheDirectory("cl_program_cache_bench");
+  EnableProgramCache(true);
+  printf("Program cache directory: %s\n\n", GetProgramCacheDirectory().c_str());
+
+  CLProgramCacheStats stats;
+  std::vector<float> cold_ms(reps), warm_ms(reps);
+  fmilliseconds elapsed;
+  float cold_total = 0.0f, warm_total = 0.0f;
+
+  for (const ProgramSource &src : g_ProgramSources) {
+    for (int i = 0; i < reps; ++i) {
+      V_RETURN(TimeProgramCreation(context, device, src, true, &elapsed));
+      cold_ms[i] = elapsed.count();
+      V_RETURN(TimeProgramCreation(context, device, src, false, &elapsed));
+      warm_ms[i] = elapsed.count();
+    }
+
+    std::sort(cold_ms.begin(), cold_ms.end());
+    std::sort(warm_ms.begin(), warm_ms.end());
+    cold_total += cold_ms[reps / 2];
+    warm_total += warm_ms[reps / 2];
+
+    printf("%-18s %-8s cold(compile): min %8.3fms, median %8.3fms | warm(binary): min %8.3fms, median %8.3fms, "
+           "speedup: %.1fx\n",
+           src.fname, src.defines ? "fp64" : "fp32", cold_ms[0], cold_ms[reps / 2], warm_ms[0], warm_ms[reps / 2],
+           cold_ms[reps / 2] / std::max(warm_ms[reps / 2], 1.0E-3f));
+  }
+
+  GetProgramCacheStats(&stats);
+  printf("\nStartup total(median): cold %.3fms, warm %.3fms\n", cold_total, warm_total);
+  printf("Cache hits: %zu, misses: %zu, stores: %zu, rejects: %zu\n", stats.hits, stats.misses, stats.stores,
+         stats.rejects);
+
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include <cl_utils.h>
+#include <cl_backend.h>
+#include <cl_queue_pool.h>
+#include <common_miscs.h>
+#include <benchmark.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+/**
+ * Throughput of a multithreaded host submitting independent requests, from 1 to N host threads. A request
+ * uploads its input, runs one kernel and reads the result back with a blocking read.
+ *
+ * shared_queue: every thread enqueues to the one queue of the context, so a blocking read also waits for the
+ *   requests the other threads enqueued before it.
+ * pooled_queues: one in-order queue per thread from CLQueuePool.
+ * pooled_queues_ooo: one out-of-order queue per thread, the request ordered by its event chain; same as
+ *   pooled_queues when the device has no out-of-order queues.
+ *
+ * The workers are spawned anew every iteration, so they take stream queues (one per worker index) rather than
+ * thread queues.
+ */
+
+static const uint32_t g_ElemCount = 1 << 16;
+static const uint32_t g_PolyIters = 64;
+static const int g_RequestsPerThread = 32;
+
+struct Worker {
+  ycl_kernel kernel;
+  ycl_buffer x_buff;
+  ycl_buffer y_buff;
+  std::vector<float> x;
+  std::vector<float> y;
+};
+
+static CLHRESULT CreateWorkers(cl_context context, cl_program program, int count,
+                               std::vector<std::unique_ptr<Worker>> *workers) {
+  CLHRESULT hr = CL_SUCCESS;
+  std::uniform_real_distribution<float> rd(-1.0f, 1.0f);
+
+  for (int i = (int)workers->size(); i < count; ++i) {
+    std::unique_ptr<Worker> worker(new Worker());
+
+    // A kernel per worker: clSetKernelArg on a shared kernel from several threads races.
+    V_RETURN2(worker->kernel <<= clCreateKernel(program, "poly_eval", &hr), hr);
+    V_RETURN2(worker->x_buff <<= clCreateBuffer(context, CL_MEM_READ_ONLY, g_ElemCount * sizeof(float), nullptr, &hr),
+              hr);
+    V_RETURN2(worker->y_buff <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY, g_ElemCount * sizeof(float), nullptr, &hr),
+              hr);
+    worker->x.resize(g_ElemCount);
+    worker->y.resize(g_ElemCount);
+    for (auto &v : worker->x)
+      v = rd(g_RandomEngine);
+    V_RETURN(SetKernelArguments(worker->kernel, &worker->y_buff, &worker->x_buff, &g_ElemCount, &g_PolyIters));
+    workers->push_back(std::move(worker));
+  }
+
+  return hr;
+}
+
+static CLHRESULT RunRequests(cl_command_queue cmd_queue, Worker *worker) {
+  CLHRESULT hr;
+  size_t global_size = RoundC(g_ElemCount, 64);
+  ycl_event write_ev, kernel_ev;
+
+  for (int r = 0; r < g_RequestsPerThread; ++r) {
+    V_RETURN(clEnqueueWriteBuffer(cmd_queue, worker->x_buff, CL_FALSE, 0, g_ElemCount * sizeof(float),
+                                  worker->x.data(), 0, nullptr, write_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, worker->kernel, 1, nullptr, &global_size, nullptr, 1, &write_ev,
+                                    kernel_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, worker->y_buff, CL_TRUE, 0, g_ElemCount * sizeof(float),
+                                 worker->y.data(), 1, &kernel_ev, nullptr));
+  }
+
+  return hr;
+}
+
+static bool VerifyWorker(const Worker &worker) {
+  for (uint32_t i = 0; i < g_ElemCount; ++i) {
+    float acc = 0.0f;
+    for (uint32_t k = 0; k < g_PolyIters; ++k)
+      acc = fmaf(acc, worker.x[i], 0.5f);
+    if (fabsf(acc - worker.y[i]) > 1.0E-4f * std::max(1.0f, fabsf(acc)))
+      return false;
+  }
+  return true;
+}
+
+static CLHRESULT TestQueues(cl_context context, cl_command_queue shared_queue, cl_program program,
+                            CLQueuePool *pool, BenchState &state) {
+  CLHRESULT hr = CL_SUCCESS;
+  int nthreads = (int)state.GetInt("threads");
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<cl_command_queue> queues(nthreads, shared_queue);
+  std::vector<CLHRESULT> results(nthreads);
+
+  V_RETURN(CreateWorkers(context, program, nthreads, &workers));
+  for (int i = 0; pool && i < nthreads; ++i)
+    V_RETURN(pool->GetStreamQueue(i, &queues[i]));
+
+  while (state.KeepRunning()) {
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < nthreads; ++i)
+      threads.emplace_back([&, i]() { results[i] = RunRequests(queues[i], workers[i].get()); });
+    for (auto &t : threads)
+      t.join();
+
+    for (auto r : results)
+      V_RETURN(r);
+  }
+
+  state.SetBytesProcessed(2.0 * nthreads * g_RequestsPerThread * g_ElemCount * sizeof(float));
+  state.SetFlopsProcessed(2.0 * nthreads * g_RequestsPerThread * g_ElemCount * g_PolyIters);
+  state.SetVerified(VerifyWorker(*workers[0]) && VerifyWorker(*workers[nthreads - 1]));
+  return hr;
+}
+
+int main(int argc, char **argv) {
+
+  CLHRESULT hr;
+  CLComputeBackend backend;
+  ycl_program program;
+
+  V_RETURN(backend.Init({"NVIDIA CUDA", "AMD"}));
+  if (!backend.HasDevice()) {
+    printf("No OpenCL device, nothing to measure\n");
+    return 0;
+  }
+
+  cl_context context = backend.Context();
+  cl_device_id device = backend.Device();
+  V_RETURN(CreateProgramFromFile(context, device, nullptr, "queue_pool.cl", &program));
+
+  CLQueuePool pool(context, device);
+  CLQueuePool pool_ooo(context, device, true);
+  printf("Out-of-order queues: %s\n", pool_ooo.IsOutOfOrder() ? "supported" : "not supported, in-order instead");
+
+  std::vector<BenchValue> thread_counts;
+  int max_threads = (int)backend.NativeThreads();
+  for (int n = 1; n < max_threads; n *= 2)
+    thread_counts.push_back(n);
+  thread_counts.push_back(max_threads);
+
+  BenchmarkSuite suite("queue_pool");
+  suite.ParseArgs(argc, argv);
+
+  auto sweep = MakeParamSweep({{"threads", thread_counts}});
+  suite.Register("shared_queue", sweep, [&](BenchState &state) {
+    return TestQueues(context, backend.Queue(), program, nullptr, state);
+  });
+  suite.Register("pooled_queues", sweep,
+                 [&](BenchState &state) { return TestQueues(context, nullptr, program, &pool, state); });
+  suite.Register("pooled_queues_ooo", sweep,
+                 [&](BenchState &state) { return TestQueues(context, nullptr, program, &pool_ooo, state); });
+
+  hr = suite.Run();
+
+  V_RETURN(pool.FinishAll());
+  V_RETURN(pool_ooo.FinishAll());
+  return hr;
+}
@@ -0,0 +1,13 @@
+// Enough arithmetic per element that a request is not launch overhead alone.
+__kernel void poly_eval(__global float *y, __global const float *x, uint n, uint iters) {
+
+  uint gid = get_global_id(0);
+  if (gid >= n)
+    return;
+
+  float v = x[gid];
+  float acc = 0.0f;
+  for (uint i = 0; i < iters; ++i)
+    acc = fma(acc, v, 0.5f);
+  y[gid] = acc;
+}
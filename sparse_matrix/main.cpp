@@ -1,6 +1,15 @@
 #include <cl_utils.h>
 #include <common_miscs.h>
+#include <cl_profiler.h>
+#include <cl_host_buffer.h>
+#include <cl_backend.h>
+#include <cl_host_arena.h>
+#include <cl_precision.h>
+#include <benchmark.h>
+#include <cl_kernel_variants.h>
+#include <cl_completion_queue.h>
 #include <cstdint>
+#include <string.h>
 #include <algorithm>
 #include <immintrin.h>
 
@@ -56,7 +65,11 @@ void raw_vector_alloc(raw_vector *vec, uint16_t rows) {
   vec->vals = new double[rows];
 }
 
-void generate_random_csr_matrix(uint16_t rows, uint16_t cols, double fmin, double fmax, csr_mat *mat) {
+/**
+ * @param arena: scratch of the generator, rewound before returning.
+ */
+void generate_random_csr_matrix(uint16_t rows, uint16_t cols, double fmin, double fmax, csr_mat *mat,
+                                CLHostArena *arena) {
 
   static std::minstd_rand zero_rd(g_RandomEngine());
   constexpr size_t zero_id_denom = 701;
@@ -67,7 +80,8 @@ void generate_random_csr_matrix(uint16_t rows, uint16_t cols, double fmin, doubl
   uint16_t max_nnz_cols = 0;
   std::uniform_int_distribution<uint16_t> cols_distr(1, cols);
   std::uniform_real_distribution<double> val_distr(fmin, fmax+1.0E6);
-  uint16_t *col_range = new uint16_t[cols];
+  CLHostArenaScope arena_scope(*arena);
+  uint16_t *col_range = arena->Allocate<uint16_t>(cols);
   uint32_t row_nnz;
 
   csr_mat_destroy(mat);
@@ -102,8 +116,6 @@ void generate_random_csr_matrix(uint16_t rows, uint16_t cols, double fmin, doubl
     }
     std::shuffle(col_range, col_range+cols, zero_rd);
   }
-
-  _SAFE_DELETE_ARRAY(col_range);
 }
 
 int csr_mat_sort_by_order_descend(
@@ -224,6 +236,34 @@ int csr_mat_mul_vec(const csr_mat *mat, const raw_vector *vec, raw_vector *res)
   return 0;
 }
 
+/**
+ * Rows split over @param threads threads, each row summed as in csr_mat_mul_vec.
+ */
+int csr_mat_mul_vec_mt(const csr_mat *mat, const raw_vector *vec, raw_vector *res, unsigned threads) {
+
+  if(mat->cols != vec->rows) {
+    printf("csr_mat_mul_vec_mt: Incompatible matrix and vector dimension.");
+    return -1;
+  }
+
+  raw_vector_alloc(res, mat->rows);
+
+  ParallelFor(mat->rows, 64, [&](size_t begin, size_t end) {
+    for(size_t i = begin; i < end; ++i) {
+      uint32_t col_start = mat->row_ptr[i];
+      uint32_t col_end = mat->row_ptr[i+1];
+      double temp = 0.0;
+
+      for(; col_start != col_end; ++col_start) {
+        temp += mat->vals[col_start] * vec->vals[mat->col_idx[col_start]];
+      }
+
+      res->vals[i] = temp;
+    }
+  }, threads);
+  return 0;
+}
+
 bool check_matrix_equiv(const double *mat1, const double *mat2, size_t count, double eq_tol, size_t cols, size_t rows) {
 
   bool res = true;
@@ -291,30 +331,85 @@ bool check_matrix_equiv(const double *mat1, const double *mat2, size_t count, do
 }
 
 static ycl_program g_pSparseMatrixProgram;
+static CLProfiler g_Profiler;
 
-CLHRESULT TestCsrMatMulVec(cl_context context, cl_device_id device, cl_command_queue cmd_queue, uint16_t nrows, uint16_t ncols) {
+/** Random "rows" x "cols" CSR matrix, vector and their serial product for one sweep point. */
+static void GenerateSpMVProblem(BenchState &state, csr_mat *mat, raw_vector *vec, raw_vector *res) {
+  uint16_t nrows = (uint16_t)state.GetInt("rows"), ncols = (uint16_t)state.GetInt("cols");
 
-  CLHRESULT hr;
-  hp_timer::time_point start, fin;
-  fmilliseconds elapsed;
+  generate_random_csr_matrix(nrows, ncols, -10.0, 10.0, mat, &GetThreadArena());
+  generate_random_vector(ncols, -10.0, 10.0, vec);
+  csr_mat_mul_vec(mat, vec, res);
+}
+
+static double GetSpMVBytes(const csr_mat &mat, size_t value_size) {
+  uint32_t nnz = mat.row_ptr[mat.rows];
+  return (double)nnz * (value_size + sizeof(uint16_t)) + (mat.rows + 1) * sizeof(uint32_t) +
+         (double)(mat.cols + mat.rows) * value_size;
+}
+
+enum class SpMVNativeVariant { SERIAL, MT };
+
+/**
+ * Native path: csr_mat_mul_vec, or the rows split over every hardware thread and checked against it.
+ */
+CLHRESULT TestCsrMatMulVecNative(SpMVNativeVariant variant, CLComputeBackend &backend, BenchState &state) {
 
   csr_mat mat = CSR_MAT_INIT;
   raw_vector vec = RAW_VECTOR_INIT;
   raw_vector res = RAW_VECTOR_INIT;
+  raw_vector res2 = RAW_VECTOR_INIT;
+
+  GenerateSpMVProblem(state, &mat, &vec, &res);
+
+  if (variant == SpMVNativeVariant::SERIAL) {
+    // The whole matrix is uploaded by the OpenCL path.
+    CLWorkload workload;
+    workload.bytes = GetSpMVBytes(mat, sizeof(double));
+    workload.flops = 2.0 * mat.row_ptr[mat.rows];
+    workload.transfer_bytes = workload.bytes;
+    printf("    backend for [%u X %u]: %s (opencl %.3fms, native %.3fms estimated)\n", mat.rows, mat.cols,
+           GetBackendKindName(backend.Select(workload)), backend.EstimateMs(CLBackendKind::OPENCL, workload),
+           backend.EstimateMs(CLBackendKind::NATIVE, workload));
+  }
+
+  while (state.KeepRunning()) {
+    if (variant == SpMVNativeVariant::SERIAL)
+      csr_mat_mul_vec(&mat, &vec, &res2);
+    else
+      csr_mat_mul_vec_mt(&mat, &vec, &res2, backend.NativeThreads());
+  }
 
-  printf("Input Matrix size: [%u X %u]\n", nrows, ncols);
+  state.SetVerified(check_matrix_equiv(res2.vals, res.vals, res.rows, 1.0E-6, 1, res.rows));
+  state.SetBytesProcessed(GetSpMVBytes(mat, sizeof(double)));
+  state.SetFlopsProcessed(2.0 * mat.row_ptr[mat.rows]);
+
+  csr_mat_destroy(&mat);
+  raw_vector_destroy(&vec);
+  raw_vector_destroy(&res);
+  raw_vector_destroy(&res2);
+  return CL_SUCCESS;
+}
 
-  generate_random_csr_matrix(nrows, ncols, -10.0, 10.0, &mat);
-  generate_random_vector(ncols, -10.0, 10.0, &vec);
+/**
+ * @param kernel_name smm_native (one row per work item) or smm_warp_per_row (one row per warp of a 2D group),
+ * double precision. An iteration is the fill, the kernel and the read back of the result through a CLHostBuffer
+ * in the `host_mem` mode of the sweep: a copy into host memory, or a map of the buffer the kernel wrote.
+ */
+CLHRESULT TestCsrMatMulVec(const char *kernel_name, cl_context context, cl_device_id device,
+                           cl_command_queue cmd_queue, BenchState &state) {
 
-  printf("Matrix NNZ(Number Not Zero) size: %u\nAverage NNZ size per Row: %u\n", mat.row_ptr[mat.rows],
-    mat.row_ptr[mat.rows] / mat.rows);
+  CLHRESULT hr;
+  CLHostMemMode host_mem;
 
-  start = hp_timer::now();
-  csr_mat_mul_vec(&mat, &vec, &res);
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("CPU Serializing elapsed: %.3fms\n", elapsed.count());
+  if (!ParseHostMemMode(state.GetString("host_mem"), &host_mem))
+    return CL_INVALID_VALUE;
+
+  csr_mat mat = CSR_MAT_INIT;
+  raw_vector vec = RAW_VECTOR_INIT;
+  raw_vector res = RAW_VECTOR_INIT;
+
+  GenerateSpMVProblem(state, &mat, &vec, &res);
 
   size_t mat_row_ptr_buff_size = (mat.rows + 1)* sizeof(uint32_t);
   size_t mat_col_idx_buff_size = mat.row_ptr[mat.rows] * sizeof(uint16_t);
@@ -325,7 +420,7 @@ CLHRESULT TestCsrMatMulVec(cl_context context, cl_device_id device, cl_command_q
   ycl_buffer mat_row_ptr_buffer;
   ycl_buffer mat_col_idx_buffer, mat_vals_buffer;
   ycl_buffer vec_vals_buffer;
-  ycl_buffer res_vals_buffer;
+  CLHostBuffer res_vals_buffer;
 
   ycl_image mat_col_idx_image, mat_vals_image;
   ycl_image vec_vals_image;
@@ -347,9 +442,7 @@ CLHRESULT TestCsrMatMulVec(cl_context context, cl_device_id device, cl_command_q
   V_RETURN2(vec_vals_buffer <<=
             clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, vec_vals_buff_size, vec.vals, &hr),
             hr);
-  V_RETURN2(res_vals_buffer <<=
-            clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, res_vals_buff_size, nullptr, &hr),
-            hr);
+  V_RETURN(res_vals_buffer.Create(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, res_vals_buff_size, host_mem));
 
   img_format.image_channel_order = CL_R;
   img_format.image_channel_data_type = CL_UNSIGNED_INT16;
@@ -376,11 +469,11 @@ CLHRESULT TestCsrMatMulVec(cl_context context, cl_device_id device, cl_command_q
   V_RETURN2(res_vals_image <<= clCreateImage(context, CL_MEM_WRITE_ONLY|CL_MEM_HOST_READ_ONLY,
     &img_format, &img_desc, nullptr, &hr), hr);
 
-  raw_vector res2 = RAW_VECTOR_INIT;
-  raw_vector_alloc(&res2, mat.rows);
+  double *res2_vals;
+  const bool per_warp = strcmp(kernel_name, "smm_warp_per_row") == 0;
+  const std::string fill_name = std::string(kernel_name) + ".fill";
 
   ycl_kernel kernel;
-  ycl_event done_ev;
   cl_uint row_size = mat.rows;
   size_t max_work_item_size[3];
   size_t work_group_size[3];
@@ -392,69 +485,490 @@ CLHRESULT TestCsrMatMulVec(cl_context context, cl_device_id device, cl_command_q
   V_RETURN(
       clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_item_size), max_work_item_size, nullptr));
 
-  V_RETURN2(kernel <<= clCreateKernel(g_pSparseMatrixProgram, "smm_native", &hr), hr);
-  V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(work_group_size), work_group_size, nullptr));
+  V_RETURN2(kernel <<= clCreateKernel(g_pSparseMatrixProgram, kernel_name, &hr), hr);
+  V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(work_group_size),
+                                    work_group_size, nullptr));
 
   work_item_size[0] = std::min(max_work_item_size[0], (size_t)mat.rows);
-  work_item_size[0] = RoundC(work_item_size[0], work_group_size[0]);
+  if (per_warp)
+    work_item_size[1] = work_group_size[1];
+  else
+    work_item_size[0] = RoundC(work_item_size[0], work_group_size[0]);
 
   V_RETURN(SetKernelArguments(kernel, &row_size, &mat_row_ptr_buffer, &mat_col_idx_image, &mat_vals_image,
                               &vec_vals_image, &res_vals_image));
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillImage(cmd_queue, res_vals_image, &zfpattern, zforigin, zfregion, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, work_item_size, work_group_size, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadImage(cmd_queue, res_vals_image, false, zforigin, zfregion, 0, 0, res2.vals, 0, nullptr,
-                              done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("GPU (One Row per Work Group) elapsed: %3.fms\n", elapsed.count());
-  printf("Results coincidence: %s\n", check_matrix_equiv(res2.vals, res.vals, res.rows, 1.0E-6, 1, res.rows) ? "true" : "false");
-
-  V_RETURN2(kernel <<= clCreateKernel(g_pSparseMatrixProgram, "smm_warp_per_row", &hr), hr);
+
+  while (state.KeepRunning()) {
+    V_RETURN(clEnqueueFillImage(cmd_queue, res_vals_image, &zfpattern, zforigin, zfregion, 0, nullptr,
+                                g_Profiler.Mark(fill_name.c_str())));
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, per_warp ? 2 : 1, nullptr, work_item_size, work_group_size, 0,
+                                    nullptr, g_Profiler.Mark(kernel_name)));
+    V_RETURN(res_vals_buffer.Map(cmd_queue, CL_MAP_READ, (void **)&res2_vals));
+    V_RETURN(res_vals_buffer.Unmap(cmd_queue));
+  }
+
+  V_RETURN(res_vals_buffer.Map(cmd_queue, CL_MAP_READ, (void **)&res2_vals));
+  state.SetVerified(check_matrix_equiv(res2_vals, res.vals, res.rows, per_warp ? 1.0E-5 : 1.0E-6, 1, res.rows));
+  V_RETURN(res_vals_buffer.Unmap(cmd_queue));
+  state.SetBytesProcessed(GetSpMVBytes(mat, sizeof(double)));
+  state.SetFlopsProcessed(2.0 * mat.row_ptr[mat.rows]);
+
+  csr_mat_destroy(&mat);
+  raw_vector_destroy(&vec);
+  raw_vector_destroy(&res);
+  return hr;
+}
+
+/**
+ * smm_warp_per_row in the storage "precision" of the sweep, from its own build of sparse_matrix.cl. Values and
+ * vector are converted on the host and read through images of the storage format; the result stays REAL_ACCUM.
+ * Kernel time only, bandwidth counts the values, column indices and vector of the matrix. The error relative to
+ * the double CPU product is printed, not checked.
+ */
+CLHRESULT TestCsrMatMulVecStorage(cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                                  BenchState &state) {
+
+  CLHRESULT hr = CL_SUCCESS;
+  CLPrecision precision;
+
+  if (!ParsePrecision(state.GetString("precision"), &precision))
+    return CL_INVALID_VALUE;
+
+  csr_mat mat = CSR_MAT_INIT;
+  raw_vector vec = RAW_VECTOR_INIT;
+  raw_vector res = RAW_VECTOR_INIT;
+
+  GenerateSpMVProblem(state, &mat, &vec, &res);
+
+  uint32_t nnz = mat.row_ptr[mat.rows];
+  cl_uint row_size = mat.rows;
+  std::vector<double> res_data(mat.rows);
+  size_t max_work_item_size[3];
+
+  ycl_program program;
+  ycl_kernel kernel;
+  ycl_buffer mat_row_ptr_buffer, mat_col_idx_buffer, mat_vals_buffer, vec_vals_buffer, res_vals_buffer;
+  ycl_image mat_col_idx_image, mat_vals_image, vec_vals_image, res_vals_image;
+  ycl_event ker_ev;
+  cl_image_format img_format;
+  cl_image_desc img_desc = {};
+  size_t work_group_size[3];
+  size_t work_item_size[2];
+  const cl_float zfpattern[4] = {};
+  const size_t zforigin[3] = {0, 0, 0};
+  const size_t zfregion[3] = {mat.rows, 1, 1};
+  double ker_ms;
+
+  size_t mat_vals_buff_size = nnz * GetStorageSize(precision);
+  size_t vec_vals_buff_size = vec.rows * GetStorageSize(precision);
+  size_t res_vals_buff_size = mat.rows * GetAccumSize(precision);
+  std::vector<uint8_t> mat_storage(mat_vals_buff_size), vec_storage(vec_vals_buff_size);
+  std::vector<uint8_t> res_accum(res_vals_buff_size);
+
+  V_RETURN(
+      clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_item_size), max_work_item_size, nullptr));
+
+  ConvertToStorage(precision, mat.vals, nnz, mat_storage.data());
+  ConvertToStorage(precision, vec.vals, vec.rows, vec_storage.data());
+
+  V_RETURN(CreateProgramFromFile(context, device, GetPrecisionBuildDefines(precision), "sparse_matrix.cl",
+                                 &program));
+  V_RETURN2(kernel <<= clCreateKernel(program, "smm_warp_per_row", &hr), hr);
+
+  V_RETURN2(mat_row_ptr_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                                  (mat.rows + 1) * sizeof(uint32_t), mat.row_ptr, &hr),
+            hr);
+  V_RETURN2(mat_col_idx_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                                  nnz * sizeof(uint16_t), mat.col_idx, &hr),
+            hr);
+  V_RETURN2(mat_vals_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, mat_vals_buff_size,
+                                               mat_storage.data(), &hr),
+            hr);
+  V_RETURN2(vec_vals_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, vec_vals_buff_size,
+                                               vec_storage.data(), &hr),
+            hr);
+  V_RETURN2(res_vals_buffer <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                                               res_vals_buff_size, nullptr, &hr),
+            hr);
+
+  img_desc.image_type = CL_MEM_OBJECT_IMAGE1D_BUFFER;
+  img_format = {CL_R, CL_UNSIGNED_INT16};
+  img_desc.image_width = nnz;
+  img_desc.buffer = mat_col_idx_buffer;
+  V_RETURN2(mat_col_idx_image <<= clCreateImage(context, CL_MEM_READ_ONLY, &img_format, &img_desc, nullptr, &hr),
+            hr);
+  img_format = GetStorageImageFormat(precision);
+  img_desc.buffer = mat_vals_buffer;
+  V_RETURN2(mat_vals_image <<= clCreateImage(context, CL_MEM_READ_ONLY, &img_format, &img_desc, nullptr, &hr), hr);
+  img_desc.image_width = vec.rows;
+  img_desc.buffer = vec_vals_buffer;
+  V_RETURN2(vec_vals_image <<= clCreateImage(context, CL_MEM_READ_ONLY, &img_format, &img_desc, nullptr, &hr), hr);
+  // results are REAL_ACCUM: the double layout for FP64, float otherwise
+  img_format = GetStorageImageFormat(precision == CLPrecision::FP64 ? CLPrecision::FP64 : CLPrecision::FP32);
+  img_desc.image_width = mat.rows;
+  img_desc.buffer = res_vals_buffer;
+  V_RETURN2(res_vals_image <<= clCreateImage(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, &img_format,
+                                             &img_desc, nullptr, &hr),
+            hr);
+
   V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(work_group_size),
                                     work_group_size, nullptr));
-
   work_item_size[0] = std::min(max_work_item_size[0], (size_t)mat.rows);
   work_item_size[1] = work_group_size[1];
 
   V_RETURN(SetKernelArguments(kernel, &row_size, &mat_row_ptr_buffer, &mat_col_idx_image, &mat_vals_image,
                               &vec_vals_image, &res_vals_image));
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillImage(cmd_queue, res_vals_image, &zfpattern, zforigin, zfregion, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 2, nullptr, work_item_size, work_group_size, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueReadImage(cmd_queue, res_vals_image, false, zforigin, zfregion, 0, 0, res2.vals, 0, nullptr,
-                              done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("GPU (One Row per warp) elapsed: %.3fms\n", elapsed.count());
-  printf("Results coincidence: %s\n",
-         check_matrix_equiv(res2.vals, res.vals, res.rows, 1.0E-5, 1, res.rows) ? "true" : "false");
+
+  while (state.KeepRunning()) {
+    V_RETURN(clEnqueueFillImage(cmd_queue, res_vals_image, zfpattern, zforigin, zfregion, 0, nullptr, nullptr));
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 2, nullptr, work_item_size, work_group_size, 0, nullptr,
+                                    ker_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clWaitForEvents(1, &ker_ev));
+    V_RETURN(GetEventElapsedTime(ker_ev, &ker_ms));
+    state.SetIterationTime(ker_ms);
+  }
+
+  V_RETURN(clEnqueueReadBuffer(cmd_queue, res_vals_buffer, CL_TRUE, 0, res_vals_buff_size, res_accum.data(), 0,
+                               nullptr, nullptr));
+  ConvertFromAccum(precision, res_accum.data(), mat.rows, res_data.data());
+  CLPrecisionError error = ComputePrecisionError(res.vals, res_data.data(), mat.rows);
+
+  printf("    smm_warp_per_row %s: relative error max %.3e rms %.3e\n", GetPrecisionName(precision), error.max_rel,
+         error.rms_rel);
+  state.SetBytesProcessed((double)(mat_vals_buff_size + nnz * sizeof(uint16_t) + vec_vals_buff_size));
+  state.SetFlopsProcessed(2.0 * nnz);
 
   csr_mat_destroy(&mat);
   raw_vector_destroy(&vec);
   raw_vector_destroy(&res);
-  raw_vector_destroy(&res2);
   return hr;
 }
 
-int main() {
+/**
+ * The two SpMV kernels, double precision. Both read the matrix through image1d_buffers, so the non zeros and the
+ * rows have to fit CL_DEVICE_IMAGE_MAX_BUFFER_SIZE; a warp per row leaves most lanes idle below a few non zeros
+ * per row.
+ */
+static void RegisterSpMVVariants(CLKernelVariantRegistry &registry) {
+
+  CLVariantPrecondition fits_image = {
+      "non zeros and rows <= CL_DEVICE_IMAGE_MAX_BUFFER_SIZE", [](cl_device_id device, const CLVariantInput &input) {
+        size_t max_texels = 0;
+        clGetDeviceInfo(device, CL_DEVICE_IMAGE_MAX_BUFFER_SIZE, sizeof(max_texels), &max_texels, nullptr);
+        return input.aux <= max_texels && input.size <= max_texels;
+      }};
+
+  registry.Register("spmv", {"smm_native", "sparse_matrix.cl", "#define _USE_DOUBLE_FP\n", {fits_image}});
+  registry.Register("spmv", {"smm_warp_per_row", "sparse_matrix.cl", "#define _USE_DOUBLE_FP\n",
+                             {fits_image, RequireMinAuxPerSize(4.0, "non zeros per row")}});
+}
+
+/**
+ * A/B mode on a live matrix: every iteration runs each eligible SpMV kernel once, the registry records the fastest
+ * for the (rows, non zeros) shape. A kernel whose result does not match the serial CPU product fails the run.
+ */
+CLHRESULT TestCsrMatMulVecAB(cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                             CLKernelVariantRegistry &registry, BenchState &state) {
 
   CLHRESULT hr;
-  ycl_platform_id platform;
-  ycl_device_id device;
-  ycl_context context;
-  ycl_command_queue cmd_queue;
+  csr_mat mat = CSR_MAT_INIT;
+  raw_vector vec = RAW_VECTOR_INIT;
+  raw_vector res = RAW_VECTOR_INIT;
+
+  GenerateSpMVProblem(state, &mat, &vec, &res);
+
+  uint32_t nnz = mat.row_ptr[mat.rows];
+  cl_uint row_size = mat.rows;
+  std::vector<double> res_data(mat.rows);
+  ycl_buffer mat_row_ptr_buffer, mat_col_idx_buffer, mat_vals_buffer, vec_vals_buffer, res_vals_buffer;
+  ycl_image mat_col_idx_image, mat_vals_image, vec_vals_image, res_vals_image;
+  cl_image_format img_format = {CL_R, CL_UNSIGNED_INT16};
+  cl_image_desc img_desc = {};
+  size_t max_work_item_size[3];
+
+  V_RETURN2(mat_row_ptr_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                                  (mat.rows + 1) * sizeof(uint32_t), mat.row_ptr, &hr),
+            hr);
+  V_RETURN2(mat_col_idx_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                                  nnz * sizeof(uint16_t), mat.col_idx, &hr),
+            hr);
+  V_RETURN2(mat_vals_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                               nnz * sizeof(double), mat.vals, &hr),
+            hr);
+  V_RETURN2(vec_vals_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                               vec.rows * sizeof(double), vec.vals, &hr),
+            hr);
+  V_RETURN2(res_vals_buffer <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                                               mat.rows * sizeof(double), nullptr, &hr),
+            hr);
 
-  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {"NVIDIA CUDA", "AMD"}, {}, &platform, &device));
-  V_RETURN(CreateDeviceContext(platform, device, &context));
-  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
+  img_desc.image_type = CL_MEM_OBJECT_IMAGE1D_BUFFER;
+  img_desc.image_width = nnz;
+  img_desc.buffer = mat_col_idx_buffer;
+  V_RETURN2(mat_col_idx_image <<= clCreateImage(context, CL_MEM_READ_ONLY, &img_format, &img_desc, nullptr, &hr),
+            hr);
+  img_format = {CL_RG, CL_FLOAT};
+  img_desc.buffer = mat_vals_buffer;
+  V_RETURN2(mat_vals_image <<= clCreateImage(context, CL_MEM_READ_ONLY, &img_format, &img_desc, nullptr, &hr), hr);
+  img_desc.image_width = vec.rows;
+  img_desc.buffer = vec_vals_buffer;
+  V_RETURN2(vec_vals_image <<= clCreateImage(context, CL_MEM_READ_ONLY, &img_format, &img_desc, nullptr, &hr), hr);
+  img_desc.image_width = mat.rows;
+  img_desc.buffer = res_vals_buffer;
+  V_RETURN2(res_vals_image <<= clCreateImage(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, &img_format,
+                                             &img_desc, nullptr, &hr),
+            hr);
+  V_RETURN(
+      clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_item_size), max_work_item_size, nullptr));
 
-  V_RETURN(CreateProgramFromFile(context, device, "#define _USE_DOUBLE_FP", "sparse_matrix.cl", &g_pSparseMatrixProgram));
+  auto run = [&](const CLKernelVariant &variant, cl_kernel kernel, double *ms) -> CLHRESULT {
+    CLHRESULT hr;
+    size_t work_group_size[3], work_item_size[2];
+    const cl_float zfpattern[4] = {};
+    const size_t zforigin[3] = {0, 0, 0};
+    const size_t zfregion[3] = {mat.rows, 1, 1};
+    ycl_event ker_ev;
+
+    V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(work_group_size),
+                                      work_group_size, nullptr));
+    // one row per work item, or one row per warp of a 2D group: the launch shapes of TestCsrMatMulVec
+    work_item_size[0] = std::min(max_work_item_size[0], (size_t)mat.rows);
+    if (work_group_size[1] == 1)
+      work_item_size[0] = RoundC(work_item_size[0], work_group_size[0]);
+    work_item_size[1] = work_group_size[1];
+
+    V_RETURN(SetKernelArguments(kernel, &row_size, &mat_row_ptr_buffer, &mat_col_idx_image, &mat_vals_image,
+                                &vec_vals_image, &res_vals_image));
+    V_RETURN(clEnqueueFillImage(cmd_queue, res_vals_image, zfpattern, zforigin, zfregion, 0, nullptr, nullptr));
+    V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, work_group_size[1] == 1 ? 1 : 2, nullptr, work_item_size,
+                                    work_group_size, 0, nullptr, ker_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, res_vals_buffer, CL_TRUE, 0, mat.rows * sizeof(double),
+                                 res_data.data(), 0, nullptr, nullptr));
+    V_RETURN(GetEventElapsedTime(ker_ev, ms));
+    if (!check_matrix_equiv(res_data.data(), res.vals, res.rows, 1.0E-5, 1, res.rows)) {
+      printf("%s: results do not coincide, not recorded\n", variant.name.c_str());
+      return CL_INVALID_VALUE;
+    }
+    return hr;
+  };
+
+  CLVariantInput input = {mat.rows, nnz, 0};
+  CLKernelVariant winner;
+  std::vector<std::string> rejected;
 
-  std::uniform_int_distribution<uint16_t> mat_nrows_distr(16, 10000), mat_ncols_distr(16, 10000);
-  TestCsrMatMulVec(context, device, cmd_queue, mat_nrows_distr(g_RandomEngine), mat_ncols_distr(g_RandomEngine));
-}
\ No newline at end of file
+  registry.GetEligible("spmv", input, &rejected);
+  for (auto &reason : rejected)
+    printf("    %s\n", reason.c_str());
+
+  hr = CL_SUCCESS;
+  while (state.KeepRunning() && CL_SUCCEEDED(hr))
+    hr = registry.RunAB("spmv", input, run, &winner);
+
+  if (CL_SUCCEEDED(hr)) {
+    for (auto &stats : registry.GetStats("spmv", input))
+      printf("    %-18s %4u runs, %.4fms%s\n", stats.first.c_str(), stats.second.runs, stats.second.mean_ms,
+             stats.first == winner.name ? "  <- winner" : "");
+    state.SetVerified(true);
+  }
+
+  csr_mat_destroy(&mat);
+  raw_vector_destroy(&vec);
+  raw_vector_destroy(&res);
+  return hr;
+}
+
+/**
+ * Throughput of many small SpMV jobs through smm_native: "jobs" matrices of ["rows" x "cols"], each result read
+ * back without blocking and checked against csr_mat_mul_vec. With @param blocking the host waits for every job in
+ * clWaitForEvents and checks it before the next one; otherwise all jobs are in flight and the checks run on the
+ * workers of @param completions while the device works on the later jobs. An iteration is every job, enqueued
+ * and checked.
+ */
+CLHRESULT TestCsrMatMulVecJobs(cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                               CLCompletionQueue &completions, bool blocking, BenchState &state) {
+
+  CLHRESULT hr;
+  const size_t jobs = (size_t)state.GetInt("jobs");
+  const uint16_t nrows = (uint16_t)state.GetInt("rows"), ncols = (uint16_t)state.GetInt("cols");
+
+  struct SpMVJob {
+    csr_mat mat;
+    raw_vector vec;
+    std::vector<double> res;
+    ycl_buffer buffers[5];  // row_ptr, col_idx, vals, vector, result
+    ycl_image images[4];    // col_idx, vals, vector, result
+  };
+  std::vector<SpMVJob> spmv_jobs(jobs);
+  ycl_kernel kernel;
+  size_t work_group_size[3], work_item_size;
+  cl_image_format img_formats[4] = {{CL_R, CL_UNSIGNED_INT16}, {CL_RG, CL_FLOAT}, {CL_RG, CL_FLOAT}, {CL_RG, CL_FLOAT}};
+  double nnz_total = 0.0;
+
+  V_RETURN2(kernel <<= clCreateKernel(g_pSparseMatrixProgram, "smm_native", &hr), hr);
+  V_RETURN(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(work_group_size),
+                                    work_group_size, nullptr));
+  work_item_size = RoundC(nrows, work_group_size[0]);
+
+  for (auto &job : spmv_jobs) {
+    job.mat = CSR_MAT_INIT;
+    job.vec = RAW_VECTOR_INIT;
+    generate_random_csr_matrix(nrows, ncols, -10.0, 10.0, &job.mat, &GetThreadArena());
+    generate_random_vector(ncols, -10.0, 10.0, &job.vec);
+    job.res.resize(nrows);
+
+    uint32_t nnz = job.mat.row_ptr[nrows];
+    const void *host_data[4] = {job.mat.row_ptr, job.mat.col_idx, job.mat.vals, job.vec.vals};
+    size_t sizes[5] = {(nrows + 1) * sizeof(uint32_t), nnz * sizeof(uint16_t), nnz * sizeof(double),
+                       ncols * sizeof(double), nrows * sizeof(double)};
+    size_t widths[4] = {nnz, nnz, ncols, nrows};
+    cl_image_desc img_desc = {};
+
+    nnz_total += nnz;
+    for (int i = 0; i < 4; ++i)
+      V_RETURN2(job.buffers[i] <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizes[i],
+                                                  (void *)host_data[i], &hr),
+                hr);
+    V_RETURN2(job.buffers[4] <<= clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizes[4],
+                                                nullptr, &hr),
+              hr);
+
+    img_desc.image_type = CL_MEM_OBJECT_IMAGE1D_BUFFER;
+    for (int i = 0; i < 4; ++i) {
+      img_desc.image_width = widths[i];
+      img_desc.buffer = job.buffers[i + 1];
+      V_RETURN2(job.images[i] <<= clCreateImage(context, i < 3 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY,
+                                                &img_formats[i], &img_desc, nullptr, &hr),
+                hr);
+    }
+  }
+
+  std::atomic<size_t> mismatches(0);
+  auto check_job = [&](SpMVJob &job) {
+    raw_vector ref = RAW_VECTOR_INIT;
+    csr_mat_mul_vec(&job.mat, &job.vec, &ref);
+    if (!check_matrix_equiv(job.res.data(), ref.vals, ref.rows, 1.0E-6, 1, ref.rows))
+      mismatches.fetch_add(1, std::memory_order_relaxed);
+    raw_vector_destroy(&ref);
+  };
+  CLCompletionDrainGuard drain_guard(cmd_queue, completions);
+
+  cl_uint row_size = nrows;
+  ycl_event rd_ev;
+
+  while (state.KeepRunning()) {
+    for (auto &job : spmv_jobs) {
+      V_RETURN(SetKernelArguments(kernel, &row_size, &job.buffers[0], &job.images[0], &job.images[1],
+                                  &job.images[2], &job.images[3]));
+      V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, &work_item_size, work_group_size, 0, nullptr,
+                                      nullptr));
+      V_RETURN(clEnqueueReadBuffer(cmd_queue, job.buffers[4], CL_FALSE, 0, nrows * sizeof(double), job.res.data(),
+                                   0, nullptr, rd_ev.ReleaseAndGetAddressOf()));
+      if (blocking) {
+        V_RETURN(clFlush(cmd_queue));
+        V_RETURN(clWaitForEvents(1, &rd_ev));
+        check_job(job);
+      } else {
+        SpMVJob *p = &job;
+        V_RETURN(completions.Post(rd_ev, [&check_job, p](cl_event, cl_int status) {
+          if (status == CL_COMPLETE)
+            check_job(*p);
+        }));
+      }
+    }
+    V_RETURN(clFlush(cmd_queue));
+    completions.Drain();
+  }
+
+  state.SetVerified(mismatches.load() == 0);
+  state.SetFlopsProcessed(2.0 * nnz_total);
+
+  for (auto &job : spmv_jobs) {
+    csr_mat_destroy(&job.mat);
+    raw_vector_destroy(&job.vec);
+  }
+  return hr;
+}
+
+int main(int argc, char **argv) {
+
+  CLHRESULT hr;
+  CLComputeBackend backend;
+
+  V_RETURN(backend.Init({"NVIDIA CUDA", "AMD"}));
+
+  cl_context context = backend.Context();
+  cl_device_id device = backend.Device();
+  cl_command_queue cmd_queue = backend.Queue();
+
+  BenchmarkSuite suite("sparse_matrix");
+  suite.ParseArgs(argc, argv);
+
+  // Rows hold cols / 2 non zeros on average.
+  auto spmv_sweep = MakeParamSweep({{"rows", {1000, 8000}}, {"cols", {500, 4000}}});
+
+  suite.Register("spmv_native_serial", spmv_sweep, [&](BenchState &state) {
+    return TestCsrMatMulVecNative(SpMVNativeVariant::SERIAL, backend, state);
+  });
+  suite.Register("spmv_native_mt", spmv_sweep, [&](BenchState &state) {
+    return TestCsrMatMulVecNative(SpMVNativeVariant::MT, backend, state);
+  });
+
+  // Result checks of the job benchmarks, one worker per hardware thread.
+  CLCompletionQueue completions;
+  CLKernelVariantRegistry registry(context, device);
+
+  if (backend.HasDevice()) {
+    V_RETURN(CreateProgramFromFile(context, device, "#define _USE_DOUBLE_FP", "sparse_matrix.cl",
+                                   &g_pSparseMatrixProgram));
+
+    auto host_mem_sweep = MakeParamSweep({{"rows", {1000, 8000}},
+                                          {"cols", {500, 4000}},
+                                          {"host_mem", {"copy", "alloc_host_ptr", "use_host_ptr"}}});
+
+    for (const char *kernel_name : {"smm_native", "smm_warp_per_row"}) {
+      suite.Register(kernel_name, host_mem_sweep, [&, kernel_name](BenchState &state) {
+        return TestCsrMatMulVec(kernel_name, context, device, cmd_queue, state);
+      });
+    }
+
+    std::vector<BenchValue> precisions;
+    for (CLPrecision precision : {CLPrecision::FP64, CLPrecision::FP32, CLPrecision::FP16, CLPrecision::BF16}) {
+      if (IsPrecisionSupported(device, precision))
+        precisions.push_back(GetPrecisionName(precision));
+    }
+    suite.Register("smm_warp_per_row_storage",
+                   MakeParamSweep({{"precision", precisions}, {"rows", {1000, 8000}}, {"cols", {4000}}}),
+                   [&](BenchState &state) { return TestCsrMatMulVecStorage(context, device, cmd_queue, state); });
+
+    // Small jobs in flight: one clWaitForEvents per job against completion callbacks on a worker pool.
+    auto jobs_sweep = MakeParamSweep({{"jobs", {64, 512}}, {"rows", {256}}, {"cols", {256}}});
+    suite.Register("spmv_jobs_blocking", jobs_sweep, [&](BenchState &state) {
+      return TestCsrMatMulVecJobs(context, device, cmd_queue, completions, true, state);
+    });
+    suite.Register("spmv_jobs_completion", jobs_sweep, [&](BenchState &state) {
+      return TestCsrMatMulVecJobs(context, device, cmd_queue, completions, false, state);
+    });
+
+    // A/B over a few more shapes, sparse_matrix.cl is rebuilt if it changes in the meantime.
+    RegisterSpMVVariants(registry);
+    registry.Load(GetVariantDBPath().c_str());
+    registry.StartWatching(500);
+
+    suite.Register("spmv_ab", MakeParamSweep({{"rows", {64, 1000, 8000}}, {"cols", {16, 4000}}}),
+                   [&](BenchState &state) { return TestCsrMatMulVecAB(context, device, cmd_queue, registry, state); });
+  }
+
+  hr = suite.Run();
+
+  if (backend.HasDevice()) {
+    registry.StopWatching();
+    registry.Save(GetVariantDBPath().c_str());
+
+    CLHRESULT report_hr = g_Profiler.WriteReports("sparse_matrix_profile");
+    g_Profiler.PrintSummary();
+    if (CL_SUCCEEDED(hr))
+      hr = report_hr;
+  }
+
+  return hr;
+}
@@ -1,10 +1,18 @@
 
+#ifndef LOCAL_SIZE_X
 #define LOCAL_SIZE_X    64
+#endif
 
+#ifndef WARP_LOCAL_SIZE_X
 #define WARP_LOCAL_SIZE_X   32
+#endif
+#ifndef WARP_LOCAL_SIZE_Y
 #define WARP_LOCAL_SIZE_Y   8
+#endif
 
+#ifndef BLOCKED_LOCAL_SIZE_X
 #define BLOCKED_LOCAL_SIZE_X  64
+#endif
 
 #ifndef BLOCKED_TILE_SIZE 
 #define BLOCKED_TILE_SIZE     128
@@ -25,17 +33,11 @@ __kernel void smm_native(
   uint gsize = get_global_size(0);
 
   for(uint i = gid; i < row_size; i += gsize) {
-    REAL temp = 0.0;
+    REAL_ACCUM temp = 0.0;
     uint2 cpos = (uint2)(row_ptr[i], row_ptr[i+1]);
     for(; cpos.x != cpos.y; ++cpos.x) {
       int vidx = read_imagei(col_idx, (int)cpos.x).x;
-      #ifdef _USE_DOUBLE_FP
-      temp += as_double(read_imagef(mat_vals, (int)cpos.x).xy) *
-          as_double(read_imagef(vec_vals, vidx).xy);
-      #else
-      temp += read_imagef(mat_vals, (int)cpos.x).x *
-          read_imagef(vec_vals, vidx).x;
-      #endif
+      temp += LOAD_REAL_IMAGE(mat_vals, (int)cpos.x) * LOAD_REAL_IMAGE(vec_vals, vidx);
     }
     #ifdef _USE_DOUBLE_FP
     write_imagef(res_vals, (int)i, (float4)(as_float2(temp), 0.0, 0.0));
@@ -54,7 +56,7 @@ __kernel void smm_warp_per_row(
   read_only image1d_buffer_t vec_vals,
   write_only image1d_buffer_t res_vals
 ) {
-  __local REAL tile[WARP_LOCAL_SIZE_Y][WARP_LOCAL_SIZE_X];
+  __local REAL_ACCUM tile[WARP_LOCAL_SIZE_Y][WARP_LOCAL_SIZE_X];
 
   const uint2 tid = (uint2)(get_local_id(0), get_local_id(1));
   const uint2 bcount = (uint2)(get_num_groups(0), get_num_groups(1));
@@ -70,16 +72,10 @@ __kernel void smm_warp_per_row(
 
     uint ii = i < row_size ? i : row_bound;
     uint2 cpos = (uint2)(row_ptr[ii] + tid.x, row_ptr[ii+1]);
-    REAL temp = 0.0;
+    REAL_ACCUM temp = 0.0;
     for(; cpos.x < cpos.y; cpos.x += WARP_LOCAL_SIZE_X) {
       int vidx = read_imagei(col_idx, (int)cpos.x).x;
-      #ifdef _USE_DOUBLE_FP
-      temp += as_double(read_imagef(mat_vals, (int)cpos.x).xy) *
-          as_double(read_imagef(vec_vals, vidx).xy);
-      #else
-      temp += read_imagef(mat_vals, (int)cpos.x).x *
-          read_imagef(vec_vals, vidx).x;
-      #endif
+      temp += LOAD_REAL_IMAGE(mat_vals, (int)cpos.x) * LOAD_REAL_IMAGE(vec_vals, vidx);
     }
     // For warp size >= 32, NO synchronizing point is needed.
     tile[tid.y][tid.x] = temp;
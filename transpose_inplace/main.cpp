@@ -1,7 +1,12 @@
 #include <cl_utils.h>
 #include <common_miscs.h>
+#include <benchmark.h>
 #include <vector>
-#include<intrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
 #include "native_transpose.h"
 #include "openmp_transpose.h"
 #include <omp.h>
@@ -234,74 +239,131 @@ void mat_tr_inplace_native(bool row_major, T *mat, size_t m, size_t n) {
 }
  
 
-CLHRESULT TestMatrixTransposeInplaceProfile(
-    cl_context context, cl_device_id device, cl_command_queue cmd_queue, double *mat_buffer, size_t ncols, size_t nrows) {
+/** Out-of-place reference, independent of every in-place variant under test. */
+template <typename T>
+static void mat_tr_reference(const T *mat, T *mat_tr, size_t rows, size_t cols) {
+  for (size_t r = 0; r < rows; ++r)
+    for (size_t c = 0; c < cols; ++c)
+      mat_tr[c * rows + r] = mat[r * cols + c];
+}
+
+enum class TransposeVariant { SERIAL, C2R_NATIVE, C2R_OPENMP };
+
+/**
+ * The matrix buffer on the page backing the benchmark asks for: the source matrix, its transpose and the working
+ * copy, each sized for MAX_MAT_ROW_COL_SIZE^2 elements, followed by the C2R scratch rows. Reallocated and first
+ * touched from the OpenMP threads only when the backing changes, so keep the page axis outermost in a sweep.
+ */
+class MatBuffer {
+public:
+  MatBuffer()
+      : size_((MAX_MAT_ROW_COL_SIZE * MAX_MAT_ROW_COL_SIZE * 3 + MAX_MAT_ROW_COL_SIZE * omp_get_max_threads()) *
+              sizeof(double)),
+        kind_(inplace::test::page_kind::base), buffer_(nullptr) {}
+  ~MatBuffer() { inplace::test::large_page_dealloc(buffer_, size_); }
+
+  CLHRESULT Acquire(inplace::test::page_kind kind, double **buffer) {
+    CLHRESULT hr = CL_SUCCESS;
+    inplace::test::page_kind obtained;
+
+    if (!buffer_ || kind != kind_) {
+      inplace::test::large_page_dealloc(buffer_, size_);
+      buffer_ = (double *)inplace::test::large_page_alloc(size_, kind, &obtained);
+      if (!buffer_)
+        V_RETURN2("Large page allocation failed, system error code: ", hr = inplace::test::get_last_error());
+      kind_ = kind;
+
+      inplace::test::first_touch(buffer_, size_);
+      printf("Matrix buffer %zuMB: requested %s pages, obtained %s pages, %zuMB backed by huge pages\n", size_ >> 20,
+             inplace::test::page_kind_name(kind), inplace::test::page_kind_name(obtained),
+             inplace::test::resident_huge_bytes(buffer_) >> 20);
+    }
+
+    *buffer = buffer_;
+    return hr;
+  }
 
-  double *test_mat, *test_mat2, *tmp_buffer;
+private:
+  size_t size_;
+  inplace::test::page_kind kind_;
+  double *buffer_;
+};
+
+/**
+ * "pages" selects the backing of the matrix buffer when present, huge_tlb (with its fallbacks) otherwise.
+ */
+CLHRESULT TestMatrixTransposeInplace(TransposeVariant variant, MatBuffer &buffer, BenchState &state) {
+
+  CLHRESULT hr;
+  double *mat_buffer, *test_mat, *test_mat_tr, *work_mat, *tmp_buffer;
+  size_t nrows = (size_t)state.GetInt("rows");
+  size_t ncols = (size_t)state.GetInt("cols");
   size_t mat_buffer_cb = nrows * ncols * sizeof(double);
+  inplace::test::page_kind pages = inplace::test::page_kind::huge_tlb;
+  bool coincident = true;
 
-  test_mat  =  mat_buffer;
-  test_mat2  = mat_buffer + (MAX_MAT_ROW_COL_SIZE * MAX_MAT_ROW_COL_SIZE);
-  tmp_buffer = test_mat2 + (MAX_MAT_ROW_COL_SIZE * MAX_MAT_ROW_COL_SIZE);
+  if (state.HasParam("pages") && !inplace::test::parse_page_kind(state.GetString("pages"), &pages))
+    return CL_INVALID_VALUE;
+  V_RETURN(buffer.Acquire(pages, &mat_buffer));
 
-  gen_random_matrix<double>(ncols, nrows, mat_buffer);
-  printf("Input matrix dimensions: (rows: %lld, cols: %lld)\n", nrows, ncols);
+  test_mat    = mat_buffer;
+  test_mat_tr = test_mat + (MAX_MAT_ROW_COL_SIZE * MAX_MAT_ROW_COL_SIZE);
+  work_mat    = test_mat_tr + (MAX_MAT_ROW_COL_SIZE * MAX_MAT_ROW_COL_SIZE);
+  tmp_buffer  = work_mat + (MAX_MAT_ROW_COL_SIZE * MAX_MAT_ROW_COL_SIZE);
+
+  gen_random_matrix<double>(ncols, nrows, test_mat);
+  mat_tr_reference(test_mat, test_mat_tr, nrows, ncols);
 
   hp_timer::time_point start, fin;
-  fmilliseconds elapsed;
-
-  memcpy(test_mat2, test_mat, mat_buffer_cb);
-  start = hp_timer::now();
-  mat_tr_inplace_native(true, test_mat2, nrows, ncols);
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("Transpose matrix(CPU seiralizing) elapsed:                         %.3fms\n", elapsed.count());
-
-  start = hp_timer::now();
-  tr_inplace::native::transpose(false, test_mat2, nrows, ncols, tmp_buffer);
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("C2R native implementation elapsed:                                 %.3fms\n", elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(test_mat2, test_mat, 1.0E-6, ncols, nrows) ? "true" : "false");
-
-  mat_tr_inplace_native(true, test_mat2, nrows, ncols);
-
-  start = hp_timer::now();
-  tr_inplace::openmp::transpose(false, test_mat2, nrows, ncols, tmp_buffer);
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("C2R OpenMP implementation elapsed:                                 %.3fms\n", elapsed.count());
-  printf("results coincidence: %s\n", check_matrix_equiv(test_mat2, test_mat, 1.0E-6, ncols, nrows) ? "true" : "false");
-
-  return 0;
-}
 
-int main() {
+  while (state.KeepRunning()) {
+
+    // Only the transpose itself is timed, the copy restores the input.
+    if (variant == TransposeVariant::SERIAL) {
+      memcpy(work_mat, test_mat, mat_buffer_cb);
+      start = hp_timer::now();
+      mat_tr_inplace_native(true, work_mat, nrows, ncols);
+      fin = hp_timer::now();
+      coincident = coincident && check_matrix_equiv(work_mat, test_mat_tr, 1.0E-6, nrows, ncols);
+    } else {
+      memcpy(work_mat, test_mat_tr, mat_buffer_cb);
+      start = hp_timer::now();
+      if (variant == TransposeVariant::C2R_NATIVE)
+        tr_inplace::native::transpose(false, work_mat, (int)nrows, (int)ncols, tmp_buffer);
+      else
+        tr_inplace::openmp::transpose(false, work_mat, (int)nrows, (int)ncols, tmp_buffer);
+      fin = hp_timer::now();
+      coincident = coincident && check_matrix_equiv(work_mat, test_mat, 1.0E-6, ncols, nrows);
+    }
 
-  CLHRESULT hr;
-  ycl_platform_id platform;
-  ycl_device_id device;
-  ycl_context context;
-  ycl_command_queue cmd_queue;
-
-  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {"NVIDIA CUDA", "AMD"}, {}, &platform, &device));
-  V_RETURN(CreateDeviceContext(platform, device, &context));
-  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
-
-  std::uniform_int_distribution<size_t> transpose_ncols_nrows_distr(
-      16, MAX_MAT_ROW_COL_SIZE);
-
-  double *mat_buffer = (double *)inplace::test::large_page_alloc(
-      (MAX_MAT_ROW_COL_SIZE * MAX_MAT_ROW_COL_SIZE * 2 + MAX_MAT_ROW_COL_SIZE * omp_get_max_threads())*sizeof(double));
-  if(!mat_buffer)
-    V_RETURN2("Large page allocation failed, system error code(win32...): ", hr = inplace::test::get_last_error());
-
-  for (ptrdiff_t i = 0; i < 100; ++i) {
-    printf("Matrix Transpose In-place Profile [%lld]:\n", i);
-    TestMatrixTransposeInplaceProfile(context, device, cmd_queue, mat_buffer, transpose_ncols_nrows_distr(g_RandomEngine),
-                                      transpose_ncols_nrows_distr(g_RandomEngine));
-    printf("\n");
+    state.SetIterationTime(fmilliseconds_cast(fin - start).count());
   }
 
-  inplace::test::large_page_dealloc(mat_buffer);
+  state.SetVerified(coincident);
+  state.SetBytesProcessed(2.0 * mat_buffer_cb);
+
+  return CL_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+
+  MatBuffer mat_buffer;
+
+  BenchmarkSuite suite("transpose_inplace");
+  suite.ParseArgs(argc, argv);
+
+  // The serial cycle following is quadratic in the worst case, keep it on the small shapes.
+  suite.Register("serial", MakeParamSweep({{"rows", {500, 1000}}, {"cols", {333, 1021}}}),
+                 [&](BenchState &state) { return TestMatrixTransposeInplace(TransposeVariant::SERIAL, mat_buffer, state); });
+
+  // 4K against THP against hugetlbfs pages, the page axis outermost so the buffer is set up once per backing.
+  auto sweep = MakeParamSweep({{"pages", {"4k", "thp", "hugetlb"}},
+                               {"rows", {500, 1000, 4000, MAX_MAT_ROW_COL_SIZE}},
+                               {"cols", {333, 1021, 7919}}});
+  suite.Register("c2r_native", sweep,
+                 [&](BenchState &state) { return TestMatrixTransposeInplace(TransposeVariant::C2R_NATIVE, mat_buffer, state); });
+  suite.Register("c2r_openmp", sweep,
+                 [&](BenchState &state) { return TestMatrixTransposeInplace(TransposeVariant::C2R_OPENMP, mat_buffer, state); });
+
+  return suite.Run();
 }
@@ -1,81 +1,120 @@
 #include "page_allocator.h"
+#include <cl_host_arena.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <initializer_list>
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
-
-#if defined(_WIN32)
+#else
+#include <errno.h>
+#endif
 
 namespace inplace {
 namespace test {
 
-BOOL _AdjustProcessAccessToken(LPWSTR pszPrivilege, BOOL bEnable) {
-
-  HANDLE hToken;
-  TOKEN_PRIVILEGES tp;
-  BOOL status;
-  DWORD error;
-
-  // open process token
-  if (!OpenProcessToken(GetCurrentProcess(),
-                        TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
-    return FALSE;
-
-  // get the luid
-  if (!LookupPrivilegeValueW(NULL, pszPrivilege, &tp.Privileges[0].Luid))
-    return FALSE;
-
-  tp.PrivilegeCount = 1;
-
-  // enable or disable privilege
-  if (bEnable)
-    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
-  else
-    tp.Privileges[0].Attributes = 0;
-
-  // enable or disable privilege
-  status =
-      AdjustTokenPrivileges(hToken, FALSE, &tp, 0, (PTOKEN_PRIVILEGES)NULL, 0);
-
-  // It is possible for AdjustTokenPrivileges to return TRUE and still not
-  // succeed.
-  // So always check for the last error value.
-  error = GetLastError();
-  if (!status || (error != ERROR_SUCCESS))
-    return FALSE;
-
-  // close the handle
-  if (!CloseHandle(hToken))
-    return FALSE;
-  return TRUE;
+const char *page_kind_name(page_kind kind) {
+  switch (kind) {
+  case page_kind::base:
+    return "4k";
+  case page_kind::transparent_huge:
+    return "thp";
+  case page_kind::huge_tlb:
+    return "hugetlb";
+  }
+  return "unknown";
 }
 
-void *large_page_alloc(size_t req_size) {
+bool parse_page_kind(const char *name, page_kind *kind) {
+  for (page_kind k : {page_kind::base, page_kind::transparent_huge, page_kind::huge_tlb}) {
+    if (strcmp(name, page_kind_name(k)) == 0) {
+      *kind = k;
+      return true;
+    }
+  }
+  return false;
+}
+
+void first_touch(void *p, size_t size) {
+  char *bytes = (char *)p;
+  ptrdiff_t npages = (ptrdiff_t)((size + 4095) / 4096);
 
-  SIZE_T dwLargePageMini = GetLargePageMinimum();
-  DWORD dwPageSize = req_size;
-  DWORD dwAllocFlags = MEM_COMMIT|MEM_RESERVE;
-  SYSTEM_INFO SysInfo;
+  // Touching every 4KB also covers huge pages, only the first write to each faults.
+#pragma omp parallel for schedule(static)
+  for (ptrdiff_t i = 0; i < npages; ++i)
+    bytes[i * 4096] = 0;
+}
 
-  if (req_size >= dwLargePageMini && _AdjustProcessAccessToken(L"SeLockMemoryPrivilege", TRUE)) {
-    dwAllocFlags |= MEM_LARGE_PAGES;
-    dwPageSize = ((dwPageSize + dwLargePageMini - 1) / dwLargePageMini) *
-                 dwLargePageMini;
-  } else {
-    GetSystemInfo(&SysInfo);
-    dwPageSize = (dwPageSize + SysInfo.dwPageSize - 1) & ~(SysInfo.dwPageSize - 1);
+static CLPageKind _to_cl_page_kind(page_kind kind) {
+  switch (kind) {
+  case page_kind::base:
+    return CLPageKind::BASE;
+  case page_kind::transparent_huge:
+    return CLPageKind::TRANSPARENT_HUGE;
+  default:
+    return CLPageKind::HUGE_TLB;
   }
+}
 
-  return VirtualAlloc(NULL, dwPageSize, dwAllocFlags, PAGE_READWRITE);
+void *large_page_alloc(size_t req_size, page_kind kind, page_kind *obtained) {
+  CLPageKind got = CLPageKind::BASE;
+  void *p = AllocLargePages(req_size, nullptr, _to_cl_page_kind(kind), &got);
+
+  if (obtained)
+    *obtained = got == CLPageKind::HUGE_TLB           ? page_kind::huge_tlb
+                : got == CLPageKind::TRANSPARENT_HUGE ? page_kind::transparent_huge
+                                                      : page_kind::base;
+  return p;
 }
 
-void large_page_dealloc(void *p) {
-  if(p) VirtualFree(p, 0, MEM_RELEASE);
+void large_page_dealloc(void *p, size_t req_size) { FreeLargePages(p, req_size); }
+
+#if defined(_WIN32)
+
+size_t resident_huge_bytes(const void *) {
+  return 0;
 }
 
 int get_last_error() {
   return (int)GetLastError();
 }
 
+#else
+
+size_t resident_huge_bytes(const void *p) {
+
+  FILE *fp = fopen("/proc/self/smaps", "r");
+  char line[256];
+  unsigned long long start, end, kb;
+  size_t bytes = 0;
+  bool in_mapping = false;
+
+  if (!fp)
+    return 0;
+
+  while (fgets(line, sizeof(line), fp)) {
+    // mapping headers are "start-end perms ...", the fields of a mapping "Name:  value kB"
+    if (sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+      if (in_mapping)
+        break;
+      in_mapping = start == (unsigned long long)(uintptr_t)p;
+    } else if (in_mapping) {
+      if (sscanf(line, "AnonHugePages: %llu kB", &kb) == 1 || sscanf(line, "Private_Hugetlb: %llu kB", &kb) == 1 ||
+          sscanf(line, "Shared_Hugetlb: %llu kB", &kb) == 1)
+        bytes += (size_t)kb << 10;
+    }
+  }
+  fclose(fp);
+  return bytes;
 }
+
+int get_last_error() {
+  return errno;
 }
 
-#endif /** _WIN32 */
\ No newline at end of file
+#endif /** _WIN32 */
+
+}
+}
\ No newline at end of file
@@ -1,11 +1,44 @@
 #pragma once
 
+#include <stddef.h>
+
 namespace inplace {
 namespace test {
 
-  void *large_page_alloc(size_t req_size);
-  void large_page_dealloc(void *p);
+  /**
+   * Page backing of a large_page_alloc buffer:
+   *   base:              the system page (4KB), THP explicitly disabled on Linux
+   *   transparent_huge:  ordinary mapping advised with MADV_HUGEPAGE, promoted by the kernel (Linux only)
+   *   huge_tlb:          MAP_HUGETLB from the hugetlbfs pool on Linux, MEM_LARGE_PAGES on Windows
+   */
+  enum class page_kind { base, transparent_huge, huge_tlb };
+
+  /** "4k", "thp" or "hugetlb". */
+  const char *page_kind_name(page_kind kind);
+  /** @return false on an unknown name. */
+  bool parse_page_kind(const char *name, page_kind *kind);
+
+  /**
+   * AllocLargePages of the common library with the backing of the sweep.
+   * @param kind preferred backing, falling back huge_tlb -> transparent_huge -> base when the system refuses.
+   * @param obtained receives the backing actually requested from the system.
+   * Pages are not touched, see first_touch.
+   */
+  void *large_page_alloc(size_t req_size, page_kind kind = page_kind::huge_tlb, page_kind *obtained = nullptr);
+  void large_page_dealloc(void *p, size_t req_size);
+
+  /**
+   * Write every page of [p, p + size) from the OpenMP threads, statically scheduled, so on a NUMA system each page
+   * is placed on the node of the thread that works on that part of the buffer later.
+   */
+  void first_touch(void *p, size_t size);
+
+  /**
+   * Bytes of the mapping starting at @param p backed by huge pages, THP or hugetlbfs, from /proc/self/smaps;
+   * 0 where it cannot be read (and always on Windows).
+   */
+  size_t resident_huge_bytes(const void *p);
 
   int get_last_error();
 }
-}
\ No newline at end of file
+}
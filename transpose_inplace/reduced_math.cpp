@@ -1,7 +1,9 @@
 #include <stdexcept>
+#ifdef _MSC_VER
 #include "int128/int128.h"
 
 typedef _uint128 __uint128_t;
+#endif
 
 namespace tr_inplace {
 namespace details {
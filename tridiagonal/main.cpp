@@ -5,203 +5,239 @@
 #include <common_miscs.h>
 #include <functional>
 #include <cl_utils.h>
+#include <cl_kernel_launcher.h>
+#include <cl_backend.h>
+#include <cl_il_library.h>
+#include <cl_host_arena.h>
+#include <benchmark.h>
 #include <memory>
 
 #define SMALL_DIAGNAL_SYSTEM_MAX_DIM 256
 
 static ycl_program g_pTridiagProgram;
 
-void TestCPUSolvingDiagonalSystem(size_t dimx,
-                                  const tridiagonal_mat<double> *A,
-                                  const column_vec<double> *d,
-                                  column_vec<double> *x0,
-                                  column_vec<double> *x
-                                  ) {
+enum class SmallSystemVariant { THOMAS, CR, PCR, CL_CR, CL_PCR };
 
-  std::unique_ptr<double[]> tmp_buffer;
+/**
+ * One diagonally dominant system of dimension "dim" solved by each variant, the CPU solvers against the work-group
+ * kernels of tridiagonal.cl (the whole system in local memory, so "dim" stays within SMALL_DIAGNAL_SYSTEM_MAX_DIM).
+ * The difference to the serial Thomas solve is printed, not checked: the reductions reorder the arithmetic.
+ */
+CLHRESULT TestSolvingSmallDiagonalSystem(SmallSystemVariant variant, cl_context context, cl_command_queue cmd_queue,
+                                         BenchState &state) {
+
+  CLHRESULT hr = 0;
+  const size_t dimx = (size_t)state.GetInt("dim");
+  CLHostArena *arena = &GetThreadArena();
+  CLHostArenaScope arena_scope(*arena);
   double *tmp[4];
+  std::uniform_int_distribution gen_pattern_distr(0, 3);
+  tridiagonal_mat<double> A;
+  column_vec<double> d;
+  column_vec<double> x0, x;
   std::tuple<double, double, double> difference;
 
-  hp_timer::time_point start, fin;
-  fmilliseconds elapsed;
+  A.alloc(dimx, arena);
+  d.alloc(dimx, arena);
+  x0.alloc(dimx, arena);
+  x.alloc(dimx, arena);
+
+  test_gen_cyclic(A.a, A.b, A.c, d.v, dimx, gen_pattern_distr(g_RandomEngine));
 
   size_t tmp_buffer_stride;
   tmp_buffer_stride = dimx + (dimx + 1) / 2;
-  tmp_buffer.reset(new double[tmp_buffer_stride * 4]); // implies that 6 * n < 4 * (3 * n + 1) / 2
-  tmp[0] = tmp_buffer.get();
+  tmp[0] = arena->Allocate<double>(tmp_buffer_stride * 4); // implies that 6 * n < 4 * (3 * n + 1) / 2
   tmp[1] = tmp[0] + tmp_buffer_stride;
   tmp[2] = tmp[1] + tmp_buffer_stride;
   tmp[3] = tmp[2] + tmp_buffer_stride;
 
-  start = hp_timer::now();
-  cpu_solver::thomas_serial(A, d, x0, tmp[0], tmp[1]);
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("CPU Thomas Serializing elapsed:                                    "
-         "%.3fms\n",
-         elapsed.count());
-
-  memset(x->v, -1, sizeof(double) * x->dim_y);
-  start = hp_timer::now();
-  cpu_solver::cyclic_reduction(A, d, x, tmp[0], tmp[1], tmp[2], tmp[3]);
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("CPU CR elapsed:                                                    "
-         "%.3fms\n",
-         elapsed.count());
-
-  difference = compare_var(x->v, x0->v, x0->dim_y);
-  printf("CPU CR difference: max: %.4f, mean: %.4f, sqrt_mean: %.4f\n", std::get<0>(difference),
-         std::get<1>(difference), std::get<2>(difference));
+  cpu_solver::thomas_serial(&A, &d, &x0, tmp[0], tmp[1]);
+  memset(x.v, -1, sizeof(double) * x.dim_y);
+
+  if (variant < SmallSystemVariant::CL_CR) {
+    while (state.KeepRunning()) {
+      switch (variant) {
+      case SmallSystemVariant::THOMAS:
+        cpu_solver::thomas_serial(&A, &d, &x, tmp[0], tmp[1]);
+        break;
+      case SmallSystemVariant::CR:
+        cpu_solver::cyclic_reduction(&A, &d, &x, tmp[0], tmp[1], tmp[2], tmp[3]);
+        break;
+      default:
+        cpu_solver::parallel_cyclic_reduction(&A, &d, &x, tmp[0], tmp[1], tmp[2], tmp[3]);
+        break;
+      }
+    }
+  } else {
+    // a, b, c, d, x, dimx, iterations, stride, tile
+    using SmallSystemLauncher =
+        KernelLauncher<ycl_buffer, ycl_buffer, ycl_buffer, ycl_buffer, ycl_buffer, cl_uint, cl_uint, cl_uint, LocalMem>;
+    const bool pcr = variant == SmallSystemVariant::CL_PCR;
+    SmallSystemLauncher launcher;
+    size_t buffer_len;
+    cl_uint dimx32;
+    cl_uint iterations32;
+    cl_uint stride32;
+    size_t local_mem_buffer_len;
+    ycl_buffer a_d, b_d, c_d, d_d, x_d;
+    uint64_t clr_pattern = -1ll;
+    ycl_event done_ev;
+    size_t local_size;
+
+    buffer_len = A.dim_x * sizeof(double);
+    V_RETURN2(a_d <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_len, A.a, &hr), hr);
+    V_RETURN2(b_d <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_len, A.b, &hr), hr);
+    V_RETURN2(c_d <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_len, A.c, &hr), hr);
+    V_RETURN2(d_d <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_len, d.v, &hr), hr);
+    V_RETURN2(x_d <<= clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, buffer_len, nullptr, &hr),
+              hr);
+    dimx32 = static_cast<cl_uint>(A.dim_x);
+    iterations32 = cpu_solver::log2c(dimx);
+    stride32 = 1;
+
+    if (pcr) {
+      local_mem_buffer_len = (buffer_len + sizeof(double)) * 4 + buffer_len;
+      local_size = RoundC(dimx, 32);
+    } else {
+      local_mem_buffer_len = buffer_len * 5;
+      local_size = RoundC(dimx >> 1, 32);
+      if(local_size == 0) local_size = 32;
+    }
+
+    V_RETURN(launcher.Create(g_pTridiagProgram, pcr ? "pcr_small_system" : "cr_small_system"));
+    V_RETURN(launcher.SetArgs(a_d, b_d, c_d, d_d, x_d, dimx32, iterations32, stride32,
+                              LocalMem{local_mem_buffer_len}));
+
+    while (state.KeepRunning()) {
+      V_RETURN(clEnqueueFillBuffer(cmd_queue, x_d, &clr_pattern, sizeof(clr_pattern), 0, buffer_len, 0, nullptr,
+                                   nullptr));
+      V_RETURN(launcher.Enqueue(cmd_queue, 1, &local_size, &local_size));
+      V_RETURN(
+          clEnqueueReadBuffer(cmd_queue, x_d, false, 0, buffer_len, x.v, 0, nullptr, done_ev.ReleaseAndGetAddressOf()));
+      V_RETURN(clFlush(cmd_queue));
+      V_RETURN(clWaitForEvents(1, &done_ev));
+    }
+  }
 
-  memset(x->v, -1, sizeof(double) * x->dim_y);
-  start = hp_timer::now();
-  cpu_solver::parallel_cyclic_reduction(A, d, x, tmp[0], tmp[1], tmp[2], tmp[3]);
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("CPU PCR elapsed:                                                   "
-         "%.3fms\n",
-         elapsed.count());
-
-  difference = compare_var(x->v, x0->v, x0->dim_y);
-  printf("CPU PCR difference: max: %.4f, mean: %.4f, sqrt_mean: %.4f\n", std::get<0>(difference),
+  difference = compare_var(x.v, x0.v, x0.dim_y);
+  printf("    dim %zu difference: max: %.4f, mean: %.4f, sqrt_mean: %.4f\n", dimx, std::get<0>(difference),
          std::get<1>(difference), std::get<2>(difference));
+  // a, b, c, d read once, x written once
+  state.SetBytesProcessed(5.0 * dimx * sizeof(double));
 
-  /*   memset(x.v, -1, sizeof(double) * x.dim_y);
-    start = hp_timer::now();
-    // This one tends to numeric instable in most cases.
-    cpu_solver::recursive_doubling(&A, &d, &x, (double(*)[2][3])tmp[0], [](double c) { return std::abs(c) > 1.0e-5;
-    }); fin = hp_timer::now(); elapsed = fmilliseconds_cast(fin - start); printf("CPU RD elapsed: "
-           "%.3fms\n",
-           elapsed.count());
-
-    difference = compare_var(x.v, x0.v, x0.dim_y);
-    printf("CPU RD difference: max: %.4f, mean: %.4f, sqrt_mean: %.4f\n",
-           std::get<0>(difference), std::get<1>(difference),
-           std::get<2>(difference)); */
+  return hr;
 }
 
-CLHRESULT TestSolvingSmallDiagonalSystem(cl_command_queue cmd_queue, size_t dimx) {
-
-  CLHRESULT hr = 0;
-  cl_device_id device;
-  cl_context context;
-  ycl_kernel kernel;
-  size_t buffer_len;
-  cl_uint dimx32;
-  cl_uint iterations32;
-  cl_uint stride32;
-  size_t local_mem_buffer_len;
-  ycl_buffer a_d, b_d, c_d, d_d, x_d;
-  uint64_t clr_pattern = -1ll;
-  ycl_event done_ev;
-  size_t local_size;
-
+enum class BatchVariant { THOMAS_1T, THOMAS_MT };
+
+/**
+ * Native backend for many independent systems: "batch" Thomas solves of dimension "dim", in a single thread or
+ * split over @param threads threads, checked against single-threaded solves made up front. The systems and the
+ * solver scratch of every thread live in the thread arena of the caller: the ParallelFor worker of a range changes
+ * per call, a thread arena would keep a block per worker.
+ */
+CLHRESULT TestCPUSolvingDiagonalSystemBatch(BatchVariant variant, unsigned threads, BenchState &state) {
+
+  const size_t batch = (size_t)state.GetInt("batch");
+  const size_t dimx = (size_t)state.GetInt("dim");
+  CLHostArena *arena = &GetThreadArena();
+  CLHostArenaScope arena_scope(*arena);
+  std::unique_ptr<tridiagonal_mat<double>[]> A(new tridiagonal_mat<double>[batch]);
+  std::unique_ptr<column_vec<double>[]> d(new column_vec<double>[batch]);
+  std::unique_ptr<column_vec<double>[]> x0(new column_vec<double>[batch]);
+  std::unique_ptr<column_vec<double>[]> x(new column_vec<double>[batch]);
   std::uniform_int_distribution gen_pattern_distr(0, 3);
-  tridiagonal_mat<double> A;
-  column_vec<double> d;
-  column_vec<double> x0, x;
-  std::tuple<double, double, double> difference;
-
-  hp_timer::time_point start, fin;
-  fmilliseconds elapsed;
 
-  A.alloc(dimx);
-  d.alloc(dimx);
-  x0.alloc(dimx);
-  x.alloc(dimx);
-
-  test_gen_cyclic(A.a, A.b, A.c, d.v, dimx, gen_pattern_distr(g_RandomEngine));
+  for (size_t i = 0; i < batch; ++i) {
+    A[i].alloc(dimx, arena);
+    d[i].alloc(dimx, arena);
+    x0[i].alloc(dimx, arena);
+    x[i].alloc(dimx, arena);
+    test_gen_cyclic(A[i].a, A[i].b, A[i].c, d[i].v, dimx, gen_pattern_distr(g_RandomEngine));
+  }
 
-  printf("Input diagonal matrix dimension: %lld\n", dimx);
-
-  TestCPUSolvingDiagonalSystem(dimx, &A, &d, &x0, &x);
-
-  V_RETURN(clGetCommandQueueInfo(cmd_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, nullptr));
-  V_RETURN(clGetCommandQueueInfo(cmd_queue, CL_QUEUE_DEVICE, sizeof(device), &device, nullptr));
-
-  // OpenCL simulation
-  buffer_len = A.dim_x * sizeof(double);
-  V_RETURN2(a_d <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_len, A.a, &hr), hr);
-  V_RETURN2(b_d <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_len, A.b, &hr), hr);
-  V_RETURN2(c_d <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_len, A.c, &hr), hr);
-  V_RETURN2(d_d <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_len, d.v, &hr), hr);
-  V_RETURN2(x_d <<= clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, buffer_len, nullptr, &hr), hr);
-  dimx32 = static_cast<cl_uint>(A.dim_x);
-  local_mem_buffer_len = buffer_len * 5;
-  iterations32 = cpu_solver::log2c(dimx);
-  stride32 = 1;
-
-  V_RETURN2(kernel <<= clCreateKernel(g_pTridiagProgram, "cr_small_system", &hr), hr);
-  V_RETURN(SetKernelArguments(kernel, &a_d, &b_d, &c_d, &d_d, &x_d, &dimx32, &iterations32, &stride32,
-                              local_mem_buffer_len));
-
-  local_size = RoundC(dimx >> 1, 32);
-  if(local_size == 0) local_size = 32;
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, x_d, &clr_pattern, sizeof(clr_pattern), 0, buffer_len, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, &local_size, &local_size, 0, nullptr, nullptr));
-  V_RETURN(
-      clEnqueueReadBuffer(cmd_queue, x_d, false, 0, buffer_len, x.v, 0, nullptr, done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("GPU CR(Small System) elapsed:                                      "
-         "%.3fms\n",
-         elapsed.count());
+  double *tmp = arena->Allocate<double>(dimx * 2);
+  for (size_t i = 0; i < batch; ++i)
+    cpu_solver::thomas_serial(&A[i], &d[i], &x0[i], tmp, tmp + dimx);
+
+  // One range of systems per thread, each with its own slice of the scratch.
+  const size_t team = variant == BatchVariant::THOMAS_1T
+                          ? 1
+                          : std::max(std::min((size_t)threads, (batch + 15) / 16), (size_t)1);
+  const size_t range_len = (batch + team - 1) / team;
+  double *team_tmp = arena->Allocate<double>(team * dimx * 2);
+
+  while (state.KeepRunning()) {
+    ParallelFor(team, 1, [&](size_t begin, size_t end) {
+      for (size_t t = begin; t < end; ++t) {
+        double *tmp = team_tmp + t * dimx * 2;
+        for (size_t i = t * range_len; i < std::min((t + 1) * range_len, batch); ++i)
+          cpu_solver::thomas_serial(&A[i], &d[i], &x[i], tmp, tmp + dimx);
+      }
+    }, (unsigned)team);
+  }
 
-  difference = compare_var(x.v, x0.v, x0.dim_y);
-  printf("GPU CR(Small System) difference: max: %.4f, mean: %.4f, sqrt_mean: "
-         "%.4f\n",
-         std::get<0>(difference), std::get<1>(difference), std::get<2>(difference));
-
-  V_RETURN2(kernel <<= clCreateKernel(g_pTridiagProgram, "pcr_small_system", &hr), hr);
-  local_mem_buffer_len = (buffer_len + sizeof(double)) * 4 + buffer_len;
-  V_RETURN(SetKernelArguments(kernel, &a_d, &b_d, &c_d, &d_d, &x_d, &dimx32, &iterations32, &stride32,
-                              local_mem_buffer_len));
-
-  local_size = RoundC(dimx, 32);
-  start = hp_timer::now();
-  V_RETURN(clEnqueueFillBuffer(cmd_queue, x_d, &clr_pattern, sizeof(clr_pattern), 0, buffer_len, 0, nullptr, nullptr));
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, kernel, 1, nullptr, &local_size, &local_size, 0, nullptr, nullptr));
-  V_RETURN(
-      clEnqueueReadBuffer(cmd_queue, x_d, false, 0, buffer_len, x.v, 0, nullptr, done_ev.ReleaseAndGetAddressOf()));
-  V_RETURN(clFlush(cmd_queue));
-  V_RETURN(clWaitForEvents(1, &done_ev));
-  fin = hp_timer::now();
-  elapsed = fmilliseconds_cast(fin - start);
-  printf("GPU PCR(Small System) elapsed:                                     "
-         "%.3fms\n",
-         elapsed.count());
+  // Same solver, same operation order: the results are bit for bit those of the reference.
+  double max_diff = 0.0;
+  for (size_t i = 0; i < batch; ++i)
+    max_diff = std::max(max_diff, std::get<0>(compare_var(x[i].v, x0[i].v, dimx)));
+  state.SetVerified(max_diff == 0.0);
+  state.SetBytesProcessed(5.0 * batch * dimx * sizeof(double));
 
-  difference = compare_var(x.v, x0.v, x0.dim_y);
-  printf("GPU PCR(Small System) difference: max: %.4f, mean: %.4f, sqrt_mean: "
-         "%.4f\n",
-         std::get<0>(difference), std::get<1>(difference), std::get<2>(difference));
-
-  return hr;
+  return CL_SUCCESS;
 }
 
-int main() {
+int main(int argc, char **argv) {
 
   CLHRESULT hr;
-  ycl_platform_id platform;
-  ycl_device_id device;
-  ycl_context context;
-  ycl_command_queue cmd_queue;
+  CLComputeBackend backend;
 
-  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {"AMD", "NVIDIA"}, {}, &platform, &device));
-  V_RETURN(CreateDeviceContext(platform, device, &context));
-  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
+  V_RETURN(backend.Init({"AMD", "NVIDIA"}));
 
-  V_RETURN(CreateProgramFromILFile(context, device, "OCL-SpirV/tridiagonal.spv", &g_pTridiagProgram));
+  cl_device_id device = backend.Device();
+  cl_context context = backend.Context();
+  cl_command_queue cmd_queue = backend.Queue();
 
-  std::uniform_int_distribution<size_t> sm_diag_dim_distr(1, 256);
+  BenchmarkSuite suite("tridiagonal");
+  suite.ParseArgs(argc, argv);
+
+  // The solvers are double precision on the host side.
+  if (backend.HasDevice() && CL_FAILED(CreateProgramFromILManifest(context, device, "OCL-SpirV/tridiagonal.manifest",
+                                                                   CLILPrecision::FP64, 0, &g_pTridiagProgram))) {
+    printf("No usable tridiagonal program on the device, CPU only\n");
+    cmd_queue = nullptr;
+  }
 
-  for (ptrdiff_t i = 0; i < 110; ++i) {
-    printf("Test case[%lld] -- Small System\n", i + 1);
-    TestSolvingSmallDiagonalSystem(cmd_queue, sm_diag_dim_distr(g_RandomEngine));
-    printf("\n");
+  // Odd and power of two dimensions, up to SMALL_DIAGNAL_SYSTEM_MAX_DIM.
+  auto small_sweep = MakeParamSweep({{"dim", {1, 17, 64, 100, 255, SMALL_DIAGNAL_SYSTEM_MAX_DIM}}});
+  const struct {
+    const char *name;
+    SmallSystemVariant variant;
+  } small_systems[] = {{"small_system_thomas", SmallSystemVariant::THOMAS},
+                       {"small_system_cr", SmallSystemVariant::CR},
+                       {"small_system_pcr", SmallSystemVariant::PCR},
+                       {"small_system_cl_cr", SmallSystemVariant::CL_CR},
+                       {"small_system_cl_pcr", SmallSystemVariant::CL_PCR}};
+
+  for (auto &s : small_systems) {
+    if (s.variant >= SmallSystemVariant::CL_CR && !cmd_queue)
+      continue;
+    suite.Register(s.name, small_sweep, [&, s](BenchState &state) {
+      return TestSolvingSmallDiagonalSystem(s.variant, context, cmd_queue, state);
+    });
   }
+
+  auto batch_sweep = MakeParamSweep({{"batch", {4096}}, {"dim", {SMALL_DIAGNAL_SYSTEM_MAX_DIM}}});
+  suite.Register("batch_thomas_1t", batch_sweep, [&](BenchState &state) {
+    return TestCPUSolvingDiagonalSystemBatch(BatchVariant::THOMAS_1T, backend.NativeThreads(), state);
+  });
+  suite.Register("batch_thomas_mt", batch_sweep, [&](BenchState &state) {
+    return TestCPUSolvingDiagonalSystemBatch(BatchVariant::THOMAS_MT, backend.NativeThreads(), state);
+  });
+
+  hr = suite.Run();
+
+  // The cached kernels hold the program, release them while the runtime is still up.
+  ClearKernelCache();
+  return hr;
 }
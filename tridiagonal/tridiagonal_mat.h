@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cl_host_arena.h>
+
 /**
  * @struct tridiagonal_mat
  * @description: describe a diagonal matrix which has the following representation:
@@ -16,17 +18,22 @@ struct tridiagonal_mat {
   T *a;
   T *b;
   T *c;
+  bool arena_owned;
 
-  tridiagonal_mat() noexcept : dim_x(0), a(nullptr), b(nullptr), c(nullptr) {}
+  tridiagonal_mat() noexcept : dim_x(0), a(nullptr), b(nullptr), c(nullptr), arena_owned(false) {}
   ~tridiagonal_mat() { dealloc(); }
 
-  void alloc(size_t dim) {
+  /**
+   * @param arena: storage comes from the arena when given, and goes back only when the arena rewinds.
+   */
+  void alloc(size_t dim, CLHostArena *arena = nullptr) {
 
     dealloc();
 
     dim_x = dim;
     if (dim_x) {
-      T *buffer = new T[dim_x * 3];
+      T *buffer = arena ? arena->Allocate<T>(dim_x * 3) : new T[dim_x * 3];
+      arena_owned = arena != nullptr;
       a = buffer;
       b = a + dim_x;
       c = b + dim_x;
@@ -35,7 +42,8 @@ struct tridiagonal_mat {
 
   void dealloc() {
     if (a) {
-      delete[] a;
+      if (!arena_owned)
+        delete[] a;
       a = nullptr;
       b = nullptr;
       c = nullptr;
@@ -50,22 +58,24 @@ template<typename T>
 struct column_vec {
   size_t dim_y;
   T *v;
+  bool arena_owned;
 
-  column_vec(): dim_y(0), v(nullptr) {}
+  column_vec(): dim_y(0), v(nullptr), arena_owned(false) {}
   ~column_vec() { dealloc(); }
 
-  void alloc(size_t dim) {
+  void alloc(size_t dim, CLHostArena *arena = nullptr) {
 
     dealloc();
 
     dim_y = dim;
     if (dim_y) {
-      v = new T[dim_y];
+      v = arena ? arena->Allocate<T>(dim_y) : new T[dim_y];
+      arena_owned = arena != nullptr;
     }
   }
 
   void dealloc() {
-    if (v)
+    if (v && !arena_owned)
       delete[] v;
       v = nullptr;
       dim_y = 0;
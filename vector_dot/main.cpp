@@ -1,12 +1,18 @@
 #include <cl_utils.h>
+#include <common_miscs.h>
+#include <benchmark.h>
+#include <cl_stream_pipeline.h>
+#include <cl_host_buffer.h>
+#include <cl_autotuner.h>
+#include <cl_kernel_launcher.h>
+#include <cl_backend.h>
+#include <cl_precision.h>
+#include <cl_completion_queue.h>
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <random>
-
-std::default_random_engine g_RandomEngine{[]() -> std::random_device::result_type {
-  std::random_device rdev;
-  return rdev();
-}()};
+#include <map>
 
 template<typename T>
 std::vector<T> generate_random_vector(uint32_t n) {
@@ -22,18 +28,92 @@ std::vector<T> generate_random_vector(uint32_t n) {
   return v;
 }
 
+template<typename T>
+T vector_dist_sqr(const std::vector<T> &a_data, const std::vector<T> &b_data) {
+
+  T dot_res = (T)0.0;
+  T temp;
+
+  for(auto it_a = a_data.begin(), it_b = b_data.begin(); it_a != a_data.end(); ++it_a, ++it_b) {
+    temp = *it_a - *it_b;
+    dot_res += temp * temp;
+  }
+
+  return dot_res;
+}
+
+/**
+ * Native path: blocks of 64K elements summed on every hardware thread, the block partials summed in order so the
+ * result does not depend on the thread count.
+ */
+template<typename T>
+T vector_dist_sqr_mt(const std::vector<T> &a_data, const std::vector<T> &b_data, unsigned threads) {
+
+  const size_t block_len = 1 << 16;
+  size_t n = a_data.size();
+  std::vector<T> partials((n + block_len - 1) / block_len);
+
+  ParallelFor(partials.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t blk = begin; blk < end; ++blk) {
+      T dot_res = (T)0.0;
+      T temp;
+      for (size_t i = blk * block_len; i < std::min(n, (blk + 1) * block_len); ++i) {
+        temp = a_data[i] - b_data[i];
+        dot_res += temp * temp;
+      }
+      partials[blk] = dot_res;
+    }
+  }, threads);
+
+  T dot_res = (T)0.0;
+  for (T partial : partials)
+    dot_res += partial;
+  return dot_res;
+}
+
+template<typename T, typename = std::enable_if_t<std::is_same_v<T, float>||std::is_same_v<T, double>>>
+CLHRESULT TestVectorDotNative(unsigned threads, BenchState &state) {
+
+  constexpr size_t ElementSize = sizeof(T);
+  uint32_t n = (uint32_t)state.GetInt("n");
+  std::vector<T> a_data, b_data;
+  T dot_res = (T)0.0;
+
+  a_data = generate_random_vector<T>(n);
+  b_data = generate_random_vector<T>(n);
+
+  while (state.KeepRunning())
+    dot_res = vector_dist_sqr_mt(a_data, b_data, threads);
+
+  T dot_res2 = vector_dist_sqr(a_data, b_data);
+  const T dot_tol =  ElementSize == 4 ? (T)1.0E-3 : (T)1.0E-6;
+
+  state.SetVerified(std::abs(dot_res - dot_res2) < dot_tol * std::max((T)1.0, std::abs(dot_res2)));
+  state.SetBytesProcessed(2.0 * n * ElementSize);
+  state.SetFlopsProcessed(3.0 * n);
+
+  return CL_SUCCESS;
+}
+
+/**
+ * Single-shot path: whole vectors resident on the device. With @param end_to_end the vectors go through
+ * CLHostBuffer in the `host_mem` mode of the sweep and are handed to the device inside every iteration, the host
+ * time is reported for comparison with the streamed path; otherwise only the kernel time.
+ */
+// a, b, N, c_temp
+using VectorDistSqrLauncher = KernelLauncher<cl_mem, cl_mem, cl_uint, cl_mem>;
+
 template<typename T, typename = std::enable_if_t<std::is_same_v<T, float>||std::is_same_v<T, double>>>
-CLHRESULT TestVectorDot(cl_context context, cl_device_id device, cl_command_queue cmd_queue, uint32_t n) {
+CLHRESULT TestVectorDot(cl_context context, cl_device_id device, cl_command_queue cmd_queue, cl_program program,
+                        bool end_to_end, BenchState &state) {
 
   CLHRESULT hr;
   constexpr size_t ElementSize = sizeof(T);
-  const char *program_defs = ElementSize == 8 ? "#define _USE_DOUBLE_FP\n" : nullptr;
-  ycl_program program;
-  ycl_kernel ker;
+  VectorDistSqrLauncher ker;
 
-  V_RETURN(CreateProgramFromFile(context, device, program_defs, "vector_dot.cl", program.ReleaseAndGetAddressOf()));
-  V_RETURN((ker <<= clCreateKernel(program, "vector_dist_sqr_reduced", &hr), hr));
+  V_RETURN(ker.Create(program, "vector_dist_sqr_reduced"));
 
+  uint32_t n = (uint32_t)state.GetInt("n");
   std::vector<T> a_data, b_data;
   size_t a_buffer_size = n * ElementSize;
   size_t c_temp_buffer_size;
@@ -42,13 +122,36 @@ CLHRESULT TestVectorDot(cl_context context, cl_device_id device, cl_command_queu
   b_data = generate_random_vector<T>(n);
 
   ycl_buffer a_buffer, b_buffer, c_temp_buffer;
-
-  V_RETURN(
-      (a_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, a_buffer_size, a_data.data(), &hr),
-       hr));
-  V_RETURN(
-      (b_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, a_buffer_size, b_data.data(), &hr),
-       hr));
+  CLHostBuffer a_host, b_host;
+  CLHostMemMode host_mem = CLHostMemMode::COPY;
+  void *host_ptr;
+
+  if (end_to_end) {
+    if (!ParseHostMemMode(state.GetString("host_mem"), &host_mem))
+      return CL_INVALID_VALUE;
+
+    V_RETURN(a_host.Create(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, a_buffer_size, host_mem));
+    V_RETURN(b_host.Create(context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, a_buffer_size, host_mem));
+
+    // Produced once in the host views, as if generated straight into them.
+    V_RETURN(a_host.Map(cmd_queue, CL_MAP_WRITE_INVALIDATE_REGION, &host_ptr));
+    memcpy(host_ptr, a_data.data(), a_buffer_size);
+    V_RETURN(a_host.Unmap(cmd_queue));
+    V_RETURN(b_host.Map(cmd_queue, CL_MAP_WRITE_INVALIDATE_REGION, &host_ptr));
+    memcpy(host_ptr, b_data.data(), a_buffer_size);
+    V_RETURN(b_host.Unmap(cmd_queue));
+    V_RETURN(clFinish(cmd_queue));
+
+    a_buffer = (cl_mem)a_host;
+    b_buffer = (cl_mem)b_host;
+  } else {
+    V_RETURN((a_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, a_buffer_size,
+                                          a_data.data(), &hr),
+              hr));
+    V_RETURN((b_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, a_buffer_size,
+                                          b_data.data(), &hr),
+              hr));
+  }
 
   size_t max_work_size[3];
   size_t local_size[3];
@@ -67,50 +170,514 @@ CLHRESULT TestVectorDot(cl_context context, cl_device_id device, cl_command_queu
             clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, c_temp_buffer_size, nullptr, &hr),
             hr);
 
-  V_RETURN(SetKernelArguments(ker, &a_buffer, &b_buffer, &n, &c_temp_buffer));
-
-  V_RETURN(clEnqueueNDRangeKernel(cmd_queue, ker, 1, nullptr, &group_size, nullptr, 0, nullptr, nullptr));
+  V_RETURN(ker.SetArgs(a_buffer, b_buffer, n, c_temp_buffer));
 
   T dot_res;
-  ycl_event rd_done_ev;
-  V_RETURN(clEnqueueReadBuffer(cmd_queue, c_temp_buffer, false, 0, sizeof(dot_res), &dot_res, 0, nullptr, &rd_done_ev));
-  V_RETURN(clFlush(cmd_queue));
+  ycl_event ker_ev, rd_done_ev;
+  double ker_ms;
+
+  while (state.KeepRunning()) {
+    if (end_to_end) {
+      // An upload in copy mode, (nearly) free when zero copy.
+      V_RETURN(a_host.Map(cmd_queue, CL_MAP_WRITE, &host_ptr));
+      V_RETURN(a_host.Unmap(cmd_queue));
+      V_RETURN(b_host.Map(cmd_queue, CL_MAP_WRITE, &host_ptr));
+      V_RETURN(b_host.Unmap(cmd_queue));
+    }
+    V_RETURN(ker.Enqueue(cmd_queue, 1, &group_size, nullptr, 0, nullptr, ker_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, c_temp_buffer, false, 0, sizeof(dot_res), &dot_res, 0, nullptr,
+                                 rd_done_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clFlush(cmd_queue));
+    V_RETURN(clWaitForEvents(1, &rd_done_ev));
+
+    if (!end_to_end) {
+      V_RETURN(GetEventElapsedTime(ker_ev, &ker_ms));
+      state.SetIterationTime(ker_ms);
+    }
+  }
 
-  clWaitForEvents(1, &rd_done_ev);
+  T dot_res2 = vector_dist_sqr(a_data, b_data);
+  const T dot_tol =  ElementSize == 4 ? (T)1.0E-3 : (T)1.0E-6;
 
-  T dot_res2 = (T)0.0;
+  // Relative to the magnitude, the large sweeps sum millions of terms.
+  state.SetVerified(std::abs(dot_res - dot_res2) < dot_tol * std::max((T)1.0, std::abs(dot_res2)));
+  state.SetBytesProcessed(2.0 * a_buffer_size);
+  state.SetFlopsProcessed(3.0 * n);
+
+  return hr;
+}
+
+
+/**
+ * Streamed path: the vectors go through CLStreamPipeline in chunks of `chunk` elements, each chunk reduced to one
+ * partial by the same kernel and the partials summed on the host. Host time end to end.
+ */
+template<typename T, typename = std::enable_if_t<std::is_same_v<T, float>||std::is_same_v<T, double>>>
+CLHRESULT TestVectorDotStreamed(cl_context context, cl_device_id device, cl_program program, BenchState &state) {
+
+  CLHRESULT hr;
+  constexpr size_t ElementSize = sizeof(T);
+  VectorDistSqrLauncher ker;
+
+  V_RETURN(ker.Create(program, "vector_dist_sqr_reduced"));
+
+  uint32_t n = (uint32_t)state.GetInt("n");
+  size_t chunk_elems = (size_t)state.GetInt("chunk");
+  std::vector<T> a_data, b_data;
+
+  a_data = generate_random_vector<T>(n);
+  b_data = generate_random_vector<T>(n);
+
+  size_t max_work_size[3];
+  size_t local_size[3];
+
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_size), max_work_size, nullptr));
+  V_RETURN(clGetKernelWorkGroupInfo(ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(local_size), local_size, nullptr));
+
+  // Partials buffer sized for the largest chunk.
+  size_t max_group_count = RoundC(std::min(chunk_elems, max_work_size[0]), local_size[0]) / local_size[0];
+
+  CLStreamPipeline pipeline(context, device);
+  pipeline.AddInput(a_data.data(), ElementSize);
+  pipeline.AddInput(b_data.data(), ElementSize);
+  pipeline.SetChunkOutput(max_group_count * ElementSize, ElementSize);
+
+  auto enqueue_chunk = [&](cl_command_queue cmd_queue, const CLStreamChunk &chunk, cl_uint num_waits,
+                           const cl_event *waits, cl_event *event) -> CLHRESULT {
+    CLHRESULT hr;
+    uint32_t chunk_n = (uint32_t)chunk.count;
+    size_t group_size = RoundC(std::min(chunk.count, max_work_size[0]), local_size[0]);
+
+    V_RETURN(ker.SetArgs(chunk.inputs[0], chunk.inputs[1], chunk_n, chunk.output));
+    V_RETURN(ker.Enqueue(cmd_queue, 1, &group_size, nullptr, num_waits, waits, event));
+    return hr;
+  };
+
+  T dot_res = (T)0.0;
+  CLStreamStats stats;
+
+  while (state.KeepRunning()) {
+    V_RETURN(pipeline.Run(n, chunk_elems, enqueue_chunk));
+
+    dot_res = (T)0.0;
+    for (size_t i = 0; i < pipeline.ChunkCount(); ++i)
+      dot_res += *(const T *)pipeline.GetChunkResult(i);
+  }
+
+  pipeline.GetStats(&stats);
+  printf("    %zu chunks: upload %.3fms, kernel %.3fms, download %.3fms busy, %.3fms wall\n", stats.chunks,
+         stats.upload_ms, stats.kernel_ms, stats.download_ms, stats.wall_ms);
+
+  T dot_res2 = vector_dist_sqr(a_data, b_data);
   const T dot_tol =  ElementSize == 4 ? (T)1.0E-3 : (T)1.0E-6;
-  T temp;
 
-  for(auto it_a = a_data.begin(), it_b = b_data.begin(); it_a != a_data.end(); ++it_a, ++it_b) {
-    temp = *it_a - *it_b;
-    dot_res2 += temp * temp;
+  state.SetVerified(std::abs(dot_res - dot_res2) < dot_tol * std::max((T)1.0, std::abs(dot_res2)));
+  state.SetBytesProcessed(2.0 * n * ElementSize);
+  state.SetFlopsProcessed(3.0 * n);
+
+  return hr;
+}
+
+/**
+ * Many small jobs in flight: `jobs` independent distances of `n` elements each iteration, every result checked
+ * against its CPU reference. In "blocking" mode the host waits for each job in clWaitForEvents and checks it
+ * before enqueueing the next; in "completion" mode all jobs are enqueued at once and the checks run on the
+ * workers of @param completions as the reads land. Host time end to end, jobs/s printed.
+ */
+template<typename T, typename = std::enable_if_t<std::is_same_v<T, float>||std::is_same_v<T, double>>>
+CLHRESULT TestVectorDotJobs(cl_context context, cl_device_id device, cl_command_queue cmd_queue, cl_program program,
+                            CLCompletionQueue &completions, BenchState &state) {
+
+  CLHRESULT hr;
+  constexpr size_t ElementSize = sizeof(T);
+  VectorDistSqrLauncher ker;
+
+  V_RETURN(ker.Create(program, "vector_dist_sqr_reduced"));
+
+  uint32_t n = (uint32_t)state.GetInt("n");
+  size_t jobs = (size_t)state.GetInt("jobs");
+  bool blocking = strcmp(state.GetString("mode"), "blocking") == 0;
+  const T dot_tol = ElementSize == 4 ? (T)1.0E-3 : (T)1.0E-6;
+
+  std::vector<std::vector<T>> a_data(jobs), b_data(jobs);
+  std::vector<ycl_buffer> a_buffers(jobs), b_buffers(jobs), c_temp_buffers(jobs);
+  std::vector<T> dot_res(jobs);
+  size_t max_work_size[3];
+  size_t local_size[3];
+  size_t group_size;
+
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_size), max_work_size, nullptr));
+  V_RETURN(clGetKernelWorkGroupInfo(ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(local_size), local_size,
+                                    nullptr));
+  group_size = RoundC(std::min((size_t)n, max_work_size[0]), local_size[0]);
+
+  for (size_t j = 0; j < jobs; ++j) {
+    a_data[j] = generate_random_vector<T>(n);
+    b_data[j] = generate_random_vector<T>(n);
+    V_RETURN2(a_buffers[j] <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * ElementSize,
+                                              a_data[j].data(), &hr),
+              hr);
+    V_RETURN2(b_buffers[j] <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * ElementSize,
+                                              b_data[j].data(), &hr),
+              hr);
+    V_RETURN2(c_temp_buffers[j] <<= clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY,
+                                                   group_size / local_size[0] * ElementSize, nullptr, &hr),
+              hr);
   }
 
-  printf("Dot result of vector dim(%d): %g, expect: %g, coincident: %s\n", n, dot_res, dot_res2,
-         std::abs(dot_res - dot_res2) < dot_tol ? "true" : "false");
+  std::atomic<size_t> mismatches(0);
+  auto check_job = [&](size_t j) {
+    T dot_res2 = vector_dist_sqr(a_data[j], b_data[j]);
+    if (std::abs(dot_res[j] - dot_res2) >= dot_tol * std::max((T)1.0, std::abs(dot_res2)))
+      mismatches.fetch_add(1, std::memory_order_relaxed);
+  };
+  CLCompletionDrainGuard drain_guard(cmd_queue, completions);
+
+  hp_timer::time_point start;
+  double total_ms = 0.0;
+  int timed_iters = 0;
+  ycl_event rd_ev;
+
+  while (state.KeepRunning()) {
+    start = hp_timer::now();
+    for (size_t j = 0; j < jobs; ++j) {
+      V_RETURN(ker.SetArgs(a_buffers[j], b_buffers[j], n, c_temp_buffers[j]));
+      V_RETURN(ker.Enqueue(cmd_queue, 1, &group_size, nullptr, 0, nullptr, nullptr));
+      V_RETURN(clEnqueueReadBuffer(cmd_queue, c_temp_buffers[j], CL_FALSE, 0, ElementSize, &dot_res[j], 0, nullptr,
+                                   rd_ev.ReleaseAndGetAddressOf()));
+      if (blocking) {
+        V_RETURN(clFlush(cmd_queue));
+        V_RETURN(clWaitForEvents(1, &rd_ev));
+        check_job(j);
+      } else {
+        V_RETURN(completions.Post(rd_ev, [&check_job, j](cl_event, cl_int status) {
+          if (status == CL_COMPLETE)
+            check_job(j);
+        }));
+      }
+    }
+    V_RETURN(clFlush(cmd_queue));
+    completions.Drain();
+
+    if (!state.IsWarmup()) {
+      total_ms += fmilliseconds_cast(hp_timer::now() - start).count();
+      ++timed_iters;
+    }
+  }
+
+  if (timed_iters)
+    printf("    %s, %zu jobs x %u: %.0f jobs/s\n", blocking ? "blocking" : "completion", jobs, n,
+           jobs * timed_iters / (total_ms * 1.0E-3));
+
+  state.SetVerified(mismatches.load() == 0);
+  state.SetBytesProcessed(2.0 * jobs * n * ElementSize);
+  state.SetFlopsProcessed(3.0 * jobs * n);
 
   return hr;
 }
 
+/**
+ * Storage precision sweep: the double vectors converted on the host to the REAL_STORAGE format of `precision`
+ * (fp16 and bf16 summed in float), kernel time only. Verified against the double distance of the unconverted
+ * vectors with a tolerance following the storage precision, the relative error is printed.
+ */
+CLHRESULT TestVectorDotStorage(cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                               cl_program program, BenchState &state) {
+
+  CLHRESULT hr;
+  CLPrecision precision;
+  VectorDistSqrLauncher ker;
 
-int main() {
+  if (!ParsePrecision(state.GetString("precision"), &precision))
+    return CL_INVALID_VALUE;
+  V_RETURN(ker.Create(program, "vector_dist_sqr_reduced"));
+
+  uint32_t n = (uint32_t)state.GetInt("n");
+  std::vector<double> a_data = generate_random_vector<double>(n);
+  std::vector<double> b_data = generate_random_vector<double>(n);
+  size_t buffer_size = n * GetStorageSize(precision);
+  std::vector<uint8_t> a_storage(buffer_size), b_storage(buffer_size);
+
+  ConvertToStorage(precision, a_data.data(), n, a_storage.data());
+  ConvertToStorage(precision, b_data.data(), n, b_storage.data());
+
+  ycl_buffer a_buffer, b_buffer, c_temp_buffer;
+  size_t max_work_size[3];
+  size_t local_size[3];
+  size_t group_size;
+
+  V_RETURN((a_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_size,
+                                        a_storage.data(), &hr),
+            hr));
+  V_RETURN((b_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, buffer_size,
+                                        b_storage.data(), &hr),
+            hr));
+
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_size), max_work_size, nullptr));
+  V_RETURN(clGetKernelWorkGroupInfo(ker, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(local_size), local_size,
+                                    nullptr));
+
+  group_size = RoundC(std::min((size_t)n, max_work_size[0]), local_size[0]);
+  V_RETURN2(c_temp_buffer <<= clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY,
+                                             group_size / local_size[0] * GetAccumSize(precision), nullptr, &hr),
+            hr);
+
+  V_RETURN(ker.SetArgs(a_buffer, b_buffer, n, c_temp_buffer));
+
+  uint8_t dot_accum[sizeof(double)];
+  double dot_res = 0.0, ker_ms;
+  ycl_event ker_ev;
+
+  while (state.KeepRunning()) {
+    V_RETURN(ker.Enqueue(cmd_queue, 1, &group_size, nullptr, 0, nullptr, ker_ev.ReleaseAndGetAddressOf()));
+    V_RETURN(clEnqueueReadBuffer(cmd_queue, c_temp_buffer, CL_TRUE, 0, GetAccumSize(precision), dot_accum, 0,
+                                 nullptr, nullptr));
+    V_RETURN(GetEventElapsedTime(ker_ev, &ker_ms));
+    state.SetIterationTime(ker_ms);
+  }
+  ConvertFromAccum(precision, dot_accum, 1, &dot_res);
+
+  double dot_ref = vector_dist_sqr(a_data, b_data);
+  CLPrecisionError error = ComputePrecisionError(&dot_ref, &dot_res, 1);
+  const double dot_tol = precision == CLPrecision::FP64   ? 1.0E-6
+                         : precision == CLPrecision::FP32 ? 1.0E-3
+                         : precision == CLPrecision::FP16 ? 1.0E-2
+                                                          : 5.0E-2;
+
+  printf("    %s n=%u: relative error %.3e\n", GetPrecisionName(precision), n,
+         error.max_abs / std::max(1.0, std::abs(dot_ref)));
+  state.SetVerified(error.max_abs < dot_tol * std::max(1.0, std::abs(dot_ref)));
+  state.SetBytesProcessed(2.0 * buffer_size);
+  state.SetFlopsProcessed(3.0 * n);
+
+  return hr;
+}
+
+static const char *GetPrecisionDefines(bool fp64) { return fp64 ? "#define _USE_DOUBLE_FP\n" : nullptr; }
+
+static std::string GetTuningKey(bool fp64) {
+  return std::string("vector_dist_sqr_reduced/") + (fp64 ? "fp64" : "fp32");
+}
+
+static std::map<std::string, ycl_program> g_TunedPrograms;
+
+/**
+ * Program with the local size tuned for @param n elements, or @param program on a tuning database miss.
+ * The kernel takes its local size from reqd_work_group_size, so the tests need nothing else.
+ */
+static CLHRESULT GetTunedProgram(cl_context context, cl_device_id device, cl_program program, bool fp64, size_t n,
+                                 cl_program *tuned) {
+
+  CLHRESULT hr = CL_SUCCESS;
+  CLTuningConfig config;
+  std::string key = GetTuningKey(fp64);
+
+  *tuned = program;
+  if (!GetTuningDB().Lookup(device, key.c_str(), n, &config))
+    return hr;
+
+  std::string defines = FormatTuningDefines(config.defines);
+  ycl_program &tuned_program = g_TunedPrograms[key + "/" + defines];
+  if (tuned_program == nullptr) {
+    if (GetPrecisionDefines(fp64))
+      defines = GetPrecisionDefines(fp64) + defines;
+    V_RETURN(CreateProgramFromFile(context, device, defines.c_str(), "vector_dot.cl", &tuned_program));
+  }
+  *tuned = tuned_program;
+  return hr;
+}
+
+/**
+ * Time LOCAL_SIZE_X from 64 to 1024 for every size in @param sizes and both precisions, and save the tuning
+ * database.
+ */
+static CLHRESULT TuneVectorDot(cl_context context, cl_device_id device, cl_command_queue cmd_queue,
+                               std::initializer_list<uint32_t> sizes) {
 
   CLHRESULT hr;
-  ycl_platform_id platform;
-  ycl_device_id device;
-  ycl_context context;
-  ycl_command_queue cmd_queue;
+  size_t max_work_size[3];
+
+  V_RETURN(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_work_size), max_work_size, nullptr));
+
+  for (bool fp64 : {false, true}) {
+    size_t elem_size = fp64 ? sizeof(double) : sizeof(float);
+    std::string key = GetTuningKey(fp64);
+
+    for (uint32_t n : sizes) {
+      std::vector<float> zeros(n * elem_size / sizeof(float));
+      ycl_mem a_buffer, b_buffer, c_temp_buffer;
+      std::vector<CLTuningConfig> candidates;
+      CLTuningConfig best;
+
+      V_RETURN2(a_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * elem_size,
+                                            zeros.data(), &hr),
+                hr);
+      V_RETURN2(b_buffer <<= clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * elem_size,
+                                            zeros.data(), &hr),
+                hr);
+      // Sized for the smallest local size, which has the most groups.
+      V_RETURN2(c_temp_buffer <<= clCreateBuffer(context, CL_MEM_READ_WRITE,
+                                                 RoundC(std::min((size_t)n, max_work_size[0]), 64) / 64 * elem_size,
+                                                 nullptr, &hr),
+                hr);
+
+      // Global size left 0: one work item per element up to the device limit, as TestVectorDot launches it.
+      for (int64_t bits = 6; bits <= 10; ++bits)
+        candidates.push_back(MakeTuningConfig({{"LOCAL_SIZE_X", (int64_t)1 << bits}, {"LOCAL_SIZE_X_BIT", bits}}, 1,
+                                              {0}, {(size_t)1 << bits}));
+
+      V_RETURN(AutotuneKernel(context, device, cmd_queue, "vector_dot.cl", GetPrecisionDefines(fp64),
+                              "vector_dist_sqr_reduced", n, candidates,
+                              [&](cl_kernel kernel, CLTuningConfig *config) -> CLHRESULT {
+                                config->global_size[0] =
+                                    RoundC(std::min((size_t)n, max_work_size[0]), config->local_size[0]);
+                                return SetKernelArguments(kernel, &a_buffer, &b_buffer, &n, &c_temp_buffer);
+                              },
+                              &best, 5, key.c_str()));
+      printf("Tuned %s for %u elements: local %zu, %.4fms\n", key.c_str(), n, best.local_size[0], best.ms);
+    }
+  }
+
+  return GetTuningDB().Save(GetTuningDBPath().c_str());
+}
+
+int main(int argc, char **argv) {
 
-  V_RETURN(FindOpenCLPlatform(CL_DEVICE_TYPE_GPU, {"NVIDIA CUDA", "AMD"}, {}, &platform, &device));
-  V_RETURN(CreateDeviceContext(platform, device, &context));
-  V_RETURN(CreateCommandQueue(context, device, &cmd_queue));
+  CLHRESULT hr;
+  CLComputeBackend backend;
+
+  V_RETURN(backend.Init({"NVIDIA CUDA", "AMD"}));
+
+  cl_context context = backend.Context();
+  cl_device_id device = backend.Device();
+  cl_command_queue cmd_queue = backend.Queue();
+
+  BenchmarkSuite suite("vector_dot");
+  suite.ParseArgs(argc, argv);
 
-  std::uniform_int_distribution<uint32_t> id(10, 100000);
+  // Result checks of the job benchmarks, one worker per hardware thread.
+  CLCompletionQueue completions;
 
-  V_RETURN(TestVectorDot<float>(context, device, cmd_queue, id(g_RandomEngine)));
+  // Build each precision once, every later test reuses it.
+  ycl_program program_fp32, program_fp64, program_fp16, program_bf16;
+  if (backend.HasDevice()) {
+    V_RETURN(CreateProgramFromFile(context, device, nullptr, "vector_dot.cl", &program_fp32));
+    V_RETURN(CreateProgramFromFile(context, device, "#define _USE_DOUBLE_FP\n", "vector_dot.cl", &program_fp64));
+    V_RETURN(CreateProgramFromFile(context, device, GetPrecisionBuildDefines(CLPrecision::FP16), "vector_dot.cl",
+                                   &program_fp16));
+    V_RETURN(CreateProgramFromFile(context, device, GetPrecisionBuildDefines(CLPrecision::BF16), "vector_dot.cl",
+                                   &program_bf16));
 
-  V_RETURN(TestVectorDot<double>(context, device, cmd_queue, id(g_RandomEngine)));
+    if (suite.IsTuningRequested())
+      V_RETURN(TuneVectorDot(context, device, cmd_queue, {1000, 100000, 1 << 20, 1 << 24}));
+    printf("Tuning database %s: %zu entries\n", GetTuningDBPath().c_str(), GetTuningDB().size());
+  }
+
+  // Tuned program for the precision and problem size of the sweep point, the default build on a miss.
+  auto select_program = [&](BenchState &state, size_t n, cl_program *program) -> CLHRESULT {
+    bool fp64 = strcmp(state.GetString("precision"), "fp64") == 0;
+    return GetTunedProgram(context, device, fp64 ? (cl_program)program_fp64 : (cl_program)program_fp32, fp64, n,
+                           program);
+  };
+
+  // Host data in, distance out: the OpenCL side uploads both vectors.
+  CLBackendOp<BenchState &> dist_sqr_op(
+      "vector_dist_sqr",
+      [](BenchState &state) -> CLWorkload {
+        double n = (double)state.GetInt("n");
+        double elem_size = strcmp(state.GetString("precision"), "fp64") == 0 ? sizeof(double) : sizeof(float);
+        return {2.0 * n * elem_size, 3.0 * n, 2.0 * n * elem_size};
+      },
+      [&](BenchState &state) -> CLHRESULT {
+        cl_program program;
+        V_RETURN(select_program(state, state.GetInt("n"), &program));
+        if (strcmp(state.GetString("precision"), "fp32") == 0)
+          return TestVectorDot<float>(context, device, cmd_queue, program, true, state);
+        return TestVectorDot<double>(context, device, cmd_queue, program, true, state);
+      },
+      [&](BenchState &state) -> CLHRESULT {
+        if (strcmp(state.GetString("precision"), "fp32") == 0)
+          return TestVectorDotNative<float>(backend.NativeThreads(), state);
+        return TestVectorDotNative<double>(backend.NativeThreads(), state);
+      });
+
+  if (backend.HasDevice()) {
+    suite.Register("vector_dist_sqr_reduced",
+                   MakeParamSweep({{"precision", {"fp32", "fp64"}}, {"n", {1000, 100000, 1 << 20, 1 << 24}}}),
+                   [&](BenchState &state) -> CLHRESULT {
+                     cl_program program;
+                     V_RETURN(select_program(state, state.GetInt("n"), &program));
+                     if (strcmp(state.GetString("precision"), "fp32") == 0)
+                       return TestVectorDot<float>(context, device, cmd_queue, program, false, state);
+                     return TestVectorDot<double>(context, device, cmd_queue, program, false, state);
+                   });
+
+    // End-to-end bandwidth, transfers included: whole vectors at once, copied or zero copy, against the chunked
+    // pipeline.
+    suite.Register("vector_dist_sqr_single_shot",
+                   MakeParamSweep({{"precision", {"fp32", "fp64"}},
+                                   {"n", {1 << 24, 1 << 26}},
+                                   {"host_mem", {"copy", "alloc_host_ptr", "use_host_ptr"}}}),
+                   [&](BenchState &state) -> CLHRESULT {
+                     cl_program program;
+                     V_RETURN(select_program(state, state.GetInt("n"), &program));
+                     if (strcmp(state.GetString("precision"), "fp32") == 0)
+                       return TestVectorDot<float>(context, device, cmd_queue, program, true, state);
+                     return TestVectorDot<double>(context, device, cmd_queue, program, true, state);
+                   });
+    suite.Register("vector_dist_sqr_streamed",
+                   MakeParamSweep({{"precision", {"fp32", "fp64"}},
+                                   {"n", {1 << 24, 1 << 26}},
+                                   {"chunk", {1 << 20, 1 << 22}}}),
+                   [&](BenchState &state) -> CLHRESULT {
+                     cl_program program;
+                     V_RETURN(select_program(state, state.GetInt("chunk"), &program));
+                     if (strcmp(state.GetString("precision"), "fp32") == 0)
+                       return TestVectorDotStreamed<float>(context, device, program, state);
+                     return TestVectorDotStreamed<double>(context, device, program, state);
+                   });
+
+    // Small jobs in flight, checked on the host as they complete instead of one clWaitForEvents per job.
+    suite.Register("vector_dist_sqr_jobs",
+                   MakeParamSweep({{"precision", {"fp32", "fp64"}},
+                                   {"n", {4096, 65536}},
+                                   {"jobs", {64, 512}},
+                                   {"mode", {"blocking", "completion"}}}),
+                   [&](BenchState &state) -> CLHRESULT {
+                     cl_program program;
+                     V_RETURN(select_program(state, state.GetInt("n"), &program));
+                     if (strcmp(state.GetString("precision"), "fp32") == 0)
+                       return TestVectorDotJobs<float>(context, device, cmd_queue, program, completions, state);
+                     return TestVectorDotJobs<double>(context, device, cmd_queue, program, completions, state);
+                   });
+
+    // Half-width storage with float sums against the full width formats, the traffic halves again from fp32.
+    suite.Register("vector_dist_sqr_storage",
+                   MakeParamSweep({{"precision", {"fp64", "fp32", "fp16", "bf16"}}, {"n", {1 << 20, 1 << 24}}}),
+                   [&](BenchState &state) -> CLHRESULT {
+                     CLPrecision precision;
+                     cl_program programs[] = {program_fp32, program_fp64, program_fp16, program_bf16};
+                     if (!ParsePrecision(state.GetString("precision"), &precision))
+                       return CL_INVALID_VALUE;
+                     return TestVectorDotStorage(context, device, cmd_queue, programs[(int)precision], state);
+                   });
+  }
 
+  suite.Register("vector_dist_sqr_native",
+                 MakeParamSweep({{"precision", {"fp32", "fp64"}}, {"n", {1000, 100000, 1 << 20, 1 << 24}}}),
+                 [&](BenchState &state) -> CLHRESULT { return dist_sqr_op.Run(CLBackendKind::NATIVE, state); });
+  suite.Register("vector_dist_sqr_auto",
+                 MakeParamSweep({{"precision", {"fp32", "fp64"}},
+                                 {"n", {1000, 100000, 1 << 20, 1 << 24}},
+                                 {"host_mem", {"copy"}}}),
+                 [&](BenchState &state) -> CLHRESULT {
+                   CLBackendKind kind = dist_sqr_op.Select(backend, state);
+                   printf("    %s n=%lld: %s\n", dist_sqr_op.Name(), (long long)state.GetInt("n"),
+                            GetBackendKindName(kind));
+                   return dist_sqr_op.Run(kind, state);
+                 });
+
+  hr = suite.Run();
+  ClearKernelCache();
   return hr;
-}
\ No newline at end of file
+}
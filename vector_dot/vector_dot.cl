@@ -1,27 +1,33 @@
+#ifndef LOCAL_SIZE_X
 #define LOCAL_SIZE_X      256
+#endif
+#ifndef LOCAL_SIZE_X_BIT
 #define LOCAL_SIZE_X_BIT  8
+#endif
 
 /**
  * Compute vector dot product
+ * @param a, @param b in REAL_STORAGE, summed in REAL_ACCUM.
  * @param c_temp must have a element count non-less than global block count.
  * @return c_temp[0] will hold the final result.
  */
 __attribute__((reqd_work_group_size(LOCAL_SIZE_X, 1, 1)))
-__kernel void vector_dist_sqr_reduced(__global const REAL *a,  __global const REAL *b, uint N, __global REAL *c_temp) {
+__kernel void vector_dist_sqr_reduced(__global const REAL_STORAGE *a,  __global const REAL_STORAGE *b, uint N,
+                                      __global REAL_ACCUM *c_temp) {
 
-  __local REAL tile[LOCAL_SIZE_X];
+  __local REAL_ACCUM tile[LOCAL_SIZE_X];
   const int tid = get_local_id(0);
   const int gid = get_global_id(0);
   const int gsize = get_global_size(0);
   const int bsize = LOCAL_SIZE_X;
   const int bid = get_group_id(0);
   const int gbsize = get_num_groups(0);
-  REAL temp;
+  REAL_ACCUM temp;
 
   tile[tid] = 0;
 
   for(int i = gid; i < N; i += gsize) {
-    temp = a[i] - b[i];
+    temp = LOAD_REAL(a, i) - LOAD_REAL(b, i);
     tile[tid] += temp * temp;
   }
 